@@ -40,6 +40,7 @@
 #include "processor.h"
 #include "util.h"
 #include "symmetry.h"
+#include "parallel.h"
 #include <gsl/gsl_multimin.h>
 #include "plugins/aligner_template.h"
 
@@ -3314,129 +3315,124 @@ EMData* RT3DTreeAligner::align(EMData * this_img, EMData *to, const string & cmp
 
 }
 
-// NOTE - if symmetry is applied, it is critical that "to" be the volume which is already aligned to the symmetry axes (ie - the reference)
-vector<Dict> RT3DTreeAligner::xform_align_nbest(EMData * this_img, EMData * to, const unsigned int nrsoln, const string & cmp_name, const Dict& cmp_params) const {
-	if (nrsoln == 0) throw InvalidParameterException("ERROR (RT3DTreeAligner): nsoln must be >0"); // What was the user thinking?
-
-	int nsoln = nrsoln*2;
-	if (nrsoln<16) nsoln=32;		// we start with at least 32 solutions, but then gradually decrease with increasing scale
-
-	// !!!!!! IMPORTANT NOTE - we are inverting the order of this and to here to match convention in other aligners, to compensate
-	// the Transform is inverted before being returned
-	EMData *base_this;
-	EMData *base_to;
-	if (this_img->is_complex()) base_to=this_img->copy();
+RT3DTreePyramid::RT3DTreePyramid(EMData *image)
+{
+	EMData *base;
+	if (image->is_complex()) base=image->copy();
 	else {
-		base_to=this_img->do_fft();
-		base_to->process_inplace("xform.phaseorigin.tocorner");
+		base=image->do_fft();
+		base->process_inplace("xform.phaseorigin.tocorner");
 	}
 
-	if (to->is_complex()) base_this=to->copy();
-	else {
-		base_this=to->do_fft();
-		base_this->process_inplace("xform.phaseorigin.tocorner");
+	ny=base->get_ysize();
+	if (base->get_xsize()!=ny+2 || ny!=base->get_zsize()) {
+		delete base;
+		throw InvalidCallException("ERROR (RT3DTreeAligner): requires cubic images with even numbered box sizes");
 	}
+	base->process_inplace("xform.fourierorigin.tocenter");		// easier to chop out Fourier subvolumes
 
-	float sigmathis = params.set_default("sigmathis",0.01f);
-	float sigmato = params.set_default("sigmato",0.01f);
-	int verbose = params.set_default("verbose",0);
-
+	try {
+		// We start with 32^3, 64^3 ...
+		for (int sexp=4; sexp<10; sexp++) {
+			int ss=pow(2.0,sexp);
+			if (ss==16) ss=24;		// 16 may be too small, but 32 takes too long...
+			if (ss==32) ss=48;		// 16 may be too small, but 32 takes too long...
+			if (ss>ny) ss=ny;
 
-	if (base_this->get_xsize()!=base_this->get_ysize()+2 || base_this->get_ysize()!=base_this->get_zsize()
-		|| base_to->get_xsize()!=base_to->get_ysize()+2 || base_to->get_ysize()!=base_to->get_zsize()) throw InvalidCallException("ERROR (RT3DTreeAligner): requires cubic images with even numbered box sizes");
+			EMData *small=base->get_clip(Region(0,(ny-ss)/2,(ny-ss)/2,ss+2,ss,ss));
+			levels.push_back(small);
+			sizes.push_back(ss);
+			small->process_inplace("xform.fourierorigin.tocorner");					// after clipping back to canonical form
+			small->process_inplace("filter.highpass.gauss",Dict("cutoff_pixels",4));
+			small->process_inplace("filter.lowpass.gauss",Dict("cutoff_abs",0.33f));
 
-	base_this->process_inplace("xform.fourierorigin.tocenter");		// easier to chop out Fourier subvolumes
-	base_to->process_inplace("xform.fourierorigin.tocenter");
+			// these are cached for speed in the comparator
+			radial.push_back(small->calc_radial_dist(ss/2,0,1,4));
+			small->get_attr("sigma");		// levels are shared read-only, so their statistics must be current
 
-	float apix=(float)this_img->get_attr("apix_x");
-	int ny=this_img->get_ysize();
+			if (ss==ny) break;
+		}
+	}
+	catch (...) {
+		delete base;
+		for (size_t i=0; i<levels.size(); i++) delete levels[i];
+		throw;
+	}
+	delete base;
+}
 
-//	int downsample=floor(ny/20);		// Minimum shrunken box size is 20^3
+RT3DTreePyramid::~RT3DTreePyramid()
+{
+	for (size_t i=0; i<levels.size(); i++) delete levels[i];
+}
 
-	vector<float> s_score(nsoln,0.0f);
-	vector<float> s_coverage(nsoln,0.0f);
-	vector<float> s_step(nsoln*3,7.5f);
-	vector<Transform> s_xform(nsoln);
-	if (verbose>0) printf("%d solutions\n",nsoln);
+// NOTE - if symmetry is applied, it is critical that "to" be the volume which is already aligned to the symmetry axes (ie - the reference)
+vector<Dict> RT3DTreeAligner::xform_align_nbest(EMData * this_img, EMData * to, const unsigned int nrsoln, const string & cmp_name, const Dict& cmp_params) const {
+	if (nrsoln == 0) throw InvalidParameterException("ERROR (RT3DTreeAligner): nsoln must be >0"); // What was the user thinking?
 
+	// !!!!!! IMPORTANT NOTE - we are inverting the order of this and to here to match convention in other aligners, to compensate
+	// the Transform is inverted before being returned
+	RT3DTreePyramid pto(this_img);
+	RT3DTreePyramid pthis(to);
+	return search(pthis,pto,nrsoln,search_options());
+}
 
-//	float dstep[3] = {7.5,7.5,7.5};		// we take  steps for each of the 3 angles, may be positive or negative
-	string axname[] = {"az","alt","phi"};
+vector<Dict> RT3DTreeAligner::xform_align_nbest(const RT3DTreePyramid &this_img, EMData * to, const unsigned int nrsoln) const {
+	if (nrsoln == 0) throw InvalidParameterException("ERROR (RT3DTreeAligner): nsoln must be >0");
 
-	// We start with 32^3, 64^3 ...
-	for (int sexp=4; sexp<10; sexp++) {
-		int ss=pow(2.0,sexp);
-		if (ss==16) ss=24;		// 16 may be too small, but 32 takes too long...
-		if (ss==32) ss=48;		// 16 may be too small, but 32 takes too long...
-		if (ss>ny) ss=ny;
-		if (verbose>0) printf("\nSize %d\n",ss);
+	RT3DTreePyramid pthis(to);
+	return search(pthis,this_img,nrsoln,search_options());
+}
 
-		//ss=good_size(ny/ds);
-		EMData *small_this=base_this->get_clip(Region(0,(ny-ss)/2,(ny-ss)/2,ss+2,ss,ss));
-		EMData *small_to=  base_to->  get_clip(Region(0,(ny-ss)/2,(ny-ss)/2,ss+2,ss,ss));
-		small_this->process_inplace("xform.fourierorigin.tocorner");					// after clipping back to canonical form
-		small_this->process_inplace("filter.highpass.gauss",Dict("cutoff_pixels",4));
-		small_this->process_inplace("filter.lowpass.gauss",Dict("cutoff_abs",0.33f));
-		small_to->process_inplace("xform.fourierorigin.tocorner");
-		small_to->process_inplace("filter.highpass.gauss",Dict("cutoff_pixels",4));
-		small_to->process_inplace("filter.lowpass.gauss",Dict("cutoff_abs",0.33f));
+namespace EMAN {
+	/** Aligns each of a list of volumes to one pyramid, a volume per item */
+	class RT3DTreeBatchTask : public ParallelTask
+	{
+	  public:
+		RT3DTreeBatchTask(const RT3DTreeAligner *a, const RT3DTreePyramid &p, const vector<EMData *> &t, unsigned int n,
+						  const RT3DTreeAligner::SearchOptions &o, vector< vector<Dict> > &r)
+			: aligner(a), pto(p), tos(t), nsoln(n), opt(o), results(r) {}
 
-		// these are cached for speed in the comparator
-		vector<float>sigmathisv=small_this->calc_radial_dist(ss/2,0,1,4);
-		vector<float>sigmatov=small_to->calc_radial_dist(ss/2,0,1,4);
-		for (int i=0; i<ss/2; i++) {
-			sigmathisv[i]*=sigmathisv[i]*sigmathis;
-			sigmatov[i]*=sigmatov[i]*sigmato;
+		void run(size_t begin, size_t end, int)
+		{
+			for (size_t i=begin; i<end; i++) {
+				RT3DTreePyramid pthis(tos[i]);
+				results[i]=aligner->search(pthis,pto,nsoln,opt);
+			}
 		}
 
-		// debug out
-// 		EMData *x=small_this->do_ift();
-// 		x->process_inplace("xform.phaseorigin.tocenter");
-// 		x->write_image("dbg.hdf",(sexp-5)*2);
-// 		delete x;
-// 		x=small_to->do_ift();
-// 		x->process_inplace("xform.phaseorigin.tocenter");
-// 		x->write_image("dbg.hdf",(sexp-5)*2+1);
-// 		delete x;
-
-		// This is a solid estimate for very complete searching, 2.5 is a bit arbitrary
-		// make sure the altitude step hits 90 degrees, not absolutely necessary for this, but can't hurt
-//		float astep = 89.999/floor(pi/(2.5*2.0*atan(2.0/ss)));
-		float astep = 89.999/floor(pi/(1.5*2.0*atan(2.0/ss)));
-
-		// This is drawn from single particle analysis testing, which in that case insures that enough sampling to
-		// reasonably fill Fourier space is achieved, but doesn't perfectly apply to SPT
-//		float astep = (float)(89.99/ceil(90.0*9.0/(8.0*sqrt((float)(4300.0/ss)))));	// 8 is (3+speed) from SPA with speed=5
+	  private:
+		const RT3DTreeAligner *aligner;
+		const RT3DTreePyramid &pto;
+		const vector<EMData *> &tos;
+		unsigned int nsoln;
+		const RT3DTreeAligner::SearchOptions &opt;
+		vector< vector<Dict> > &results;
+	};
+
+	/** The first, exhaustive level of the search. Each item is one orientation from the asymmetric unit,
+	 * whose phi rotations are tried in order, exactly as the serial loop did. The per-candidate results
+	 * are kept so the caller can merge them in the serial order. */
+	class RT3DTreeScanTask : public ParallelTask
+	{
+	  public:
+		struct Candidate
+		{
+			float sim;
+			float coverage;
+			Transform xform;
+		};
 
-		// This insures we make at least one real effort at each level
-		for (int i=0; i<nsoln; i++) {
-			s_score[i]=1.0e24;	// reset the scores since the different scales will not match
-			if (fabs(s_step[i*3+0])<astep/4.0) s_step[i*3+0]*=2.0;
-			if (fabs(s_step[i*3+1])<astep/4.0) s_step[i*3+1]*=2.0;
-			if (fabs(s_step[i*3+2])<astep/4.0) s_step[i*3+2]*=2.0;
-		}
+		RT3DTreeScanTask(const vector<EMData *> &t, const vector<EMData *> &o, const vector<Transform> &tr, float a, vector< vector<Candidate> > &c)
+			: lthis(t), lto(o), transforms(tr), astep(a), candidates(c) {}
 
-		// This is for the first loop, we do a full search in a heavily downsampled space
-		if (s_coverage[0]==0.0f) {
-			// Genrate points on a sphere in an asymmetric unit
-			if (verbose>1) printf("stage 1 - ang step %1.2f\n",astep);
-			Dict d;
-			d["inc_mirror"] = true;
-			d["delta"] = astep;
-			Symmetry3D* sym = Factory<Symmetry3D>::get((string)params.set_default("sym","c1"));
-			// We don't generate for phi, since this can produce a very large number of orientations
-			vector<Transform> transforms = sym->gen_orientations((string)params.set_default("orientgen","eman"),d);
-			if (verbose>0) printf("%d orientations to test (%lu)\n",(int)(transforms.size()*(360.0/astep)),transforms.size());
-			if (transforms.size()<30) continue; // for very high symmetries we will go up to 32 instead of 24
+		void run(size_t begin, size_t end, int thread)
+		{
+			EMData *small_this=lthis[thread];
+			EMData *small_to=lto[thread];
 
-			// We iterate over all orientations in an asym triangle (alt & az) then deal with phi ourselves
-//			for (std::vector<Transform>::iterator t = transforms.begin(); t!=transforms.end(); ++t) {    // iterator form was causing all sorts of problems
-			for (unsigned int it=0; it<transforms.size(); it++) {
+			for (size_t it=begin; it<end; it++) {
 				Transform t = transforms[it];
-				if (verbose>2) {
-					printf("  %d/%lu \r",it,transforms.size());
-					fflush(stdout);
-				}
 				for (float phi=0; phi<360.0; phi+=astep) {
 					Dict aap=t.get_params("eman");
 					aap["phi"]=phi;
@@ -3460,60 +3456,41 @@ vector<Dict> RT3DTreeAligner::xform_align_nbest(EMData * this_img, EMData * to,
 					delete ccf;
 					stt=small_this->process("xform",Dict("transform",EMObject(&t),"zerocorners",1));	// we have to do 1 slow transform here now that we have the translation
 
-//					float sim=stt->cmp("ccc.tomo.thresh",small_to,Dict("sigmaimg",sigmathis,"sigmawith",sigmato));
-					float sim=stt->cmp("ccc.tomo.thresh",small_to);
-//					float sim=stt->cmp("fsc.tomo.auto",small_to,Dict("sigmaimg",sigmathisv,"sigmawith",sigmatov));
-//					float sim=stt->cmp("fsc.tomo.auto",small_to);
-
-					// We want to make sure our starting points are somewhat separated from each other, so we replace any angles too close to an existing angle
-					// If we find an existing 'best' angle within range, then we either replace it or skip
-					int worst=-1;
-					for (int i=0; i<nsoln; i++) {
-						if (s_coverage[i]==0.0) continue;	// hasn't been set yet
-						Transform tdif=s_xform[i].inverse();
-						tdif=tdif*t;
-						float adif=tdif.get_rotation("spin")["omega"];
-						if (adif<astep*2.5) {
-							worst=i;
-//							printf("= %1.3f\n",adif);
-						}
-					}
-
-					// if we weren't close to an existing angle, then we find the lowest current score and use that
-					if (worst==-1) {
-						// First we find the worst solution in the list of possible best solutions, or the first
-						// solution which is currently "empty"
-						for (int i=0; i<nsoln; i++) {
-							if (s_coverage[i]==0.0) { worst=i; break; }
-							if (s_score[i]<s_score[worst]) worst=i;
-						}
-					}
-
-					// If the current solution is better than the 'worst' of the previous solutions, then we
-					// displace it. Note that there is no sorting performed here
-					if (sim<s_score[worst]) {
-						s_score[worst]=sim;
-						s_coverage[worst]=stt->get_attr("fft_overlap");
-						s_xform[worst]=t;
-						//printf("%f\t%f\t%d\n",s_score[worst],s_coverage[worst],worst);
-					}
+					Candidate c;
+					c.sim=stt->cmp("ccc.tomo.thresh",small_to);
+					c.coverage=stt->get_attr("fft_overlap");
+					c.xform=t;
+					candidates[it].push_back(c);
 					delete stt;
 				}
 			}
-			if (verbose>2) printf("\n");
+		}
 
+	  private:
+		const vector<EMData *> &lthis;
+		const vector<EMData *> &lto;
+		const vector<Transform> &transforms;
+		float astep;
+		vector< vector<Candidate> > &candidates;
+	};
+
+	/** The later levels of the search, each item refining one of the current solutions. Solutions are
+	 * independent of each other, so this matches the serial loop exactly. */
+	class RT3DTreeRefineTask : public ParallelTask
+	{
+	  public:
+		RT3DTreeRefineTask(const RT3DTreeAligner *a, const vector<EMData *> &t, const vector<EMData *> &o, const vector<float> &st, const vector<float> &so,
+						   vector<float> &sc, vector<float> &cv, vector<float> &sp, vector<Transform> &x, float as, int v)
+			: aligner(a), lthis(t), lto(o), sigmathisv(st), sigmatov(so), s_score(sc), s_coverage(cv), s_step(sp), s_xform(x), astep(as), verbose(v) {}
 
-		}
-		// Once we have our initial list of best locations, we just refine each possibility individually
-		else {
-			// We generate a search pattern around each existing solution
-			if (verbose>1) printf("stage 2 (%1.2f)\n",astep);
-			for (int i=0; i<nsoln; i++) {
+		void run(size_t begin, size_t end, int thread)
+		{
+			static const string axname[] = {"az","alt","phi"};
+			EMData *small_this=lthis[thread];
+			EMData *small_to=lto[thread];
 
-				if (verbose>2) {
-					printf("  %d\t%d\r",i,nsoln);
-					fflush(stdout);
-				}
+			for (size_t ii=begin; ii<end; ii++) {
+				int i=(int)ii;
 				// We work an axis at a time until we get where we want to be. Somewhat like a simplex
 				int changed=1;
 				while (changed) {
@@ -3526,7 +3503,7 @@ vector<Dict> RT3DTreeAligner::xform_align_nbest(EMData * this_img, EMData * to,
 						// phi continues to move independently. I believe this should produce a more monotonic energy surface
 						if (axis==0) upd[axname[2]]=-s_step[i*3+axis];
 
-						int r=testort(small_this,small_to,sigmathisv,sigmatov,s_score,s_coverage,s_xform,i,upd);
+						int r=aligner->testort(small_this,small_to,sigmathisv,sigmatov,s_score,s_coverage,s_xform,i,upd);
 
 						// If we fail, we reverse direction with a slightly smaller step and try that
 						// Whether this fails or not, we move on to the next axis
@@ -3534,7 +3511,7 @@ vector<Dict> RT3DTreeAligner::xform_align_nbest(EMData * this_img, EMData * to,
 						else {
 							s_step[i*3+axis]*=-0.75;
 							upd[axname[axis]]=s_step[i*3+axis];
-							r=testort(small_this,small_to,sigmathisv,sigmatov,s_score,s_coverage,s_xform,i,upd);
+							r=aligner->testort(small_this,small_to,sigmathisv,sigmatov,s_score,s_coverage,s_xform,i,upd);
 							if (r) changed=1;
 						}
 						if (verbose>4) printf("\nX %1.3f\t%1.3f\t%1.3f\t%d\t",s_step[i*3],s_step[i*3+1],s_step[i*3+2],changed);
@@ -3545,53 +3522,207 @@ vector<Dict> RT3DTreeAligner::xform_align_nbest(EMData * this_img, EMData * to,
 					}
 
 					if (!changed) {
-//						for (int j=0; j<3; j++) s_step[i*3+j]*-0.75;
 						changed=1;
 					}
 					if (fabs(s_step[i*3])<astep/4 && fabs(s_step[i*3+1])<astep/4 && fabs(s_step[i*3+2])<astep/4) changed=0;
 				}
-
-				// Ouch, exhaustive (local) search
-// 				for (int daz=-1; daz<=1; daz++) {
-// 					for (int dalt=-1; dalt<=1; dalt++) {
-// 						for (int dphi=-1; dphi<=1; dphi++) {
-// 							Dict upd;
-// 							upd["az"]=daz*astep;
-// 							upd["alt"]=dalt*astep;
-// 							upd["phi"]=dphi*astep;
-// 							int r=testort(small_this,small_to,s_score,s_coverage,s_xform,i,upd);
-// 						}
-// 					}
-// 				}
 			}
 		}
-		// lazy earlier in defining s_ vectors, so lazy here too and inefficiently sorting
-		// We are sorting inside the outermost loop so we can decrease the number of solutions
-		// before we get to the finest precision
-		for (unsigned int i=0; i<nsoln-1; i++) {
-			for (unsigned int j=i+1; j<nsoln; j++) {
-				if (s_score[i]>s_score[j]) {
-					float t=s_score[i]; s_score[i]=s_score[j]; s_score[j]=t;
-					t=s_coverage[i]; s_coverage[i]=s_coverage[j]; s_coverage[j]=t;
-					Transform tt=s_xform[i]; s_xform[i]=s_xform[j]; s_xform[j]=tt;
-				}
+
+	  private:
+		const RT3DTreeAligner *aligner;
+		const vector<EMData *> &lthis;
+		const vector<EMData *> &lto;
+		const vector<float> &sigmathisv;
+		const vector<float> &sigmatov;
+		vector<float> &s_score;
+		vector<float> &s_coverage;
+		vector<float> &s_step;
+		vector<Transform> &s_xform;
+		float astep;
+		int verbose;
+	};
+}
+
+vector< vector<Dict> > RT3DTreeAligner::xform_align_nbest_batch(const RT3DTreePyramid &this_img, const vector<EMData *> &to_imgs, const unsigned int nrsoln) const {
+	if (nrsoln == 0) throw InvalidParameterException("ERROR (RT3DTreeAligner): nsoln must be >0");
+
+	// Factory registries are built on first use, which must not happen concurrently
+	Factory<Cmp>::get_list();
+	Factory<Processor>::get_list();
+	Factory<Symmetry3D>::get_list();
+
+	// params is shared, so it is read here rather than by each worker
+	SearchOptions opt=search_options();
+
+	vector< vector<Dict> > results(to_imgs.size());
+	RT3DTreeBatchTask task(this,this_img,to_imgs,nrsoln,opt,results);
+	Parallel::run(task,to_imgs.size());
+	return results;
+}
+
+RT3DTreeAligner::SearchOptions RT3DTreeAligner::search_options() const {
+	SearchOptions opt;
+	opt.sigmathis = params.set_default("sigmathis",0.01f);
+	opt.sigmato = params.set_default("sigmato",0.01f);
+	opt.verbose = params.set_default("verbose",0);
+	opt.sym = (string)params.set_default("sym","c1");
+	opt.orientgen = (string)params.set_default("orientgen","eman");
+	return opt;
+}
+
+vector<Dict> RT3DTreeAligner::search(const RT3DTreePyramid &pthis, const RT3DTreePyramid &pto, const unsigned int nrsoln, const SearchOptions &opt) const {
+	if (pthis.get_ny()!=pto.get_ny()) throw ImageDimensionException("ERROR (RT3DTreeAligner): volumes must be the same size");
+
+	unsigned int nsoln = nrsoln*2;
+	if (nrsoln<16) nsoln=32;		// we start with at least 32 solutions, but then gradually decrease with increasing scale
+
+	float sigmathis = opt.sigmathis;
+	float sigmato = opt.sigmato;
+	int verbose = opt.verbose;
+
+	vector<float> s_score(nsoln,0.0f);
+	vector<float> s_coverage(nsoln,0.0f);
+	vector<float> s_step(nsoln*3,7.5f);
+	vector<Transform> s_xform(nsoln);
+	if (verbose>0) printf("%d solutions\n",nsoln);
+
+	Factory<Cmp>::get_list();
+	Factory<Processor>::get_list();
+
+	// Each thread works on its own copy of a level; images cache state even when only read
+	int nt = Parallel::in_worker() ? 1 : Parallel::get_threads();
+	vector<EMData *> lthis(nt,(EMData *)0), lto(nt,(EMData *)0);
+
+	try {
+		for (int level=0; level<pthis.get_nlevels(); level++) {
+			int ss=pthis.get_size(level);
+			if (verbose>0) printf("\nSize %d\n",ss);
+
+			for (int t=0; t<nt; t++) {
+				delete lthis[t];
+				delete lto[t];
+				lthis[t]=lto[t]=0;
+				lthis[t]=pthis.get_level(level)->copy();
+				lto[t]=pto.get_level(level)->copy();
 			}
-		}
 
-		// At each level of sampling we (potentially) decrease the number of answers we check in detail
-		// assuming we are gradually homing in on the best solution
-		nsoln/=2;
-		if (nsoln<nrsoln) nsoln=nrsoln;
+			// these are cached for speed in the comparator
+			vector<float> sigmathisv=pthis.get_radial(level);
+			vector<float> sigmatov=pto.get_radial(level);
+			for (int i=0; i<ss/2; i++) {
+				sigmathisv[i]*=sigmathisv[i]*sigmathis;
+				sigmatov[i]*=sigmatov[i]*sigmato;
+			}
 
+			// This is a solid estimate for very complete searching, 2.5 is a bit arbitrary
+			// make sure the altitude step hits 90 degrees, not absolutely necessary for this, but can't hurt
+			float astep = 89.999/floor(pi/(1.5*2.0*atan(2.0/ss)));
 
-		delete small_this;
-		delete small_to;
-		if (ss==ny) break;
-	}
+			// This insures we make at least one real effort at each level
+			for (unsigned int i=0; i<nsoln; i++) {
+				s_score[i]=1.0e24;	// reset the scores since the different scales will not match
+				if (fabs(s_step[i*3+0])<astep/4.0) s_step[i*3+0]*=2.0;
+				if (fabs(s_step[i*3+1])<astep/4.0) s_step[i*3+1]*=2.0;
+				if (fabs(s_step[i*3+2])<astep/4.0) s_step[i*3+2]*=2.0;
+			}
 
-	delete base_this;
-	delete base_to;
+			// This is for the first loop, we do a full search in a heavily downsampled space
+			if (s_coverage[0]==0.0f) {
+				// Genrate points on a sphere in an asymmetric unit
+				if (verbose>1) printf("stage 1 - ang step %1.2f\n",astep);
+				Dict d;
+				d["inc_mirror"] = true;
+				d["delta"] = astep;
+				Symmetry3D* sym = Factory<Symmetry3D>::get(opt.sym);
+				// We don't generate for phi, since this can produce a very large number of orientations
+				vector<Transform> transforms = sym->gen_orientations(opt.orientgen,d);
+				delete sym;
+				if (verbose>0) printf("%d orientations to test (%lu)\n",(int)(transforms.size()*(360.0/astep)),transforms.size());
+				if (transforms.size()<30) continue; // for very high symmetries we will go up to 32 instead of 24
+
+				// We iterate over all orientations in an asym triangle (alt & az) then deal with phi ourselves
+				vector< vector<RT3DTreeScanTask::Candidate> > candidates(transforms.size());
+				RT3DTreeScanTask scan(lthis,lto,transforms,astep,candidates);
+				Parallel::run(scan,transforms.size(),1,nt);
+
+				// merged in the order the serial search visited them, so the result doesn't depend on threading
+				for (unsigned int it=0; it<candidates.size(); it++) {
+					for (unsigned int ic=0; ic<candidates[it].size(); ic++) {
+						const RT3DTreeScanTask::Candidate &c=candidates[it][ic];
+						const Transform &t=c.xform;
+
+						// We want to make sure our starting points are somewhat separated from each other, so we replace any angles too close to an existing angle
+						// If we find an existing 'best' angle within range, then we either replace it or skip
+						int worst=-1;
+						for (unsigned int i=0; i<nsoln; i++) {
+							if (s_coverage[i]==0.0) continue;	// hasn't been set yet
+							Transform tdif=s_xform[i].inverse();
+							tdif=tdif*t;
+							float adif=tdif.get_rotation("spin")["omega"];
+							if (adif<astep*2.5) {
+								worst=i;
+							}
+						}
+
+						// if we weren't close to an existing angle, then we find the lowest current score and use that
+						if (worst==-1) {
+							// First we find the worst solution in the list of possible best solutions, or the first
+							// solution which is currently "empty"
+							for (unsigned int i=0; i<nsoln; i++) {
+								if (s_coverage[i]==0.0) { worst=i; break; }
+								if (s_score[i]<s_score[worst]) worst=i;
+							}
+						}
+
+						// If the current solution is better than the 'worst' of the previous solutions, then we
+						// displace it. Note that there is no sorting performed here
+						if (c.sim<s_score[worst]) {
+							s_score[worst]=c.sim;
+							s_coverage[worst]=c.coverage;
+							s_xform[worst]=t;
+						}
+					}
+				}
+			}
+			// Once we have our initial list of best locations, we just refine each possibility individually
+			else {
+				// We generate a search pattern around each existing solution
+				if (verbose>1) printf("stage 2 (%1.2f)\n",astep);
+				RT3DTreeRefineTask refine(this,lthis,lto,sigmathisv,sigmatov,s_score,s_coverage,s_step,s_xform,astep,verbose);
+				Parallel::run(refine,nsoln,1,nt);
+			}
+
+			// lazy earlier in defining s_ vectors, so lazy here too and inefficiently sorting
+			// We are sorting inside the outermost loop so we can decrease the number of solutions
+			// before we get to the finest precision
+			for (unsigned int i=0; i<nsoln-1; i++) {
+				for (unsigned int j=i+1; j<nsoln; j++) {
+					if (s_score[i]>s_score[j]) {
+						float t=s_score[i]; s_score[i]=s_score[j]; s_score[j]=t;
+						t=s_coverage[i]; s_coverage[i]=s_coverage[j]; s_coverage[j]=t;
+						Transform tt=s_xform[i]; s_xform[i]=s_xform[j]; s_xform[j]=tt;
+					}
+				}
+			}
 
+			// At each level of sampling we (potentially) decrease the number of answers we check in detail
+			// assuming we are gradually homing in on the best solution
+			nsoln/=2;
+			if (nsoln<nrsoln) nsoln=nrsoln;
+		}
+	}
+	catch (...) {
+		for (int t=0; t<nt; t++) {
+			delete lthis[t];
+			delete lto[t];
+		}
+		throw;
+	}
+	for (int t=0; t<nt; t++) {
+		delete lthis[t];
+		delete lto[t];
+	}
 
 	// initialize results
 	vector<Dict> solns;
@@ -3609,7 +3740,7 @@ vector<Dict> RT3DTreeAligner::xform_align_nbest(EMData * this_img, EMData * to,
 
 // This is just to prevent redundancy. It takes the existing solution vectors as arguments, an a proposed update for
 // vector i. It updates the vectors if the proposal makes an improvement, in which case it returns true
-bool RT3DTreeAligner::testort(EMData *small_this,EMData *small_to,vector<float> &sigmathisv,vector<float> &sigmatov,vector<float> &s_score, vector<float> &s_coverage,vector<Transform> &s_xform,int i,Dict &upd) const {
+bool RT3DTreeAligner::testort(EMData *small_this,EMData *small_to,const vector<float> &sigmathisv,const vector<float> &sigmatov,vector<float> &s_score, vector<float> &s_coverage,vector<Transform> &s_xform,int i,Dict &upd) const {
 	Transform t;
 	Dict aap=s_xform[i].get_params("eman");
 	aap["tx"]=0;
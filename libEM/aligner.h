@@ -1786,6 +1786,47 @@ namespace EMAN
 	};
 
 	
+	/** The downsampled, band-limited Fourier-space levels RT3DTreeAligner searches, from coarsest
+	 * to the full box. Making them takes several FFTs and filters per level, so when many volumes are
+	 * aligned to one reference, make the reference's pyramid once and pass it to
+	 * RT3DTreeAligner::xform_align_nbest_batch(). A pyramid is not modified once made, and may be
+	 * shared by any number of threads.
+	 */
+	class RT3DTreePyramid
+	{
+		public:
+			/** @param image a cubic, even sized volume, either real or as returned by do_fft() followed by
+			 * xform.phaseorigin.tocorner. It is not modified.
+			 * @exception InvalidCallException if image isn't cubic with an even box size
+			 */
+			explicit RT3DTreePyramid(EMData *image);
+			~RT3DTreePyramid();
+
+			/** @return the box size of the original volume */
+			int get_ny() const { return ny; }
+
+			int get_nlevels() const { return (int)levels.size(); }
+
+			/** @return the box size of a level */
+			int get_size(int level) const { return sizes[level]; }
+
+			/** @return a level, in canonical Fourier layout. Owned by the pyramid. */
+			const EMData *get_level(int level) const { return levels[level]; }
+
+			/** @return the radial amplitude profile of a level, ss/2 values */
+			const vector<float> &get_radial(int level) const { return radial[level]; }
+
+		private:
+			int ny;
+			vector<int> sizes;
+			vector<EMData *> levels;
+			vector< vector<float> > radial;
+
+			// not copyable, owns the levels
+			RT3DTreePyramid(const RT3DTreePyramid &);
+			RT3DTreePyramid &operator=(const RT3DTreePyramid &);
+	};
+
 	/** 3D rotational and translational alignment using a hierarchical method with gradually decreasing downsampling in Fourier space.
 	 * In theory, very fast, and without need for a "refine" aligner. Comparator is ignored. Uses an inbuilt comparison.
 	 * @param sym The symmtery to use as the basis of the spherical sampling
@@ -1812,6 +1853,16 @@ namespace EMAN
 			 */
 			virtual vector<Dict> xform_align_nbest(EMData * this_img, EMData * to_img, const unsigned int nsoln, const string & cmp_name, const Dict& cmp_params) const;
 
+			/** As xform_align_nbest(), with the pyramid of this_img already made. Candidate orientations
+			 * at each level are tested in parallel, with results identical to a serial search.
+			 */
+			vector<Dict> xform_align_nbest(const RT3DTreePyramid &this_img, EMData * to_img, const unsigned int nsoln) const;
+
+			/** Align each of a list of volumes against one prepared this_img, in parallel over the volumes.
+			 * @return the xform_align_nbest() result for each volume, in order
+			 */
+			vector< vector<Dict> > xform_align_nbest_batch(const RT3DTreePyramid &this_img, const vector<EMData *> &to_imgs, const unsigned int nsoln) const;
+
 			virtual string get_name() const
 			{
 				return NAME;
@@ -1841,7 +1892,27 @@ namespace EMAN
 			static const string NAME;
 
 		private:
-			bool testort(EMData *small_this, EMData *small_to,vector<float> &sigmathisv,vector<float> &sigmatov, vector<float> &s_score, vector<float> &s_coverage,vector<Transform> &s_xform,int i,Dict &upd) const;
+			/** Parameters of search(), read from params before any threads start */
+			struct SearchOptions
+			{
+				float sigmathis;
+				float sigmato;
+				int verbose;
+				string sym;
+				string orientgen;
+			};
+
+			/** Read the search parameters, filling in defaults. This may add keys to params, so it must
+			 * not be called from worker threads */
+			SearchOptions search_options() const;
+
+			/** The search itself. pthis is the pyramid of the 'to' volume, which is rotated, and pto that of 'this', which stays put */
+			vector<Dict> search(const RT3DTreePyramid &pthis, const RT3DTreePyramid &pto, const unsigned int nrsoln, const SearchOptions &opt) const;
+
+			bool testort(EMData *small_this, EMData *small_to,const vector<float> &sigmathisv,const vector<float> &sigmatov, vector<float> &s_score, vector<float> &s_coverage,vector<Transform> &s_xform,int i,Dict &upd) const;
+
+			friend class RT3DTreeRefineTask;
+			friend class RT3DTreeBatchTask;
 
 	};
 
@@ -53,6 +53,7 @@
 
 #ifdef USE_TIFF
 	#include "tifio.h"
+	#include "eerio.h"
 #endif	//USE_TIFF
 
 #include "pifio.h"
@@ -32,6 +32,9 @@
 #include "cmp.h"
 #include "emdata.h"
 #include "ctf.h"
+#include "fsc.h"
+#include "parallel.h"
+#include "processor.h"
 #include "plugins/cmp_template.h"
 #undef max
 #include <climits>
@@ -78,6 +81,284 @@ template <> Factory < Cmp >::Factory()
 //	force_add<XYZCmp>();
 }
 
+namespace {
+	// Sums are accumulated in float over blocks of this many values, then added to double
+	// totals. The float inner loops vectorize, while the totals keep double precision.
+	const size_t CMP_BLOCK = 256;
+
+	/** sum(b), sum(b*b) and sum(a*b) over n values */
+	void batch_sums(const float *a, const float *b, size_t n, double &sb, double &sbb, double &sab)
+	{
+		sb = sbb = sab = 0.0;
+		for (size_t i0 = 0; i0 < n; i0 += CMP_BLOCK) {
+			size_t i1 = std::min(n,i0+CMP_BLOCK);
+			float fb = 0.0f, fbb = 0.0f, fab = 0.0f;
+			for (size_t i = i0; i < i1; i++) {
+				fb += b[i];
+				fbb += b[i]*b[i];
+				fab += a[i]*b[i];
+			}
+			sb += fb; sbb += fbb; sab += fab;
+		}
+	}
+
+	/** sum(m*b), sum(m*b*b) and sum(am*b) over n values, where m is a 0/1 mask and am=a*m */
+	void batch_sums_masked(const float *am, const float *m, const float *b, size_t n, double &sb, double &sbb, double &sab)
+	{
+		sb = sbb = sab = 0.0;
+		for (size_t i0 = 0; i0 < n; i0 += CMP_BLOCK) {
+			size_t i1 = std::min(n,i0+CMP_BLOCK);
+			float fb = 0.0f, fbb = 0.0f, fab = 0.0f;
+			for (size_t i = i0; i < i1; i++) {
+				float mb = m[i]*b[i];
+				fb += mb;
+				fbb += mb*b[i];
+				fab += am[i]*b[i];
+			}
+			sb += fb; sbb += fbb; sab += fab;
+		}
+	}
+
+	/** sum((a-b)^2), optionally under a 0/1 mask m */
+	double batch_sqdiff(const float *a, const float *b, const float *m, size_t n)
+	{
+		double ret = 0.0;
+		for (size_t i0 = 0; i0 < n; i0 += CMP_BLOCK) {
+			size_t i1 = std::min(n,i0+CMP_BLOCK);
+			float f = 0.0f;
+			if (m) {
+				for (size_t i = i0; i < i1; i++) f += m[i]*(a[i]-b[i])*(a[i]-b[i]);
+			}
+			else {
+				for (size_t i = i0; i < i1; i++) f += (a[i]-b[i])*(a[i]-b[i]);
+			}
+			ret += f;
+		}
+		return ret;
+	}
+
+	/** sum((a-b)^2) over values where neither a nor b is zero. Returns the count in n */
+	double batch_sqdiff_nonzero(const float *a, const float *b, size_t n, double &count)
+	{
+		double ret = 0.0;
+		count = 0.0;
+		for (size_t i0 = 0; i0 < n; i0 += CMP_BLOCK) {
+			size_t i1 = std::min(n,i0+CMP_BLOCK);
+			float f = 0.0f, c = 0.0f;
+			for (size_t i = i0; i < i1; i++) {
+				float use = (a[i]!=0 && b[i]!=0) ? 1.0f : 0.0f;
+				f += use*(a[i]-b[i])*(a[i]-b[i]);
+				c += use;
+			}
+			ret += f;
+			count += c;
+		}
+		return ret;
+	}
+
+	/** A particle prepared once for a set of real-space comparisons: its data, an optional
+	 * 0/1 mask and the masked particle, plus sum(a) and sum(a*a) under the mask */
+	struct PreparedReal {
+		const float *a;
+		vector<float> m;
+		vector<float> am;
+		size_t n;
+		double sa, saa, count;
+
+		PreparedReal(EMData *image, EMData *mask) : a(image->get_const_data()), sa(0), saa(0), count(0) {
+			n = (size_t)image->get_xsize()*image->get_ysize()*image->get_zsize();
+			if (mask) {
+				if (!EMUtil::is_same_size(image,mask)) throw ImageFormatException("mask not same size as image");
+				const float *dm = mask->get_const_data();
+				m.resize(n);
+				am.resize(n);
+				for (size_t i = 0; i < n; i++) {
+					m[i] = dm[i]>0.5 ? 1.0f : 0.0f;
+					am[i] = a[i]*m[i];
+				}
+			}
+			double s, ss, x;
+			if (mask) batch_sums_masked(&am[0],&m[0],a,n,s,ss,x);
+			else batch_sums(a,a,n,s,ss,x);
+			sa = s;
+			saa = ss;
+			if (mask) batch_sums(&m[0],&m[0],n,count,s,x);
+			else count = (double)n;
+		}
+
+		bool masked() const { return !m.empty(); }
+	};
+
+	class CccBatchTask : public ParallelTask {
+	  public:
+		CccBatchTask(const PreparedReal &p, const vector<EMData *> &r, float neg) :
+			prep(p), refs(r), negative(neg), result(r.size()) {}
+
+		void run(size_t begin, size_t end, int) {
+			for (size_t i = begin; i < end; i++) {
+				const float *b = refs[i]->get_const_data();
+				double sb, sbb, sab;
+				if (prep.masked()) batch_sums_masked(&prep.am[0],&prep.m[0],b,prep.n,sb,sbb,sab);
+				else batch_sums(prep.a,b,prep.n,sb,sbb,sab);
+
+				double n = prep.count;
+				double avg1 = prep.sa/n;
+				double var1 = prep.saa/n - avg1*avg1;
+				double avg2 = sb/n;
+				double var2 = sbb/n - avg2*avg2;
+				double ccc = (sab/n - avg1*avg2)/sqrt(var1*var2);
+				if (!Util::goodf(&ccc)) ccc=-2.0;
+				result[i] = static_cast<float>(ccc*negative);
+			}
+		}
+
+		const PreparedReal &prep;
+		const vector<EMData *> &refs;
+		float negative;
+		vector<float> result;
+	};
+
+	class SqEuclideanBatchTask : public ParallelTask {
+	  public:
+		SqEuclideanBatchTask(const PreparedReal &p, const vector<EMData *> &r, int zm) :
+			prep(p), refs(r), zeromask(zm), result(r.size()) {}
+
+		void run(size_t begin, size_t end, int) {
+			for (size_t i = begin; i < end; i++) {
+				const float *b = refs[i]->get_const_data();
+				double sum, n;
+				if (prep.masked()) {
+					sum = batch_sqdiff(prep.a,b,&prep.m[0],prep.n);
+					n = prep.count;
+				}
+				else if (zeromask) sum = batch_sqdiff_nonzero(prep.a,b,prep.n,n);
+				else {
+					sum = batch_sqdiff(prep.a,b,0,prep.n);
+					n = (double)prep.n;
+				}
+				float ret = (float)(sum/(float)n);
+				if (!Util::goodf(&ret)) ret = FLT_MAX;
+				result[i] = ret;
+			}
+		}
+
+		const PreparedReal &prep;
+		const vector<EMData *> &refs;
+		int zeromask;
+		vector<float> result;
+	};
+
+	class DotBatchTask : public ParallelTask {
+	  public:
+		DotBatchTask(const PreparedReal &p, const vector<EMData *> &r, int norm, float neg) :
+			prep(p), refs(r), normalize(norm), negative(neg), result(r.size()) {}
+
+		void run(size_t begin, size_t end, int) {
+			for (size_t i = begin; i < end; i++) {
+				const float *b = refs[i]->get_const_data();
+				double sb, sbb, sab;
+				if (prep.masked()) batch_sums_masked(&prep.am[0],&prep.m[0],b,prep.n,sb,sbb,sab);
+				else batch_sums(prep.a,b,prep.n,sb,sbb,sab);
+
+				double ret;
+				if (normalize) ret = sab/sqrt(prep.saa*sbb);
+				else ret = sab/prep.count;
+				result[i] = (float)(negative*ret);
+			}
+		}
+
+		const PreparedReal &prep;
+		const vector<EMData *> &refs;
+		int normalize;
+		float negative;
+		vector<float> result;
+	};
+
+	/** PhaseCmp against many references. The particle FFT, its amplitudes and the
+	 * per-pixel radial weights are computed once. */
+	class PhaseBatchTask : public ParallelTask {
+	  public:
+		PhaseBatchTask(EMData *f, const vector<float> &w, int aw, const vector<EMData *> &r) :
+			image_fft(f), weight(w), ampweight(aw), refs(r), result(r.size())
+		{
+			const float *d1 = image_fft->get_const_data();
+			amp1.resize(weight.size());
+			for (size_t j = 0; j < weight.size(); j++) amp1[j] = hypot(d1[j*2],d1[j*2+1]);
+		}
+
+		void run(size_t begin, size_t end, int) {
+			const float *d1 = image_fft->get_const_data();
+			for (size_t i = begin; i < end; i++) {
+				EMData *with_fft = refs[i]->is_complex() ? refs[i] : refs[i]->do_fft();
+				const float *d2 = with_fft->get_const_data();
+
+				double sum = 0;
+				double norm = FLT_MIN;
+				for (size_t j = 0; j < weight.size(); j++) {
+					if (weight[j]==0) continue;		// outside the box radius, or fully suppressed by the resolution cutoffs
+					float r2 = d2[j*2], i2 = d2[j*2+1];
+					double amp2 = hypot(r2,i2);
+					float a = ampweight ? (float)amp2 : 1.0f;
+					a *= weight[j];
+
+					// Util::angle_err_ri with the particle amplitude precomputed
+					float err = 0;
+					if (amp1[j]!=0 && amp2!=0) err = Util::fast_acos((d1[j*2]*r2+d1[j*2+1]*i2)/(float)(amp1[j]*amp2));
+					sum += err * a;
+					norm += a;
+				}
+				result[i] = (float)(sum / norm);
+
+				if (with_fft != refs[i]) delete with_fft;
+			}
+		}
+
+		EMData *image_fft;
+		const vector<float> &weight;
+		int ampweight;
+		vector<double> amp1;
+		const vector<EMData *> &refs;
+		vector<float> result;
+	};
+
+	/** OptSubCmp against many references. Each reference has its own processor instances,
+	 * created before the threads start, since processors aren't safe to share. */
+	class OptSubBatchTask : public ParallelTask {
+	  public:
+		OptSubBatchTask(EMData *f, bool ptcl_ctf, const vector<EMData *> &r, const vector<Processor *> &s, const vector<Processor *> &z, EMData *m) :
+			image_fft(f), image_primary(ptcl_ctf), refs(r), subs(s), zeros(z), mask(m), result(r.size()) {}
+
+		void run(size_t begin, size_t end, int) {
+			for (size_t i = begin; i < end; i++) {
+				EMData *diff = subs[i]->process(image_primary ? image_fft : refs[i]);
+				if (mask!=NULL) diff->mult(*mask);
+				if (zeros[i]) {
+					EMData *tmp=zeros[i]->process(refs[i]);
+					diff->mult(*tmp);
+					delete tmp;
+				}
+				result[i] = (float)diff->get_attr("sigma")/(float)diff->get_attr("sigma_presub");
+				delete diff;
+			}
+		}
+
+		EMData *image_fft;
+		bool image_primary;
+		const vector<EMData *> &refs;
+		const vector<Processor *> &subs;
+		const vector<Processor *> &zeros;
+		EMData *mask;
+		vector<float> result;
+	};
+}
+
+vector<float> Cmp::cmp_batch(EMData * image, const vector<EMData *> &refs) const
+{
+	vector<float> ret(refs.size());
+	for (size_t i = 0; i < refs.size(); i++) ret[i] = cmp(image,refs[i]);
+	return ret;
+}
+
 void Cmp::validate_input_args(const EMData * image, const EMData *with) const
 {
 	
@@ -183,6 +464,32 @@ float CccCmp::cmp(EMData * image, EMData *with) const
 }
 
 
+vector<float> CccCmp::cmp_batch(EMData * image, const vector<EMData *> &refs) const
+{
+	ENTERFUNC;
+#ifdef EMAN2_USING_CUDA
+	if (image->getcudarwdata()) return Cmp::cmp_batch(image,refs);
+#endif
+	for (size_t i = 0; i < refs.size(); i++) {
+		if (image->is_complex() || refs[i]->is_complex())
+			throw ImageFormatException( "Complex images not supported by CMP::CccCmp");
+		validate_input_args(image, refs[i]);
+	}
+
+	float negative = (float)params.set_default("negative", 1);
+	if (negative) negative=-1.0; else negative=1.0;
+
+	EMData* mask = 0;
+	if (params.has_key("mask")) mask = params["mask"];
+
+	PreparedReal prep(image,mask);
+	CccBatchTask task(prep,refs,negative);
+	Parallel::run(task,refs.size());
+
+	EXITFUNC;
+	return task.result;
+}
+
 // Added by JAK 11/12/10
 // L^1-norm difference of two maps, after normalization.
 float LodCmp::cmp(EMData * image, EMData *with) const
@@ -411,6 +718,31 @@ float SqEuclideanCmp::cmp(EMData *image,EMData * withorig ) const
 }
 
 
+vector<float> SqEuclideanCmp::cmp_batch(EMData * image, const vector<EMData *> &refs) const
+{
+	ENTERFUNC;
+	int zeromask = params.set_default("zeromask",0);
+	int normto = params.set_default("normto",0);
+
+	// normto rescales each reference, and complex images need the Friedel-aware sums in cmp()
+	bool simple = !normto && !image->is_complex();
+	for (size_t i = 0; i < refs.size() && simple; i++) {
+		validate_input_args(image, refs[i]);
+		if (refs[i]->is_complex()) simple = false;
+	}
+	if (!simple) return Cmp::cmp_batch(image,refs);
+
+	EMData* mask = 0;
+	if (params.has_key("mask")) mask = params["mask"];
+
+	PreparedReal prep(image,mask);
+	SqEuclideanBatchTask task(prep,refs,zeromask);
+	Parallel::run(task,refs.size());
+
+	EXITFUNC;
+	return task.result;
+}
+
 // Even though this uses doubles, it might be wise to recode it row-wise
 // to avoid numerical errors on large images
 float DotCmp::cmp(EMData* image, EMData* with) const
@@ -633,6 +965,35 @@ float DotCmp::cmp(EMData* image, EMData* with) const
 	return (float) (negative*result);
 }
 
+vector<float> DotCmp::cmp_batch(EMData * image, const vector<EMData *> &refs) const
+{
+	ENTERFUNC;
+	int normalize = params.set_default("normalize", 0);
+	float negative = (float)params.set_default("negative", 1);
+	if (negative) negative=-1.0; else negative=1.0;
+
+#ifdef EMAN2_USING_CUDA
+	if (image->getcudarwdata()) return Cmp::cmp_batch(image,refs);
+#endif
+	// The complex case has its own Friedel-pair weighting in cmp()
+	bool simple = !image->is_complex();
+	for (size_t i = 0; i < refs.size() && simple; i++) {
+		validate_input_args(image, refs[i]);
+		if (refs[i]->is_complex()) simple = false;
+	}
+	if (!simple) return Cmp::cmp_batch(image,refs);
+
+	EMData* mask = 0;
+	if (params.has_key("mask")) mask = params["mask"];
+
+	PreparedReal prep(image,mask);
+	DotBatchTask task(prep,refs,normalize,negative);
+	Parallel::run(task,refs.size());
+
+	EXITFUNC;
+	return task.result;
+}
+
 // This implements the technique of Mike Schmid where by the cross correlation is normalized
 // in an effort to remove the effects of the missing wedge. Somewhat of a heuristic solution, but it seems
 // to work. Basically it relies on the observation that 'good' matchs will conentrate the correlation
@@ -1211,22 +1572,15 @@ float OptVarianceCmp::cmp(EMData * image, EMData *with) const
 	return static_cast<float>(result);
 }
 
-float PhaseCmp::cmp(EMData * image, EMData *with) const
+vector<float> PhaseCmp::radial_weight(EMData * image, EMData * with) const
 {
-	ENTERFUNC;
-
 	int snrweight = params.set_default("snrweight", 0);
 	int snrfn = params.set_default("snrfn",0);
-	int ampweight = params.set_default("ampweight",0);
-	int zeromask = params.set_default("zeromask",0);
 	float minres = params.set_default("minres",500.0f);
 	float maxres = params.set_default("maxres",10.0f);
 
 	if (snrweight && snrfn) throw InvalidCallException("SNR weight and SNRfn cannot both be set in the phase comparator");
 
-	EMData *image_fft = NULL;
-	EMData *with_fft = NULL;
-
 	int ny = image->get_ysize();
 //	int np = (int) ceil(Ctf::CTFOS * sqrt(2.0f) * ny / 2) + 2;
 	int np = 0;
@@ -1283,6 +1637,23 @@ float PhaseCmp::cmp(EMData * image, EMData *with) const
 //		printf("%d\t%f\n",i,snr[i]);
 	}
 
+	return snr;
+}
+
+float PhaseCmp::cmp(EMData * image, EMData *with) const
+{
+	ENTERFUNC;
+
+	int ampweight = params.set_default("ampweight",0);
+	int zeromask = params.set_default("zeromask",0);
+
+	EMData *image_fft = NULL;
+	EMData *with_fft = NULL;
+
+	vector<float> snr = radial_weight(image,with);
+	int np = snr.size();
+	int ny;
+
 	if (zeromask) {
 		image_fft=image->copy();
 		with_fft=with->copy();
@@ -1403,158 +1774,130 @@ float PhaseCmp::cmp(EMData * image, EMData *with) const
 	return (float)(sum / norm);
 }
 
-float FRCCmp::cmp(EMData * image, EMData * with) const
+vector<float> PhaseCmp::cmp_batch(EMData * image, const vector<EMData *> &refs) const
 {
 	ENTERFUNC;
-	validate_input_args(image, with);
 
 	int snrweight = params.set_default("snrweight", 0);
-	int ampweight = params.set_default("ampweight", 0);
-	int sweight = params.set_default("sweight", 1);
-	int nweight = params.set_default("nweight", 0);
+	int ampweight = params.set_default("ampweight",0);
 	int zeromask = params.set_default("zeromask",0);
-	float minres = params.set_default("minres",200.0f);
-	float maxres = params.set_default("maxres",8.0f);
 
-	vector < float >fsc;
-	bool use_cpu = true;
+	// zeromask masks each pair differently, and an SNR weight taken from the references differs for each one
+	if (refs.empty() || zeromask || (snrweight && !image->has_attr("ctf"))) return Cmp::cmp_batch(image,refs);
 
-	if (use_cpu) {
-		if (zeromask) {
-			image=image->copy();
-			with=with->copy();
-		
-			int sz=image->get_xsize()*image->get_ysize()*image->get_zsize();
-			float *d1=image->get_data();
-			float *d2=with->get_data();
-		
-			for (int i=0; i<sz; i++) {
-				if (d1[i]==0.0 || d2[i]==0.0) { d1[i]=0.0; d2[i]=0.0; }
-			}
-		
-			image->update();
-			with->update();
-			image->do_fft_inplace();
-			with->do_fft_inplace();
-			image->set_attr("free_me",1); 
-			with->set_attr("free_me",1); 
+	EMData *image_fft = image->is_complex() ? image : image->do_fft();
+	int nx2=image_fft->get_xsize()/2;
+	int ny=image_fft->get_ysize();
+	int nz=image_fft->get_zsize();
+	int ny2=ny/2;
+
+	for (size_t i = 0; i < refs.size(); i++) {
+		EMData *r = refs[i];
+		int rx = r->is_complex() ? r->get_xsize() : r->get_xsize()+2-r->get_xsize()%2;
+		if (rx!=image_fft->get_xsize() || r->get_ysize()!=ny || r->get_zsize()!=nz) {
+			if (image_fft!=image) delete image_fft;
+			throw ImageFormatException( "images not same size");
 		}
+	}
 
-
-		if (!image->is_complex()) {
-			image=image->do_fft(); 
-			image->set_attr("free_me",1); 
-		}
-		if (!with->is_complex()) { 
-			with=with->do_fft(); 
-			with->set_attr("free_me",1); 
+	// The radial weight of every Fourier pixel, 0 beyond the box radius, using the same radius as cmp()
+	vector<float> snr = radial_weight(image,refs[0]);
+	vector<float> weight((size_t)nx2*ny*nz);
+	size_t j = 0;
+	for (int z = 0; z < nz; z++) {
+		for (int y = 0; y < ny; y++) {
+			for (int x = 0; x < nx2; x++) {
+				int r;
+				if (nz==1) r=Util::hypot_fast_int(x,y>ny/2?ny-y:y);
+				else r=(int)Util::hypot3(x,y>ny/2?ny-y:y,z>nz/2?nz-z:z);
+				weight[j++] = r>=ny2 ? 0.0f : snr[r];
+			}
 		}
+	}
 
-		fsc = image->calc_fourier_shell_correlation(with,1);
+	PhaseBatchTask task(image_fft,weight,ampweight,refs);
+	try {
+		Parallel::run(task,refs.size());
 	}
-	
-	int ny = image->get_ysize();
-	int ny2=ny/2+1;
-
-	// The fast hypot here was supposed to speed things up. Little effect
-// 	if (image->get_zsize()>1) fsc = image->calc_fourier_shell_correlation(with,1);
-// 	else {
-// 		double *sxy = (double *)malloc(ny2*sizeof(double)*4);
-// 		double *sxx = sxy+ny2;
-// 		double *syy = sxy+2*ny2;
-// 		double *norm= sxy+3*ny2;
-//
-// 		float *df1=image->get_data();
-// 		float *df2=with->get_data();
-// 		int nx2=image->get_xsize();
-//
-// 		for (int y=-ny/2; y<ny/2; y++) {
-// 			for (int x=0; x<nx2/2; x++) {
-// 				if (x==0 && y<0) continue;	// skip Friedel pair
-// 				short r=Util::hypot_fast_int(x,y);
-// 				if (r>ny2-1) continue;
-// 				int l=x*2+(y<0?ny+y:y)*nx2;
-// 				sxy[r]+=df1[l]*df2[l]+df1[l+1]*df2[l+1];
-// 				sxx[r]+=df1[l]*df1[l];
-// 				syy[r]+=df2[l]*df2[l];
-// 				norm[r]+=1.0;
-// 			}
-// 		}
-// 		fsc.resize(ny2*3);
-// 		for (int r=0; r<ny2; r++) {
-// 			fsc[r]=r*0.5/ny2;
-// 			fsc[ny2+r]=sxy[r]/(sqrt(sxx[r])*sqrt(syy[r]));
-// 			fsc[ny2*2+r]=norm[r];
-// 		}
-// 		free(sxy);
-// 	}
+	catch (...) {
+		if (image_fft!=image) delete image_fft;
+		throw;
+	}
+	if (image_fft!=image) delete image_fft;
 
-	vector<float> snr;
-	if (snrweight) {
-		Ctf *ctf = NULL;
-		if (!image->has_attr("ctf")) {
-			if (!with->has_attr("ctf")) throw InvalidCallException("SNR weight with no CTF parameters");
-			ctf=with->get_attr("ctf");
-		}
-		else ctf=image->get_attr("ctf");
+	EXITFUNC;
+	return task.result;
+}
 
-		float ds=1.0f/(ctf->apix*ny);
-		snr=ctf->compute_1d(ny,ds,Ctf::CTF_SNR);
-		for (int i=0; i<snr.size(); i++) {
-			if (snr[i]<=0) snr[i]=0.001;		// make sure that points don't get completely excluded due to SNR estimation issues, or worse, contribute with a negative weight
-		}
-		if(ctf) {delete ctf; ctf=0;}
-	}
+float FRCCmp::cmp(EMData * image, EMData * with) const
+{
+	ENTERFUNC;
+	validate_input_args(image, with);
 
-	vector<float> amp;
-	if (ampweight) amp=image->calc_radial_dist(ny/2,0,1,0);
+	int zeromask = params.set_default("zeromask",0);
+	params.set_default("snrweight", 0);
+	params.set_default("ampweight", 0);
+	params.set_default("sweight", 1);
+	params.set_default("nweight", 0);
+	params.set_default("minres",200.0f);
+	params.set_default("maxres",8.0f);
 
-	// Min/max modifications to weighting
-	float pmin,pmax;
-	if (minres>0) pmin=((float)image->get_attr("apix_x")*image->get_ysize())/minres;		//cutoff in pixels, assume square
-	else pmin=0;
-	if (maxres>0) pmax=((float)image->get_attr("apix_x")*image->get_ysize())/maxres;
-	else pmax=0;
+	if (zeromask) {
+		image=image->copy();
+		with=with->copy();
 
-	double sum=0.0, norm=0.0;
-
-	for (int i=0; i<ny/2; i++) {
-		double weight=1.0;
-		if (sweight) weight*=fsc[(ny2)*2+i];
-		if (ampweight) weight*=amp[i];
-		if (snrweight) weight*=snr[i];
-//		if (snrweight)  {
-//			if (snr[i]>0) weight*=sqrt(snr[i]);
-//			else weight=0;
-//		}
-//if(snr[i]<0) printf("snr[%d] = %1.5g\n",i,snr[i]);
-		if (pmin>0) weight*=(tanh(5.0*(i-pmin)/pmin)+1.0)/2.0;
-		if (pmax>0) weight*=(1.0-tanh(i-pmax))/2.0;
-		
-		sum+=weight*fsc[ny2+i];
-		norm+=weight;
-//		printf("%d\t%f\t%f\n",i,weight,fsc[ny/2+1+i]);
-	}
+		int sz=image->get_xsize()*image->get_ysize()*image->get_zsize();
+		float *d1=image->get_data();
+		float *d2=with->get_data();
 
-	// This performs a weighting that tries to normalize FRC by correcting from the number of particles represented by the average
-	sum/=norm;
-	if (nweight && with->get_attr_default("ptcl_repr",0) && sum>=0 && sum<1.0) {
-		sum=sum/(1.0-sum);							// convert to SNR
-		sum/=(float)with->get_attr_default("ptcl_repr",0);	// divide by ptcl represented
-		sum=sum/(1.0+sum);							// convert back to correlation
+		for (int i=0; i<sz; i++) {
+			if (d1[i]==0.0 || d2[i]==0.0) { d1[i]=0.0; d2[i]=0.0; }
+		}
+
+		image->update();
+		with->update();
+		image->do_fft_inplace();
+		with->do_fft_inplace();
+		image->set_attr("free_me",1);
+		with->set_attr("free_me",1);
 	}
 
+	// The shell geometry is cached, so repeated comparisons of same-size images don't recompute it
+	float ret = FourierShellCorrelator::get(image)->frc_cmp(image,with,params);
+
 	if (image->has_attr("free_me")) delete image;
 	if (with->has_attr("free_me")) delete with;
 
 	EXITFUNC;
 
-	if (!Util::goodf(&sum)) sum=-2.0;	// normally should be >-1.0
-
-	//.Note the negative! This is because EMAN2 follows the convention that
+	//.Note the negative (applied by frc_cmp)! This is because EMAN2 follows the convention that
 	// smaller return values from comparitors indicate higher similarity -
 	// this enables comparitors to be used in a generic fashion.
-	return (float)-sum;
+	return ret;
+}
+
+vector<float> FRCCmp::cmp_batch(EMData * image, const vector<EMData *> &refs) const
+{
+	ENTERFUNC;
+
+	int zeromask = params.set_default("zeromask",0);
+	params.set_default("snrweight", 0);
+	params.set_default("ampweight", 0);
+	params.set_default("sweight", 1);
+	params.set_default("nweight", 0);
+	params.set_default("minres",200.0f);
+	params.set_default("maxres",8.0f);
+
+	// zeromask masks each pair differently
+	if (zeromask) return Cmp::cmp_batch(image,refs);
+
+	for (size_t i = 0; i < refs.size(); i++) validate_input_args(image, refs[i]);
+
+	// FourierShellCorrelator transforms the particle once and scores groups of references in parallel
+	vector<float> ret = FourierShellCorrelator::get(image)->frc_cmp_batch(image,refs,params);
+
+	EXITFUNC;
+	return ret;
 }
 
 float OptSubCmp::cmp(EMData * image, EMData * with) const
@@ -1624,6 +1967,52 @@ float OptSubCmp::cmp(EMData * image, EMData * with) const
 // 	delete diff;
 // 	return sum;
 }
+vector<float> OptSubCmp::cmp_batch(EMData * image, const vector<EMData *> &refs) const
+{
+	ENTERFUNC;
+
+	int ctfweight = params.set_default("ctfweight",0);
+	int zeromask = params.set_default("zeromask",0);
+	float minres = params.set_default("minres",200.0f);
+	float maxres = params.set_default("maxres",10.0f);
+	EMData *mask = params.set_default("mask",(EMData *)NULL);
+
+	for (size_t i = 0; i < refs.size(); i++) validate_input_args(image, refs[i]);
+	if (refs.empty()) return vector<float>();
+
+	float apix=(float)image->get_attr("apix_x");
+	bool ptcl_ctf = image->has_attr("ctf");
+
+	// The particle is transformed once, whichever side of the subtraction it is on (see cmp())
+	EMData *image_fft = image->is_complex() ? image : image->do_fft();
+	// every worker reads image_fft, and get_attr() would otherwise recompute its stats in each of them
+	image_fft->get_attr("sigma");
+
+	vector<Processor *> subs(refs.size(),(Processor *)NULL);
+	vector<Processor *> zeros(refs.size(),(Processor *)NULL);
+	for (size_t i = 0; i < refs.size(); i++) {
+		EMData *ref = ptcl_ctf ? refs[i] : image_fft;
+		subs[i] = Factory<Processor>::get("math.sub.optimal",Dict("ref",ref,"return_presigma",1,"low_cutoff_frequency",apix/minres ,"high_cutoff_frequency",apix/maxres,"ctfweight",ctfweight));
+		if (zeromask) zeros[i] = Factory<Processor>::get("threshold.notzero");
+	}
+
+	OptSubBatchTask task(image_fft,ptcl_ctf,refs,subs,zeros,mask);
+	try {
+		Parallel::run(task,refs.size());
+	}
+	catch (...) {
+		for (size_t i = 0; i < refs.size(); i++) { delete subs[i]; delete zeros[i]; }
+		if (image_fft!=image) delete image_fft;
+		throw;
+	}
+
+	for (size_t i = 0; i < refs.size(); i++) { delete subs[i]; delete zeros[i]; }
+	if (image_fft!=image) delete image_fft;
+
+	EXITFUNC;
+	return task.result;
+}
+
 float VerticalCmp::cmp(EMData * image, EMData * with) const
 {
 	ENTERFUNC;
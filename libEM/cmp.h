@@ -80,6 +80,8 @@ namespace EMAN
      *        string get_name() const { return "XYZ"; }
      *        static Cmp *NEW() { return XYZCmp(); }
 	 @endcode
+	 *    Comparators with work that can be shared when one image is compared
+	 *    against many references may also implement cmp_batch().
      */
 
 	class Cmp
@@ -99,6 +101,18 @@ namespace EMAN
 		 */
 		virtual float cmp(EMData * image, EMData * with) const = 0;
 
+		/** Compare 'image' with each of a set of references. The result is the
+		 * same as calling cmp(image,refs[i]) for each reference, but comparators
+		 * which can share work between the comparisons (FFT of 'image', norms,
+		 * masks, filters) override this to do that work once, then score the
+		 * references in parallel. The default simply calls cmp() repeatedly.
+		 *
+		 * @param image The image to compare with each reference
+		 * @param refs The references
+		 * @return One comparison result per reference, in order
+		 */
+		virtual vector<float> cmp_batch(EMData * image, const vector<EMData *> &refs) const;
+
 		/** Get the Cmp's name. Each Cmp is identified by a unique name.
 		 * @return The Cmp's name.
 		 */
@@ -158,6 +172,8 @@ namespace EMAN
 	  public:
 		float cmp(EMData * image, EMData * with) const;
 
+		vector<float> cmp_batch(EMData * image, const vector<EMData *> &refs) const;
+
 		string get_name() const
 		{
 			return NAME;
@@ -233,6 +249,8 @@ namespace EMAN
 
 		float cmp(EMData * image, EMData * with) const;
 
+		vector<float> cmp_batch(EMData * image, const vector<EMData *> &refs) const;
+
 		string get_name() const
 		{
 			return NAME;
@@ -274,6 +292,8 @@ namespace EMAN
 	  public:
 		float cmp(EMData * image, EMData * with) const;
 
+		vector<float> cmp_batch(EMData * image, const vector<EMData *> &refs) const;
+
 		string get_name() const
 		{
 			return NAME;
@@ -529,6 +549,8 @@ to be missing values. If not provided, these values will be computed automatical
 
 		float cmp(EMData * image, EMData * with) const;
 
+		vector<float> cmp_batch(EMData * image, const vector<EMData *> &refs) const;
+
 		string get_name() const
 		{
 			return NAME;
@@ -639,6 +661,8 @@ to be missing values. If not provided, these values will be computed automatical
 	  public:
 		float cmp(EMData * image, EMData * with) const;
 
+		vector<float> cmp_batch(EMData * image, const vector<EMData *> &refs) const;
+
 		string get_name() const
 		{
 			return NAME;
@@ -671,6 +695,11 @@ to be missing values. If not provided, these values will be computed automatical
 //#ifdef EMAN2_USING_CUDA
 //		 float cuda_cmp(EMData * image, EMData *with) const;
 //#endif //EMAN2_USING_CUDA
+
+	  private:
+		/** The radial weight (SNR or empirical function, with the minres/maxres soft cutoffs)
+		 * used by cmp() and cmp_batch() */
+		vector<float> radial_weight(EMData * image, EMData * with) const;
 	};
 
 	/** FRCCmp returns a quality factor based on FRC between images.
@@ -684,6 +713,8 @@ to be missing values. If not provided, these values will be computed automatical
 	  public:
 		float cmp(EMData * image, EMData * with) const;
 
+		vector<float> cmp_batch(EMData * image, const vector<EMData *> &refs) const;
+
 		string get_name() const
 		{
 			return NAME;
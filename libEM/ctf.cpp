@@ -37,6 +37,12 @@
 #include "emdata.h"
 #include "xydata.h"
 #include "emassert.h"
+#include "util.h"
+#include <cstring>
+#include <map>
+#include <pthread.h>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
 
 using namespace EMAN;
 
@@ -958,6 +964,277 @@ void EMAN2Ctf::compute_2d_real(EMData *, CtfType, XYData *)
 
 
 
+namespace {
+	/** Per-pixel geometry of a (nx,ny) complex image, stored for the nx/2 x ny pixels in image
+	 * order: squared radius in pixels, and cos/sin of twice the polar angle for astigmatism */
+	struct CtfGrid
+	{
+		int nx, ny;
+		vector<float> r2;
+		vector<float> cos2a;
+		vector<float> sin2a;
+	};
+
+	pthread_mutex_t ctf_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+	vector< boost::shared_ptr<CtfGrid> > ctf_grids;
+	const size_t MAX_CTF_GRIDS = 8;
+
+	boost::shared_ptr<CtfGrid> get_ctf_grid(int nx, int ny)
+	{
+		pthread_mutex_lock(&ctf_cache_lock);
+		for (size_t i = 0; i < ctf_grids.size(); i++) {
+			if (ctf_grids[i]->nx == nx && ctf_grids[i]->ny == ny) {
+				boost::shared_ptr<CtfGrid> g = ctf_grids[i];
+				pthread_mutex_unlock(&ctf_cache_lock);
+				return g;
+			}
+		}
+		pthread_mutex_unlock(&ctf_cache_lock);
+
+		boost::shared_ptr<CtfGrid> g(new CtfGrid);
+		g->nx = nx;
+		g->ny = ny;
+		int nxh = nx/2;
+		g->r2.resize((size_t)nxh*ny);
+		g->cos2a.resize((size_t)nxh*ny);
+		g->sin2a.resize((size_t)nxh*ny);
+		for (int y2 = 0; y2 < ny; y2++) {
+			int y = y2 < ny/2 ? y2 : y2-ny;
+			for (int x = 0; x < nxh; x++) {
+				size_t i = (size_t)y2*nxh + x;
+				float a = atan2((float)y,(float)x);
+				g->r2[i] = (float)(x*x + y*y);
+				g->cos2a[i] = cos(2.0f*a);
+				g->sin2a[i] = sin(2.0f*a);
+			}
+		}
+
+		pthread_mutex_lock(&ctf_cache_lock);
+		if (ctf_grids.size() >= MAX_CTF_GRIDS) ctf_grids.erase(ctf_grids.begin());
+		ctf_grids.push_back(g);
+		pthread_mutex_unlock(&ctf_cache_lock);
+		return g;
+	}
+
+	// Round to nearest for |x| < 2^22 by pushing the fraction out of the mantissa. Unlike floor()
+	// this needs nothing from libm, so loops using it vectorize.
+	inline float round_nearest(float x)
+	{
+		return (x + 12582912.0f) - 12582912.0f;
+	}
+
+	/** cos(x) to within 1e-6 absolute, for |x| up to ~2e4. x is reduced to [-pi,pi] with a two
+	 * part 2*pi (Cody-Waite), then cos(r)=1-2*sin^2(r/2) with a degree 11 series for sin. */
+	inline float ctf_cos(float x)
+	{
+		float k = round_nearest(x*0.159154943f);
+		float h = (x - k*6.28125f - k*1.93530717959e-3f)*0.5f;
+		float h2 = h*h;
+		float sn = h*(1.0f + h2*(-1.66666667e-1f + h2*(8.33333333e-3f + h2*(-1.98412698e-4f + h2*(2.75573192e-6f + h2*-2.50521084e-8f)))));
+		return 1.0f - 2.0f*sn*sn;
+	}
+
+	/** exp(x) to within 1e-7 relative, for -87 < x < 88. x=k*ln2+r with |r|<=ln2/2, a degree 7
+	 * series for exp(r), and 2^k put straight into the exponent bits. */
+	inline float ctf_exp(float x)
+	{
+		x = x < -87.0f ? -87.0f : (x > 88.0f ? 88.0f : x);
+		float k = round_nearest(x*1.44269504f);
+		float r = x - k*0.693145752f - k*1.42860677e-6f;
+		float p = 1.0f + r*(1.0f + r*(0.5f + r*(1.66666667e-1f + r*(4.16666667e-2f + r*(8.33333333e-3f + r*(1.38888889e-3f + r*1.98412698e-4f))))));
+		int32_t bits = ((int32_t)k + 127) << 23;
+		float scale;
+		memcpy(&scale, &bits, sizeof(scale));
+		return p*scale;
+	}
+
+	/** The parameters a cached CTF image depends on, defocus and astigmatism already rounded */
+	struct CtfKey
+	{
+		int type, nx, ny;
+		float defocus, dfdiff, dfang, bfactor, ampcont, voltage, cs, apix;
+
+		bool operator<(const CtfKey & k) const
+		{
+			if (type != k.type) return type < k.type;
+			if (nx != k.nx) return nx < k.nx;
+			if (ny != k.ny) return ny < k.ny;
+			if (defocus != k.defocus) return defocus < k.defocus;
+			if (dfdiff != k.dfdiff) return dfdiff < k.dfdiff;
+			if (dfang != k.dfang) return dfang < k.dfang;
+			if (bfactor != k.bfactor) return bfactor < k.bfactor;
+			if (ampcont != k.ampcont) return ampcont < k.ampcont;
+			if (voltage != k.voltage) return voltage < k.voltage;
+			if (cs != k.cs) return cs < k.cs;
+			return apix < k.apix;
+		}
+	};
+
+	struct CtfImage
+	{
+		vector<float> data;
+		unsigned long used;
+	};
+
+	typedef map<CtfKey, CtfImage> CtfImageMap;
+
+	CtfImageMap ctf_images;
+	size_t ctf_cache_bytes = 0;
+	size_t ctf_cache_limit = 64*1024*1024;
+	unsigned long ctf_cache_clock = 0;
+
+	bool get_ctf_image(const CtfKey & key, float *d, size_t n)
+	{
+		bool found = false;
+		pthread_mutex_lock(&ctf_cache_lock);
+		CtfImageMap::iterator it = ctf_images.find(key);
+		if (it != ctf_images.end()) {
+			it->second.used = ++ctf_cache_clock;
+			memcpy(d, &it->second.data[0], n*sizeof(float));
+			found = true;
+		}
+		pthread_mutex_unlock(&ctf_cache_lock);
+		return found;
+	}
+
+	void put_ctf_image(const CtfKey & key, const float *d, size_t n)
+	{
+		size_t bytes = n*sizeof(float);
+		pthread_mutex_lock(&ctf_cache_lock);
+		if (bytes <= ctf_cache_limit && ctf_images.find(key) == ctf_images.end()) {
+			// evict least recently used images until this one fits
+			while (ctf_cache_bytes + bytes > ctf_cache_limit && !ctf_images.empty()) {
+				CtfImageMap::iterator oldest = ctf_images.begin();
+				for (CtfImageMap::iterator it = ctf_images.begin(); it != ctf_images.end(); ++it) {
+					if (it->second.used < oldest->second.used) oldest = it;
+				}
+				ctf_cache_bytes -= oldest->second.data.size()*sizeof(float);
+				ctf_images.erase(oldest);
+			}
+			CtfImage & img = ctf_images[key];
+			img.data.assign(d, d+n);
+			img.used = ++ctf_cache_clock;
+			ctf_cache_bytes += bytes;
+		}
+		pthread_mutex_unlock(&ctf_cache_lock);
+	}
+}
+
+void EMAN2Ctf::set_image_cache_size(size_t bytes)
+{
+	pthread_mutex_lock(&ctf_cache_lock);
+	ctf_cache_limit = bytes;
+	while (ctf_cache_bytes > ctf_cache_limit) {
+		CtfImageMap::iterator oldest = ctf_images.begin();
+		for (CtfImageMap::iterator it = ctf_images.begin(); it != ctf_images.end(); ++it) {
+			if (it->second.used < oldest->second.used) oldest = it;
+		}
+		ctf_cache_bytes -= oldest->second.data.size()*sizeof(float);
+		ctf_images.erase(oldest);
+	}
+	pthread_mutex_unlock(&ctf_cache_lock);
+}
+
+bool EMAN2Ctf::compute_2d_complex_fast(EMData * image, CtfType type) const
+{
+	if (type != CTF_AMP && type != CTF_SIGN && type != CTF_INTEN && type != CTF_FITREF &&
+		type != CTF_POWEVAL && type != CTF_ALIFILT) return false;
+
+	int nx = image->get_xsize();
+	int ny = image->get_ysize();
+	size_t n = (size_t)nx*ny;
+
+	CtfKey key;
+	key.type = type;
+	key.nx = nx;
+	key.ny = ny;
+	key.defocus = Util::round(defocus*1.0e4f)/1.0e4f;		// 1 A
+	key.dfdiff = Util::round(dfdiff*1.0e4f)/1.0e4f;
+	key.dfang = Util::round(dfang*100.0f)/100.0f;			// 0.01 degree
+	key.bfactor = bfactor;
+	key.ampcont = ampcont;
+	key.voltage = voltage;
+	key.cs = cs;
+	key.apix = apix;
+
+	image->set_ri(true);
+	float *d = image->get_data();
+	if (get_ctf_image(key, d, n)) {
+		image->update();
+		return true;
+	}
+
+	boost::shared_ptr<CtfGrid> grid = get_ctf_grid(nx, ny);
+	const float *r2 = &grid->r2[0];
+	const float *cos2a = &grid->cos2a[0];
+	const float *sin2a = &grid->sin2a[0];
+
+	float ds = 1.0f / (apix * ny);
+	float ds2 = ds*ds;
+	float g1=M_PI/2.0*cs*1.0e7*pow(lambda(),3.0f);	// s^4 coefficient for gamma
+	float g2=M_PI*lambda()*10000.0;					// s^2 coefficient for gamma
+	float acac=M_PI/2.0-get_phase();
+	float env=-bfactor/4.0f;
+	// df(ang)=defocus+dfdiff/2*cos(2*ang-2*dfang), expanded so only the per-pixel cos/sin of 2*ang are needed
+	float dfc=key.dfdiff/2.0f*cos(2.0f*M_PI/180.0f*key.dfang);
+	float dfs=key.dfdiff/2.0f*sin(2.0f*M_PI/180.0f*key.dfang);
+	int nxh = nx/2;
+
+	vector<float> v(nxh);
+	for (int y2 = 0; y2 < ny; y2++) {
+		size_t row = (size_t)y2*nxh;
+		float *dr = d + (size_t)y2*nx;
+
+		// the CTF itself, cos(gamma-acac)*envelope, for a row at a time
+		for (int x = 0; x < nxh; x++) {
+			float s2 = r2[row+x]*ds2;
+			float dfp = key.defocus + dfc*cos2a[row+x] + dfs*sin2a[row+x];
+			float gam = (-g1*s2 + g2*dfp)*s2;
+			float c = ctf_cos(gam-acac);
+			if (type == CTF_ALIFILT) v[x] = c*c*ctf_exp(env*s2);
+			else if (type == CTF_SIGN || type == CTF_POWEVAL) v[x] = c;
+			else v[x] = c*ctf_exp(env*s2);
+		}
+
+		for (int x = 0; x < nxh; x++) {
+			float val = v[x];
+			float s = sqrt(r2[row+x])*ds;
+			switch (type) {
+			case CTF_AMP:
+				break;
+			case CTF_SIGN:
+				val = val<0?-1.0f:1.0f;
+				break;
+			case CTF_INTEN:
+				val = val*val;
+				break;
+			case CTF_ALIFILT:
+				break;
+			case CTF_FITREF:
+				// We exclude very low frequencies, and "turn on" the CTF gradually
+				if (s<.04) val=0;
+				else if (s<.05) val=(1.0-exp(-pow((s-.04f)*300.0f,2.0f)))*val*val;
+				else val=val*val;
+				break;
+			case CTF_POWEVAL:
+				val = val>0.9 ? exp(-(50.0f/4.0f * s*s)) : 0.0f;
+				if (s<.04) val=0;
+				else if (s<.05) val=(1.0-exp(-pow((s-.04f)*300.0f,2.0f)))*val*val;
+				else val=val*val;
+				break;
+			default:
+				break;
+			}
+			dr[x*2] = val;
+			dr[x*2+1] = 0;
+		}
+	}
+
+	put_ctf_image(key, d, n);
+	image->update();
+	return true;
+}
+
 void EMAN2Ctf::compute_2d_complex(EMData * image, CtfType type, XYData * sf)
 {
 	if (!image) {
@@ -979,6 +1256,8 @@ void EMAN2Ctf::compute_2d_complex(EMData * image, CtfType type, XYData * sf)
 		return;
 	}
 
+	if (ny%2==0 && compute_2d_complex_fast(image,type)) return;
+
 	float ds = 1.0f / (apix * ny);
 	image->to_one();
 
@@ -290,7 +290,19 @@ namespace EMAN
 		float get_phase() const; 
 		
 		void set_phase(float phase);
+
+		/** compute_2d_complex() keeps the CTF images it makes for the types which depend only on
+		 * the scalar parameters (AMP, SIGN, INTEN, FITREF, POWEVAL, ALIFILT), so particles from one
+		 * micrograph share a single computation. Defocus and astigmatism are rounded to 1 A and
+		 * 0.01 degree for this. Default 64 MB, 0 disables the cache.
+		 * @param bytes memory the cache may use
+		 */
+		static void set_image_cache_size(size_t bytes);
+
 		private:
+		/** compute_2d_complex() for the scalar-parameter types, vectorizable and cached.
+		 * @return false if type isn't one of them */
+		bool compute_2d_complex_fast(EMData * image, CtfType type) const;
 
 		// Electron wavelength in A
 		inline float lambda() const
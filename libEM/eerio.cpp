@@ -0,0 +1,396 @@
+/**
+ * $Id$
+ */
+
+/*
+ * Author: Steven Ludtke, 04/10/2003 (sludtke@bcm.edu)
+ * Copyright (c) 2000-2006 Baylor College of Medicine
+ *
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ * */
+
+#ifdef USE_TIFF
+
+#include "eerio.h"
+#include "geometry.h"
+#include "parallel.h"
+#include "util.h"
+
+#include <tiffio.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+using namespace EMAN;
+
+namespace {
+	int env_int(const char *name, int def)
+	{
+		const char *v = getenv(name);
+		return v ? atoi(v) : def;
+	}
+
+	// 64 bits of the stream starting at byte i, least significant bit first.
+	// 'buf' must be padded with 8 bytes past the data.
+	inline unsigned long long load_bits(const unsigned char *buf, size_t i)
+	{
+		unsigned long long w = 0;
+		for (int b = 7; b >= 0; b--) w = (w << 8) | buf[i + b];
+		return w;
+	}
+}
+
+// Decodes one frame's bitstream per item
+class EerIO::DecodeTask : public ParallelTask
+{
+  public:
+	DecodeTask(const EerIO *e, const vector< vector<unsigned char> > &b, vector< vector<unsigned int> > &ev)
+		: eer(e), bits(b), events(ev)
+	{
+	}
+
+	void run(size_t begin, size_t end, int)
+	{
+		for (size_t i = begin; i < end; i++) {
+			eer->decode_frame(bits[i], events[i]);
+		}
+	}
+
+  private:
+	const EerIO *eer;
+	const vector< vector<unsigned char> > &bits;
+	vector< vector<unsigned int> > &events;
+};
+
+EerIO::EerIO(const string & fname, IOMode rw)
+:	filename(fname), rw_mode(rw), tiff_file(0), initialized(false),
+	width(0), height(0), nframes(0), compression(0), grouping(1), upsampling(1)
+{
+}
+
+EerIO::~EerIO()
+{
+	if (tiff_file) {
+		TIFFClose(tiff_file);
+		tiff_file = 0;
+	}
+}
+
+void EerIO::init()
+{
+	ENTERFUNC;
+
+	if (initialized) {
+		return;
+	}
+
+	initialized = true;
+
+	if (rw_mode != READ_ONLY) {
+		throw ImageWriteException(filename, "EER writing not supported");
+	}
+
+	TIFFSetWarningHandler(0);
+
+	tiff_file = TIFFOpen(filename.c_str(), "r");
+
+	if (! tiff_file) {
+		throw ImageReadException(filename, "open EER");
+	}
+
+	uint32 w = 0, h = 0;
+	uint16 comp = 0;
+
+	TIFFGetField(tiff_file, TIFFTAG_IMAGEWIDTH, &w);
+	TIFFGetField(tiff_file, TIFFTAG_IMAGELENGTH, &h);
+	TIFFGetField(tiff_file, TIFFTAG_COMPRESSION, &comp);
+
+	width = w;
+	height = h;
+	compression = comp;
+
+	if (compression != EER_RLE8 && compression != EER_RLE7) {
+		char desc[256];
+		sprintf(desc, "unsupported EER compression %d", compression);
+		throw ImageReadException(filename, desc);
+	}
+
+	if ((size_t)width * height >= (1u << 28)) {
+		throw ImageReadException(filename, "EER frame too large");
+	}
+
+	nframes = 0;
+
+	do {
+		nframes++;
+	} while (TIFFReadDirectory(tiff_file));
+
+	grouping = env_int("EER_GROUPING", 1);
+	upsampling = env_int("EER_UPSAMPLING", 1);
+
+	if (grouping < 1 || grouping > nframes) {
+		grouping = 1;
+	}
+
+	if (upsampling != 1 && upsampling != 2 && upsampling != 4) {
+		throw ImageReadException(filename, "EER_UPSAMPLING must be 1, 2 or 4");
+	}
+
+	EXITFUNC;
+}
+
+bool EerIO::is_valid(const void *first_block)
+{
+	ENTERFUNC;
+	bool result = false;
+
+	if (first_block) {
+		const unsigned char *data = static_cast < const unsigned char *>(first_block);
+
+		result = (data[0] == 'I' && data[1] == 'I' && data[2] == 42 && data[3] == 0) ||
+				 (data[0] == 'M' && data[1] == 'M' && data[2] == 0 && data[3] == 42);
+	}
+
+	EXITFUNC;
+	return result;
+}
+
+int EerIO::get_nimg()
+{
+	init();
+
+	return nframes / grouping;
+}
+
+int EerIO::read_header(Dict & dict, int image_index, const Region * area, bool)
+{
+	ENTERFUNC;
+
+	init();
+
+	if (image_index < 0) {
+		image_index = 0;
+	}
+
+	if (image_index >= get_nimg()) {
+		throw ImageReadException(filename, "EER image index out of range");
+	}
+
+	int nx = width * upsampling;
+	int ny = height * upsampling;
+
+	check_region(area, IntSize(nx, ny));
+
+	int xlen = 0, ylen = 0;
+
+	EMUtil::get_region_dims(area, nx, &xlen, ny, &ylen);
+
+	dict["nx"] = xlen;
+	dict["ny"] = ylen;
+	dict["nz"] = 1;
+	dict["datatype"] = EMUtil::EM_FLOAT;
+
+	dict["EER.frames"] = nframes;
+	dict["EER.grouping"] = grouping;
+	dict["EER.upsampling"] = upsampling;
+	dict["EER.compression"] = compression;
+	dict["EER.first_frame"] = image_index * grouping;
+
+	EXITFUNC;
+	return 0;
+}
+
+void EerIO::read_frame_bits(int frame, vector<unsigned char> &buf)
+{
+	if (! TIFFSetDirectory(tiff_file, frame)) {
+		throw ImageReadException(filename, "EER frame missing");
+	}
+
+	// the strips of a frame form one continuous bitstream
+	tstrip_t nstrips = TIFFNumberOfStrips(tiff_file);
+
+	buf.clear();
+
+	for (tstrip_t s = 0; s < nstrips; s++) {
+		size_t n = TIFFRawStripSize(tiff_file, s);
+		size_t at = buf.size();
+
+		buf.resize(at + n);
+
+		if (n > 0 && TIFFReadRawStrip(tiff_file, s, &buf[at], n) != (tsize_t)n) {
+			throw ImageReadException(filename, "EER strip read failed");
+		}
+	}
+}
+
+void EerIO::decode_frame(const vector<unsigned char> &bits, vector<unsigned int> &events) const
+{
+	size_t nbits = bits.size() * 8;
+	vector<unsigned char> buf(bits.size() + 8, 0);
+
+	std::copy(bits.begin(), bits.end(), buf.begin());
+
+	const unsigned char *data = &buf[0];
+	const int rle_bits = compression == EER_RLE8 ? 8 : 7;
+	const unsigned int rle_max = (1u << rle_bits) - 1;
+	const unsigned int npix = width * height;
+
+	events.clear();
+
+	size_t bit = 0;
+	unsigned int pos = 0;
+
+	// each step needs at most rle_bits+4 bits, which one 64-bit load always holds
+	while (bit + rle_bits <= nbits) {
+		unsigned long long w = load_bits(data, bit >> 3) >> (bit & 7);
+		unsigned int rle = (unsigned int)(w & rle_max);
+
+		bit += rle_bits;
+		pos += rle;
+
+		if (pos >= npix) {
+			break;
+		}
+
+		if (rle == rle_max) {
+			continue;	// long run, continued by the next code
+		}
+
+		// subpixel codes are stored XORed with 0x0A
+		unsigned int code = ((unsigned int)(w >> rle_bits) & 15) ^ 0x0A;
+
+		bit += 4;
+		events.push_back(pos << 4 | code);
+		pos++;
+	}
+}
+
+int EerIO::read_data(float *rdata, int image_index, const Region * area, bool)
+{
+	ENTERFUNC;
+
+	check_read_access(image_index, rdata);
+
+	if (image_index < 0) {
+		image_index = 0;
+	}
+
+	if (image_index >= get_nimg()) {
+		throw ImageReadException(filename, "EER image index out of range");
+	}
+
+	int nx = width * upsampling;
+	int ny = height * upsampling;
+
+	check_region(area, IntSize(nx, ny));
+
+	vector<float> full;
+	float *out = rdata;
+
+	if (area) {
+		full.resize((size_t)nx * ny);
+		out = &full[0];
+	}
+
+	std::fill(out, out + (size_t)nx * ny, 0.0f);
+
+	// subpixel codes are 2 bits per axis; keep the leading bits the grid can resolve
+	int shift = upsampling == 4 ? 0 : (upsampling == 2 ? 1 : 2);
+	// libtiff reads are serial; the frames of a group are then decoded in parallel
+	vector< vector<unsigned char> > bits(grouping);
+	vector< vector<unsigned int> > events(grouping);
+
+	for (int g = 0; g < grouping; g++) {
+		read_frame_bits(image_index * grouping + g, bits[g]);
+	}
+
+	DecodeTask task(this, bits, events);
+	Parallel::run(task, grouping);
+
+	for (int g = 0; g < grouping; g++) {
+		const vector<unsigned int> &ev = events[g];
+
+		for (size_t i = 0; i < ev.size(); i++) {
+			unsigned int p = ev[i] >> 4;
+			unsigned int code = ev[i] & 15;
+			int x = (p % width) * upsampling + ((code & 3) >> shift);
+			int y = (p / width) * upsampling + ((code >> 2) >> shift);
+
+			out[(size_t)(ny - 1 - y) * nx + x] += 1.0f;
+		}
+	}
+
+	if (area) {
+		int xlen = 0, ylen = 0, x0 = 0, y0 = 0;
+
+		EMUtil::get_region_dims(area, nx, &xlen, ny, &ylen);
+		EMUtil::get_region_origins(area, &x0, &y0);
+
+		for (int y = 0; y < ylen; y++) {
+			memcpy(rdata + (size_t)y * xlen, out + (size_t)(y0 + y) * nx + x0, xlen * sizeof(float));
+		}
+	}
+
+	EXITFUNC;
+	return 0;
+}
+
+int EerIO::write_header(const Dict &, int, const Region *, EMUtil::EMDataType, bool)
+{
+	ENTERFUNC;
+
+	throw ImageWriteException(filename, "EER writing not supported");
+
+	EXITFUNC;
+	return 0;
+}
+
+int EerIO::write_data(float *, int, const Region *, EMUtil::EMDataType, bool)
+{
+	ENTERFUNC;
+
+	throw ImageWriteException(filename, "EER writing not supported");
+
+	EXITFUNC;
+	return 0;
+}
+
+void EerIO::flush()
+{
+}
+
+bool EerIO::is_complex_mode()
+{
+	return false;
+}
+
+bool EerIO::is_image_big_endian()
+{
+	return false;
+}
+
+#endif	//USE_TIFF
@@ -0,0 +1,104 @@
+/**
+ * $Id$
+ */
+
+/*
+ * Author: Steven Ludtke, 04/10/2003 (sludtke@bcm.edu)
+ * Copyright (c) 2000-2006 Baylor College of Medicine
+ * 
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ * 
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ * 
+ * */
+
+#ifndef eman__eerio_h__
+#define eman__eerio_h__ 1
+
+#ifdef USE_TIFF
+
+#include "imageio.h"
+
+typedef struct tiff TIFF;
+
+namespace EMAN
+{
+	/** EerIO reads EER (Electron Event Representation) movies, which store the
+	 * position of every detected electron instead of rendered frames. The file is a
+	 * TIFF container with one directory per detector frame; each frame's strips hold
+	 * a bitstream of run lengths (skipped pixels) each followed by a 4-bit subpixel
+	 * code. Compression 65000 uses 8-bit runs and 65001 7-bit runs. 65002, with run
+	 * and subpixel widths given in private tags, is not supported.
+	 *
+	 * Frames are rendered as they are read. Image i is the sum of detector frames
+	 * [i*grouping, (i+1)*grouping); a final partial group is dropped. Electrons are
+	 * counted on a grid 'upsampling' (1, 2 or 4) times finer than the physical pixels,
+	 * using the subpixel codes. Both are read from the environment when the file is
+	 * opened: EER_GROUPING (default 1) and EER_UPSAMPLING (default 1).
+	 *
+	 * Rows are flipped as TiffIO does, so gain references prepared from TIFF data
+	 * line up. Writing is not supported.
+	 */
+	class EerIO : public ImageIO
+	{
+	  public:
+		explicit EerIO(const string & filename, IOMode rw_mode = READ_ONLY);
+		~EerIO();
+
+		DEFINE_IMAGEIO_FUNC;
+		static bool is_valid(const void *first_block);
+		int get_nimg();
+
+	  private:
+		enum
+		{
+			EER_RLE8 = 65000,
+			EER_RLE7 = 65001
+		};
+
+		class DecodeTask;
+
+		/** Read the raw bitstream of one detector frame */
+		void read_frame_bits(int frame, vector<unsigned char> &bits);
+
+		/** Decode a frame's bitstream into 'events', each (pixel index << 4 | subpixel code) */
+		void decode_frame(const vector<unsigned char> &bits, vector<unsigned int> &events) const;
+
+		string filename;
+		IOMode rw_mode;
+		TIFF *tiff_file;
+		bool initialized;
+
+		int width;
+		int height;
+		int nframes;
+		int compression;
+		int grouping;
+		int upsampling;
+	};
+}
+
+#endif	//USE_TIFF
+
+#endif	//eman__eerio_h__
@@ -40,7 +40,8 @@
 #include "imageio.h"
 #include "util.h"
 #include <stdio.h>
-#include <pthread.h>
+#include <vector>
+#include <boost/functional/hash.hpp>
 using namespace EMAN;
 
 void *thread_clean( void *ptr ) {
@@ -57,164 +58,167 @@ void thread_start() {
 
 // GlobalCache
 GlobalCache *GlobalCache::global_cache = 0;
+volatile time_t GlobalCache::now = 0;
+
+static pthread_once_t global_cache_once = PTHREAD_ONCE_INIT;
+
+void GlobalCache::create()
+{
+    global_cache = new GlobalCache();
+}
 
 GlobalCache::GlobalCache()
 {
-    // pthread_mutex_init(&mutex, NULL);
+    now = time(0);
+    for (int i = 0; i < NSHARDS; i++) pthread_mutex_init(&shards[i].mutex, NULL);
     thread_start();
 }
 
 GlobalCache::~GlobalCache()
 {
-    clean();
-    pthread_mutex_destroy(&mutex);
+    for (int i = 0; i < NSHARDS; i++) {
+        for (EntryMap::iterator it = shards[i].entries.begin(); it != shards[i].entries.end(); ++it) {
+            delete it->second.io;
+        }
+        pthread_mutex_destroy(&shards[i].mutex);
+    }
 }
 
 GlobalCache *GlobalCache::instance()
 {
-	if (!global_cache) {
-		global_cache = new GlobalCache();
-	}
+	pthread_once(&global_cache_once, create);
 	return global_cache;
 }
 
+GlobalCache::Shard & GlobalCache::shard(const string & filename)
+{
+    return shards[boost::hash<string>()(filename) % NSHARDS];
+}
+
 ImageIO *GlobalCache::get_imageio(const string & filename, int rw)
 {
-    pthread_mutex_lock(&mutex);
-#ifdef DEBUG_CACHE
-    printf("get_imageio: filename: %s, rw: %d\n", filename.c_str(), rw);
-#endif
+    Shard & s = shard(filename);
+    ImageIO *io = 0;
+    ImageIO *stale = 0;
 
-    if (file_imageio.count(filename) == 0) {
-        // printf("get_imageio: no cached imageio!\n");
-        pthread_mutex_unlock(&mutex);
-        return 0;        
-    }     
-    
-    ImageIO *io = file_imageio[filename];    
+    pthread_mutex_lock(&s.mutex);
+    EntryMap::iterator it = s.entries.find(filename);
+    if (it != s.entries.end()) {
+        Entry & e = it->second;
 #ifdef DEBUG_CACHE
-    printf("get_imageio:      found cached; refs: %d, current rw: %d, request rw: %d\n", file_ref[filename], file_rw[filename], rw);
+        printf("get_imageio: %s: refs: %d, current rw: %d, request rw: %d\n", filename.c_str(), e.ref, e.rw, rw);
 #endif
-    time_t t = time(0);
-    file_time[filename] = time(0);
-    // printf("get_imageio:      updated time\n");
-    if (file_rw[filename] == rw) {
-        // current == request
-        file_ref[filename]++;
-        // printf("get_imageio:      ref += 1 to %d\n", file_ref[filename]);
-    } else if (file_rw[filename] == 2 && rw == 1) {
-        // current == read_write, request == read
-        file_ref[filename]++;
-        // printf("get_imageio:      ref += 1 to %d (passing write mode to read request)\n", file_ref[filename]);
-    } else if (file_ref[filename] == 0) {
-        // current != request, no open handles
-        // printf("get_imageio:      re-opening in mode %d\n", rw);
-        this->delete_imageio(filename);
-        io = 0;        
-    } else {
-        // current != request, open handles
-        // current is read, request is write -- we can't make this change with open handles. How to fail?
-        file_ref[filename]++;
-        printf("GlobalCache::get_imageio: %s: Cannot switch mode %d to %d with open references!\n", filename.c_str(), file_rw[filename], rw);
+        e.time = now;
+        if (e.rw == rw || (e.rw == 2 && rw == 1)) {
+            // same mode, or a read request served by a read_write instance
+            e.ref++;
+            io = e.io;
+        } else if (e.ref == 0) {
+            // other mode, no open handles: reopen in the new mode
+            stale = e.io;
+            s.entries.erase(it);
+        } else {
+            // current is read, request is write -- we can't make this change with open handles. How to fail?
+            e.ref++;
+            io = e.io;
+            printf("GlobalCache::get_imageio: %s: Cannot switch mode %d to %d with open references!\n", filename.c_str(), e.rw, rw);
+        }
     }
-    pthread_mutex_unlock(&mutex);
+    pthread_mutex_unlock(&s.mutex);
+
+    delete stale;
     return io;
 }
 
-void GlobalCache::delete_imageio(const string & filename) {
-    // Lock acquired in caller
-    if (file_imageio.count(filename) == 0) {
-        // printf("delete_imageio: Not in cache\n");
-    } else if (file_ref[filename] == 0) {
-        ImageIO *io = file_imageio[filename];
-        file_imageio.erase(filename);
-        delete io;
-    }
-}
+bool GlobalCache::close_imageio(const string & filename, const ImageIO * io, bool release)
+{
+    Shard & s = shard(filename);
+    ImageIO *closing = 0;
 
-void GlobalCache::close_imageio(const string & filename) {
-    pthread_mutex_lock(&mutex);
-#ifdef DEBUG_CACHE
-    printf("close_imageio: filename: %s\n", filename.c_str());
-#endif
-    if (file_imageio.count(filename) > 0) {
-        ImageIO *io = file_imageio[filename];
-        // Decrement the reference and update the access time.
-        file_ref[filename]--;
-        file_time[filename] = time(0);
-        // printf("close_imageio:      ref -= 1 to %d\n", file_ref[filename]);
-        if (file_ref[filename] == 0 && file_persist[filename] == 0) {
-            // printf("close_imageio:      auto closing!\n");
-            this->delete_imageio(filename);
+    pthread_mutex_lock(&s.mutex);
+    EntryMap::iterator it = s.entries.find(filename);
+    bool cached = (it != s.entries.end() && it->second.io == io);
+    if (cached) {
+        Entry & e = it->second;
+        e.ref--;
+        e.time = now;
+        if (e.ref == 0 && (release || e.persist == 0)) {
+            closing = e.io;
+            s.entries.erase(it);
         }
-    } else {
-        // printf("close_imageio:      No ImageIO to close!\n");
     }
-    pthread_mutex_unlock(&mutex);
+    pthread_mutex_unlock(&s.mutex);
+
+    // closing a file can take a while; nobody else can reach it any more
+    delete closing;
+    return cached;
 }
 
-void GlobalCache::add_imageio(const string & filename, int rw, int persist, ImageIO * io)
+ImageIO *GlobalCache::add_imageio(const string & filename, int rw, int persist, ImageIO * io)
 {
-    pthread_mutex_lock(&mutex);    
+    Shard & s = shard(filename);
+
+    pthread_mutex_lock(&s.mutex);
 #ifdef DEBUG_CACHE
     printf("add_imageio: filename %s, rw %d, persist %d\n", filename.c_str(), rw, persist);
 #endif
-    if (file_imageio.count(filename) > 0) {
-        // Todo: How to handle error if file is already in cache?
-        // printf("File already in cache.")
+    EntryMap::iterator it = s.entries.find(filename);
+    if (it != s.entries.end()) {
+        // Another thread opened and cached the file first. Hand out that
+        // instance when the mode allows it, as get_imageio() would have.
+        Entry & e = it->second;
+        if (e.rw == rw || (e.rw == 2 && rw == 1)) {
+            e.ref++;
+            e.time = now;
+            io = e.io;
+        }
     } else if (io && persist > 0) {
-        // Todo: Make a class to hold all these values and the ImageIO.
-        file_imageio[filename] = io;
-        file_ref[filename] = 1;
-		file_rw[filename] = rw;
-        file_time[filename] = time(0);
-        file_persist[filename] = persist;
-	}
-    pthread_mutex_unlock(&mutex);
+        Entry e;
+        e.io = io;
+        e.rw = rw;
+        e.ref = 1;
+        e.persist = persist;
+        e.time = now;
+        s.entries[filename] = e;
+    }
+    pthread_mutex_unlock(&s.mutex);
+    return io;
 }
 
 int GlobalCache::contains(const string & filename) {
-    pthread_mutex_lock(&mutex);
-    int ret = 0;
-    if (file_imageio.count(filename) > 0) {
-        ret = 1;
-    }
-    pthread_mutex_unlock(&mutex);    
+    Shard & s = shard(filename);
+    pthread_mutex_lock(&s.mutex);
+    int ret = s.entries.count(filename) > 0 ? 1 : 0;
+    pthread_mutex_unlock(&s.mutex);
     return ret;
 }
 
 void GlobalCache::clean() {
-    pthread_mutex_lock(&mutex);    
-#ifdef DEBUG_CACHE
-    printf("clean: %ld items in cache\n", file_imageio.size());
-#endif
-    
-    // Find cached items to close
-    vector<string> toclose;
-    time_t now = time(0);
-    int seconds;
-    string filename;
-    for (map<string, ImageIO*>::iterator iter=file_imageio.begin(); iter!=file_imageio.end(); ++iter) {
-        filename = iter->first;
-        seconds = int(difftime(now, file_time[filename]));
+    now = time(0);
+
+    for (int i = 0; i < NSHARDS; i++) {
+        // Find unreferenced items past their persist time, then close them unlocked
+        std::vector<ImageIO *> toclose;
+        Shard & s = shards[i];
+
+        pthread_mutex_lock(&s.mutex);
+        for (EntryMap::iterator it = s.entries.begin(); it != s.entries.end(); ) {
+            const Entry & e = it->second;
 #ifdef DEBUG_CACHE
-        printf("clean:       filename: %s, rw: %d, ref: %d, last access: %d, persist: %d\n", filename.c_str(), file_rw[filename], file_ref[filename], seconds, file_persist[filename]);
+            printf("clean:       filename: %s, rw: %d, ref: %d, last access: %d, persist: %d\n", it->first.c_str(), e.rw, e.ref, int(now - e.time), e.persist);
 #endif
-        if (seconds >= file_persist[filename]) {
-            // printf("clean:      marking to close %s...\n", filename.c_str());
-            toclose.push_back(filename);
+            if (e.ref == 0 && now - e.time >= e.persist) {
+                toclose.push_back(e.io);
+                it = s.entries.erase(it);
+            }
+            else {
+                ++it;
+            }
         }
+        pthread_mutex_unlock(&s.mutex);
+
+        for (size_t j = 0; j < toclose.size(); j++) delete toclose[j];
     }
-    
-    // Close the selected items
-    for(vector<string>::iterator iter=toclose.begin(); iter!=toclose.end(); iter++) {
-        filename = *iter;
-        // printf("clean: closing %s...\n", filename.c_str());        
-        this->delete_imageio(filename);
-    }
-    
-    pthread_mutex_unlock(&mutex);
 }
 
 #endif // IMAGEIO_CACHE
-
@@ -39,35 +39,68 @@
 #define eman__emcache__h__ 1
 
 #include <cstdlib>
+#include <ctime>
 #include <string>
-#include <map>
+#include <pthread.h>
+#include <boost/unordered_map.hpp>
 using std::string;
-using std::map;
 
 namespace EMAN
 {
 	class ImageIO;
 
-	/* GlobalCache is a Singleton class that handles cache across EMAN. */
+	/* GlobalCache is a Singleton class that handles cache across EMAN.
+	 * Open ImageIOs live in a hash table split into shards by filename, each
+	 * shard with its own lock, so threads working on different files don't
+	 * wait on each other. Access times come from a clock the cleaning thread
+	 * advances once a second, which is all the precision persist needs. */
 	class GlobalCache
 	{
 	  public:
 		static GlobalCache *instance();
+		/** @return the cached ImageIO for filename with a reference taken, or 0 if
+		 * the file must be (re)opened */
 		ImageIO *get_imageio(const string & filename, int rw);
         int contains(const string & filename);
-		void add_imageio(const string & filename, int rw, int persist, ImageIO * io);
-        void close_imageio(const string & filename);
-        void delete_imageio(const string & filename);
+		/** Cache 'io' for 'filename'. If another ImageIO for the file was cached in
+		 * the meantime that one is returned (with its reference count taken) and the
+		 * caller should discard 'io'; otherwise 'io' is returned. */
+		ImageIO *add_imageio(const string & filename, int rw, int persist, ImageIO * io);
+		/** Drop a reference taken by get_imageio() or add_imageio().
+		 * @param release close the file at once when no one else holds it, rather
+		 *        than keeping it for its persist time
+		 * @return false if io isn't the cached ImageIO of filename, so the caller
+		 *         still owns it */
+		bool close_imageio(const string & filename, const ImageIO * io, bool release = false);
         void clean();
 
 	  private:
-        pthread_mutex_t mutex;          
+		struct Entry
+		{
+			ImageIO *io;
+			int rw;
+			int ref;
+			int persist;
+			time_t time;
+		};
+
+		typedef boost::unordered_map<string, Entry> EntryMap;
+
+		struct Shard
+		{
+			pthread_mutex_t mutex;
+			EntryMap entries;
+		};
+
+		enum { NSHARDS = 32 };
+
+		Shard & shard(const string & filename);
+
+		Shard shards[NSHARDS];
+		static volatile time_t now;
+
 		static GlobalCache *global_cache;
-		map < string, ImageIO* >file_imageio;
-		map < string, int >file_rw;
-        map < string, int >file_ref;
-        map < string, int >file_time;
-        map < string, int >file_persist;
+		static void create();
 
 		GlobalCache();
 		~GlobalCache();
@@ -823,6 +823,12 @@ namespace EMAN
 		void update_stat() const;
 		void save_byteorder_to_dict(ImageIO * imageio);
 
+		/** Read the header of image 'img_index' through an open ImageIO and
+		 * set this image's attributes, flags and nx/ny/nz from it. The data
+		 * are left alone. */
+		void read_header_from(ImageIO * imageio, const string & filename,
+							  int img_index, const Region * region, bool is_3d);
+
 	private:
 		/** to store all image header info */
 		mutable Dict attr_dict;
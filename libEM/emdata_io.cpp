@@ -38,6 +38,11 @@
 #include "emdata.h"
 #include "all_imageio.h"
 #include "ctf.h"
+#include "parallel.h"
+#include "headerindex.h"
+
+#include <algorithm>
+#include <pthread.h>
 
 #include <iostream>
 using std::cout;
@@ -48,6 +53,37 @@ using boost::shared_ptr;
 
 using namespace EMAN;
 
+void EMData::read_header_from(ImageIO * imageio, const string & filename, int img_index,
+							  const Region * region, bool is_3d)
+{
+	int err = imageio->read_header(attr_dict, img_index, region, is_3d);
+	if (err) {
+		throw ImageReadException(filename, "imageio read header failed");
+	}
+
+	LstIO * myLstIO = dynamic_cast<LstIO *>(imageio);
+	if(!myLstIO)	attr_dict["source_path"] = filename;	//"source_path" is set to full path of reference image for LstIO, so skip this statement
+	attr_dict["source_n"] = img_index;
+	if (imageio->is_complex_mode()) {
+		set_complex(true);
+		set_fftpad(true);
+	}
+	if (attr_dict.has_key("is_fftodd") && (int)attr_dict["is_fftodd"] == 1) {
+		set_fftodd(true);
+	}
+	if ((int) attr_dict["is_complex_ri"] == 1) {
+		set_ri(true);
+	}
+	save_byteorder_to_dict(imageio);
+
+	nx = attr_dict["nx"];
+	ny = attr_dict["ny"];
+	nz = attr_dict["nz"];
+	attr_dict.erase("nx");
+	attr_dict.erase("ny");
+	attr_dict.erase("nz");
+}
+
 void EMData::read_image(const string & filename, int img_index, bool nodata,
 						const Region * region, bool is_3d)
 {
@@ -59,65 +95,38 @@ void EMData::read_image(const string & filename, int img_index, bool nodata,
 		throw ImageFormatException("cannot create an image io");
 	}
 	else {
-		int err = imageio->read_header(attr_dict, img_index, region, is_3d);
-		if (err) {
-			throw ImageReadException(filename, "imageio read header failed");
-		}
-		else {
-			LstIO * myLstIO = dynamic_cast<LstIO *>(imageio);
-			if(!myLstIO)	attr_dict["source_path"] = filename;	//"source_path" is set to full path of reference image for LstIO, so skip this statement
-			attr_dict["source_n"] = img_index;
-			if (imageio->is_complex_mode()) {
-				set_complex(true);
-				set_fftpad(true);
-			}
-			if (attr_dict.has_key("is_fftodd") && (int)attr_dict["is_fftodd"] == 1) {
-				set_fftodd(true);
-			}
-			if ((int) attr_dict["is_complex_ri"] == 1) {
-				set_ri(true);
+		read_header_from(imageio, filename, img_index, region, is_3d);
+
+		if (!nodata) {
+
+			if (region) {
+				nx = (int)region->get_width();
+				if (nx <= 0) nx = 1;
+				ny = (int)region->get_height();
+				if (ny <= 0) ny = 1;
+				nz = (int)region->get_depth();
+				if (nz <= 0) nz = 1;
+				set_size(nx,ny,nz);
+				to_zero(); // This could be avoided in favor of setting only the regions that were not read to to zero... but tedious
+			} // else the dimensions of the file being read match those of this
+			else {
+				set_size(nx, ny, nz);
 			}
-			save_byteorder_to_dict(imageio);
-
-			nx = attr_dict["nx"];
-			ny = attr_dict["ny"];
-			nz = attr_dict["nz"];
-			attr_dict.erase("nx");
-			attr_dict.erase("ny");
-			attr_dict.erase("nz");
-
-			if (!nodata) {
-
-				if (region) {
-					nx = (int)region->get_width();
-					if (nx <= 0) nx = 1;
-					ny = (int)region->get_height();
-					if (ny <= 0) ny = 1;
-					nz = (int)region->get_depth();
-					if (nz <= 0) nz = 1;
-					set_size(nx,ny,nz);
-					to_zero(); // This could be avoided in favor of setting only the regions that were not read to to zero... but tedious
-				} // else the dimensions of the file being read match those of this
-				else {
-					set_size(nx, ny, nz);
-				}
 
-				// If GPU features are enabled there is  danger that rdata will
-				// not be allocated, but set_size takes care of this, so this
-				// should be safe.
-				int err = imageio->read_data(get_data(), img_index, region, is_3d);
-				if (err) {
-					throw ImageReadException(filename, "imageio read data failed");
-				}
-				else {
-					update();
-				}
+			// If GPU features are enabled there is  danger that rdata will
+			// not be allocated, but set_size takes care of this, so this
+			// should be safe.
+			int err = imageio->read_data(get_data(), img_index, region, is_3d);
+			if (err) {
+				throw ImageReadException(filename, "imageio read data failed");
 			}
 			else {
-				if (rdata!=0) EMUtil::em_free(rdata);
-				rdata=0;
+				update();
 			}
-
+		}
+		else {
+			if (rdata!=0) EMUtil::em_free(rdata);
+			rdata=0;
 		}
 	}
     
@@ -126,78 +135,299 @@ void EMData::read_image(const string & filename, int img_index, bool nodata,
 	EXITFUNC;
 }
 
-void EMData::read_binedimage(const string & filename, int img_index, int binfactor, bool fast, bool is_3d)
+namespace {
+	// One z-slab read of a binned read, run on its own thread so the next slab
+	// loads while the current one is being binned.
+	struct SlabRead
+	{
+		ImageIO *imageio;
+		int img_index;
+		bool is_3d;
+		Region region;
+		float *data;
+		int err;
+		string error;
+	};
+
+	void *read_slab(void *arg)
+	{
+		SlabRead *slab = static_cast < SlabRead * >(arg);
+
+		try {
+			slab->err = slab->imageio->read_data(slab->data, slab->img_index, &slab->region, slab->is_3d);
+		}
+		catch (E2Exception & e) {
+			slab->err = 1;
+			slab->error = e.what();
+		}
+		catch (...) {
+			slab->err = 1;
+		}
+
+		return 0;
+	}
+
+	// Bins output rows of one slab by mean or median. A slab holds
+	// zbin*nplanes input slices of nx*ny; item i is output row i%ony of
+	// output plane i/ony within the slab.
+	class BinRowsTask : public ParallelTask
+	{
+	  public:
+		BinRowsTask(const float *in, float *out, int nx, int ny, int bin, int zbin,
+					bool median, int nthreads)
+			: in(in), out(out), nx(nx), ny(ny), bin(bin), zbin(zbin), median(median),
+			  onx(nx / bin), ony(ny / bin), scratch(nthreads)
+		{
+		}
+
+		void run(size_t begin, size_t end, int thread)
+		{
+			vector < float > &tmp = scratch[thread];
+			size_t nxy = (size_t)nx * ny;
+
+			if (median) {
+				tmp.resize((size_t)bin * bin * zbin);
+			}
+			else {
+				tmp.resize(nx);
+			}
+
+			float norm = 1.0f / ((float)bin * bin * zbin);
+
+			for (size_t item = begin; item < end; item++) {
+				size_t plane = item / ony;
+				int oy = (int)(item % ony);
+				const float *src = in + plane * zbin * nxy + (size_t)oy * bin * nx;
+				float *dst = out + item * onx;
+
+				if (median) {
+					size_t mid = tmp.size() / 2;
+
+					for (int ox = 0; ox < onx; ox++) {
+						size_t l = 0;
+						for (int dz = 0; dz < zbin; dz++) {
+							for (int dy = 0; dy < bin; dy++) {
+								const float *row = src + dz * nxy + (size_t)dy * nx + ox * bin;
+								for (int dx = 0; dx < bin; dx++) tmp[l++] = row[dx];
+							}
+						}
+						std::nth_element(tmp.begin(), tmp.begin() + mid, tmp.end());
+						dst[ox] = tmp[mid];
+					}
+				}
+				else {
+					// Sum whole rows first; these loops are contiguous and vectorize
+					float *acc = &tmp[0];
+					std::fill(tmp.begin(), tmp.end(), 0.0f);
+
+					for (int dz = 0; dz < zbin; dz++) {
+						for (int dy = 0; dy < bin; dy++) {
+							const float *row = src + dz * nxy + (size_t)dy * nx;
+							for (int x = 0; x < nx; x++) acc[x] += row[x];
+						}
+					}
+
+					for (int ox = 0; ox < onx; ox++) {
+						float sum = 0.0f;
+						for (int dx = 0; dx < bin; dx++) sum += acc[ox * bin + dx];
+						dst[ox] = sum * norm;
+					}
+				}
+			}
+		}
+
+	  private:
+		const float *in;
+		float *out;
+		int nx, ny, bin, zbin;
+		bool median;
+		int onx, ony;
+		vector < vector < float > > scratch;
+	};
+
+	// Fourier binning, one output plane per item: the zbin input slices are
+	// averaged, then the plane is Fourier truncated to nx/bin x ny/bin.
+	class FourierBinTask : public ParallelTask
+	{
+	  public:
+		FourierBinTask(const float *in, float *out, int nx, int ny, int bin, int zbin)
+			: in(in), out(out), nx(nx), ny(ny), bin(bin), zbin(zbin)
+		{
+		}
+
+		void run(size_t begin, size_t end, int)
+		{
+			size_t nxy = (size_t)nx * ny;
+			int onx = nx / bin;
+			int ony = ny / bin;
+
+			EMData plane;
+			plane.set_size(nx, ny, 1);
+
+			for (size_t item = begin; item < end; item++) {
+				float *p = plane.get_data();
+				const float *src = in + item * zbin * nxy;
+
+				std::copy(src, src + nxy, p);
+				for (int dz = 1; dz < zbin; dz++) {
+					const float *s2 = src + dz * nxy;
+					for (size_t i = 0; i < nxy; i++) p[i] += s2[i];
+				}
+				if (zbin > 1) {
+					float norm = 1.0f / zbin;
+					for (size_t i = 0; i < nxy; i++) p[i] *= norm;
+				}
+				plane.update();
+
+				EMData *small = plane.FourTruncate(onx, ony, 1, true, true);
+				std::copy(small->get_data(), small->get_data() + (size_t)onx * ony,
+						  out + item * onx * ony);
+				delete small;
+			}
+		}
+
+	  private:
+		const float *in;
+		float *out;
+		int nx, ny, bin, zbin;
+	};
+}
+
+void EMData::read_binedimage(const string & filename, int img_index, int binfactor, bool fast,
+							 bool is_3d, const string & method)
 {
 	ENTERFUNC;
 
+	if (binfactor < 1) {
+		throw InvalidValueException(binfactor, "binfactor must be >= 1");
+	}
+
+	bool median = (method == "median");
+	bool fourier = (method == "fourier");
+
+	if (!median && !fourier && method != "mean") {
+		throw InvalidParameterException("read_binedimage: method must be mean, median or fourier");
+	}
+
 	ImageIO *imageio = EMUtil::get_imageio(filename, ImageIO::READ_ONLY);
 
 	if (!imageio) {
 		throw ImageFormatException("cannot create an image io");
 	}
-	else {
-		int err = imageio->read_header(attr_dict, img_index, 0, is_3d);
-		if (err) {
-			throw ImageReadException(filename, "imageio read header failed");
+
+	pthread_t reader;
+	bool reading = false;
+	SlabRead slab[2];
+
+	try {
+		read_header_from(imageio, filename, img_index, 0, is_3d);
+		attr_dict["source_path"] = filename;
+
+		int ori_nx = nx;
+		int ori_ny = ny;
+		int ori_nz = nz;
+		int onx = ori_nx / binfactor;
+		int ony = ori_ny / binfactor;
+		int onz = ori_nz / binfactor;
+
+		if (onx < 1 || ony < 1 || onz < 1) {
+			throw InvalidValueException(binfactor, "binfactor larger than the image");
 		}
-		else {
-			attr_dict["source_path"] = filename;
-			attr_dict["source_n"] = img_index;
-			if (imageio->is_complex_mode()) {
-				set_complex(true);
-				set_fftpad(true);
-			}
-			if (attr_dict.has_key("is_fftodd") && (int)attr_dict["is_fftodd"] == 1) {
-				set_fftodd(true);
-			}
-			if ((int) attr_dict["is_complex_ri"] == 1) {
-				set_ri(true);
+
+		// 'fast' samples every binfactor'th slice instead of averaging in Z
+		int zbin = fast ? 1 : binfactor;
+
+		set_size(onx, ony, onz);
+
+		// Each slab holds the input for 'planes' output planes, about 256 MB.
+		// In fast mode the slices used aren't adjacent, so read them singly.
+
+		size_t slice_bytes = (size_t)ori_nx * ori_ny * sizeof(float);
+		int planes = 1;
+		if (!fast) {
+			planes = (int)((size_t)256 * 1024 * 1024 / (slice_bytes * zbin));
+			planes = std::max(1, std::min(planes, onz));
+		}
+
+		size_t slab_size = (size_t)ori_nx * ori_ny * zbin * planes;
+		vector < float > buf[2];
+		buf[0].resize(slab_size);
+		buf[1].resize(slab_size);
+
+		if (fourier) {
+			// creating processors and FFT plans from the workers must not be the first use
+			EMData warm;
+			warm.set_size(ori_nx, ori_ny, 1);
+			warm.to_zero();
+			delete warm.FourTruncate(onx, ony, 1, true, true);
+		}
+
+		int nthreads = Parallel::get_threads();
+		int nslab = (onz + planes - 1) / planes;
+		float percent = 0.1f;
+
+		for (int i = 0; i <= nslab; i++) {
+			// start reading slab i while slab i-1 is binned
+			if (i < nslab) {
+				int z0 = i * planes * (fast ? binfactor : zbin);
+				int np = std::min(planes, onz - i * planes);
+				SlabRead &r = slab[i % 2];
+				r.imageio = imageio;
+				r.img_index = img_index;
+				r.is_3d = is_3d;
+				r.region = Region(0, 0, z0, ori_nx, ori_ny, np * zbin);
+				r.data = &buf[i % 2][0];
+				r.err = 0;
+				r.error = "";
+				if (pthread_create(&reader, 0, read_slab, &r) != 0) {
+					throw ImageReadException(filename, "cannot start slab reader thread");
+				}
+				reading = true;
 			}
-			save_byteorder_to_dict(imageio);
-
-			int ori_nx = nx = attr_dict["nx"];
-			int ori_ny = ny = attr_dict["ny"];
-			int ori_nz = nz = attr_dict["nz"];
-			if (!fast) ori_nz-=ori_nz%binfactor;	// makes sure Z is a multiple of binfactor, hack to fix the poor logic in the original routine
-			attr_dict.erase("nx");
-			attr_dict.erase("ny");
-			attr_dict.erase("nz");
-
-			// At this point nx, ny and nz are all reduced by binfactor
-			set_size(nx/binfactor, ny/binfactor, nz/binfactor);
-
-			//here is where we read in the binned data
-			EMData* tempdata = new EMData();
-			size_t sizeofslice = nx*ny*sizeof(float);
-
-			//zbin factor use 1 to speed binning(but don't benfit by averaging in Z)
-			int zbin = binfactor;
-			if(fast) zbin = 1;
-			//verbose
-			float percent = 0.1f;
-			for(int k = 0; k < ori_nz; k+=binfactor){
-				if(k > ori_nz*percent){
-					printf("%1.0f %% Done\n",100.0*float(k)/float(ori_nz));
-					percent+=0.1f;
+
+			if (i > 0) {
+				int p0 = (i - 1) * planes;
+				int np = std::min(planes, onz - p0);
+				float *out = get_data() + (size_t)p0 * onx * ony;
+				const float *in = &buf[(i - 1) % 2][0];
+
+				if (fourier) {
+					FourierBinTask task(in, out, ori_nx, ori_ny, binfactor, zbin);
+					Parallel::run(task, np, 1, nthreads);
+				}
+				else {
+					BinRowsTask task(in, out, ori_nx, ori_ny, binfactor, zbin, median, nthreads);
+					Parallel::run(task, (size_t)np * ony, 16, nthreads);
+				}
+
+				if (p0 + np > onz * percent) {
+					printf("%1.0f %% Done\n", 100.0 * float(p0 + np) / float(onz));
+					percent += 0.1f;
 				}
-				// read in a slice region
-//				printf("%d %d %d %d\n",k,ori_nx,ori_ny,zbin);
-				const Region* binregion = new Region(0,0,k,ori_nx,ori_ny,zbin);
-				tempdata->read_image(filename, 0, false, binregion);
-				// shrink the slice
-				if (binfactor > 1) tempdata->process_inplace("math.meanshrink",Dict("n",binfactor));
-				size_t offset = nx*ny*k/binfactor;
-				//add slice to total
-				EMUtil::em_memcpy(get_data()+offset,tempdata->get_data(),sizeofslice);
-				delete binregion;
 			}
 
-			delete tempdata;
-			update();
+			if (reading) {
+				pthread_join(reader, 0);
+				reading = false;
+				if (i < nslab && slab[i % 2].err) {
+					throw ImageReadException(filename, "slab read failed " + slab[i % 2].error);
+				}
+			}
 		}
+
+		attr_dict["apix_x"] = (float)attr_dict["apix_x"] * binfactor;
+		attr_dict["apix_y"] = (float)attr_dict["apix_y"] * binfactor;
+		attr_dict["apix_z"] = (float)attr_dict["apix_z"] * binfactor;
+
+		update();
+	}
+	catch (...) {
+		if (reading) pthread_join(reader, 0);
+		EMUtil::close_imageio(filename, imageio);
+		throw;
 	}
 
-    EMUtil::close_imageio(filename, imageio);
+	EMUtil::close_imageio(filename, imageio);
 	imageio = 0;
 	EXITFUNC;
 }
@@ -234,6 +464,9 @@ void EMData::write_image(const string & filename, int img_index,
 	attr_dict["nz"] = nz;
 	attr_dict["changecount"] = changecount;
 
+	// a current header index is kept current; see HeaderIndex
+	bool indexed = HeaderIndex::has_current_index(filename);
+
     // Check if this is a write only format.
     if (Util::is_file_exist(filename)) {
         if (!header_only && region == 0) {
@@ -356,8 +589,10 @@ void EMData::write_image(const string & filename, int img_index,
 		imageio->flush();
 	}
 
-    EMUtil::close_imageio(filename, imageio);
+	// the index records the file's size and time, so the file must be closed first
+    EMUtil::close_imageio(filename, imageio, indexed);
 	imageio = 0;
+	if (indexed) HeaderIndex::update(filename, img_index, attr_dict);
 	EXITFUNC;
 }
 
@@ -405,38 +640,124 @@ void EMData::print_image(const string str, ostream& out) {
 	}
 }
 
-vector < shared_ptr<EMData> > EMData::read_images(const string & filename, vector < int >img_indices,
-									   bool header_only)
+void EMData::read_images_into(const string & filename, const vector < int > &img_indices,
+							  vector < EMData * > &images, bool header_only)
 {
 	ENTERFUNC;
 
-	int total_img = EMUtil::get_image_count(filename);
-	size_t num_img = img_indices.size();
+	ImageIO *imageio = EMUtil::get_imageio(filename, ImageIO::READ_ONLY);
 
-	for (size_t i = 0; i < num_img; i++) {
-		if (img_indices[i] < 0 || img_indices[i] >= total_img) {
-			throw OutofRangeException(0, total_img, img_indices[i], "image index");
-		}
+	if (!imageio) {
+		throw ImageFormatException("cannot create an image io");
 	}
 
-	size_t n = (num_img == 0 ? total_img : num_img);
+	try {
+		int total_img = imageio->get_nimg();
+		size_t num_img = img_indices.size();
 
-	vector< shared_ptr<EMData> > v;
-	for (size_t j = 0; j < n; j++) {
-		shared_ptr<EMData> d(new EMData());
-		size_t k = (num_img == 0 ? j : img_indices[j]);
-		try {
-			d->read_image(filename, (int)k, header_only);
+		for (size_t i = 0; i < num_img; i++) {
+			if (img_indices[i] < 0 || img_indices[i] >= total_img) {
+				throw OutofRangeException(0, total_img, img_indices[i], "image index");
+			}
 		}
-		catch(E2Exception &e) {
-			throw(e);
+
+		size_t n = (num_img == 0 ? total_img : num_img);
+		if (images.size() < n) {
+			images.resize(n, 0);
 		}
-		if ( d != 0 )
-		{
-			v.push_back(d);
+
+		// All headers first, through the one open ImageIO
+
+		for (size_t j = 0; j < n; j++) {
+			if (!images[j]) {
+				images[j] = new EMData();
+			}
+			int k = (num_img == 0 ? (int)j : img_indices[j]);
+			images[j]->read_header_from(imageio, filename, k, 0, false);
 		}
-		else
-			throw ImageReadException(filename, "imageio read data failed");
+
+		if (header_only) {
+			for (size_t j = 0; j < n; j++) {
+				if (images[j]->rdata != 0) EMUtil::em_free(images[j]->rdata);
+				images[j]->rdata = 0;
+			}
+		}
+		else {
+			// Runs of consecutive indices with equal sizes are read with
+			// ImageIO::read_data_block(), at most max_block floats at a time.
+
+			const size_t max_block = 16 * 1024 * 1024;
+			vector < float > block;
+			size_t j = 0;
+
+			while (j < n) {
+				EMData *d = images[j];
+				d->set_size(d->nx, d->ny, d->nz);
+				int k = (num_img == 0 ? (int)j : img_indices[j]);
+				size_t image_size = d->get_size();
+
+				size_t run = 1;
+				while (j + run < n && image_size * (run + 1) <= max_block) {
+					EMData *e = images[j + run];
+					int kk = (num_img == 0 ? (int)(j + run) : img_indices[j + run]);
+					if (kk != k + (int)run || (size_t)e->nx * e->ny * e->nz != image_size) {
+						break;
+					}
+					run++;
+				}
+
+				if (run == 1) {
+					if (imageio->read_data(d->get_data(), k, 0, false)) {
+						throw ImageReadException(filename, "imageio read data failed");
+					}
+					d->update();
+				}
+				else {
+					block.resize(image_size * run);
+					if (imageio->read_data_block(&block[0], k, (int)run, image_size, false)) {
+						throw ImageReadException(filename, "imageio read data failed");
+					}
+					for (size_t i = 0; i < run; i++) {
+						EMData *e = images[j + i];
+						e->set_size(e->nx, e->ny, e->nz);
+						EMUtil::em_memcpy(e->get_data(), &block[image_size * i],
+										  image_size * sizeof(float));
+						e->update();
+					}
+				}
+
+				j += run;
+			}
+		}
+	}
+	catch (...) {
+		EMUtil::close_imageio(filename, imageio);
+		throw;
+	}
+
+	EMUtil::close_imageio(filename, imageio);
+	EXITFUNC;
+}
+
+vector < shared_ptr<EMData> > EMData::read_images(const string & filename, vector < int >img_indices,
+									   bool header_only)
+{
+	ENTERFUNC;
+
+	vector < EMData * > images;
+	try {
+		read_images_into(filename, img_indices, images, header_only);
+	}
+	catch (...) {
+		for (size_t i = 0; i < images.size(); i++) {
+			delete images[i];
+		}
+		throw;
+	}
+
+	vector< shared_ptr<EMData> > v(images.size());
+	for (size_t j = 0; j < images.size(); j++) {
+		v[j] = shared_ptr<EMData>(images[j]);
 	}
 
 	EXITFUNC;
@@ -73,10 +73,16 @@ void read_image(const string & filename, int img_index = 0,
  * @param is_3d  Whether to treat the image as a single 3D or a
  *   set of 2Ds. This is a hint for certain image formats which
  *   has no difference between 3D image and set of 2Ds.
+ * @param method "mean", "median" or "fourier". Fourier binning truncates each
+ *   xy slice in Fourier space; along z it averages like "mean".
+ *
+ * The file is opened once and read in large z slabs, the next slab loading
+ * while the current one is binned on the worker threads.
  * @exception ImageFormatException
  * @exception ImageReadException
+ * @exception InvalidValueException if binfactor is < 1 or larger than the image
  */
-void read_binedimage(const string & filename, int img_index = 0, int binfactor=0, bool fast = false, bool is_3d = false);
+void read_binedimage(const string & filename, int img_index = 0, int binfactor=0, bool fast = false, bool is_3d = false, const string & method = "mean");
 
 
 /** write the header and data out to an image.
@@ -157,6 +163,27 @@ static vector < boost::shared_ptr<EMData> >read_images(const string & filename,
 									  bool header_only = false);
 
 
+/** Read a set of images from file specified by 'filename' into
+ * existing EMData objects. The file is opened once, all headers are
+ * read first, and runs of consecutive indices are fetched with
+ * ImageIO::read_data_block(), which for MRC, SPIDER and IMAGIC stacks
+ * is a single large read. As with read_image(), header attributes are
+ * merged into each object's existing ones.
+ * @param filename The image file name.
+ * @param img_indices Which images are read; all of them if empty.
+ * @param images EMData objects to fill, in the order of img_indices.
+ *     An object whose size already matches is refilled without
+ *     reallocating, so the same vector can be reused as a pool. NULL
+ *     entries, and entries beyond its end, are created with new and
+ *     are owned by the caller.
+ * @param header_only If true, only read image headers.
+ */
+static void read_images_into(const string & filename,
+							 const vector < int > &img_indices,
+							 vector < EMData * > &images,
+							 bool header_only = false);
+
+
 /** Read a set of images from file specified by 'filename'. If
  * the given 'ext' is not empty, replace 'filename's extension it.
  * Images with index from img_index_start to img_index_end are read.
@@ -48,8 +48,12 @@
 #include "emassert.h"
 #include "exception.h"
 #include "hdf_filecache.h"
+#include "parallel.h"
 
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <sys/stat.h>
+#include <pthread.h>
 using boost::shared_ptr;
 
 //#ifdef EMAN2_USING_CUDA_MALLOC
@@ -190,6 +194,9 @@ EMUtil::ImageType EMUtil::get_image_ext_type(const string & file_ext)
 		imagetypes["jpeg"] = IMAGE_JPEG;
 		imagetypes["JPEG"] = IMAGE_JPEG;
 
+		imagetypes["eer"] = IMAGE_EER;
+		imagetypes["EER"] = IMAGE_EER;
+
 		imagetypes["df3"] = IMAGE_DF3;
 		imagetypes["DF3"] = IMAGE_DF3;
 
@@ -371,6 +378,13 @@ EMUtil::ImageType EMUtil::fast_get_image_type(const string & filename,
 			return IMAGE_SER;
 		}
 		break;
+#ifdef USE_TIFF
+	case IMAGE_EER:
+		if (EerIO::is_valid(first_block)) {
+			return IMAGE_EER;
+		}
+		break;
+#endif
 	case IMAGE_IMAGIC:
 		if (ImagicIO::is_valid(first_block)) {
 			return IMAGE_IMAGIC;
@@ -547,6 +561,129 @@ int EMUtil::get_image_count(const string & filename)
 	return nimg;
 }
 
+namespace {
+	/** What the batched queries know about one file, valid while size and mtime match */
+	struct FileInfo
+	{
+		off_t size;
+		time_t mtime;
+		long mtime_ns;
+		EMUtil::ImageType type;
+		bool has_header;
+		int nimg;
+		Dict header;
+	};
+
+	typedef boost::unordered_map<string, FileInfo> FileInfoMap;
+
+	pthread_mutex_t file_info_lock = PTHREAD_MUTEX_INITIALIZER;
+	FileInfoMap file_info;
+	const size_t MAX_FILE_INFO = 200000;
+
+	/** Fills in FileInfo for a list of files, reading only those not already cached */
+	class FileInfoTask : public ParallelTask
+	{
+	  public:
+		FileInfoTask(const vector<string> & f, bool h, vector<FileInfo> & i)
+			: filenames(f), headers(h), info(i) {}
+
+		void run(size_t begin, size_t end, int)
+		{
+			for (size_t i = begin; i < end; i++) probe(filenames[i], info[i]);
+		}
+
+	  private:
+		void probe(const string & filename, FileInfo & fi)
+		{
+			fi.type = EMUtil::IMAGE_UNKNOWN;
+			fi.has_header = false;
+			fi.nimg = 0;
+			fi.header.clear();
+
+			struct stat st;
+			if (filename.empty() || stat(filename.c_str(), &st) != 0) return;
+			fi.size = st.st_size;
+			fi.mtime = st.st_mtime;
+			fi.mtime_ns = portable_mtime_nsec(st);
+
+			pthread_mutex_lock(&file_info_lock);
+			FileInfoMap::iterator it = file_info.find(filename);
+			bool hit = (it != file_info.end() && it->second.size == fi.size && it->second.mtime == fi.mtime &&
+						it->second.mtime_ns == fi.mtime_ns &&
+						(it->second.has_header || !headers));
+			if (hit) fi = it->second;
+			pthread_mutex_unlock(&file_info_lock);
+			if (hit) return;
+
+			try {
+				fi.type = EMUtil::get_image_type(filename);
+				if (headers && fi.type != EMUtil::IMAGE_UNKNOWN) {
+					ImageIO *imageio = EMUtil::get_imageio(filename, ImageIO::READ_ONLY, fi.type);
+					try {
+						fi.nimg = imageio->get_nimg();
+						if (fi.nimg > 0) imageio->read_header(fi.header, 0, 0, false);
+					}
+					catch (...) {
+						EMUtil::close_imageio(filename, imageio, true);
+						throw;
+					}
+					EMUtil::close_imageio(filename, imageio, true);
+				}
+			}
+			catch (E2Exception &) {
+				// unreadable files are reported as unknown, and cached as such
+				fi.nimg = 0;
+				fi.header.clear();
+			}
+			fi.has_header = headers;
+
+			pthread_mutex_lock(&file_info_lock);
+			if (file_info.size() >= MAX_FILE_INFO) file_info.clear();
+			file_info[filename] = fi;
+			pthread_mutex_unlock(&file_info_lock);
+		}
+
+		const vector<string> & filenames;
+		bool headers;
+		vector<FileInfo> & info;
+	};
+
+	vector<FileInfo> get_file_info(const vector<string> & filenames, bool headers, int nthreads)
+	{
+		vector<FileInfo> info(filenames.size());
+		// the extension table is filled on first use, which must not happen on several workers at once
+		EMUtil::get_image_ext_type("");
+		FileInfoTask task(filenames, headers, info);
+		// mostly waiting on the disk, so more threads than CPUs still pay off
+		Parallel::run(task, filenames.size(), 4, nthreads > 0 ? nthreads : 2*Parallel::get_threads());
+		return info;
+	}
+}
+
+vector<EMUtil::ImageType> EMUtil::get_image_types(const vector<string> & filenames, int nthreads)
+{
+	vector<FileInfo> info = get_file_info(filenames, false, nthreads);
+	vector<ImageType> ret(info.size());
+	for (size_t i = 0; i < info.size(); i++) ret[i] = info[i].type;
+	return ret;
+}
+
+vector<int> EMUtil::get_image_counts(const vector<string> & filenames, int nthreads)
+{
+	vector<FileInfo> info = get_file_info(filenames, true, nthreads);
+	vector<int> ret(info.size());
+	for (size_t i = 0; i < info.size(); i++) ret[i] = info[i].nimg;
+	return ret;
+}
+
+vector<Dict> EMUtil::get_headers(const vector<string> & filenames, int nthreads)
+{
+	vector<FileInfo> info = get_file_info(filenames, true, nthreads);
+	vector<Dict> ret(info.size());
+	for (size_t i = 0; i < info.size(); i++) ret[i] = info[i].header;
+	return ret;
+}
+
 ImageIO *EMUtil::get_imageio(const string & filename, int rw,
 							 ImageType image_type)
 {
@@ -561,6 +698,7 @@ ImageIO *EMUtil::get_imageio(const string & filename, int rw,
 
 	ImageIO *imageio = 0;
    int persist = 0;
+	bool shareable = false;	// read path safe for concurrent readers once opened
 
    #ifdef IMAGEIO_CACHE
    imageio = GlobalCache::instance()->get_imageio(filename, rw);
@@ -589,12 +727,15 @@ ImageIO *EMUtil::get_imageio(const string & filename, int rw,
 #endif
 	case IMAGE_MRC:
 		imageio = new MrcIO(filename, rw_mode);
+		shareable = true;
 		break;
 	case IMAGE_IMAGIC:
 		imageio = new ImagicIO2(filename, rw_mode);
+		shareable = true;
 		if (rw_mode==ImageIO::READ_ONLY && ((ImagicIO2 *)imageio)->init_test()==-1 ) {
 			delete imageio;
 			imageio = new ImagicIO(filename, rw_mode);
+			shareable = false;
 		}
 		break;
 	case IMAGE_DM3:
@@ -615,17 +756,21 @@ ImageIO *EMUtil::get_imageio(const string & filename, int rw,
             persist = 3;
         }
 		imageio = new HdfIO2(filename, rw_mode);
+		shareable = true;
 		if (((HdfIO2 *)imageio)->init_test()==-1) {
 			delete imageio;
 			imageio = new HdfIO(filename, rw_mode);
+			shareable = false;
 		}
 		break;
 #endif	//USE_HDF5
 	case IMAGE_LST:
 		imageio = new LstIO(filename, rw_mode);
+		shareable = true;
 		break;
 	case IMAGE_LSTFAST:
 		imageio = new LstFastIO(filename, rw_mode);
+		shareable = true;
 		break;
 	case IMAGE_PIF:
 		imageio = new PifIO(filename, rw_mode);
@@ -635,6 +780,7 @@ ImageIO *EMUtil::get_imageio(const string & filename, int rw,
 		break;
 	case IMAGE_SPIDER:
 		imageio = new SpiderIO(filename, rw_mode);
+		shareable = true;
 		break;
 	case IMAGE_SINGLE_SPIDER:
 		imageio = new SingleSpiderIO(filename, rw_mode);
@@ -685,13 +831,36 @@ ImageIO *EMUtil::get_imageio(const string & filename, int rw,
 	case IMAGE_SER:
 		imageio = new SerIO(filename, rw_mode);
 		break;
+#ifdef USE_TIFF
+	case IMAGE_EER:
+		imageio = new EerIO(filename, rw_mode);
+		break;
+#endif
 	default:
 		break;
 	}
 
+	// Parse the header before anyone else can see this ImageIO. Their init() sets
+	// 'initialized' before it finishes, so a second thread calling it lazily could
+	// otherwise read a half-opened file.
+	if (imageio && shareable && rw_mode == ImageIO::READ_ONLY) {
+		try {
+			imageio->open();
+		}
+		catch (...) {
+			delete imageio;
+			throw;
+		}
+	}
+
    #ifdef IMAGEIO_CACHE
 	if (persist > 0) {
-		GlobalCache::instance()->add_imageio(filename, rw, persist, imageio);
+		// Another thread may have cached the same file meanwhile; use that one
+		ImageIO *cached = GlobalCache::instance()->add_imageio(filename, rw, persist, imageio);
+		if (cached != imageio) {
+			delete imageio;
+			imageio = cached;
+		}
 	}
    #endif
 
@@ -700,13 +869,11 @@ ImageIO *EMUtil::get_imageio(const string & filename, int rw,
 	return imageio;
 }
 
-void EMUtil::close_imageio(const string & filename, const ImageIO * io)
+void EMUtil::close_imageio(const string & filename, const ImageIO * io, bool release)
 {
     //printf("EMUtil::close_imageio\n");
     #ifdef IMAGEIO_CACHE
-    if (GlobalCache::instance()->contains(filename)) {
-        GlobalCache::instance()->close_imageio(filename);
-    } else {
+    if (!GlobalCache::instance()->close_imageio(filename, io, release)) {
         delete io;
     }
     #else
@@ -801,6 +968,9 @@ const char *EMUtil::get_imagetype_name(ImageType t)
 	case IMAGE_SER:
 		return "SER";
 		break;
+	case IMAGE_EER:
+		return "EER";
+		break;
 	case IMAGE_UNKNOWN:
 		return "unknown";
 	}
@@ -911,11 +1081,38 @@ double EMUtil::mode_size_product(size_t factor, size_t mode_size)
 	return product;
 }
 
+namespace {
+	// Skip n bytes in process_region_io(): a positional read (pos >= 0) only
+	// advances its own cursor, otherwise the FILE position is moved.
+	inline void region_skip(FILE * file, off_t & pos, size_t n)
+	{
+		if (pos >= 0) {
+			pos += n;
+		}
+		else {
+			portable_fseek(file, n, SEEK_CUR);
+		}
+	}
+
+	inline bool region_read(FILE * file, off_t & pos, unsigned char * dst, size_t n)
+	{
+		if (pos >= 0) {
+			size_t got = portable_pread(file, dst, n, pos);
+			pos += n;
+
+			return got == n;
+		}
+
+		return fread(dst, n, 1, file) == 1;
+	}
+}
+
 void EMUtil::process_region_io(void *vdata, FILE * file,
 							   int rw_mode, int image_index,
 							   size_t mode_size, int nx, int ny, int nz,
 							   const Region * area, bool need_flip,
-							   ImageType imgtype, int pre_row, int post_row)
+							   ImageType imgtype, int pre_row, int post_row,
+							   off_t offset)
 {
 	Assert(vdata != 0);
 	Assert(file != 0);
@@ -923,6 +1120,10 @@ void EMUtil::process_region_io(void *vdata, FILE * file,
 		   rw_mode == ImageIO::READ_WRITE ||
 		   rw_mode == ImageIO::WRITE_ONLY);
 
+	if (offset >= 0 && rw_mode != ImageIO::READ_ONLY) {
+		throw InvalidParameterException("positional region I/O is only supported for reading");
+	}
+
 	if (mode_size == 0) throw UnexpectedBehaviorException("The mode size was 0?");
 
 	const size_t mode_size_half = 11111111;
@@ -1088,7 +1289,9 @@ void EMUtil::process_region_io(void *vdata, FILE * file,
 
 	if (extra > 0) x_post_gap += extra;
 
-	portable_fseek(file, img_row_size * ny * fz0, SEEK_CUR);
+	off_t pos = offset;
+
+	region_skip(file, pos, img_row_size * ny * fz0);
 
 	float nxlendata[1];
 	int floatsize = (int) sizeof(float);
@@ -1104,28 +1307,47 @@ void EMUtil::process_region_io(void *vdata, FILE * file,
 		printf ("-----------------------------------------------\n");
 	}
 
+	// Whole rows landing in consecutive rows of cdata: each slice of the region is
+	// one contiguous block of the file, so read it in one go.
+	bool whole_rows = (rw_mode == ImageIO::READ_ONLY && !need_flip &&
+					   pre_row == 0 && post_row == 0 && x_pre_gap == 0 &&
+					   x_post_gap == 0 && area_row_size == memory_row_size);
+
 	for (int k = dz0; k < (dz0+zlen); k++) {
 		// k is image/slice number, starting from 0
 
 		if (y_pre_gap > 0) {
-			portable_fseek(file, y_pre_gap, SEEK_CUR);
+			region_skip(file, pos, y_pre_gap);
 		}
 
 		//long k2 = k * area_sec_size;
 		long k2 = k*memory_sec_size;
 
+		if (whole_rows) {
+			if (!region_read(file, pos, &cdata[k2 + dy0 * memory_row_size],
+							 area_row_size * ylen)) {
+				throw ImageReadException("Unknownfilename", "incomplete data read");
+			}
+
+			if (y_post_gap > 0) {
+				region_skip(file, pos, y_post_gap);
+			}
+
+			continue;
+		}
+
 		for (int j = dy0; j < (dy0+ylen); j++) {
 			if (pre_row > 0) {
 				if (imgtype == IMAGE_ICOS && rw_mode != ImageIO::READ_ONLY && !area) {
 					fwrite(nxlendata, floatsize, 1, file);
 				}
 				else {
-					portable_fseek(file, pre_row, SEEK_CUR);
+					region_skip(file, pos, pre_row);
 				}
 			}
 
 			if (x_pre_gap > 0) {
-				portable_fseek(file, x_pre_gap, SEEK_CUR);
+				region_skip(file, pos, x_pre_gap);
 			}
 
 			int jj = j;
@@ -1142,9 +1364,9 @@ void EMUtil::process_region_io(void *vdata, FILE * file,
 			}
 
 			if (rw_mode == ImageIO::READ_ONLY) {
-				if (fread(&cdata[k2 + jj * memory_row_size +
-						  (size_t) mode_size_product(dx0, mode_size)],
-						  area_row_size, 1, file) != 1) {
+				if (!region_read(file, pos, &cdata[k2 + jj * memory_row_size +
+								 (size_t) mode_size_product(dx0, mode_size)],
+								 area_row_size)) {
 
 //					cout << jj << " " << k2 << " " << memory_row_size
 //						  << " " << dx0 << " "
@@ -1153,7 +1375,7 @@ void EMUtil::process_region_io(void *vdata, FILE * file,
 
 					cout << "Reached premature end-of-file reading "
 						  << "region from image/slice number " << k
-						  << " of file with " << ftell(file)
+						  << " of file with " << (pos >= 0 ? pos : portable_ftell(file))
 						  << " bytes." << endl;
 
 					throw ImageReadException("Unknownfilename",
@@ -1169,7 +1391,7 @@ void EMUtil::process_region_io(void *vdata, FILE * file,
 			}
 
 			if (x_post_gap > 0) {
-				portable_fseek(file, x_post_gap, SEEK_CUR);
+				region_skip(file, pos, x_post_gap);
 			}
 
 			if (post_row > 0) {
@@ -1177,13 +1399,13 @@ void EMUtil::process_region_io(void *vdata, FILE * file,
 					fwrite(nxlendata, floatsize, 1, file);
 				}
 				else {
-					portable_fseek(file, post_row, SEEK_CUR);
+					region_skip(file, pos, post_row);
 				}
 			}
 		}
 
 		if (y_post_gap > 0) {
-			portable_fseek(file, y_post_gap, SEEK_CUR);
+			region_skip(file, pos, y_post_gap);
 		}
 	}
 }
@@ -1908,6 +2130,19 @@ EMObject EMUtil::read_hdf_attribute(const string & filename, const string & key,
 	HdfIO2* imageio = new HdfIO2(filename, ImageIO::READ_ONLY);
 	imageio->init();
 
+	if (imageio->is_stack_layout()) {
+		EMObject emobj;
+		try {
+			emobj = imageio->read_stack_attr(key, image_index);
+		}
+		catch (...) {
+			delete imageio;
+			throw;
+		}
+		delete imageio;
+		return emobj;
+	}
+
 	// Each image is in a group for later expansion. Open the group
 
 	hid_t file = imageio->get_fileid();
@@ -1944,6 +2179,19 @@ int EMUtil::write_hdf_attribute(const string & filename, const string & key, EMO
 	HdfIO2* imageio = new HdfIO2(filename, ImageIO::WRITE_ONLY);
 	imageio->init();
 
+	if (imageio->is_stack_layout()) {
+		int ret;
+		try {
+			ret = imageio->write_stack_attr(key, value, image_index);
+		}
+		catch (...) {
+			delete imageio;
+			throw;
+		}
+		delete imageio;
+		return ret;
+	}
+
 	// Each image is in a group for later expansion. Open the group
 
 	hid_t file = imageio->get_fileid();
@@ -1978,6 +2226,12 @@ int EMUtil::delete_hdf_attribute(const string & filename, const string & key, in
 	HdfIO2* imageio = new HdfIO2(filename, ImageIO::READ_WRITE);
 	imageio->init();
 
+	if (imageio->is_stack_layout()) {
+		int ret = imageio->delete_stack_attr(key, image_index);
+		delete imageio;
+		return ret;
+	}
+
 	// Each image is in a group for later expansion. Open the group
 
 	hid_t file = imageio->get_fileid();
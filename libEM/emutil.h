@@ -37,6 +37,7 @@
 #define eman__emutil__h__ 1
 
 #include <string.h>
+#include <sys/types.h>
 #include "emobject.h"
 #include "emassert.h"
 
@@ -137,7 +138,8 @@ namespace EMAN
 			IMAGE_DF3,
 			IMAGE_OMAP,
 			IMAGE_SITUS,
-			IMAGE_SER
+			IMAGE_SER,
+			IMAGE_EER
 		};
 
 		static EMData *vertical_acf(const EMData * image, int maxdy);
@@ -170,6 +172,28 @@ namespace EMAN
 		 */
 		static int get_image_count(const string & filename);
 
+		/** Get the format type of many files at once. The files are examined in
+		 * parallel, and the results are cached by path, size and modification time,
+		 * so asking again about unchanged files costs only a stat() each.
+		 * @param filenames Image file names.
+		 * @param nthreads Number of threads, 0 for Parallel::get_threads().
+		 * @return One image format type per file, IMAGE_UNKNOWN for unreadable files.
+		 */
+		static vector<ImageType> get_image_types(const vector<string> & filenames, int nthreads = 0);
+
+		/** Get the number of images in many files at once, in parallel and cached
+		 * as for get_image_types().
+		 * @return One count per file, 0 for unreadable files.
+		 */
+		static vector<int> get_image_counts(const vector<string> & filenames, int nthreads = 0);
+
+		/** Read the header of the first image of many files at once, in parallel and
+		 * cached as for get_image_types(). Files are closed again as soon as they are
+		 * read, so long lists don't hold files open.
+		 * @return One header per file, empty for unreadable files.
+		 */
+		static vector<Dict> get_headers(const vector<string> & filenames, int nthreads = 0);
+
 		/** Get an ImageIO object. It may be a newly created
 		 * object. Or an object stored in the cache.
 		 * @param filename Image file name.
@@ -180,8 +204,11 @@ namespace EMAN
 		static ImageIO *get_imageio(const string & filename, int rw_mode,
 									ImageType image_type = IMAGE_UNKNOWN);
 
-      /** Ian: Close ImageIO object*/
-      static void close_imageio(const string & filename, const ImageIO * io);
+      /** Ian: Close ImageIO object
+       * @param release close the file now instead of leaving it cached, so
+       *        everything written is on disk when this returns
+       */
+      static void close_imageio(const string & filename, const ImageIO * io, bool release = false);
 
 		/** Give each image type a meaningful name.
 		 * @param type Image format type.
@@ -240,6 +267,10 @@ namespace EMAN
 		 * @param imgtype The Image type of the processed file.
 		 * @param pre_row File size needed to be skipped before each row.
 		 * @param post_row File size needed to be skipped after each row.
+		 * @param offset If >= 0, the absolute file offset of the data. The read is then
+		 *        done with positional I/O (portable_pread) and does not use or move the
+		 *        FILE position, so a READ_ONLY file may be shared between threads. If < 0,
+		 *        the data start at the current file position.
 		 * @exception ImageReadException If the read has some error.
 		 * @exception ImageWriteException If the write has some error.
 		 */
@@ -247,7 +278,7 @@ namespace EMAN
 									  int image_index, size_t mode_size, int nx,
 									  int ny, int nz = 1, const Region * area = 0,
 									  bool need_flip = false, ImageType imgtype=IMAGE_UNKNOWN,
-									  int pre_row = 0, int post_row = 0);
+									  int pre_row = 0, int post_row = 0, off_t offset = -1);
 
 
 		/**
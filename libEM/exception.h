@@ -114,6 +114,7 @@ namespace EMAN {
 		int linenum;
 		string desc;
 		string objname;
+		mutable string message;	// what() returns a pointer into this
     };
 
 
@@ -0,0 +1,484 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA 
+ */
+
+#include "fsc.h"
+#include "emdata.h"
+#include "ctf.h"
+#include "util.h"
+#include "parallel.h"
+#include <map>
+
+using namespace EMAN;
+
+#ifdef _WIN32
+MUTEX fsc_mutex;
+#else
+pthread_mutex_t fsc_mutex=PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+namespace {
+	struct FSCKey {
+		int nx, ny, nz;
+		float width;
+		bool operator<(const FSCKey &k) const {
+			if (nx!=k.nx) return nx<k.nx;
+			if (ny!=k.ny) return ny<k.ny;
+			if (nz!=k.nz) return nz<k.nz;
+			return width<k.width;
+		}
+	};
+
+	map<FSCKey,FourierShellCorrelator *> fsc_cache;
+}
+
+FourierShellCorrelator::FourierShellCorrelator(int nx_in, int ny_in, int nz_in, float width_in) :
+	nx(nx_in), ny(ny_in), nz(nz_in), width(width_in)
+{
+	if (ny<=1 && nz<=1) throw ImageFormatException("Cannot calculate FSC for 1D images");
+	if (width<=0) throw InvalidValueException(width,"FSC shell width must be positive");
+
+	int lsd2 = (nx + 2 - nx%2);
+	int nx2 = nx/2;
+	int ny2 = ny/2;
+	int nz2 = nz/2;
+
+	// This must match EMData::calc_fourier_shell_correlation exactly, including the float arithmetic
+	float dx2 = 1.0f/float(nx2)/float(nx2);
+	float dy2 = 1.0f/float(ny2)/float(ny2);
+	float dz2 = 1.0f/std::max(float(nz2),1.0f)/std::max(float(nz2),1.0f);
+	inc = Util::round(float(std::max(std::max(nx2,ny2),nz2))/width);
+
+	counts.resize(inc+1,0.0f);
+
+	for (int iz = 0; iz < nz; iz++) {
+		int kz = iz>nz2 ? iz-nz : iz;
+		float argz = float(kz*kz)*dz2;
+		for (int iy = 0; iy < ny; iy++) {
+			int ky = iy>ny2 ? iy-ny : iy;
+			float argy = argz + float(ky*ky)*dy2;
+			size_t rowoff = (size_t)(iy + iz*ny)*lsd2;
+			int cur = -1;			// shell of the run being built, -1 if none
+			for (int ix = 0; ix < lsd2; ix+=2) {
+				int r = -1;
+				// Skip Friedel related values
+				if (ix>0 || (kz>=0 && (ky>=0 || kz!=0))) {
+					float argx = 0.5f*std::sqrt(argy + float(ix*ix)*0.25f*dx2);
+					r = Util::round(inc*2*argx);
+					if (r > inc) r = -1;
+				}
+				if (r>=0) counts[r]+=2.0f;
+
+				if (r==cur && r>=0) {
+					run_length.back()+=2;
+					continue;
+				}
+				if (r>=0) {
+					run_offset.push_back(rowoff+ix);
+					run_length.push_back(2);
+					run_shell.push_back(r);
+				}
+				cur = r;
+			}
+		}
+	}
+}
+
+FourierShellCorrelator *FourierShellCorrelator::get(int nx, int ny, int nz, float width)
+{
+	FSCKey key;
+	key.nx = nx; key.ny = ny; key.nz = nz; key.width = width;
+
+	Util::MUTEX_LOCK(&fsc_mutex);
+	map<FSCKey,FourierShellCorrelator *>::iterator it = fsc_cache.find(key);
+	if (it != fsc_cache.end()) {
+		FourierShellCorrelator *ret = it->second;
+		Util::MUTEX_UNLOCK(&fsc_mutex);
+		return ret;
+	}
+	Util::MUTEX_UNLOCK(&fsc_mutex);
+
+	// Built outside the lock, since this is the slow part. If two threads race, one copy is discarded
+	FourierShellCorrelator *ret = new FourierShellCorrelator(nx,ny,nz,width);
+
+	Util::MUTEX_LOCK(&fsc_mutex);
+	it = fsc_cache.find(key);
+	if (it != fsc_cache.end()) {
+		delete ret;
+		ret = it->second;
+	}
+	else fsc_cache[key] = ret;
+	Util::MUTEX_UNLOCK(&fsc_mutex);
+
+	return ret;
+}
+
+FourierShellCorrelator *FourierShellCorrelator::get(const EMData *image, float width)
+{
+	if (!image) throw NullPointerException("NULL input image");
+
+	int nx = image->get_xsize();
+	if (image->is_complex()) nx = nx - 2 + (image->is_fftodd() ? 1 : 0);
+	return get(nx,image->get_ysize(),image->get_zsize(),width);
+}
+
+EMData *FourierShellCorrelator::prepare(EMData *image, bool &owned) const
+{
+	if (!image) throw NullPointerException("NULL input image");
+
+	owned = false;
+	if (!image->is_complex()) {
+		if (image->get_xsize()!=nx || image->get_ysize()!=ny || image->get_zsize()!=nz)
+			throw ImageFormatException("FSC: image size does not match correlator geometry");
+		image = image->do_fft();
+		owned = true;
+	}
+	else if (image->get_xsize()!=nx+2-nx%2 || image->get_ysize()!=ny || image->get_zsize()!=nz)
+		throw ImageFormatException("FSC: image size does not match correlator geometry");
+
+	return image;
+}
+
+void FourierShellCorrelator::shell_power(const float *data, double *pw) const
+{
+	for (int i = 0; i <= inc; i++) pw[i] = 0.0;
+
+	size_t nruns = run_offset.size();
+	for (size_t k = 0; k < nruns; k++) {
+		const float *a = data + run_offset[k];
+		int len = run_length[k];
+		float s = 0.0f;
+		for (int j = 0; j < len; j++) s += a[j]*a[j];
+		pw[run_shell[k]] += s;
+	}
+}
+
+void FourierShellCorrelator::shell_cross(const float *d1, const float *d2, double *cross, double *pw2) const
+{
+	for (int i = 0; i <= inc; i++) cross[i] = 0.0;
+
+	size_t nruns = run_offset.size();
+	if (!pw2) {
+		for (size_t k = 0; k < nruns; k++) {
+			const float *a = d1 + run_offset[k];
+			const float *b = d2 + run_offset[k];
+			int len = run_length[k];
+			float s = 0.0f;
+			for (int j = 0; j < len; j++) s += a[j]*b[j];
+			cross[run_shell[k]] += s;
+		}
+		return;
+	}
+
+	for (int i = 0; i <= inc; i++) pw2[i] = 0.0;
+	for (size_t k = 0; k < nruns; k++) {
+		const float *a = d1 + run_offset[k];
+		const float *b = d2 + run_offset[k];
+		int len = run_length[k];
+		float s = 0.0f, p = 0.0f;
+		for (int j = 0; j < len; j++) {
+			s += a[j]*b[j];
+			p += b[j]*b[j];
+		}
+		cross[run_shell[k]] += s;
+		pw2[run_shell[k]] += p;
+	}
+}
+
+vector<float> FourierShellCorrelator::make_curve(const double *cross, const double *pw1, const double *pw2) const
+{
+	int linc = 0;
+	for (int i = 0; i <= inc; i++) if (counts[i]>0) linc++;
+
+	vector<float> result(linc*3,0.0f);
+
+	int ii = 0;
+	for (int i = 0; i <= inc; i++) {
+		if (counts[i]<=0) continue;
+		if (pw1[i]>0.0 && pw2[i]>0.0) {
+			result[ii]        = float(i)/float(2*inc);
+			result[ii+linc]   = float(cross[i] / (std::sqrt(pw1[i] * pw2[i])));
+			result[ii+2*linc] = counts[i];
+		}
+		ii++;
+	}
+
+	return result;
+}
+
+vector<float> FourierShellCorrelator::calc_fsc(EMData *image, EMData *with) const
+{
+	ENTERFUNC;
+
+	bool own1, own2;
+	EMData *f = prepare(image,own1);
+	EMData *g = prepare(with,own2);
+
+	vector<double> cross(inc+1), pw1(inc+1), pw2(inc+1);
+	shell_power(f->get_const_data(),&pw1[0]);
+	shell_cross(f->get_const_data(),g->get_const_data(),&cross[0],&pw2[0]);
+
+	if (own1) delete f;
+	if (own2) delete g;
+
+	EXITFUNC;
+	return make_curve(&cross[0],&pw1[0],&pw2[0]);
+}
+
+// Scores a block of references per call, so each thread works on its own group
+class FourierShellCorrelator::BatchTask : public ParallelTask {
+  public:
+	BatchTask(const FourierShellCorrelator *c, const float *d, const double *p, const vector<EMData *> &r,
+			  vector< vector<float> > &out) :
+		fscr(c), d1(d), pw1(p), refs(r), ret(out) {}
+
+	void run(size_t begin, size_t end, int) {
+		fscr->fsc_group(d1,pw1,refs,begin,end,ret);
+	}
+
+  private:
+	const FourierShellCorrelator *fscr;
+	const float *d1;
+	const double *pw1;
+	const vector<EMData *> &refs;
+	vector< vector<float> > &ret;
+};
+
+void FourierShellCorrelator::fsc_group(const float *d1, const double *pw1, const vector<EMData *> &refs,
+									   size_t begin, size_t end, vector< vector<float> > &ret) const
+{
+	size_t nref = end - begin;
+	vector<bool> ownref(nref,false);
+	vector<EMData *> gs(nref,(EMData *)0);
+	vector<const float *> d2(nref);
+	try {
+		for (size_t r = 0; r < nref; r++) {
+			bool o;
+			gs[r] = prepare(refs[begin+r],o);
+			ownref[r] = o;
+			d2[r] = gs[r]->get_const_data();
+		}
+	}
+	catch (...) {
+		for (size_t r = 0; r < nref; r++) if (ownref[r]) delete gs[r];
+		throw;
+	}
+
+	int nsh = inc+1;
+	vector<double> cross(nref*nsh,0.0), pw2(nref*nsh,0.0);
+
+	// runs are the outer loop, so each run of 'image' is read once and stays in cache for every reference
+	size_t nruns = run_offset.size();
+	for (size_t k = 0; k < nruns; k++) {
+		size_t off = run_offset[k];
+		int len = run_length[k];
+		int sh = run_shell[k];
+		const float *a = d1 + off;
+		for (size_t r = 0; r < nref; r++) {
+			const float *b = d2[r] + off;
+			float s = 0.0f, p = 0.0f;
+			for (int j = 0; j < len; j++) {
+				s += a[j]*b[j];
+				p += b[j]*b[j];
+			}
+			cross[r*nsh+sh] += s;
+			pw2[r*nsh+sh] += p;
+		}
+	}
+
+	for (size_t r = 0; r < nref; r++) {
+		ret[begin+r] = make_curve(&cross[r*nsh],pw1,&pw2[r*nsh]);
+		if (ownref[r]) delete gs[r];
+	}
+}
+
+vector< vector<float> > FourierShellCorrelator::calc_fsc_batch(EMData *image, const vector<EMData *> &refs) const
+{
+	ENTERFUNC;
+
+	size_t nref = refs.size();
+	vector< vector<float> > ret(nref);
+	if (nref==0) return ret;
+
+	bool own;
+	EMData *f = prepare(image,own);
+
+	vector<double> pw1(inc+1);
+	shell_power(f->get_const_data(),&pw1[0]);
+
+	// small groups keep the references of one pass in cache while still balancing the threads
+	BatchTask task(this,f->get_const_data(),&pw1[0],refs,ret);
+	try {
+		Parallel::run(task,nref,8);
+	}
+	catch (...) {
+		if (own) delete f;
+		throw;
+	}
+	if (own) delete f;
+
+	EXITFUNC;
+	return ret;
+}
+
+vector<double> FourierShellCorrelator::frc_weights(EMData *image_fft, EMData *with, const Dict &params) const
+{
+	int snrweight = params.has_key("snrweight") ? (int)params["snrweight"] : 0;
+	int ampweight = params.has_key("ampweight") ? (int)params["ampweight"] : 0;
+	int sweight = params.has_key("sweight") ? (int)params["sweight"] : 1;
+	float minres = params.has_key("minres") ? (float)params["minres"] : 200.0f;
+	float maxres = params.has_key("maxres") ? (float)params["maxres"] : 8.0f;
+
+	int nr = ny/2;
+	vector<double> weight(nr,1.0);
+
+	if (sweight) {
+		for (int i = 0; i < nr && i <= inc; i++) weight[i] *= counts[i];
+	}
+
+	if (ampweight) {
+		vector<float> amp = image_fft->calc_radial_dist(nr,0,1,0);
+		for (int i = 0; i < nr; i++) weight[i] *= amp[i];
+	}
+
+	if (snrweight) {
+		Ctf *ctf = NULL;
+		if (!image_fft->has_attr("ctf")) {
+			if (!with || !with->has_attr("ctf")) throw InvalidCallException("SNR weight with no CTF parameters");
+			ctf=with->get_attr("ctf");
+		}
+		else ctf=image_fft->get_attr("ctf");
+
+		float ds=1.0f/(ctf->apix*ny);
+		vector<float> snr=ctf->compute_1d(ny,ds,Ctf::CTF_SNR);
+		delete ctf;
+		for (int i = 0; i < nr; i++) {
+			float s = i<(int)snr.size() ? snr[i] : 0.0f;
+			if (s<=0) s=0.001f;		// make sure that points don't get completely excluded due to SNR estimation issues, or worse, contribute with a negative weight
+			weight[i] *= s;
+		}
+	}
+
+	// Min/max modifications to weighting
+	float pmin,pmax;
+	if (minres>0) pmin=((float)image_fft->get_attr("apix_x")*ny)/minres;		//cutoff in pixels, assume square
+	else pmin=0;
+	if (maxres>0) pmax=((float)image_fft->get_attr("apix_x")*ny)/maxres;
+	else pmax=0;
+
+	for (int i = 0; i < nr; i++) {
+		if (pmin>0) weight[i]*=(tanh(5.0*(i-pmin)/pmin)+1.0)/2.0;
+		if (pmax>0) weight[i]*=(1.0-tanh(i-pmax))/2.0;
+	}
+
+	return weight;
+}
+
+float FourierShellCorrelator::frc_score(const vector<float> &fsc, const vector<double> &weights, EMData *with, int nweight) const
+{
+	int k = (int)fsc.size()/3;
+	double sum=0.0, norm=0.0;
+	for (int i = 0; i < (int)weights.size() && i < k; i++) {
+		sum+=weights[i]*fsc[k+i];
+		norm+=weights[i];
+	}
+
+	// This performs a weighting that tries to normalize FRC by correcting from the number of particles represented by the average
+	sum/=norm;
+	if (nweight && with->get_attr_default("ptcl_repr",0) && sum>=0 && sum<1.0) {
+		sum=sum/(1.0-sum);							// convert to SNR
+		sum/=(float)with->get_attr_default("ptcl_repr",0);	// divide by ptcl represented
+		sum=sum/(1.0+sum);							// convert back to correlation
+	}
+
+	if (!Util::goodf(&sum)) sum=-2.0;	// normally should be >-1.0
+
+	// Negative, since smaller comparator values indicate higher similarity in EMAN2
+	return (float)-sum;
+}
+
+float FourierShellCorrelator::frc_cmp(EMData *image, EMData *with, const Dict &params) const
+{
+	ENTERFUNC;
+
+	int nweight = params.has_key("nweight") ? (int)params["nweight"] : 0;
+
+	bool own1, own2;
+	EMData *f = prepare(image,own1);
+	EMData *g = prepare(with,own2);
+
+	float ret;
+	try {
+		vector<float> fsc = calc_fsc(f,g);
+		vector<double> weights = frc_weights(f,g,params);
+		ret = frc_score(fsc,weights,g,nweight);
+	}
+	catch (...) {
+		if (own1) delete f;
+		if (own2) delete g;
+		throw;
+	}
+
+	if (own1) delete f;
+	if (own2) delete g;
+
+	EXITFUNC;
+	return ret;
+}
+
+vector<float> FourierShellCorrelator::frc_cmp_batch(EMData *image, const vector<EMData *> &refs, const Dict &params) const
+{
+	ENTERFUNC;
+
+	int snrweight = params.has_key("snrweight") ? (int)params["snrweight"] : 0;
+	int nweight = params.has_key("nweight") ? (int)params["nweight"] : 0;
+
+	bool own;
+	EMData *f = prepare(image,own);
+
+	vector<float> ret(refs.size());
+	try {
+		vector< vector<float> > fscs = calc_fsc_batch(f,refs);
+
+		// If the SNR weight has to come from the references, the weights differ for each one
+		bool perref = snrweight && !f->has_attr("ctf");
+		vector<double> weights;
+		if (!perref) weights = frc_weights(f,0,params);
+
+		for (size_t r = 0; r < refs.size(); r++) {
+			if (perref) weights = frc_weights(f,refs[r],params);
+			ret[r] = frc_score(fscs[r],weights,refs[r],nweight);
+		}
+	}
+	catch (...) {
+		if (own) delete f;
+		throw;
+	}
+	if (own) delete f;
+
+	EXITFUNC;
+	return ret;
+}
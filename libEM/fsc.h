@@ -0,0 +1,157 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA 
+ */
+
+#ifndef eman_fsc_h__
+#define eman_fsc_h__ 1
+
+#include "emobject.h"
+
+namespace EMAN
+{
+	class EMData;
+
+	/** FourierShellCorrelator computes Fourier ring/shell correlations for a fixed
+	 * image geometry. EMData::calc_fourier_shell_correlation recomputes the radius
+	 * and shell of every Fourier pixel on each call. Here the shell assignment is
+	 * computed once per (nx,ny,nz,width) and stored as a list of contiguous 'runs' of
+	 * pixels sharing a shell, so the per-shell sums become short dense dot products
+	 * which the compiler can vectorize.
+	 *
+	 * Shell assignment, Friedel-pair handling and the output layout are identical to
+	 * EMData::calc_fourier_shell_correlation. Instances are immutable once built, so a
+	 * single correlator may be shared between threads.
+	 *
+	 * Typical usage:
+	 @code
+	 *	FourierShellCorrelator *fscr = FourierShellCorrelator::get(nx,ny,nz);
+	 *	vector<float> fsc = fscr->calc_fsc(image,with);
+	 *	vector< vector<float> > all = fscr->calc_fsc_batch(image,projections);
+	 @endcode
+	 */
+	class FourierShellCorrelator
+	{
+	  public:
+		/** @param nx real-space x size of the images to be compared
+		 * @param ny real-space y size
+		 * @param nz real-space z size
+		 * @param width ring/shell width in Fourier pixels
+		 */
+		FourierShellCorrelator(int nx, int ny, int nz=1, float width=1.0f);
+
+		/** Returns a correlator for the given geometry from a process-wide cache,
+		 * creating it on first use. The returned object is owned by the cache and
+		 * must not be deleted.
+		 */
+		static FourierShellCorrelator *get(int nx, int ny, int nz=1, float width=1.0f);
+
+		/** Find the cached correlator matching an image (real or complex) */
+		static FourierShellCorrelator *get(const EMData *image, float width=1.0f);
+
+		/** Calculate the FSC between two images. Either image may be real or complex.
+		 * @return 3*k values: normalized frequency, FSC and the number of Fourier
+		 * values in each shell, the same as EMData::calc_fourier_shell_correlation
+		 * @exception ImageFormatException if the image geometry does not match
+		 */
+		vector<float> calc_fsc(EMData *image, EMData *with) const;
+
+		/** Calculate the FSC between one image and each of a set of references.
+		 * 'image' is transformed and its shell power is computed only once. References
+		 * are split into small groups scored in parallel (see Parallel), each group in
+		 * a single pass over the Fourier data of 'image'.
+		 * @return one FSC curve per reference, in the calc_fsc() format
+		 */
+		vector< vector<float> > calc_fsc_batch(EMData *image, const vector<EMData *> &refs) const;
+
+		/** The FRCCmp score between two images.
+		 * @param params any FRCCmp parameters (snrweight, ampweight, sweight, nweight, minres, maxres)
+		 * @return -(weighted mean FRC), smaller is better
+		 */
+		float frc_cmp(EMData *image, EMData *with, const Dict &params) const;
+
+		/** FRCCmp scores of one image against many references, using calc_fsc_batch.
+		 * Weights depending only on 'image' are computed once.
+		 */
+		vector<float> frc_cmp_batch(EMData *image, const vector<EMData *> &refs, const Dict &params) const;
+
+		/** Sum of |F|^2 over each shell of a complex image with this geometry.
+		 * @param data complex image data
+		 * @param pw output array of get_nshells() values, overwritten
+		 */
+		void shell_power(const float *data, double *pw) const;
+
+		/** Sum of Re(F1 conj(F2)) over each shell, plus the shell power of d2.
+		 * @param d1 first complex image data
+		 * @param d2 second complex image data
+		 * @param cross output, get_nshells() values, overwritten
+		 * @param pw2 output shell power of d2, overwritten. May be NULL.
+		 */
+		void shell_cross(const float *d1, const float *d2, double *cross, double *pw2) const;
+
+		/** @return the number of shells, including the origin */
+		int get_nshells() const { return inc + 1; }
+
+		/** @return the number of Fourier values (2 per pixel) in each shell */
+		const vector<float> &get_shell_counts() const { return counts; }
+
+		int get_xsize() const { return nx; }
+		int get_ysize() const { return ny; }
+		int get_zsize() const { return nz; }
+
+	  private:
+		class BatchTask;
+
+		/** FSC curves of references [begin,end) against the complex data d1 with shell power pw1 */
+		void fsc_group(const float *d1, const double *pw1, const vector<EMData *> &refs,
+					   size_t begin, size_t end, vector< vector<float> > &ret) const;
+
+		/** Convert raw per-shell sums to the calc_fourier_shell_correlation layout */
+		vector<float> make_curve(const double *cross, const double *pw1, const double *pw2) const;
+
+		/** Return a complex version of 'image' and check its geometry. Sets 'owned' if
+		 * the caller must delete the result */
+		EMData *prepare(EMData *image, bool &owned) const;
+
+		/** Per-ring weights from the FRCCmp parameters which depend on one image only */
+		vector<double> frc_weights(EMData *image_fft, EMData *with, const Dict &params) const;
+
+		/** Weighted mean of an FSC curve, with the optional 'nweight' correction */
+		float frc_score(const vector<float> &fsc, const vector<double> &weights, EMData *with, int nweight) const;
+
+		int nx, ny, nz;
+		float width;
+		int inc;
+
+		// each run is a contiguous range of floats in the complex image in a single shell
+		vector<size_t> run_offset;
+		vector<int> run_length;
+		vector<int> run_shell;
+
+		vector<float> counts;
+	};
+}
+
+#endif	//eman_fsc_h__
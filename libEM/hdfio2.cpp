@@ -46,6 +46,11 @@
 
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <limits>
+#include <algorithm>
+#include <pthread.h>
 
 #ifndef WIN32
 	#include <sys/param.h>
@@ -74,11 +79,81 @@ using namespace EMAN;
 
 static const int ATTR_NAME_LEN = 128;
 
+// Few HDF5 installations are built thread-safe, so HdfIO2 serializes all of its
+// library calls on one process-wide lock. It is recursive since the public
+// methods call one another (read_header() -> init(), init_test() -> init()).
+namespace {
+	pthread_mutex_t hdf_mutex;
+	pthread_once_t hdf_mutex_once = PTHREAD_ONCE_INIT;
+
+	void hdf_mutex_init()
+	{
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&hdf_mutex, &attr);
+		pthread_mutexattr_destroy(&attr);
+	}
+
+	class HdfLock
+	{
+	  public:
+		HdfLock()
+		{
+			pthread_once(&hdf_mutex_once, hdf_mutex_init);
+			pthread_mutex_lock(&hdf_mutex);
+		}
+
+		~HdfLock()
+		{
+			pthread_mutex_unlock(&hdf_mutex);
+		}
+	};
+
+	const hsize_t COLUMN_CHUNK = 4096;	// header table rows per chunk
+
+	// Transform attributes are a compound of the 12 elements of the 3x4 matrix
+	hid_t transform_type()
+	{
+		static const char *names[12] = { "00", "01", "02", "03", "10", "11", "12", "13", "20", "21", "22", "23" };
+		hid_t type = H5Tcreate(H5T_COMPOUND, 12 * sizeof(float));
+		for (int i = 0; i < 12; i++) H5Tinsert(type, names[i], i*sizeof(float), H5T_NATIVE_FLOAT);
+		H5Tpack(type);
+		return type;
+	}
+
+	// Strings starting with O or E and a digit are EMAN1/EMAN2 CTF parameters
+	EMObject string_object(const char *s)
+	{
+		if ((s[0] == 'O' || s[0] == 'E') && isdigit(s[1])) {
+			Ctf *ctf;
+			if (s[0] == 'O') ctf = new EMAN1Ctf();
+			else ctf = new EMAN2Ctf();
+
+			EMObject ret;
+			try {
+				ctf->from_string(string(s));
+				ret = EMObject(ctf);
+			}
+			catch(...) {
+				ret = EMObject(s);
+			}
+
+			delete ctf;
+			return ret;
+		}
+
+		return EMObject(s);
+	}
+}
+
 HdfIO2::HdfIO2(const string & hdf_filename, IOMode rw)
 :	nx(1), ny(1), nz(1), is_exist(false),
 	file(-1), group(-1), filename(hdf_filename),
-	rw_mode(rw), initialized(false), rendermin(0.0), rendermax(0.0)
+	rw_mode(rw), initialized(false), rendermin(0.0), rendermax(0.0),
+	stack(false), stack_data(-1), stack_header(-1), stack_n(0), stack_nx(0), stack_ny(0)
 {
+	HdfLock lock;
 	H5dont_atexit();
 	accprop=H5Pcreate(H5P_FILE_ACCESS);
 
@@ -97,6 +172,8 @@ HdfIO2::HdfIO2(const string & hdf_filename, IOMode rw)
 
 HdfIO2::~HdfIO2()
 {
+	HdfLock lock;
+	close_stack();
 	H5Sclose(simple_space);
 	H5Pclose(accprop);
    if (group >= 0) {
@@ -335,20 +412,7 @@ int HdfIO2::write_attr(hid_t loc,const char *name,EMObject obj) {
 		spc=H5Screate_simple(1,&dims,NULL);
 		break;
 	case EMObject::TRANSFORM:
-		type = H5Tcreate(H5T_COMPOUND, 12 * sizeof(float)); // Transform is a 3x4 matrix
-		H5Tinsert(type, "00", 0, H5T_NATIVE_FLOAT);
-		H5Tinsert(type, "01", 1*sizeof(float), H5T_NATIVE_FLOAT);
-		H5Tinsert(type, "02", 2*sizeof(float), H5T_NATIVE_FLOAT);
-		H5Tinsert(type, "03", 3*sizeof(float), H5T_NATIVE_FLOAT);
-		H5Tinsert(type, "10", 4*sizeof(float), H5T_NATIVE_FLOAT);
-		H5Tinsert(type, "11", 5*sizeof(float), H5T_NATIVE_FLOAT);
-		H5Tinsert(type, "12", 6*sizeof(float), H5T_NATIVE_FLOAT);
-		H5Tinsert(type, "13", 7*sizeof(float), H5T_NATIVE_FLOAT);
-		H5Tinsert(type, "20", 8*sizeof(float), H5T_NATIVE_FLOAT);
-		H5Tinsert(type, "21", 9*sizeof(float), H5T_NATIVE_FLOAT);
-		H5Tinsert(type, "22", 10*sizeof(float), H5T_NATIVE_FLOAT);
-		H5Tinsert(type, "23", 11*sizeof(float), H5T_NATIVE_FLOAT);
-		H5Tpack(type);
+		type = transform_type(); // Transform is a 3x4 matrix
 
 		dims = 1;	// one compound type
 		spc = H5Screate_simple(1, &dims, NULL);
@@ -494,6 +558,7 @@ int HdfIO2::write_attr(hid_t loc,const char *name,EMObject obj) {
 
 void HdfIO2::init()
 {
+	HdfLock lock;
 	ENTERFUNC;
 
 	if (initialized) {
@@ -525,12 +590,29 @@ void HdfIO2::init()
 		}
 	}
 
+	group=H5Gopen(file,"/MDF/stack");
+	if (group>=0) {
+		open_stack();
+		initialized = true;
+		EXITFUNC;
+		return;
+	}
+
 	group=H5Gopen(file,"/MDF/images");
 	if (group<0) {
 		if (rw_mode == READ_ONLY) throw ImageReadException(filename,"HDF5 file has no image data (no /MDF group)");
 		group=H5Gcreate(file,"/MDF",64);		// create the group for Macromolecular data
 		if (group<0) throw ImageWriteException(filename,"Unable to add image group (/MDF) to HDF5 file");
 		H5Gclose(group);
+
+		const char *use_stack = getenv("EMAN_HDF_STACK");
+		if (use_stack && atoi(use_stack) != 0) {
+			create_stack();
+			initialized = true;
+			EXITFUNC;
+			return;
+		}
+
 		group=H5Gcreate(file,"/MDF/images",4096);		// create the group for images/volumes
 		if (group<0) throw ImageWriteException(filename,"Unable to add image group (/MDF/images) to HDF5 file");
 		write_attr(group,"imageid_max",EMObject(-1));
@@ -565,6 +647,7 @@ void HdfIO2::init()
 
 int HdfIO2::init_test()
 {
+	HdfLock lock;
 	ENTERFUNC;
 
 	if (initialized) {
@@ -618,9 +701,12 @@ bool HdfIO2::is_valid(const void *first_block)
 
 int HdfIO2::read_header(Dict & dict, int image_index, const Region * area, bool)
 {
+	HdfLock lock;
 	ENTERFUNC;
 	init();
 
+	if (stack) return read_stack_header(dict, image_index, area);
+
 	/* Copy the meta attributes stored in /MDF/images */
 
 	size_t meta_attr_size = meta_attr_dict.size();
@@ -691,31 +777,7 @@ int HdfIO2::read_header(Dict & dict, int image_index, const Region * area, bool)
 		}
 	}
 
-	if (area) {
-		check_region(area, IntSize(dict["nx"], dict["ny"], dict["nz"]), false, false);
-
-		dict["nx"] = area->get_width();
-		dict["ny"] = area->get_height();
-		dict["nz"] = area->get_depth();
-
-		if (dict.has_key("apix_x") && dict.has_key("apix_y") && dict.has_key("apix_z"))
-		{
-			if (dict.has_key("origin_x") && dict.has_key("origin_y") && dict.has_key("origin_z"))
-			{
-				float xorigin = dict["origin_x"];
-				float yorigin = dict["origin_y"];
-				float zorigin = dict["origin_z"];
-
-				float apix_x = dict["apix_x"];
-				float apix_y = dict["apix_y"];
-				float apix_z = dict["apix_z"];
-
-				dict["origin_x"] = xorigin + apix_x * area->origin[0];
-				dict["origin_y"] = yorigin + apix_y * area->origin[1];
-				dict["origin_z"] = zorigin + apix_z * area->origin[2];
-			}
-		}
-	}
+	set_region_header(dict, area);
 
 	H5Gclose(igrp);
 
@@ -750,17 +812,48 @@ int HdfIO2::read_header(Dict & dict, int image_index, const Region * area, bool)
 	return 0;
 }
 
+void HdfIO2::set_region_header(Dict & dict, const Region * area)
+{
+	if (area) {
+		check_region(area, IntSize(dict["nx"], dict["ny"], dict["nz"]), false, false);
+
+		dict["nx"] = area->get_width();
+		dict["ny"] = area->get_height();
+		dict["nz"] = area->get_depth();
+
+		if (dict.has_key("apix_x") && dict.has_key("apix_y") && dict.has_key("apix_z"))
+		{
+			if (dict.has_key("origin_x") && dict.has_key("origin_y") && dict.has_key("origin_z"))
+			{
+				float xorigin = dict["origin_x"];
+				float yorigin = dict["origin_y"];
+				float zorigin = dict["origin_z"];
+
+				float apix_x = dict["apix_x"];
+				float apix_y = dict["apix_y"];
+				float apix_z = dict["apix_z"];
+
+				dict["origin_x"] = xorigin + apix_x * area->origin[0];
+				dict["origin_y"] = yorigin + apix_y * area->origin[1];
+				dict["origin_z"] = zorigin + apix_z * area->origin[2];
+			}
+		}
+	}
+}
+
 // This erases any existing attributes from the image group
 // prior to writing a new header. For a new image there
 // won't be any, so this should be harmless.
 
 int HdfIO2::erase_header(int image_index)
 {
+	HdfLock lock;
 	ENTERFUNC;
 
 	if (image_index < 0) return 0; // image_index<0 for appending image, no need for erasing
 
 	init();
+	if (stack) return 0;	// write_stack_header() replaces the whole row
 
 #ifdef DEBUGHDF
 	printf("HDF: erase_head %d\n",image_index);
@@ -795,11 +888,14 @@ int HdfIO2::erase_header(int image_index)
 
 // TODO : incomplete
 int HdfIO2::read_data_8bit(unsigned char *data, int image_index, const Region *area, bool is_3d, float minval, float maxval) {
+	HdfLock lock;
 	ENTERFUNC;
 #ifdef DEBUGHDF
 	printf("HDF: read_data_8bit %d\n",image_index);
 #endif
 
+	if (stack) throw ImageReadException(filename, "8 bit reads are not supported in the HDF5 stack layout");
+
 	char ipath[50];
 	sprintf(ipath,"/MDF/images/%d/image",image_index);
 	hid_t ds = H5Dopen(file,ipath);
@@ -1041,11 +1137,14 @@ int HdfIO2::read_data_8bit(unsigned char *data, int image_index, const Region *a
 }
 int HdfIO2::read_data(float *data, int image_index, const Region *area, bool)
 {
+	HdfLock lock;
 	ENTERFUNC;
 #ifdef DEBUGHDF
 	printf("HDF: read_data %d\n",image_index);
 #endif
 
+	if (stack) return read_stack_data(data, image_index, area);
+
 	char ipath[50];
 	sprintf(ipath,"/MDF/images/%d/image",image_index);
 	hid_t ds = H5Dopen(file,ipath);
@@ -1290,8 +1389,9 @@ int HdfIO2::read_data(float *data, int image_index, const Region *area, bool)
 // Creation of the image dataset is also handled here
 
 int HdfIO2::write_header(const Dict & dict, int image_index, const Region* area,
-						EMUtil::EMDataType, bool)
+						EMUtil::EMDataType filestoragetype, bool)
 {
+	HdfLock lock;
 #ifdef DEBUGHDF
 	printf("HDF: write_head %d\n",image_index);
 #endif
@@ -1300,6 +1400,8 @@ int HdfIO2::write_header(const Dict & dict, int image_index, const Region* area,
 
 	init();
 
+	if (stack) return write_stack_header(dict, image_index, area, filestoragetype);
+
 	nx = (int)dict["nx"];
 	ny = (int)dict["ny"];
 	nz = (int)dict["nz"];
@@ -1410,12 +1512,15 @@ int HdfIO2::write_header(const Dict & dict, int image_index, const Region* area,
 int HdfIO2::write_data(float *data, int image_index, const Region* area,
 					  EMUtil::EMDataType dt, bool)
 {
+	HdfLock lock;
 	ENTERFUNC;
 
 #ifdef DEBUGHDF
 	printf("HDF: write_data %d\n",image_index);
 #endif
 
+	if (stack) return write_stack_data(data, image_index, area);
+
 	if (image_index < 0) {
 		hid_t attr=H5Aopen_name(group,"imageid_max");
 		image_index = read_attr(attr);
@@ -1760,7 +1865,10 @@ int HdfIO2::write_data(float *data, int image_index, const Region* area,
 
 int HdfIO2::get_nimg()
 {
+	HdfLock lock;
 	init();
+	if (stack) return (int)stack_n;
+
 	hid_t attr=H5Aopen_name(group,"imageid_max");
 	int n = read_attr(attr);
 	H5Aclose(attr);
@@ -1784,4 +1892,744 @@ bool HdfIO2::is_image_big_endian()
 	return true;
 }
 
+// The stack layout keeps all images in /MDF/stack/images, [n][ny][nx] floats,
+// chunked one image per chunk so a particle read touches a single chunk. The
+// header is /MDF/stack/header/<key>, one extendible 1-D dataset per attribute.
+// A row where an attribute is missing holds the column's fill value.
+
+hid_t HdfIO2::column_type(ColumnKind kind)
+{
+	hid_t type = -1;
+
+	switch (kind) {
+	case COL_BOOL:
+		type = H5Tcopy(H5T_NATIVE_CHAR);
+		break;
+	case COL_INT:
+		type = H5Tcopy(H5T_NATIVE_INT);
+		break;
+	case COL_UINT:
+		type = H5Tcopy(H5T_NATIVE_UINT);
+		break;
+	case COL_FLOAT:
+		type = H5Tcopy(H5T_NATIVE_FLOAT);
+		break;
+	case COL_DOUBLE:
+		type = H5Tcopy(H5T_NATIVE_DOUBLE);
+		break;
+	case COL_STRING:
+		type = H5Tcopy(H5T_C_S1);
+		H5Tset_size(type, H5T_VARIABLE);
+		break;
+	case COL_FLOATARRAY:
+		type = H5Tvlen_create(H5T_NATIVE_FLOAT);
+		break;
+	case COL_INTARRAY:
+		type = H5Tvlen_create(H5T_NATIVE_INT);
+		break;
+	case COL_TRANSFORM:
+		type = transform_type();
+		break;
+	}
+
+	return type;
+}
+
+size_t HdfIO2::cell_size(ColumnKind kind)
+{
+	switch (kind) {
+	case COL_BOOL:
+		return 1;
+	case COL_INT:
+		return sizeof(int);
+	case COL_UINT:
+		return sizeof(unsigned int);
+	case COL_FLOAT:
+		return sizeof(float);
+	case COL_DOUBLE:
+		return sizeof(double);
+	case COL_STRING:
+		return sizeof(char *);
+	case COL_FLOATARRAY:
+	case COL_INTARRAY:
+		return sizeof(hvl_t);
+	case COL_TRANSFORM:
+		break;
+	}
+
+	return 12*sizeof(float);
+}
+
+int HdfIO2::object_kind(const EMObject & obj)
+{
+	switch (obj.get_type()) {
+	case EMObject::BOOL:
+		return COL_BOOL;
+	case EMObject::SHORT:
+	case EMObject::INT:
+		return COL_INT;
+	case EMObject::UNSIGNEDINT:
+		return COL_UINT;
+	case EMObject::FLOAT:
+		return COL_FLOAT;
+	case EMObject::DOUBLE:
+		return COL_DOUBLE;
+	case EMObject::STRING:
+	case EMObject::CTF:
+		return COL_STRING;
+	case EMObject::FLOATARRAY:
+		return COL_FLOATARRAY;
+	case EMObject::INTARRAY:
+		return COL_INTARRAY;
+	case EMObject::TRANSFORM:
+		return COL_TRANSFORM;
+	default:
+		return -1;
+	}
+}
+
+int HdfIO2::type_kind(hid_t type)
+{
+	int kind = -1;
+
+	switch (H5Tget_class(type)) {
+	case H5T_INTEGER:
+		if (H5Tget_size(type) == 1) kind = COL_BOOL;
+		else if (H5Tget_sign(type) == H5T_SGN_NONE) kind = COL_UINT;
+		else kind = COL_INT;
+		break;
+	case H5T_FLOAT:
+		kind = (H5Tget_size(type) == 8 ? COL_DOUBLE : COL_FLOAT);
+		break;
+	case H5T_STRING:
+		if (H5Tis_variable_str(type) > 0) kind = COL_STRING;
+		break;
+	case H5T_VLEN:
+	{
+		hid_t super = H5Tget_super(type);
+		kind = (H5Tget_class(super) == H5T_FLOAT ? COL_FLOATARRAY : COL_INTARRAY);
+		H5Tclose(super);
+	}
+		break;
+	case H5T_COMPOUND:
+		if (H5Tget_nmembers(type) == 12) kind = COL_TRANSFORM;
+		break;
+	default:
+		break;
+	}
+
+	return kind;
+}
+
+void HdfIO2::open_stack()
+{
+	stack = true;
+
+	stack_header = H5Gopen(group, "header");
+	if (stack_header < 0) throw ImageReadException(filename, "HDF5 stack has no header table");
+
+	stack_data = H5Dopen(group, "images");
+	if (stack_data >= 0) {
+		hid_t spc = H5Dget_space(stack_data);
+		hsize_t dims[3];
+		if (H5Sget_simple_extent_ndims(spc) != 3) {
+			H5Sclose(spc);
+			throw ImageReadException(filename, "HDF5 stack images are not a 3-D dataset");
+		}
+		H5Sget_simple_extent_dims(spc, dims, NULL);
+		H5Sclose(spc);
+		stack_n = dims[0];
+		stack_ny = dims[1];
+		stack_nx = dims[2];
+	}
+
+	hsize_t nobj = 0;
+	H5Gget_num_objs(stack_header, &nobj);
+
+	char name[ATTR_NAME_LEN];
+	for (hsize_t i = 0; i < nobj; i++) {
+		if (H5Gget_objtype_by_idx(stack_header, i) != H5G_DATASET) continue;
+		H5Gget_objname_by_idx(stack_header, i, name, ATTR_NAME_LEN);
+
+		hid_t ds = H5Dopen(stack_header, name);
+		hid_t type = H5Dget_type(ds);
+		int kind = type_kind(type);
+		H5Tclose(type);
+
+		if (kind < 0) {
+			LOGWARN("HDF: skipping header column %s of unknown type", name);
+			H5Dclose(ds);
+			continue;
+		}
+
+		StackColumn & col = columns[name];
+		col.ds = ds;
+		col.kind = (ColumnKind)kind;
+		col.cached = false;
+	}
+}
+
+void HdfIO2::create_stack()
+{
+	stack = true;
+
+	group = H5Gcreate(file, "/MDF/stack", 64);
+	if (group < 0) throw ImageWriteException(filename, "Unable to add image group (/MDF/stack) to HDF5 file");
+
+	stack_header = H5Gcreate(group, "header", 4096);
+	if (stack_header < 0) throw ImageWriteException(filename, "Unable to add header table (/MDF/stack/header) to HDF5 file");
+}
+
+void HdfIO2::close_stack()
+{
+	for (std::map<string, StackColumn>::iterator it = columns.begin(); it != columns.end(); ++it) {
+		StackColumn & col = it->second;
+
+		if (col.cached && is_vlen(col.kind) && stack_n > 0) {
+			hid_t type = column_type(col.kind);
+			hid_t spc = H5Screate_simple(1, &stack_n, NULL);
+			H5Dvlen_reclaim(type, spc, H5P_DEFAULT, &col.cache[0]);
+			H5Sclose(spc);
+			H5Tclose(type);
+		}
+
+		H5Dclose(col.ds);
+	}
+	columns.clear();
+
+	if (stack_data >= 0) H5Dclose(stack_data);
+	if (stack_header >= 0) H5Gclose(stack_header);
+	stack_data = -1;
+	stack_header = -1;
+}
+
+void HdfIO2::extend_stack(hsize_t n)
+{
+	hsize_t dims[3] = { n, stack_ny, stack_nx };
+	if (H5Dset_extent(stack_data, dims) < 0) throw ImageWriteException(filename, "Unable to extend HDF5 stack");
+
+	for (std::map<string, StackColumn>::iterator it = columns.begin(); it != columns.end(); ++it) {
+		if (H5Dset_extent(it->second.ds, &n) < 0) throw ImageWriteException(filename, "Unable to extend HDF5 header table");
+	}
+
+	stack_n = n;
+}
+
+HdfIO2::StackColumn & HdfIO2::add_column(const string & key, ColumnKind kind)
+{
+	hsize_t maxdims = H5S_UNLIMITED;
+	hsize_t chunk = COLUMN_CHUNK;
+	hid_t spc = H5Screate_simple(1, &stack_n, &maxdims);
+	hid_t type = column_type(kind);
+	hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+	H5Pset_chunk(plist, 1, &chunk);
+
+	// variable length types fill with empty values, which read as absent already
+	char fill[12*sizeof(float)];
+	float fnan = std::numeric_limits<float>::quiet_NaN();
+	double dnan = std::numeric_limits<double>::quiet_NaN();
+	int imin = INT_MIN;
+	unsigned int umax = UINT_MAX;
+
+	switch (kind) {
+	case COL_BOOL:
+		fill[0] = 0;
+		break;
+	case COL_INT:
+		memcpy(fill, &imin, sizeof(int));
+		break;
+	case COL_UINT:
+		memcpy(fill, &umax, sizeof(unsigned int));
+		break;
+	case COL_FLOAT:
+		memcpy(fill, &fnan, sizeof(float));
+		break;
+	case COL_DOUBLE:
+		memcpy(fill, &dnan, sizeof(double));
+		break;
+	case COL_TRANSFORM:
+		for (int i = 0; i < 12; i++) memcpy(fill + i*sizeof(float), &fnan, sizeof(float));
+		break;
+	default:
+		break;
+	}
+	if (!is_vlen(kind)) H5Pset_fill_value(plist, type, fill);
+
+	hid_t ds = H5Dcreate(stack_header, key.c_str(), type, spc, plist);
+
+	H5Pclose(plist);
+	H5Tclose(type);
+	H5Sclose(spc);
+
+	if (ds < 0) throw ImageWriteException(filename, "Unable to add header column " + key);
+
+	StackColumn & col = columns[key];
+	col.ds = ds;
+	col.kind = kind;
+	col.cached = false;
+	return col;
+}
+
+bool HdfIO2::read_cell(StackColumn & col, hsize_t row, EMObject & value)
+{
+	hid_t type = column_type(col.kind);
+	size_t size = cell_size(col.kind);
+
+	// In read-only mode the first access reads the whole column, so a header scan
+	// costs one read per attribute rather than one per attribute per image
+	if (rw_mode == READ_ONLY && !col.cached && stack_n > 0) {
+		col.cache.resize(stack_n*size);
+		if (H5Dread(col.ds, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, &col.cache[0]) < 0) {
+			H5Tclose(type);
+			throw ImageReadException(filename, "Unable to read HDF5 header table");
+		}
+		col.cached = true;
+	}
+
+	char buf[12*sizeof(float)];
+	const char *cell = buf;
+	hsize_t one = 1;
+	hid_t mspc = -1;
+
+	if (col.cached) {
+		cell = &col.cache[row*size];
+	}
+	else {
+		hid_t fspc = H5Dget_space(col.ds);
+		mspc = H5Screate_simple(1, &one, NULL);
+		H5Sselect_hyperslab(fspc, H5S_SELECT_SET, &row, NULL, &one, NULL);
+		herr_t err = H5Dread(col.ds, type, mspc, fspc, H5P_DEFAULT, buf);
+		H5Sclose(fspc);
+		if (err < 0) {
+			H5Sclose(mspc);
+			H5Tclose(type);
+			throw ImageReadException(filename, "Unable to read HDF5 header table");
+		}
+	}
+
+	bool present = true;
+
+	switch (col.kind) {
+	case COL_BOOL:
+		present = (cell[0] == 'T' || cell[0] == 'F');
+		if (present) value = EMObject(cell[0] == 'T');
+		break;
+	case COL_INT:
+	{
+		int v;
+		memcpy(&v, cell, sizeof(int));
+		present = (v != INT_MIN);
+		if (present) value = EMObject(v);
+	}
+		break;
+	case COL_UINT:
+	{
+		unsigned int v;
+		memcpy(&v, cell, sizeof(unsigned int));
+		present = (v != UINT_MAX);
+		if (present) value = EMObject(v);
+	}
+		break;
+	case COL_FLOAT:
+	{
+		float v;
+		memcpy(&v, cell, sizeof(float));
+		present = (v == v);
+		if (present) value = EMObject(v);
+	}
+		break;
+	case COL_DOUBLE:
+	{
+		double v;
+		memcpy(&v, cell, sizeof(double));
+		present = (v == v);
+		if (present) value = EMObject(v);
+	}
+		break;
+	case COL_STRING:
+	{
+		const char *v = *(char * const *)cell;
+		present = (v != 0);
+		if (present) value = string_object(v);
+	}
+		break;
+	case COL_FLOATARRAY:
+	{
+		const hvl_t *v = (const hvl_t *)cell;
+		present = (v->len > 0);
+		if (present) {
+			const float *p = (const float *)v->p;
+			value = EMObject(vector<float>(p, p + v->len));
+		}
+	}
+		break;
+	case COL_INTARRAY:
+	{
+		const hvl_t *v = (const hvl_t *)cell;
+		present = (v->len > 0);
+		if (present) {
+			const int *p = (const int *)v->p;
+			value = EMObject(vector<int>(p, p + v->len));
+		}
+	}
+		break;
+	case COL_TRANSFORM:
+	{
+		float m[12];
+		memcpy(m, cell, sizeof(m));
+		present = (m[0] == m[0]);
+		if (present) {
+			Transform t(m);
+			value = EMObject(&t);
+		}
+	}
+		break;
+	}
+
+	if (mspc >= 0) {
+		if (is_vlen(col.kind)) H5Dvlen_reclaim(type, mspc, H5P_DEFAULT, buf);
+		H5Sclose(mspc);
+	}
+	H5Tclose(type);
+
+	return present;
+}
+
+void HdfIO2::write_cell(StackColumn & col, hsize_t row, const EMObject * obj)
+{
+	char cell[12*sizeof(float)];
+	vector<float> fv;
+	vector<int> iv;
+	string sv;
+
+	float fnan = std::numeric_limits<float>::quiet_NaN();
+
+	switch (col.kind) {
+	case COL_BOOL:
+		cell[0] = (obj ? ((bool)*obj ? 'T' : 'F') : 0);
+		break;
+	case COL_INT:
+	{
+		int v = (obj ? (int)*obj : INT_MIN);
+		memcpy(cell, &v, sizeof(int));
+	}
+		break;
+	case COL_UINT:
+	{
+		unsigned int v = (obj ? (unsigned int)*obj : UINT_MAX);
+		memcpy(cell, &v, sizeof(unsigned int));
+	}
+		break;
+	case COL_FLOAT:
+	{
+		float v = (obj ? (float)*obj : fnan);
+		memcpy(cell, &v, sizeof(float));
+	}
+		break;
+	case COL_DOUBLE:
+	{
+		double v = (obj ? (double)*obj : std::numeric_limits<double>::quiet_NaN());
+		memcpy(cell, &v, sizeof(double));
+	}
+		break;
+	case COL_STRING:
+	{
+		const char *v = 0;
+		if (obj) {
+			sv = (const char *)*obj;
+			v = sv.c_str();
+		}
+		memcpy(cell, &v, sizeof(char *));
+	}
+		break;
+	case COL_FLOATARRAY:
+	case COL_INTARRAY:
+	{
+		hvl_t v;
+		v.len = 0;
+		v.p = 0;
+		if (obj && col.kind == COL_FLOATARRAY) {
+			fv = *obj;
+			v.len = fv.size();
+			if (!fv.empty()) v.p = &fv[0];
+		}
+		else if (obj) {
+			iv = *obj;
+			v.len = iv.size();
+			if (!iv.empty()) v.p = &iv[0];
+		}
+		memcpy(cell, &v, sizeof(hvl_t));
+	}
+		break;
+	case COL_TRANSFORM:
+	{
+		float m[12];
+		if (obj) {
+			Transform *t = *obj;
+			for (int r = 0; r < 3; r++) {
+				for (int c = 0; c < 4; c++) m[r*4+c] = t->at(r,c);
+			}
+		}
+		else {
+			for (int i = 0; i < 12; i++) m[i] = fnan;
+		}
+		memcpy(cell, m, sizeof(m));
+	}
+		break;
+	}
+
+	hsize_t one = 1;
+	hid_t type = column_type(col.kind);
+	hid_t fspc = H5Dget_space(col.ds);
+	hid_t mspc = H5Screate_simple(1, &one, NULL);
+	H5Sselect_hyperslab(fspc, H5S_SELECT_SET, &row, NULL, &one, NULL);
+	herr_t err = H5Dwrite(col.ds, type, mspc, fspc, H5P_DEFAULT, cell);
+	H5Sclose(mspc);
+	H5Sclose(fspc);
+	H5Tclose(type);
+
+	if (err < 0) throw ImageWriteException(filename, "Unable to write HDF5 header table");
+}
+
+int HdfIO2::read_stack_header(Dict & dict, int image_index, const Region * area)
+{
+	if (image_index < 0 || (hsize_t)image_index >= stack_n) {
+		char msg[40];
+		sprintf(msg,"Image %d does not exist",image_index);
+		throw ImageReadException(filename,msg);
+	}
+
+	for (std::map<string, StackColumn>::iterator it = columns.begin(); it != columns.end(); ++it) {
+		EMObject value;
+		if (read_cell(it->second, image_index, value)) dict[it->first] = value;
+	}
+
+	dict["nx"] = (int)stack_nx;
+	dict["ny"] = (int)stack_ny;
+	dict["nz"] = 1;
+	dict["datatype"] = (int)EMUtil::EM_FLOAT;
+
+	set_region_header(dict, area);
+
+	EXITFUNC;
+	return 0;
+}
+
+int HdfIO2::read_stack_data(float *data, int image_index, const Region * area)
+{
+	if (image_index < 0 || (hsize_t)image_index >= stack_n) throw ImageReadException(filename, "Image does not exist");
+
+	// the part of the region inside the image; the rest of the region is zero
+	int x0 = 0, y0 = 0, w = (int)stack_nx, h = (int)stack_ny;
+	int rx = 0, ry = 0;
+	if (area) {
+		rx = (int)area->x_origin();
+		ry = (int)area->y_origin();
+		w = (int)area->get_width();
+		h = (int)area->get_height();
+		x0 = std::max(rx, 0);
+		y0 = std::max(ry, 0);
+	}
+	int x1 = std::min(rx + w, (int)stack_nx);
+	int y1 = std::min(ry + h, (int)stack_ny);
+
+	if (area && (x0 != rx || y0 != ry || x1 != rx + w || y1 != ry + h)) {
+		std::fill(data, data + (size_t)w*h, 0.0f);
+	}
+	if (x1 <= x0 || y1 <= y0) {
+		EXITFUNC;
+		return 0;
+	}
+
+	hsize_t foffset[3] = { (hsize_t)image_index, (hsize_t)y0, (hsize_t)x0 };
+	hsize_t count[3] = { 1, (hsize_t)(y1-y0), (hsize_t)(x1-x0) };
+	hid_t fspc = H5Dget_space(stack_data);
+	H5Sselect_hyperslab(fspc, H5S_SELECT_SET, foffset, NULL, count, NULL);
+
+	// HDF5 places the clipped part straight into the region buffer
+	hsize_t mdims[2] = { (hsize_t)h, (hsize_t)w };
+	hsize_t moffset[2] = { (hsize_t)(y0-ry), (hsize_t)(x0-rx) };
+	hid_t mspc = H5Screate_simple(2, mdims, NULL);
+	H5Sselect_hyperslab(mspc, H5S_SELECT_SET, moffset, NULL, count+1, NULL);
+
+	herr_t err = H5Dread(stack_data, H5T_NATIVE_FLOAT, mspc, fspc, H5P_DEFAULT, data);
+	H5Sclose(mspc);
+	H5Sclose(fspc);
+
+	if (err < 0) throw ImageReadException(filename, "HDF5 stack read failed");
+
+	EXITFUNC;
+	return 0;
+}
+
+int HdfIO2::write_stack_header(const Dict & dict, int image_index, const Region * area,
+							   EMUtil::EMDataType filestoragetype)
+{
+	if (filestoragetype != EMUtil::EM_FLOAT) {
+		throw ImageWriteException(filename, "the HDF5 stack layout stores float data only");
+	}
+
+	nx = (int)dict["nx"];
+	ny = (int)dict["ny"];
+	nz = (int)dict["nz"];
+
+	if (nz != 1) throw ImageWriteException(filename, "the HDF5 stack layout holds 2-D images only");
+
+	if (stack_data < 0) {
+		hsize_t dims[3] = { 0, ny, nx };
+		hsize_t maxdims[3] = { H5S_UNLIMITED, ny, nx };
+		hsize_t chunk[3] = { 1, ny, nx };
+		hid_t spc = H5Screate_simple(3, dims, maxdims);
+		hid_t plist = H5Pcreate(H5P_DATASET_CREATE);
+		H5Pset_chunk(plist, 3, chunk);
+		stack_data = H5Dcreate(group, "images", H5T_NATIVE_FLOAT, spc, plist);
+		H5Pclose(plist);
+		H5Sclose(spc);
+		if (stack_data < 0) throw ImageWriteException(filename, "Unable to add /MDF/stack/images to HDF5 file");
+
+		stack_nx = nx;
+		stack_ny = ny;
+	}
+	else if (nx != stack_nx || ny != stack_ny) {
+		throw ImageWriteException(filename, "the HDF5 stack layout needs all images to be the same size");
+	}
+
+	if (image_index < 0) image_index = (int)stack_n;
+
+	if (area) {
+		if ((hsize_t)image_index >= stack_n) throw ImageWriteException(filename, "Image does not exist");
+		EXITFUNC;
+		return 0;
+	}
+
+	if ((hsize_t)image_index >= stack_n) extend_stack(image_index+1);
+
+	// every column gets a value or the absent marker, which replaces the old header
+	for (std::map<string, StackColumn>::iterator it = columns.begin(); it != columns.end(); ++it) {
+		if (!dict.has_key(it->first)) write_cell(it->second, image_index, 0);
+	}
+
+	vector <string> keys = dict.keys();
+
+	for (size_t i = 0; i < keys.size(); i++) {
+		const string & key = keys[i];
+		if (key == "nx" || key == "ny" || key == "nz" || key == "datatype") continue;
+
+		EMObject value = dict[key];
+		int kind = object_kind(value);
+		if (kind < 0 || key.find('/') != string::npos) continue;	// as write_attr() skips them
+
+		std::map<string, StackColumn>::iterator it = columns.find(key);
+		if (it == columns.end()) {
+			write_cell(add_column(key, (ColumnKind)kind), image_index, &value);
+			continue;
+		}
+
+		// numbers convert to the type the column already has
+		bool numeric = (kind >= COL_INT && kind <= COL_DOUBLE);
+		bool numeric_column = (it->second.kind >= COL_INT && it->second.kind <= COL_DOUBLE);
+		if (kind == it->second.kind || (numeric && numeric_column)) {
+			write_cell(it->second, image_index, &value);
+		}
+		else {
+			LOGWARN("HDF: %s doesn't match the type of its header column, not written", key.c_str());
+			write_cell(it->second, image_index, 0);
+		}
+	}
+
+	EMUtil::getRenderLimits(dict, rendermin, rendermax);
+
+	EXITFUNC;
+	return 0;
+}
+
+int HdfIO2::write_stack_data(float *data, int image_index, const Region * area)
+{
+	if (image_index < 0) image_index = (int)stack_n - 1;
+	if (image_index < 0 || (hsize_t)image_index >= stack_n) throw ImageWriteException(filename, "Image does not exist");
+
+	if (!data) {
+		EXITFUNC;
+		return 0;
+	}
+
+	hsize_t offset[3] = { (hsize_t)image_index, 0, 0 };
+	hsize_t count[3] = { 1, stack_ny, stack_nx };
+	if (area) {
+		if (area->x_origin() < 0 || area->y_origin() < 0 ||
+			area->x_origin() + area->get_width() > stack_nx ||
+			area->y_origin() + area->get_height() > stack_ny) {
+			throw ImageWriteException(filename, "region writes to the HDF5 stack layout must lie inside the image");
+		}
+		offset[1] = (hsize_t)area->y_origin();
+		offset[2] = (hsize_t)area->x_origin();
+		count[1] = (hsize_t)area->get_height();
+		count[2] = (hsize_t)area->get_width();
+	}
+
+	hid_t fspc = H5Dget_space(stack_data);
+	H5Sselect_hyperslab(fspc, H5S_SELECT_SET, offset, NULL, count, NULL);
+	hid_t mspc = H5Screate_simple(2, count+1, NULL);
+
+	herr_t err = H5Dwrite(stack_data, H5T_NATIVE_FLOAT, mspc, fspc, H5P_DEFAULT, data);
+	H5Sclose(mspc);
+	H5Sclose(fspc);
+
+	if (err < 0) throw ImageWriteException(filename, "HDF5 stack write failed");
+
+	EXITFUNC;
+	return 0;
+}
+
+EMObject HdfIO2::read_stack_attr(const string & key, int image_index)
+{
+	HdfLock lock;
+	init();
+
+	std::map<string, StackColumn>::iterator it = columns.find(key);
+	EMObject value;
+	if (image_index < 0 || (hsize_t)image_index >= stack_n || it == columns.end() ||
+		!read_cell(it->second, image_index, value)) {
+		throw _NotExistingObjectException(key);
+	}
+
+	return value;
+}
+
+int HdfIO2::write_stack_attr(const string & key, EMObject value, int image_index)
+{
+	HdfLock lock;
+	init();
+
+	if (image_index < 0 || (hsize_t)image_index >= stack_n) throw _NotExistingObjectException(key);
+
+	int kind = object_kind(value);
+	if (kind < 0) return -1;
+
+	std::map<string, StackColumn>::iterator it = columns.find(key);
+	if (it == columns.end()) {
+		write_cell(add_column(key, (ColumnKind)kind), image_index, &value);
+		return 0;
+	}
+
+	bool numeric = (kind >= COL_INT && kind <= COL_DOUBLE);
+	bool numeric_column = (it->second.kind >= COL_INT && it->second.kind <= COL_DOUBLE);
+	if (kind != it->second.kind && !(numeric && numeric_column)) return -1;
+
+	write_cell(it->second, image_index, &value);
+	return 0;
+}
+
+int HdfIO2::delete_stack_attr(const string & key, int image_index)
+{
+	HdfLock lock;
+	init();
+
+	std::map<string, StackColumn>::iterator it = columns.find(key);
+	if (image_index < 0 || (hsize_t)image_index >= stack_n || it == columns.end()) return -1;
+
+	write_cell(it->second, image_index, 0);
+	return 0;
+}
+
 #endif	//USE_HDF5
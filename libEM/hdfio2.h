@@ -54,6 +54,7 @@
 	#include <stdint.h>
 #endif
 #include <vector>
+#include <map>
 
 using std::vector;
 
@@ -66,6 +67,21 @@ namespace EMAN
 	 * 
 	 * Attribute name must be within 128 charaters, including string terminator '\0'. 
 	 * 
+	 * Files normally keep each image in its own group, /MDF/images/<n>, with the
+	 * header as attributes of the group. A file may instead use the stack layout,
+	 * where all images are 2-D and the same size: the pixels are one chunked
+	 * [n][ny][nx] float dataset, /MDF/stack/images, and the header is a table under
+	 * /MDF/stack/header with one 1-D dataset per attribute. Reading one particle is
+	 * then a single hyperslab, and scanning one attribute over the stack is a single
+	 * dataset read. In read-only mode each attribute column is read whole the first
+	 * time it is needed. The layout is detected on read. New files are written in the
+	 * stack layout when the environment variable EMAN_HDF_STACK is set to a nonzero
+	 * value; appending to an existing file always keeps its layout.
+	 *
+	 * The stack layout stores the same attribute types as group attributes. Float and
+	 * double NaNs, INT_MIN, UINT_MAX and empty arrays mark an attribute as absent for
+	 * an image, so those values can't be stored there.
+	 * 
 	 * After you make change to this class, please check the HDF5 file created 
 	 * by EMAN2 with the h5check program from:
 	 * ftp:://ftp.hdfgroup.org/HDF5/special_tools/h5check/
@@ -122,7 +138,30 @@ namespace EMAN
 		 * For single attribute read/write*/
 		hid_t get_fileid() const {return file;}
 
+		/** @return true if the file uses the stack layout. Call after init(). */
+		bool is_stack_layout() const {return stack;}
+
+		/** Single attribute access for the stack layout, as EMUtil::read_hdf_attribute()
+		 * and friends do with group attributes.
+		 * @exception _NotExistingObjectException if the image or attribute doesn't exist */
+		EMObject read_stack_attr(const string & key, int image_index);
+		int write_stack_attr(const string & key, EMObject value, int image_index);
+		int delete_stack_attr(const string & key, int image_index);
+
 	  private:
+		enum ColumnKind {
+			COL_BOOL, COL_INT, COL_UINT, COL_FLOAT, COL_DOUBLE,
+			COL_STRING, COL_FLOATARRAY, COL_INTARRAY, COL_TRANSFORM
+		};
+
+		/** One header attribute in the stack layout */
+		struct StackColumn
+		{
+			hid_t ds;
+			ColumnKind kind;
+			vector<char> cache;	// the whole column, read-only mode only
+			bool cached;
+		};
 		hsize_t nx, ny, nz;
 		bool is_exist;	//boolean to tell if the image (group) already exist(to be overwrite)
 
@@ -147,6 +186,49 @@ namespace EMAN
         // render_min and render_max
 	    float rendermin;
 	    float rendermax;
+
+		/** Adjust nx/ny/nz and the origin in a header read with a region */
+		void set_region_header(Dict & dict, const Region * area);
+
+		bool stack;
+		hid_t stack_data;		// /MDF/stack/images, -1 until the first image is written
+		hid_t stack_header;		// /MDF/stack/header
+		hsize_t stack_n;
+		hsize_t stack_nx, stack_ny;
+		std::map<string, StackColumn> columns;
+
+		static bool is_vlen(ColumnKind kind)
+		{
+			return kind == COL_STRING || kind == COL_FLOATARRAY || kind == COL_INTARRAY;
+		}
+
+		static hid_t column_type(ColumnKind kind);
+		static size_t cell_size(ColumnKind kind);
+
+		/** @return the column kind for a value or an HDF5 type, or -1 if it has none */
+		static int object_kind(const EMObject & obj);
+		static int type_kind(hid_t type);
+
+		void open_stack();
+		void create_stack();
+		void close_stack();
+
+		/** Grow the image dataset and every column to n images */
+		void extend_stack(hsize_t n);
+
+		StackColumn & add_column(const string & key, ColumnKind kind);
+
+		/** Read one element. Returns false if the attribute is absent for this row. */
+		bool read_cell(StackColumn & col, hsize_t row, EMObject & value);
+
+		/** Write one element; a NULL obj writes the absent marker */
+		void write_cell(StackColumn & col, hsize_t row, const EMObject * obj);
+
+		int read_stack_header(Dict & dict, int image_index, const Region * area);
+		int read_stack_data(float *data, int image_index, const Region * area);
+		int write_stack_header(const Dict & dict, int image_index, const Region * area,
+							   EMUtil::EMDataType filestoragetype);
+		int write_stack_data(float *data, int image_index, const Region * area);
 	};
 }
 
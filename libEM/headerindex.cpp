@@ -0,0 +1,492 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+#include "headerindex.h"
+#include "ctf.h"
+#include "emutil.h"
+#include "imageio.h"
+#include "portable_fileio.h"
+#include "transform.h"
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <limits>
+#ifndef _WIN32
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+using namespace EMAN;
+
+// Index file layout, native byte order:
+//	FileHeader, 64 bytes
+//	ncols x ColumnEntry, 64 bytes each
+//	column data, each column 'capacity' rows of width 4-byte values, 64-byte aligned
+namespace {
+	const char INDEX_MAGIC[8] = { 'E', 'M', 'H', 'I', 'D', 'X', '0', '1' };
+	const int32_t BYTE_ORDER_MARK = 0x01020304;
+	const size_t NAME_LEN = 48;
+
+	struct FileHeader
+	{
+		char magic[8];
+		int32_t byte_order;
+		int32_t ncols;
+		int64_t nrows;
+		int64_t capacity;
+		int64_t src_size;
+		int64_t src_mtime;
+		int64_t src_mtime_ns;
+		int64_t reserved;
+	};
+
+	struct ColumnEntry
+	{
+		char name[NAME_LEN];
+		int32_t type;
+		int32_t width;
+		int64_t offset;
+	};
+
+	// mtime_ns is the sub-second part, so rewrites within the same second are still seen
+	bool stat_file(const string & filename, int64_t & size, int64_t & mtime, int64_t & mtime_ns)
+	{
+		struct stat st;
+		if (stat(filename.c_str(), &st) != 0) return false;
+		size = (int64_t)st.st_size;
+		mtime = (int64_t)st.st_mtime;
+		mtime_ns = (int64_t)portable_mtime_nsec(st);
+		return true;
+	}
+
+	bool read_layout(FILE *f, FileHeader & hdr, vector<ColumnEntry> & cols)
+	{
+		if (fread(&hdr, sizeof(hdr), 1, f) != 1) return false;
+		if (memcmp(hdr.magic, INDEX_MAGIC, 8) != 0 || hdr.byte_order != BYTE_ORDER_MARK) return false;
+		if (hdr.ncols < 0 || hdr.nrows < 0 || hdr.nrows > hdr.capacity) return false;
+
+		cols.resize(hdr.ncols);
+		if (hdr.ncols > 0 && fread(&cols[0], sizeof(ColumnEntry), hdr.ncols, f) != (size_t)hdr.ncols) return false;
+		return true;
+	}
+
+	int column_type(const EMObject & obj)
+	{
+		switch (obj.get_type()) {
+		case EMObject::BOOL:
+		case EMObject::SHORT:
+		case EMObject::INT:
+		case EMObject::UNSIGNEDINT:
+			return HeaderIndex::INDEX_INT;
+		case EMObject::FLOAT:
+		case EMObject::DOUBLE:
+			return HeaderIndex::INDEX_FLOAT;
+		case EMObject::TRANSFORM:
+			return HeaderIndex::INDEX_TRANSFORM;
+		default:
+			return -1;
+		}
+	}
+
+	/** Look up key in a header; "ctf.<field>" reaches into a Ctf object */
+	bool lookup(const Dict & header, const string & key, EMObject & value)
+	{
+		if (header.has_key(key)) {
+			value = header[key];
+			return true;
+		}
+
+		if (key.compare(0, 4, "ctf.") == 0 && header.has_key("ctf")) {
+			EMObject c = header["ctf"];
+			if (c.get_type() != EMObject::CTF) return false;
+			Ctf *ctf = c;
+			Dict d = ctf->to_dict();
+			delete ctf;
+			string field = key.substr(4);
+			if (d.has_key(field)) {
+				value = d[field];
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/** Encode one cell as width 4-byte values; absent values get the column's marker */
+	void encode(const Dict & header, const ColumnEntry & col, char *cell)
+	{
+		EMObject value;
+		bool found = lookup(header, col.name, value) && column_type(value) >= 0;
+		float nan = std::numeric_limits<float>::quiet_NaN();
+
+		if (col.type == HeaderIndex::INDEX_INT) {
+			int32_t v = INT_MIN;
+			if (found && column_type(value) != HeaderIndex::INDEX_TRANSFORM) v = (int)value;
+			memcpy(cell, &v, 4);
+		}
+		else if (col.type == HeaderIndex::INDEX_FLOAT) {
+			float v = nan;
+			if (found && column_type(value) != HeaderIndex::INDEX_TRANSFORM) v = (float)value;
+			memcpy(cell, &v, 4);
+		}
+		else {
+			float m[12];
+			if (found && column_type(value) == HeaderIndex::INDEX_TRANSFORM) {
+				Transform *t = value;
+				for (int r = 0; r < 3; r++) {
+					for (int c = 0; c < 4; c++) m[r*4+c] = t->at(r,c);
+				}
+				delete t;
+			}
+			else {
+				for (int i = 0; i < 12; i++) m[i] = nan;
+			}
+			memcpy(cell, m, sizeof(m));
+		}
+	}
+
+	void encode_missing(const ColumnEntry & col, char *cell)
+	{
+		encode(Dict(), col, cell);
+	}
+
+	/** Write a new index file with room for 'capacity' rows, taking 'rows' rows of each column from data */
+	void write_index(const string & indexfile, const vector<ColumnEntry> & entries, int64_t nrows,
+					 int64_t capacity, const vector< vector<char> > & data, int64_t src_size, int64_t src_mtime,
+					 int64_t src_mtime_ns)
+	{
+		FileHeader hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, INDEX_MAGIC, 8);
+		hdr.byte_order = BYTE_ORDER_MARK;
+		hdr.ncols = (int32_t)entries.size();
+		hdr.nrows = nrows;
+		hdr.capacity = capacity;
+		hdr.src_size = src_size;
+		hdr.src_mtime = src_mtime;
+		hdr.src_mtime_ns = src_mtime_ns;
+
+		vector<ColumnEntry> cols(entries);
+		int64_t offset = sizeof(FileHeader) + cols.size()*sizeof(ColumnEntry);
+		for (size_t i = 0; i < cols.size(); i++) {
+			offset = (offset + 63) / 64 * 64;
+			cols[i].offset = offset;
+			offset += capacity*cols[i].width*4;
+		}
+
+		// write beside the old index and rename, so readers never see a partial file
+		string tmp = indexfile + ".tmp";
+		FILE *f = fopen(tmp.c_str(), "wb");
+		if (!f) throw FileAccessException(tmp);
+
+		bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+		if (ok && !cols.empty()) ok = fwrite(&cols[0], sizeof(ColumnEntry), cols.size(), f) == cols.size();
+
+		for (size_t i = 0; ok && i < cols.size(); i++) {
+			size_t cell = cols[i].width*4;
+			vector<char> block((size_t)(capacity - nrows)*cell);
+			for (int64_t r = nrows; r < capacity; r++) encode_missing(cols[i], &block[(size_t)(r - nrows)*cell]);
+
+			ok = (fseek(f, (long)cols[i].offset, SEEK_SET) == 0);
+			if (ok && nrows > 0) ok = fwrite(&data[i][0], cell, (size_t)nrows, f) == (size_t)nrows;
+			if (ok && !block.empty()) ok = fwrite(&block[0], 1, block.size(), f) == block.size();
+		}
+
+		if (fclose(f) != 0) ok = false;
+		if (!ok || rename(tmp.c_str(), indexfile.c_str()) != 0) {
+			remove(tmp.c_str());
+			throw ImageWriteException(indexfile, "cannot write header index");
+		}
+	}
+}
+
+string HeaderIndex::index_name(const string & filename)
+{
+	return filename + ".hidx";
+}
+
+HeaderIndex::HeaderIndex(const string & fname)
+	: filename(fname), nrows(0), src_size(0), src_mtime(0), src_mtime_ns(0), map(0), map_size(0)
+{
+	string indexfile = index_name(filename);
+	FILE *f = fopen(indexfile.c_str(), "rb");
+	if (!f) throw FileAccessException(indexfile);
+
+	FileHeader hdr;
+	vector<ColumnEntry> entries;
+	bool ok = read_layout(f, hdr, entries);
+	fclose(f);
+	if (!ok) throw ImageReadException(indexfile, "not a header index");
+
+	nrows = hdr.nrows;
+	src_size = hdr.src_size;
+	src_mtime = hdr.src_mtime;
+	src_mtime_ns = hdr.src_mtime_ns;
+
+	int64_t isize = 0, imtime = 0, imtime_ns = 0;
+	stat_file(indexfile, isize, imtime, imtime_ns);
+	map_size = (size_t)isize;
+
+	for (size_t i = 0; i < entries.size(); i++) {
+		Column c;
+		c.name = string(entries[i].name, strnlen(entries[i].name, NAME_LEN));
+		c.type = entries[i].type;
+		c.width = entries[i].width;
+		c.offset = (size_t)entries[i].offset;
+		if (c.offset + (size_t)hdr.capacity*c.width*4 > map_size) throw ImageReadException(indexfile, "truncated header index");
+		columns.push_back(c);
+	}
+
+#ifndef _WIN32
+	int fd = open(indexfile.c_str(), O_RDONLY);
+	if (fd < 0) throw FileAccessException(indexfile);
+	void *m = mmap(0, map_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (m == MAP_FAILED) throw ImageReadException(indexfile, "cannot map header index");
+	map = (char *)m;
+#else
+	// no mmap here; a private copy serves the same queries
+	map = new char[map_size];
+	f = fopen(indexfile.c_str(), "rb");
+	if (!f || fread(map, 1, map_size, f) != map_size) {
+		if (f) fclose(f);
+		delete [] map;
+		throw ImageReadException(indexfile, "cannot read header index");
+	}
+	fclose(f);
+#endif
+}
+
+HeaderIndex::~HeaderIndex()
+{
+#ifndef _WIN32
+	if (map) munmap(map, map_size);
+#else
+	delete [] map;
+#endif
+}
+
+bool HeaderIndex::is_current() const
+{
+	int64_t size = 0, mtime = 0, mtime_ns = 0;
+	if (!stat_file(filename, size, mtime, mtime_ns)) return false;
+	return size == src_size && mtime == src_mtime && mtime_ns == src_mtime_ns;
+}
+
+bool HeaderIndex::has_current_index(const string & filename)
+{
+	int64_t isize = 0, imtime = 0, imtime_ns = 0;
+	if (!stat_file(index_name(filename), isize, imtime, imtime_ns)) return false;
+
+	FILE *f = fopen(index_name(filename).c_str(), "rb");
+	if (!f) return false;
+	FileHeader hdr;
+	bool ok = fread(&hdr, sizeof(hdr), 1, f) == 1 && memcmp(hdr.magic, INDEX_MAGIC, 8) == 0;
+	fclose(f);
+
+	int64_t size = 0, mtime = 0, mtime_ns = 0;
+	return ok && stat_file(filename, size, mtime, mtime_ns) && size == hdr.src_size &&
+		mtime == hdr.src_mtime && mtime_ns == hdr.src_mtime_ns;
+}
+
+vector<string> HeaderIndex::get_keys() const
+{
+	vector<string> keys;
+	for (size_t i = 0; i < columns.size(); i++) keys.push_back(columns[i].name);
+	return keys;
+}
+
+const HeaderIndex::Column & HeaderIndex::find(const string & key) const
+{
+	for (size_t i = 0; i < columns.size(); i++) {
+		if (columns[i].name == key) return columns[i];
+	}
+	throw NotExistingObjectException(key, "not in the header index of " + filename);
+}
+
+int HeaderIndex::get_type(const string & key) const
+{
+	for (size_t i = 0; i < columns.size(); i++) {
+		if (columns[i].name == key) return columns[i].type;
+	}
+	return -1;
+}
+
+int HeaderIndex::get_width(const string & key) const
+{
+	return find(key).width;
+}
+
+const void *HeaderIndex::get_column_data(const string & key) const
+{
+	return map + find(key).offset;
+}
+
+vector<float> HeaderIndex::get_column(const string & key) const
+{
+	const Column & c = find(key);
+	size_t n = (size_t)nrows*c.width;
+	vector<float> ret(n);
+
+	if (c.type == INDEX_INT) {
+		const int32_t *src = (const int32_t *)(map + c.offset);
+		float nan = std::numeric_limits<float>::quiet_NaN();
+		for (size_t i = 0; i < n; i++) ret[i] = (src[i] == INT_MIN ? nan : (float)src[i]);
+	}
+	else if (n > 0) {
+		memcpy(&ret[0], map + c.offset, n*sizeof(float));
+	}
+
+	return ret;
+}
+
+void HeaderIndex::build(const string & filename, const vector<string> & keys)
+{
+	int64_t src_size = 0, src_mtime = 0, src_mtime_ns = 0;
+	if (!stat_file(filename, src_size, src_mtime, src_mtime_ns)) throw FileAccessException(filename);
+
+	ImageIO *imageio = EMUtil::get_imageio(filename, ImageIO::READ_ONLY);
+	if (!imageio) throw ImageFormatException("cannot create an image io");
+
+	vector<ColumnEntry> entries;
+	vector< vector<char> > data;
+	int nimg = 0;
+
+	try {
+		nimg = imageio->get_nimg();
+
+		for (size_t k = 0; k < keys.size(); k++) {
+			if (keys[k].empty() || keys[k].size() >= NAME_LEN) {
+				LOGWARN("HeaderIndex: can't index '%s', keys must be 1-%d characters", keys[k].c_str(), (int)NAME_LEN-1);
+				continue;
+			}
+			ColumnEntry e;
+			memset(&e, 0, sizeof(e));
+			strncpy(e.name, keys[k].c_str(), NAME_LEN-1);
+			e.type = -1;
+			entries.push_back(e);
+		}
+		data.resize(entries.size());
+
+		// headers are read once; a column's type is fixed by the first image with the key,
+		// and rows before that are recoded once the type is known
+		vector<Dict> pending;
+		for (int i = 0; i < nimg; i++) {
+			Dict header;
+			imageio->read_header(header, i, 0, false);
+
+			for (size_t c = 0; c < entries.size(); c++) {
+				ColumnEntry & e = entries[c];
+				if (e.type < 0) {
+					EMObject value;
+					if (!lookup(header, e.name, value) || column_type(value) < 0) continue;
+					e.type = column_type(value);
+					e.width = (e.type == INDEX_TRANSFORM ? 12 : 1);
+					data[c].resize((size_t)nimg*e.width*4);
+					for (int j = 0; j < i; j++) encode_missing(e, &data[c][(size_t)j*e.width*4]);
+				}
+				encode(header, e, &data[c][(size_t)i*e.width*4]);
+			}
+		}
+	}
+	catch (...) {
+		EMUtil::close_imageio(filename, imageio);
+		throw;
+	}
+	EMUtil::close_imageio(filename, imageio);
+
+	// keys no image has become empty float columns
+	for (size_t c = 0; c < entries.size(); c++) {
+		if (entries[c].type >= 0) continue;
+		entries[c].type = INDEX_FLOAT;
+		entries[c].width = 1;
+		data[c].resize((size_t)nimg*4);
+		for (int j = 0; j < nimg; j++) encode_missing(entries[c], &data[c][(size_t)j*4]);
+	}
+
+	int64_t capacity = nimg + nimg/4 + 64;
+	write_index(index_name(filename), entries, nimg, capacity, data, src_size, src_mtime, src_mtime_ns);
+}
+
+void HeaderIndex::update(const string & filename, int image_index, const Dict & header)
+{
+	string indexfile = index_name(filename);
+	FILE *f = fopen(indexfile.c_str(), "r+b");
+	if (!f) return;
+
+	FileHeader hdr;
+	vector<ColumnEntry> cols;
+	if (!read_layout(f, hdr, cols)) {
+		fclose(f);
+		return;
+	}
+
+	int64_t row = (image_index < 0 ? hdr.nrows : image_index);
+	int64_t nrows = (row >= hdr.nrows ? row + 1 : hdr.nrows);
+
+	int64_t src_size = 0, src_mtime = 0, src_mtime_ns = 0;
+	stat_file(filename, src_size, src_mtime, src_mtime_ns);
+
+	if (nrows > hdr.capacity) {
+		// out of room: copy the columns into a larger file
+		vector< vector<char> > data(cols.size());
+		for (size_t c = 0; c < cols.size(); c++) {
+			size_t cell = cols[c].width*4;
+			data[c].resize((size_t)nrows*cell);
+			fseek(f, (long)cols[c].offset, SEEK_SET);
+			if (hdr.nrows > 0 && fread(&data[c][0], cell, (size_t)hdr.nrows, f) != (size_t)hdr.nrows) {
+				fclose(f);
+				throw ImageReadException(indexfile, "truncated header index");
+			}
+			for (int64_t r = hdr.nrows; r < nrows; r++) encode_missing(cols[c], &data[c][(size_t)r*cell]);
+			encode(header, cols[c], &data[c][(size_t)row*cell]);
+		}
+		fclose(f);
+		write_index(indexfile, cols, nrows, nrows*2, data, src_size, src_mtime, src_mtime_ns);
+		return;
+	}
+
+	bool ok = true;
+	char cell[12*4];
+	for (size_t c = 0; ok && c < cols.size(); c++) {
+		encode(header, cols[c], cell);
+		ok = fseek(f, (long)(cols[c].offset + row*cols[c].width*4), SEEK_SET) == 0 &&
+			 fwrite(cell, cols[c].width*4, 1, f) == 1;
+	}
+
+	hdr.nrows = nrows;
+	hdr.src_size = src_size;
+	hdr.src_mtime = src_mtime;
+	hdr.src_mtime_ns = src_mtime_ns;
+	if (ok) ok = fseek(f, 0, SEEK_SET) == 0 && fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+	if (fclose(f) != 0) ok = false;
+
+	if (!ok) throw ImageWriteException(indexfile, "cannot update header index");
+}
@@ -0,0 +1,134 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+#ifndef eman_headerindex_h__
+#define eman_headerindex_h__ 1
+
+#include "emobject.h"
+#include <stdint.h>
+
+namespace EMAN
+{
+	/** HeaderIndex is a columnar sidecar for an image stack, holding selected header
+	 * values for every image so they can be scanned without reading any headers. It
+	 * lives next to the stack as <filename>.hidx and is memory mapped for queries.
+	 *
+	 * Each column is one header key, stored as int32, float32, or the 12 floats of a
+	 * Transform's 3x4 matrix. The type comes from the first image which has the key.
+	 * Sub-fields of a Ctf can be indexed as "ctf.<field>", e.g. "ctf.defocus". Absent
+	 * values are NaN for float and Transform columns, and INT_MIN for int columns.
+	 *
+	 * EMData::write_image() and ImageWriter update the index on every write, as long
+	 * as it was current before the write. It records the stack's size and modification
+	 * time (to the nanosecond where the filesystem keeps it), so an index left behind
+	 * by another writer reports itself as stale through is_current(), and build()
+	 * must be run again.
+	 *
+	 @code
+	 *	HeaderIndex::build("particles.hdf", keys);	// once
+	 *	HeaderIndex idx("particles.hdf");
+	 *	vector<float> defocus = idx.get_column("ctf.defocus");
+	 @endcode
+	 */
+	class HeaderIndex
+	{
+	  public:
+		enum ColumnType { INDEX_INT, INDEX_FLOAT, INDEX_TRANSFORM };
+
+		/** Open and map the index of an image file.
+		 * @exception FileAccessException if there is no readable index
+		 */
+		explicit HeaderIndex(const string & filename);
+		~HeaderIndex();
+
+		/** @return the name of the index file for filename */
+		static string index_name(const string & filename);
+
+		/** Read every header of filename once and write its index.
+		 * @param keys the header keys to index, at most 47 characters each
+		 */
+		static void build(const string & filename, const vector<string> & keys);
+
+		/** @return true if filename has an index which matches the current file */
+		static bool has_current_index(const string & filename);
+
+		/** Store the indexed values of one header. An index of -1 appends. This is done by
+		 * the write paths; call it directly only after writing the image itself.
+		 */
+		static void update(const string & filename, int image_index, const Dict & header);
+
+		/** @return true if the stack hasn't changed since the index was last written */
+		bool is_current() const;
+
+		int get_nimg() const { return (int)nrows; }
+
+		vector<string> get_keys() const;
+
+		/** @return the ColumnType of key, or -1 if key isn't indexed */
+		int get_type(const string & key) const;
+
+		/** @return values per image: 12 for Transform columns, otherwise 1 */
+		int get_width(const string & key) const;
+
+		/** @return the mapped column, get_nimg()*get_width() int32 or float values. It stays
+		 * valid while this HeaderIndex exists.
+		 * @exception NotExistingObjectException if key isn't indexed
+		 */
+		const void *get_column_data(const string & key) const;
+
+		/** @return a copy of the column as floats, int columns converted */
+		vector<float> get_column(const string & key) const;
+
+	  private:
+		struct Column
+		{
+			string name;
+			int type;
+			int width;
+			size_t offset;
+		};
+
+		const Column & find(const string & key) const;
+
+		string filename;
+		int64_t nrows;
+		int64_t src_size;
+		int64_t src_mtime;
+		int64_t src_mtime_ns;
+		vector<Column> columns;
+
+		char *map;
+		size_t map_size;
+
+		// not copyable, owns the mapping
+		HeaderIndex(const HeaderIndex &);
+		HeaderIndex &operator=(const HeaderIndex &);
+	};
+}
+
+#endif	//eman_headerindex_h__
@@ -49,6 +49,19 @@ ImageIO::~ImageIO()
 {
 }
 
+int ImageIO::read_data_block(float *data, int first_index, int n,
+							 size_t image_size, bool is_3d)
+{
+	for (int i = 0; i < n; i++) {
+		int err = read_data(data + image_size * i, first_index + i, 0, is_3d);
+		if (err) {
+			return err;
+		}
+	}
+
+	return 0;
+}
+
 int ImageIO::read_ctf(Ctf &, int)
 {
 	return 1;
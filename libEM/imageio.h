@@ -179,6 +179,23 @@ namespace EMAN
 		virtual int read_data(float *data, int image_index = 0,
 							  const Region * area = 0, bool is_3d = false) = 0;
 
+		/** Read the data of 'n' consecutive images, starting at
+		 * 'first_index', into one array. Formats that store a stack
+		 * contiguously override this to fetch the whole run with a
+		 * single request; the default calls read_data() per image.
+		 *
+		 * @param data An array of n*image_size floats, created outside
+		 *        of this function.
+		 * @param first_index The index of the first image to read.
+		 * @param n Number of images to read.
+		 * @param image_size Number of floats in each image. All n
+		 *        images must have this size.
+		 * @param is_3d As for read_data().
+		 * @return 0 if OK; 1 if error.
+		 */
+		virtual int read_data_block(float *data, int first_index, int n,
+									size_t image_size, bool is_3d = false);
+
 		/** Read the data from an image as an 8 bit array, regardless of format.
 		 *
 		 * @param data An array to store the data. It should be
@@ -254,6 +271,18 @@ namespace EMAN
 			return true;
 		}
 
+		/** Open the file and parse its header now instead of on first
+		 * access. EMUtil::get_imageio() does this for READ_ONLY MRC,
+		 * SPIDER, IMAGIC, HDF5 and .lst files; from then on reading
+		 * never modifies those objects' parsed headers and data are
+		 * read with positional I/O, so one instance may be shared by
+		 * several reader threads.
+		 */
+		void open()
+		{
+			init();
+		}
+
 		/** Convert data of this image into host endian format.
 		 *
 		 * @param data An array of data. It can be any type, short,
@@ -0,0 +1,273 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+#include "imagewriter.h"
+#include "emdata.h"
+#include "headerindex.h"
+#include "imageio.h"
+#include "log.h"
+#include "util.h"
+#include <cstring>
+
+using namespace EMAN;
+
+ImageWriter::ImageWriter(const string & fname, EMUtil::ImageType type,
+						 EMUtil::EMDataType filestoragetype, int maxq)
+	: filename(fname), imgtype(type), storage(filestoragetype),
+	  max_queue(maxq > 0 ? maxq : 1), busy(0), written(0), closing(false), closed(false)
+{
+	if (imgtype == EMUtil::IMAGE_UNKNOWN) {
+		const char *ext = strrchr(filename.c_str(), '.');
+		if (ext) imgtype = EMUtil::get_image_ext_type(ext+1);
+	}
+
+	pthread_mutex_init(&lock, 0);
+	pthread_cond_init(&has_work, 0);
+	pthread_cond_init(&has_room, 0);
+	pthread_cond_init(&done, 0);
+
+	if (pthread_create(&thread, 0, writer_thread, this) != 0) {
+		pthread_cond_destroy(&done);
+		pthread_cond_destroy(&has_room);
+		pthread_cond_destroy(&has_work);
+		pthread_mutex_destroy(&lock);
+		throw ImageWriteException(filename, "cannot start writer thread");
+	}
+}
+
+ImageWriter::~ImageWriter()
+{
+	try {
+		close();
+	}
+	catch (E2Exception & e) {
+		LOGERR("ImageWriter: %s", e.what());
+	}
+
+	pthread_cond_destroy(&done);
+	pthread_cond_destroy(&has_room);
+	pthread_cond_destroy(&has_work);
+	pthread_mutex_destroy(&lock);
+}
+
+void *ImageWriter::writer_thread(void *arg)
+{
+	static_cast < ImageWriter * >(arg)->run();
+	return 0;
+}
+
+void ImageWriter::run()
+{
+	vector<Job> batch;
+
+	pthread_mutex_lock(&lock);
+	while (true) {
+		while (queue.empty() && !closing) pthread_cond_wait(&has_work, &lock);
+		if (queue.empty()) break;
+
+		batch.assign(queue.begin(), queue.end());
+		queue.clear();
+		busy = batch.size();
+		pthread_cond_broadcast(&has_room);
+
+		size_t nwritten = 0;
+		bool skip = !error.empty();
+		pthread_mutex_unlock(&lock);
+
+		// after a failure nothing more is written, so the file ends at the last good image
+		string failure;
+		if (!skip) {
+			try {
+				write_batch(batch, nwritten);
+			}
+			catch (E2Exception & e) {
+				failure = e.what();
+			}
+			catch (std::exception & e) {
+				failure = e.what();
+			}
+			catch (...) {
+				failure = "unknown error";
+			}
+		}
+		for (size_t i = 0; i < batch.size(); i++) delete batch[i].image;
+
+		pthread_mutex_lock(&lock);
+		written += (int)nwritten;
+		if (!failure.empty() && error.empty()) {
+			error = "writing image " + Util::int2str(written) + " (counting from 0) failed: " + failure;
+		}
+		if (nwritten < batch.size()) {
+			LOGERR("ImageWriter: %d image(s) not written to %s", (int)(batch.size() - nwritten), filename.c_str());
+		}
+		busy = 0;
+		pthread_cond_broadcast(&done);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void ImageWriter::write_batch(const vector<Job> & batch, size_t & nwritten)
+{
+	bool single = (imgtype == EMUtil::IMAGE_LST || imgtype == EMUtil::IMAGE_LSTFAST);
+	ImageIO *imageio = 0;
+	if (!single) {
+		imageio = EMUtil::get_imageio(filename, ImageIO::READ_WRITE, imgtype);
+		if (!imageio) throw ImageFormatException("cannot create an image io");
+		single = imageio->is_single_image_format();
+		if (single) {
+			EMUtil::close_imageio(filename, imageio);
+			imageio = 0;
+		}
+	}
+
+	// write_image reopens single-image files in WRITE_ONLY mode and knows the LST layout
+	if (single) {
+		for (nwritten = 0; nwritten < batch.size(); nwritten++) {
+			EMData *image = batch[nwritten].image;
+			image->write_image(filename, batch[nwritten].index, imgtype, false, 0, storage);
+		}
+		return;
+	}
+
+	bool indexed = HeaderIndex::has_current_index(filename);
+	vector<Dict> headers;
+
+	try {
+		for (nwritten = 0; nwritten < batch.size(); nwritten++) {
+			EMData *image = batch[nwritten].image;
+			if (image->is_complex() && image->is_shuffled()) image->fft_shuffle();
+
+			Dict attr = image->get_attr_dict();
+			switch (storage) {
+			case EMUtil::EM_UINT:
+			case EMUtil::EM_USHORT:
+			case EMUtil::EM_SHORT:
+			case EMUtil::EM_CHAR:
+			case EMUtil::EM_UCHAR:
+				attr["datatype"] = (int)storage;
+				break;
+			default:
+				attr["datatype"] = (int)EMUtil::EM_FLOAT;
+			}
+
+			if (imageio->write_header(attr, batch[nwritten].index, 0, storage, true)) {
+				throw ImageWriteException(filename, "imageio write header failed");
+			}
+			if (imageio->write_data(image->get_data(), batch[nwritten].index, 0, storage, true)) {
+				throw ImageWriteException(filename, "imageio write data failed");
+			}
+			if (indexed) headers.push_back(attr);
+		}
+	}
+	catch (...) {
+		imageio->flush();
+		EMUtil::close_imageio(filename, imageio, indexed);
+		for (size_t i = 0; i < headers.size(); i++) HeaderIndex::update(filename, batch[i].index, headers[i]);
+		throw;
+	}
+
+	imageio->flush();
+	EMUtil::close_imageio(filename, imageio, indexed);
+	for (size_t i = 0; i < headers.size(); i++) HeaderIndex::update(filename, batch[i].index, headers[i]);
+}
+
+void ImageWriter::write(EMData * image, int img_index, bool copy)
+{
+	if (!image) throw NullPointerException("ImageWriter: NULL image");
+
+	// snapshot outside the lock so the writer thread isn't held up by the copy
+	EMData *queued = copy ? image->copy() : image;
+
+	pthread_mutex_lock(&lock);
+	while (queue.size() >= max_queue && !closing) pthread_cond_wait(&has_room, &lock);
+	if (closing) {
+		pthread_mutex_unlock(&lock);
+		delete queued;	// ours either way, the copy or the image handed over
+		throw ImageWriteException(filename, "ImageWriter is closed");
+	}
+
+	Job job;
+	job.image = queued;
+	job.index = img_index;
+	queue.push_back(job);
+	pthread_cond_signal(&has_work);
+	pthread_mutex_unlock(&lock);
+}
+
+void ImageWriter::check_error()
+{
+	if (!error.empty()) {
+		string msg = error;
+		pthread_mutex_unlock(&lock);
+		throw ImageWriteException(filename, msg);
+	}
+}
+
+void ImageWriter::flush()
+{
+	pthread_mutex_lock(&lock);
+	while (!queue.empty() || busy > 0) pthread_cond_wait(&done, &lock);
+	check_error();
+	pthread_mutex_unlock(&lock);
+}
+
+void ImageWriter::close()
+{
+	pthread_mutex_lock(&lock);
+	if (closed) {
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	closing = true;
+	closed = true;
+	pthread_cond_broadcast(&has_work);
+	pthread_cond_broadcast(&has_room);
+	pthread_mutex_unlock(&lock);
+
+	pthread_join(thread, 0);
+
+	pthread_mutex_lock(&lock);
+	check_error();
+	pthread_mutex_unlock(&lock);
+}
+
+int ImageWriter::get_pending()
+{
+	pthread_mutex_lock(&lock);
+	int n = (int)(queue.size() + busy);
+	pthread_mutex_unlock(&lock);
+	return n;
+}
+
+int ImageWriter::get_written()
+{
+	pthread_mutex_lock(&lock);
+	int n = written;
+	pthread_mutex_unlock(&lock);
+	return n;
+}
@@ -0,0 +1,148 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+#ifndef eman_imagewriter_h__
+#define eman_imagewriter_h__ 1
+
+#include "emutil.h"
+#include <deque>
+#include <pthread.h>
+
+namespace EMAN
+{
+	class EMData;
+
+	/** ImageWriter writes images to one file on a background thread, so the caller
+	 * can go on computing while earlier results reach the disk. Each write() queues
+	 * the image and returns; the writer thread takes everything queued so far and
+	 * writes it as one batch through a single open ImageIO, flushing once per batch
+	 * rather than once per image as EMData::write_image does.
+	 *
+	 * The queue holds at most max_queue images. When it is full, write() blocks until
+	 * the writer catches up, which bounds memory if the disk is slower than the
+	 * producer.
+	 *
+	 * Write errors happen on the writer thread and can't be thrown from write(). The
+	 * first failure is kept, any later images are discarded, and the failure is thrown
+	 * by the next flush() or close(). The destructor closes the writer but can only log
+	 * an error, so call close() explicitly when the result matters.
+	 *
+	 @code
+	 *	ImageWriter out("particles.hdf");
+	 *	for (...) {
+	 *		EMData *ptcl=...;
+	 *		out.write(ptcl,-1,false);	// writer takes ownership
+	 *	}
+	 *	out.close();
+	 @endcode
+	 */
+	class ImageWriter
+	{
+	  public:
+		/** @param filename output file. The format follows the extension unless imgtype is given.
+		 * @param imgtype output format
+		 * @param filestoragetype data type stored in the file, as for EMData::write_image
+		 * @param max_queue number of images which may wait to be written
+		 * @exception ImageWriteException if the writer thread can't be started
+		 */
+		explicit ImageWriter(const string & filename,
+							 EMUtil::ImageType imgtype = EMUtil::IMAGE_UNKNOWN,
+							 EMUtil::EMDataType filestoragetype = EMUtil::EM_FLOAT,
+							 int max_queue = 32);
+		~ImageWriter();
+
+		/** Queue an image for writing.
+		 * @param image image to write
+		 * @param img_index position in the file, -1 to append
+		 * @param copy if true a snapshot of image is queued and the caller keeps it. If false
+		 *   the writer takes ownership and deletes image once it has been written, or
+		 *   at once if the writer is closed.
+		 * @exception ImageWriteException if the writer is closed
+		 */
+		void write(EMData * image, int img_index = -1, bool copy = true);
+
+		/** Wait until every queued image has been written.
+		 * @exception ImageWriteException if any write has failed
+		 */
+		void flush();
+
+		/** Write everything still queued and stop the writer thread. Further calls do nothing.
+		 * @exception ImageWriteException if any write has failed
+		 */
+		void close();
+
+		/** @return the number of images queued or being written */
+		int get_pending();
+
+		/** @return the number of images written so far */
+		int get_written();
+
+	  private:
+		struct Job
+		{
+			EMData *image;
+			int index;
+		};
+
+		static void *writer_thread(void *writer);
+
+		void run();
+
+		/** Write a batch through one ImageIO, or image by image for single-image formats.
+		 * nwritten counts the images written before any exception.
+		 */
+		void write_batch(const vector<Job> & batch, size_t & nwritten);
+
+		/** Throw the stored error, if any. Call with the lock held; it is released before throwing. */
+		void check_error();
+
+		string filename;
+		EMUtil::ImageType imgtype;
+		EMUtil::EMDataType storage;
+		size_t max_queue;
+
+		std::deque<Job> queue;
+		size_t busy;
+		int written;
+		bool closing;
+		bool closed;
+		string error;
+
+		pthread_t thread;
+		pthread_mutex_t lock;
+		pthread_cond_t has_work;
+		pthread_cond_t has_room;
+		pthread_cond_t done;
+
+		// not copyable, owns the writer thread and the queued images
+		ImageWriter(const ImageWriter &);
+		ImageWriter &operator=(const ImageWriter &);
+	};
+}
+
+#endif	//eman_imagewriter_h__
@@ -35,6 +35,7 @@
 
 #include <cstring>
 #include <climits>
+#include <algorithm>
 #include "imagicio2.h"
 #include "portable_fileio.h"
 #include "util.h"
@@ -233,16 +234,21 @@ int ImagicIO2::read_header(Dict & dict, int image_index, const Region * area, bo
 	}
 	else {
 		memset(&hed, 0, sizeof(Imagic4D));
-		portable_fseek(hed_file, sizeof(Imagic4D) * image_index, SEEK_SET);
-		fread(&hed, sizeof(Imagic4D), 1, hed_file);
+
+		if (rw_mode == READ_ONLY) {
+			portable_pread(hed_file, &hed, sizeof(Imagic4D), sizeof(Imagic4D) * image_index);
+		}
+		else {
+			portable_fseek(hed_file, sizeof(Imagic4D) * image_index, SEEK_SET);
+			fread(&hed, sizeof(Imagic4D), 1, hed_file);
+		}
+
 		make_header_host_endian(hed);
 	}
 
 	int nz = hed.izlp ? hed.izlp : 1;
 	check_region(area, FloatSize(hed.nx, hed.ny, nz), is_new_hed, false);
 
-    datatype = get_datatype_from_name(imagich.type);
-
 	int xlen = 0, ylen = 0, zlen = 0;
 	EMUtil::get_region_dims(area, hed.nx, &xlen, hed.ny, &ylen, nz, &zlen);
 
@@ -714,15 +720,21 @@ int ImagicIO2::read_data(float* data, int image_index, EMAN::Region const* area,
 
 	check_region(area, FloatSize(nx, ny, nz), is_new_hed, false);
 
-	portable_fseek(img_file, img_size*image_index*sizeof(float), SEEK_SET);
+	off_t offset = img_size*image_index*sizeof(float);
+
+	if (rw_mode != READ_ONLY) {
+		portable_fseek(img_file, offset, SEEK_SET);
+		offset = -1;
+	}
 
 	short *sdata = (short *) data;
 	unsigned char *cdata = (unsigned char *) data;
 	size_t mode_size = get_datatype_size(datatype);
 
-	/**The image_index option does not work in EMUtil::process_region_io(), so I set the
-	 * file pointer to the right place before actually read data*/
-	EMUtil::process_region_io(cdata, img_file, READ_ONLY, 0, mode_size, nx, ny, nz, area, true);
+	/**The image_index option does not work in EMUtil::process_region_io(), so I pass the
+	 * offset of the image (or set the file pointer there) before actually read data*/
+	EMUtil::process_region_io(cdata, img_file, READ_ONLY, 0, mode_size, nx, ny, nz, area, true,
+							  EMUtil::IMAGE_UNKNOWN, 0, 0, offset);
 
 	if (datatype == IMAGIC_FLOAT) {
 		become_host_endian(data, img_size);
@@ -742,6 +754,56 @@ int ImagicIO2::read_data(float* data, int image_index, EMAN::Region const* area,
 	return 0;
 }
 
+int ImagicIO2::read_data_block(float *data, int first_index, int n,
+							   size_t image_size, bool is_3d)
+{
+	ENTERFUNC;
+
+	check_read_access(first_index, data);
+
+	int nx = imagich.ny;
+	int ny = imagich.nx;
+	int nz = imagich.izlp ? imagich.izlp : 1;
+	size_t img_size = (size_t)nx*ny*nz;
+
+	if (datatype != IMAGIC_FLOAT || image_size != img_size || n <= 1) {
+		return ImageIO::read_data_block(data, first_index, n, image_size, is_3d);
+	}
+
+	check_read_access(first_index + n - 1);
+
+	size_t nbytes = img_size * n * sizeof(float);
+	off_t offset = img_size*first_index*sizeof(float);
+	size_t nread = 0;
+
+	if (rw_mode == READ_ONLY) {
+		nread = portable_pread(img_file, data, nbytes, offset);
+	}
+	else {
+		portable_fseek(img_file, offset, SEEK_SET);
+		nread = fread(data, 1, nbytes, img_file);
+	}
+
+	if (nread != nbytes) {
+		throw ImageReadException(img_filename, "incomplete data read");
+	}
+
+	// IMAGIC stores rows bottom to top; flip each section as read_data() does
+	size_t nsec = (size_t)nz * n;
+	for (size_t k = 0; k < nsec; k++) {
+		float *sec = data + k * nx * ny;
+		for (int j = 0; j < ny / 2; j++) {
+			std::swap_ranges(sec + (size_t)j * nx, sec + (size_t)(j + 1) * nx,
+							 sec + (size_t)(ny - 1 - j) * nx);
+		}
+	}
+
+	become_host_endian(data, img_size * n);
+
+	EXITFUNC;
+	return 0;
+}
+
 int ImagicIO2::get_nimg()
 {
 	init();
@@ -99,6 +99,11 @@ namespace EMAN
 		 *
 		 * @return number of images*/
 		int get_nimg();
+
+		/** Images in the .img file are contiguous, so a run of float
+		 * images is read with one request. */
+		int read_data_block(float *data, int first_index, int n,
+							size_t image_size, bool is_3d = false);
 		
 	  private:
 		static const char *REAL_TYPE_MAGIC;
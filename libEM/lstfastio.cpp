@@ -46,6 +46,7 @@
 #include <cstdio>
 #include <cstring>
 #include "lstfastio.h"
+#include "portable_fileio.h"
 #include "util.h"
 
 
@@ -59,10 +60,6 @@ LstFastIO::LstFastIO(const string & file, IOMode rw)
 	is_big_endian = ByteOrder::is_host_big_endian();
 	initialized = false;
 	nimg = 0;
-	imageio = 0;
-	ref_filename = "";
-	last_lst_index = -1;
-	last_ref_index = -1;
 }
 
 LstFastIO::~LstFastIO()
@@ -71,11 +68,6 @@ LstFastIO::~LstFastIO()
 		fclose(lst_file);
 		lst_file = 0;
 	}
-	ref_filename = "";
-	if(imageio) {
-		delete imageio;
-		imageio = 0;
-	}
 }
 
 void LstFastIO::init()
@@ -129,70 +121,39 @@ bool LstFastIO::is_valid(const void *first_block)
 	return result;
 }
 
-int LstFastIO::calc_ref_image_index(int image_index)
+int LstFastIO::calc_ref_image_index(int image_index, string & ref_filename)
 {
-	if (image_index == last_lst_index) {
-		return last_ref_index;
+	char buf[MAXPATHLEN];
+	size_t len = line_length < MAXPATHLEN ? line_length : MAXPATHLEN - 1;
+	off_t offset = head_length + (off_t) line_length * image_index;
+	size_t n = 0;
+
+	// Each line sits at a fixed offset, so READ_ONLY lists are read
+	// positionally and any number of threads can look up images at once.
+	if (rw_mode == READ_ONLY) {
+		n = portable_pread(lst_file, buf, len, offset);
 	}
 	else {
-		char buf[MAXPATHLEN];
-
-		fseek(lst_file,head_length+line_length*image_index,SEEK_SET);
-		if (!fgets(buf, MAXPATHLEN, lst_file)) {
-			LOGERR("reach EOF in file '%s' before reading %dth image",
-				   filename.c_str(), image_index);
-			return 1;
-		}
+		portable_fseek(lst_file, offset, SEEK_SET);
+		n = fread(buf, 1, len, lst_file);
+	}
 
-		int ref_image_index = 0;
-		char ref_image_path[MAXPATHLEN];
-		char unused[256];
-		sscanf(buf, " %d %s %[ .,0-9-]", &ref_image_index, ref_image_path, unused);
+	if (n == 0) {
+		char desc[256];
+		sprintf(desc, "reached EOF before reading image %d", image_index);
+		throw ImageReadException(filename, desc);
+	}
 
-		char fullpath[MAXPATHLEN];
+	buf[n] = '\0';
 
-		char sep = '/';
-#ifdef WIN32
-		sep = '\\';
-#endif
-// 		if (ref_image_path[0] == sep) {
-			strcpy(fullpath, ref_image_path);
-// 		}
-// 		else {
-// 			if (strrchr(filename.c_str(), sep)) {
-// 				strcpy(fullpath, filename.c_str());
-// 			}
-// 			else {
-// #ifndef WIN32
-// 				getcwd(fullpath, MAXPATHLEN);
-// #else
-// 				//GetCurrentDirectory(MAXPATHLEN, fullpath);
-// #endif
-// 			}
-// 
-// 			char *p_basename = strrchr(fullpath, sep);
-// 			if (p_basename) {
-// 				//p_basename++;
-// 				//*p_basename = '\0';
-// 				char ssep[2];
-// 				ssep[0] = sep;
-// 				ssep[1] = '\0';
-// 				strcat(fullpath, ssep);
-// 				strcat(fullpath, ref_image_path);
-// 			}
-// 		}
-
-		ref_filename = string(fullpath);
-		if (!Util::is_file_exist(ref_filename)) throw FileAccessException(ref_filename);
-		imageio = EMUtil::get_imageio(ref_filename, rw_mode);
-
-		last_ref_index = ref_image_index;
-	}
-//	printf("%d\t%d\t%s\n",image_index,last_ref_index,ref_filename.c_str());
+	int ref_image_index = 0;
+	char ref_image_path[MAXPATHLEN];
+	char unused[256];
+	sscanf(buf, " %d %s %[ .,0-9-]", &ref_image_index, ref_image_path, unused);
 
-	last_lst_index = image_index;
+	ref_filename = string(ref_image_path);
 
-	return last_ref_index;
+	return ref_image_index;
 }
 
 
@@ -200,8 +161,9 @@ int LstFastIO::read_header(Dict & dict, int image_index, const Region * area, bo
 {
 	ENTERFUNC;
 	check_read_access(image_index);
-	int ref_image_index = calc_ref_image_index(image_index);
-	int err = imageio->read_header(dict, ref_image_index, area, is_3d);
+	string ref_filename;
+	int ref_image_index = calc_ref_image_index(image_index, ref_filename);
+	int err = refs.read_header(ref_filename, dict, ref_image_index, area, is_3d);
 	dict.put("data_source",ref_filename);
 	dict.put("data_n",ref_image_index);
 	EXITFUNC;
@@ -220,8 +182,9 @@ int LstFastIO::read_data(float *data, int image_index, const Region * area, bool
 {
 	ENTERFUNC;
 	check_read_access(image_index, data);
-	int ref_image_index = calc_ref_image_index(image_index);
-	int err = imageio->read_data(data, ref_image_index, area, is_3d);
+	string ref_filename;
+	int ref_image_index = calc_ref_image_index(image_index, ref_filename);
+	int err = refs.read_data(ref_filename, data, ref_image_index, area, is_3d);
 	EXITFUNC;
 	return err;
 }
@@ -36,7 +36,7 @@
 #ifndef eman__lstiofast_h__
 #define eman__lstiofast_h__ 1
 
-#include "imageio.h"
+#include "lstio.h"
 
 namespace EMAN
 {
@@ -80,13 +80,9 @@ namespace EMAN
 		unsigned int line_length;
 		unsigned int head_length;
 
-		ImageIO *imageio;
-		string ref_filename;
+		LstReferences refs;
 
-		int last_lst_index;
-		int last_ref_index;
-
-		int calc_ref_image_index(int image_index);
+		int calc_ref_image_index(int image_index, string & ref_filename);
 		static const char *MAGIC;
 	};
 
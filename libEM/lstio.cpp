@@ -46,6 +46,7 @@
 #include <cstdio>
 #include <cstring>
 #include "lstio.h"
+#include "portable_fileio.h"
 #include "util.h"
 
 
@@ -53,16 +54,129 @@ using namespace EMAN;
 
 const char *LstIO::MAGIC = "#LST";
 
+LstReferences::LstReferences()
+{
+	Util::MUTEX_INIT(&mutex);
+}
+
+LstReferences::~LstReferences()
+{
+	for (map < string, Entry >::iterator it = files.begin(); it != files.end(); ++it) {
+		EMUtil::close_imageio(it->first, it->second.imageio);
+	}
+	files.clear();
+}
+
+ImageIO *LstReferences::acquire(const string & path)
+{
+	Util::MUTEX_LOCK(&mutex);
+
+	map < string, Entry >::iterator it = files.find(path);
+
+	if (it == files.end()) {
+		ImageIO *imageio = 0;
+
+		try {
+			if (!Util::is_file_exist(path)) {
+				throw FileAccessException(path);
+			}
+
+			imageio = EMUtil::get_imageio(path, ImageIO::READ_ONLY);
+
+			if (!imageio) {
+				throw ImageFormatException("unsupported image format in " + path);
+			}
+		}
+		catch (...) {
+			Util::MUTEX_UNLOCK(&mutex);
+			throw;
+		}
+
+		// Close files nobody is reading before opening one more than MAX_OPEN
+		if (files.size() >= MAX_OPEN) {
+			map < string, Entry >::iterator old = files.begin();
+
+			while (old != files.end()) {
+				if (old->second.users == 0) {
+					EMUtil::close_imageio(old->first, old->second.imageio);
+					files.erase(old++);
+				}
+				else {
+					++old;
+				}
+			}
+		}
+
+		Entry e;
+		e.imageio = imageio;
+		e.users = 0;
+		it = files.insert(std::make_pair(path, e)).first;
+	}
+
+	it->second.users++;
+	ImageIO *imageio = it->second.imageio;
+
+	Util::MUTEX_UNLOCK(&mutex);
+
+	return imageio;
+}
+
+void LstReferences::release(const string & path)
+{
+	Util::MUTEX_LOCK(&mutex);
+
+	map < string, Entry >::iterator it = files.find(path);
+
+	if (it != files.end()) {
+		it->second.users--;
+	}
+
+	Util::MUTEX_UNLOCK(&mutex);
+}
+
+int LstReferences::read_header(const string & path, Dict & dict, int image_index,
+							   const Region * area, bool is_3d)
+{
+	ImageIO *imageio = acquire(path);
+	int err = 0;
+
+	try {
+		err = imageio->read_header(dict, image_index, area, is_3d);
+	}
+	catch (...) {
+		release(path);
+		throw;
+	}
+
+	release(path);
+	return err;
+}
+
+int LstReferences::read_data(const string & path, float *data, int image_index,
+							 const Region * area, bool is_3d)
+{
+	ImageIO *imageio = acquire(path);
+	int err = 0;
+
+	try {
+		err = imageio->read_data(data, image_index, area, is_3d);
+	}
+	catch (...) {
+		release(path);
+		throw;
+	}
+
+	release(path);
+	return err;
+}
+
+
 LstIO::LstIO(const string & file, IOMode rw)
 :	filename(file), rw_mode(rw), lst_file(0)
 {
 	is_big_endian = ByteOrder::is_host_big_endian();
 	initialized = false;
 	nimg = 0;
-	imageio = 0;
-	ref_filename = "";
-	last_lst_index = -1;
-	last_ref_index = -1;
 }
 
 LstIO::~LstIO()
@@ -71,11 +185,6 @@ LstIO::~LstIO()
 		fclose(lst_file);
 		lst_file = 0;
 	}
-	ref_filename = "";
-	if(imageio) {
-		delete imageio;
-		imageio = 0;
-	}
 }
 
 void LstIO::init()
@@ -102,11 +211,15 @@ void LstIO::init()
 			throw ImageReadException(filename, "invalid LST file");
 		}
 
-		for (nimg = 0; fgets(buf, MAXPATHLEN, lst_file) != 0; nimg++) {
-			if (buf[0] == '#') {
-				nimg--;
+		off_t offset = portable_ftell(lst_file);
+
+		while (fgets(buf, MAXPATHLEN, lst_file) != 0) {
+			if (buf[0] != '#') {
+				line_offsets.push_back(offset);
 			}
+			offset = portable_ftell(lst_file);
 		}
+		nimg = (int)line_offsets.size();
 		rewind(lst_file);
 	}
 	EXITFUNC;
@@ -128,77 +241,37 @@ bool LstIO::is_valid(const void *first_block)
 	return result;
 }
 
-int LstIO::calc_ref_image_index(int image_index)
+int LstIO::calc_ref_image_index(int image_index, string & ref_filename)
 {
-	if (image_index == last_lst_index) {
-		return last_ref_index;
-	}
-	else {
-		char buf[MAXPATHLEN];
-		int step = image_index - last_lst_index;
+	char buf[MAXPATHLEN];
+	size_t n = 0;
 
-		if (step < 0) {
-			rewind(lst_file);
-			step = image_index + 1;
+	if (image_index >= 0 && image_index < (int)line_offsets.size()) {
+		if (rw_mode == READ_ONLY) {
+			n = portable_pread(lst_file, buf, MAXPATHLEN - 1, line_offsets[image_index]);
 		}
-
-		for (int i = 0; i < step; i++) {
-			if (!fgets(buf, MAXPATHLEN, lst_file)) {
-				LOGERR("reach EOF in file '%s' before reading %dth image",
-					   filename.c_str(), image_index);
-				return 1;
-			}
-			if (buf[0] == '#') {
-				i--;
-			}
+		else {
+			portable_fseek(lst_file, line_offsets[image_index], SEEK_SET);
+			n = fread(buf, 1, MAXPATHLEN - 1, lst_file);
 		}
-		int ref_image_index = 0;
-		char ref_image_path[MAXPATHLEN];
-		char unused[256];
-		sscanf(buf, " %d %s %[ .,0-9-]", &ref_image_index, ref_image_path, unused);
-
-		char fullpath[MAXPATHLEN];
+	}
 
-		char sep = '/';
-#ifdef WIN32
-		sep = '\\';
-#endif
-// 		if (ref_image_path[0] == sep) {
-			strcpy(fullpath, ref_image_path);
-// 		}
-// 		else {
-// 			if (strrchr(filename.c_str(), sep)) {
-// 				strcpy(fullpath, filename.c_str());
-// 			}
-// 			else {
-// #ifndef WIN32
-// 				getcwd(fullpath, MAXPATHLEN);
-// #else
-// 				//GetCurrentDirectory(MAXPATHLEN, fullpath);
-// #endif
-// 			}
-// 
-// 			char *p_basename = strrchr(fullpath, sep);
-// 			if (p_basename) {
-// 				//p_basename++;
-// 				//*p_basename = '\0';
-// 				char ssep[2];
-// 				ssep[0] = sep;
-// 				ssep[1] = '\0';
-// 				strcat(fullpath, ssep);
-// 				strcat(fullpath, ref_image_path);
-// 			}
-// 		}
-
-		ref_filename = string(fullpath);
-		imageio = EMUtil::get_imageio(ref_filename, rw_mode);
-
-		last_ref_index = ref_image_index;
+	if (n == 0) {
+		char desc[256];
+		sprintf(desc, "reached EOF before reading image %d", image_index);
+		throw ImageReadException(filename, desc);
 	}
 
-	last_lst_index = image_index;
+	buf[n] = '\0';
+
+	int ref_image_index = 0;
+	char ref_image_path[MAXPATHLEN];
+	char unused[256];
+	sscanf(buf, " %d %s %[ .,0-9-]", &ref_image_index, ref_image_path, unused);
+
+	ref_filename = string(ref_image_path);
 
-	return last_ref_index;
+	return ref_image_index;
 }
 
 
@@ -207,8 +280,9 @@ int LstIO::read_header(Dict & dict, int image_index, const Region * area, bool i
 	ENTERFUNC;
 	init();
 	check_read_access(image_index);
-	int ref_image_index = calc_ref_image_index(image_index);
-	int err = imageio->read_header(dict, ref_image_index, area, is_3d);
+	string ref_filename;
+	int ref_image_index = calc_ref_image_index(image_index, ref_filename);
+	int err = refs.read_header(ref_filename, dict, ref_image_index, area, is_3d);
 	dict["source_path"] = ref_filename;
 	EXITFUNC;
 	return err;
@@ -227,8 +301,9 @@ int LstIO::read_data(float *data, int image_index, const Region * area, bool is_
 {
 	ENTERFUNC;
 	check_read_access(image_index, data);
-	int ref_image_index = calc_ref_image_index(image_index);
-	int err = imageio->read_data(data, ref_image_index, area, is_3d);
+	string ref_filename;
+	int ref_image_index = calc_ref_image_index(image_index, ref_filename);
+	int err = refs.read_data(ref_filename, data, ref_image_index, area, is_3d);
 	EXITFUNC;
 	return err;
 }
@@ -37,9 +37,59 @@
 #define eman__lstio_h__ 1
 
 #include "imageio.h"
+#include "util.h"
+#include <map>
+#include <vector>
+
+using std::map;
+using std::vector;
 
 namespace EMAN
 {
+	/** The image files referenced by a LST or LSX file. Each file is opened
+	 * (READ_ONLY) on first use and then shared by every reader of the list;
+	 * files no reader is using are closed once more than MAX_OPEN are open.
+	 * All methods are thread-safe.
+	 */
+	class LstReferences
+	{
+	  public:
+		LstReferences();
+		~LstReferences();
+
+		/** Read a header from image 'image_index' of the file 'path'.
+		 * @exception FileAccessException if the file doesn't exist.
+		 */
+		int read_header(const string & path, Dict & dict, int image_index,
+						const Region * area, bool is_3d);
+
+		/** Read image 'image_index' of the file 'path'.
+		 * @exception FileAccessException if the file doesn't exist.
+		 */
+		int read_data(const string & path, float *data, int image_index,
+					  const Region * area, bool is_3d);
+
+		static const size_t MAX_OPEN = 32;
+
+	  private:
+		struct Entry
+		{
+			ImageIO *imageio;
+			int users;
+		};
+
+		map < string, Entry > files;
+		MUTEX mutex;
+
+		/** The ImageIO for 'path', opened if needed. It stays open until
+		 * the matching release(). */
+		ImageIO *acquire(const string & path);
+		void release(const string & path);
+
+		LstReferences(const LstReferences &);
+		LstReferences & operator=(const LstReferences &);
+	};
+
 	/** A LST file is an ASCII file that contains a list of image
 	 * file names. Each line of a LST file has the following format:
 	 * reference_image_index  reference-image-filename comments
@@ -69,13 +119,11 @@ namespace EMAN
 		bool initialized;
 		int nimg;
 
-		ImageIO *imageio;
-		string ref_filename;
-
-		int last_lst_index;
-		int last_ref_index;
+		/** Offset of each image's line, so lookups don't depend on the file position. */
+		vector < off_t > line_offsets;
+		LstReferences refs;
 
-		int calc_ref_image_index(int image_index);
+		int calc_ref_image_index(int image_index, string & ref_filename);
 		static const char *MAGIC;
 	};
 
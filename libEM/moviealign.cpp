@@ -0,0 +1,585 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+#include "moviealign.h"
+#include "emdata.h"
+#include "parallel.h"
+#include "processor.h"
+#include "util.h"
+#include <cmath>
+#include <cstdio>
+#include <complex>
+#include <algorithm>
+
+using namespace EMAN;
+
+namespace {
+	/** Solve m x = b for symmetric positive definite m (n x n, row major) by
+	 * Cholesky decomposition. m is overwritten. b holds 'nrhs' right hand sides
+	 * of length n, one after another, and is replaced by the solutions. */
+	void cholesky_solve(vector<double> &m, vector<double> &b, int n, int nrhs)
+	{
+		for (int j = 0; j < n; j++) {
+			double d = m[j*n+j];
+			for (int k = 0; k < j; k++) d -= m[j*n+k]*m[j*n+k];
+			if (d <= 0) throw InvalidValueException(j, "MovieAligner: singular trajectory fit");
+			d = sqrt(d);
+			m[j*n+j] = d;
+			for (int i = j+1; i < n; i++) {
+				double s = m[i*n+j];
+				for (int k = 0; k < j; k++) s -= m[i*n+k]*m[j*n+k];
+				m[i*n+j] = s/d;
+			}
+		}
+
+		for (int r = 0; r < nrhs; r++) {
+			double *x = &b[r*n];
+			for (int i = 0; i < n; i++) {
+				for (int k = 0; k < i; k++) x[i] -= m[i*n+k]*x[k];
+				x[i] /= m[i*n+i];
+			}
+			for (int i = n-1; i >= 0; i--) {
+				for (int k = i+1; k < n; k++) x[i] -= m[k*n+i]*x[k];
+				x[i] /= m[i*n+i];
+			}
+		}
+	}
+
+	/** Critical exposure (e/A^2) at spatial frequency s (1/A), Grant & Grigorieff 2015, at 300 kV */
+	inline float critical_exposure(float s)
+	{
+		return 0.245f*pow(s, -1.665f) + 2.81f;
+	}
+}
+
+// Gain/dark correction, one frame per item
+class MovieAligner::CorrectTask : public ParallelTask {
+  public:
+	CorrectTask(const vector<EMData *> &f, const EMData *d, const EMData *g) : frames(f), dark(d), gain(g) {}
+
+	void run(size_t begin, size_t end, int) {
+		for (size_t i = begin; i < end; i++) {
+			if (dark) frames[i]->sub(*dark);
+			if (gain) frames[i]->mult(*gain);
+		}
+	}
+
+  private:
+	const vector<EMData *> &frames;
+	const EMData *dark;
+	const EMData *gain;
+};
+
+// Shrinks one frame per item, then transforms and filters its tiles. The tile
+// transforms of frame i are stored one after another in out[i].
+class MovieAligner::TileTask : public ParallelTask {
+  public:
+	TileTask(const vector<EMData *> &f, int s, int b, const vector<int> &o, float hp, vector< vector<float> > &t) :
+		frames(f), shrink(s), box(b), origins(o), highpass(hp), out(t) {}
+
+	void run(size_t begin, size_t end, int) {
+		int nxc = box+2;
+		size_t tsize = (size_t)nxc*box;
+
+		for (size_t i = begin; i < end; i++) {
+			EMData *img = frames[i];
+			if (shrink > 1) img = img->process("math.meanshrink", Dict("n", (float)shrink));
+
+			vector<float> &tiles = out[i];
+			tiles.resize(tsize*origins.size()/2);
+
+			for (size_t t = 0; t < origins.size()/2; t++) {
+				EMData *clip = img->get_clip(Region(origins[2*t], origins[2*t+1], box, box));
+				EMData *fft = clip->do_fft();
+				delete clip;
+
+				float *d = fft->get_data();
+				float *o = &tiles[t*tsize];
+				double power = 0;
+
+				// high-pass, and remove the axes where detector line artifacts concentrate
+				for (int y = 0; y < box; y++) {
+					int ky = y < box/2 ? y : y-box;
+					for (int x = 0; x < nxc/2; x++) {
+						size_t l = (size_t)y*nxc + 2*x;
+						float w = 0;
+						if (x != 0 && ky != 0) {
+							float r2 = (float)(x*x + ky*ky);
+							w = highpass > 0 ? 1.0f - exp(-r2/(2.0f*highpass*highpass)) : 1.0f;
+						}
+						o[l] = d[l]*w;
+						o[l+1] = d[l+1]*w;
+						power += (double)o[l]*o[l] + (double)o[l+1]*o[l+1];
+					}
+				}
+				delete fft;
+
+				if (power > 0) {
+					float norm = (float)(1.0/sqrt(power));
+					for (size_t l = 0; l < tsize; l++) o[l] *= norm;
+				}
+			}
+
+			if (img != frames[i]) delete img;
+		}
+	}
+
+  private:
+	const vector<EMData *> &frames;
+	int shrink;
+	int box;
+	const vector<int> &origins;
+	float highpass;
+	vector< vector<float> > &out;
+};
+
+// One pair of frames per item. The tile cross spectra are summed, inverse
+// transformed once, and the peak located near the origin.
+class MovieAligner::PairTask : public ParallelTask {
+  public:
+	PairTask(const vector< vector<float> > &t, const vector<int> &pi, const vector<int> &pj, int b, int s, vector<float> &o) :
+		tiles(t), pair_i(pi), pair_j(pj), box(b), shrink(s), out(o) {}
+
+	void run(size_t begin, size_t end, int) {
+		int nxc = box+2;
+		size_t tsize = (size_t)nxc*box;
+		int search = std::max(1, box/4);
+
+		EMData spec;
+		spec.set_size(nxc, box, 1);
+		spec.set_complex(true);
+		spec.set_ri(true);
+		spec.set_fftpad(true);
+
+		for (size_t p = begin; p < end; p++) {
+			const vector<float> &a = tiles[pair_i[p]];
+			const vector<float> &b = tiles[pair_j[p]];
+			float *s = spec.get_data();
+			std::fill(s, s+tsize, 0.0f);
+
+			// conj(a)*b, summed over tiles
+			for (size_t t = 0; t < a.size(); t += tsize) {
+				const float *pa = &a[t];
+				const float *pb = &b[t];
+				for (size_t l = 0; l < tsize; l += 2) {
+					s[l] += pa[l]*pb[l] + pa[l+1]*pb[l+1];
+					s[l+1] += pa[l]*pb[l+1] - pa[l+1]*pb[l];
+				}
+			}
+			spec.update();
+
+			EMData *ccf = spec.do_ift();
+			float *c = ccf->get_data();
+
+			// the origin carries the correlation of fixed pattern noise, replace it by its surroundings
+			float sum = 0;
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+					if (dx || dy) sum += c[wrap(dy)*box + wrap(dx)];
+				}
+			}
+			c[0] = sum/8.0f;
+
+			double mean = 0, sq = 0;
+			for (size_t l = 0; l < (size_t)box*box; l++) {
+				mean += c[l];
+				sq += (double)c[l]*c[l];
+			}
+			mean /= (double)box*box;
+			double sigma = sqrt(std::max(0.0, sq/((double)box*box) - mean*mean));
+
+			int px = 0, py = 0;
+			float peak = c[0];
+			for (int dy = -search; dy <= search; dy++) {
+				for (int dx = -search; dx <= search; dx++) {
+					float v = c[wrap(dy)*box + wrap(dx)];
+					if (v > peak) { peak = v; px = dx; py = dy; }
+				}
+			}
+
+			float fx = px + subpixel(c[wrap(py)*box + wrap(px-1)], peak, c[wrap(py)*box + wrap(px+1)]);
+			float fy = py + subpixel(c[wrap(py-1)*box + wrap(px)], peak, c[wrap(py+1)*box + wrap(px)]);
+			delete ccf;
+
+			// frame j is frame i displaced by (fx,fy), so it is brought back by the opposite translation
+			out[3*p] = -fx*shrink;
+			out[3*p+1] = -fy*shrink;
+			out[3*p+2] = sigma > 0 ? std::max(0.0f, (float)((peak-mean)/sigma)) : 0.0f;
+		}
+	}
+
+  private:
+	inline int wrap(int i) const { return i < 0 ? i+box : (i >= box ? i-box : i); }
+
+	// offset of a parabola's maximum through 3 equally spaced values
+	static inline float subpixel(float l, float c, float r) {
+		float d = l - 2.0f*c + r;
+		if (d >= 0) return 0;
+		return Util::get_min(0.5f, Util::get_max(-0.5f, 0.5f*(l-r)/d));
+	}
+
+	const vector< vector<float> > &tiles;
+	const vector<int> &pair_i;
+	const vector<int> &pair_j;
+	int box;
+	int shrink;
+	vector<float> &out;
+};
+
+// Shifts and weights one frame per item in Fourier space and adds it to a shared
+// accumulator. Transforms run concurrently; only the accumulation is serialized.
+class MovieAligner::SumTask : public ParallelTask {
+  public:
+	SumTask(const vector<EMData *> &f, const vector<float> &tr, const vector<float> &e, float ap, float k,
+			EMData *a, vector<float> *w) :
+		frames(f), traj(tr), exposure(e), apix(ap), kv(k), acc(a), wsum(w) {
+		Util::MUTEX_INIT(&mutex);
+	}
+
+	void run(size_t begin, size_t end, int) {
+		int nxc = acc->get_xsize();
+		int nx = frames[0]->get_xsize();
+		int ny = frames[0]->get_ysize();
+		int nxh = nxc/2;
+		vector< std::complex<float> > ex(nxh), ey(ny);
+		vector<float> q;
+
+		for (size_t f = begin; f < end; f++) {
+			EMData *fft = frames[f]->do_fft();
+			float *d = fft->get_data();
+
+			for (int x = 0; x < nxh; x++) ex[x] = std::polar(1.0f, (float)(-2.0*M_PI*x*traj[2*f]/nx));
+			for (int y = 0; y < ny; y++) {
+				int ky = y < ny/2 ? y : y-ny;
+				ey[y] = std::polar(1.0f, (float)(-2.0*M_PI*ky*traj[2*f+1]/ny));
+			}
+
+			bool weighted = !exposure.empty();
+			if (weighted) q.resize((size_t)nxh*ny);
+
+			for (int y = 0; y < ny; y++) {
+				int ky = y < ny/2 ? y : y-ny;
+				float sy = ky/(ny*apix);
+				std::complex<float> *row = reinterpret_cast< std::complex<float> * >(d + (size_t)y*nxc);
+				for (int x = 0; x < nxh; x++) {
+					std::complex<float> v = row[x]*ex[x]*ey[y];
+					if (weighted) {
+						float sx = x/(nx*apix);
+						float s = sqrt(sx*sx + sy*sy);
+						float w = 1.0f;
+						if (s > 0) {
+							float ne = critical_exposure(s);
+							if (kv <= 200.0f) ne *= 0.8f;
+							w = exp(-exposure[f]/(2.0f*ne));
+						}
+						q[(size_t)y*nxh + x] = w;
+						v *= w;
+					}
+					row[x] = v;
+				}
+			}
+
+			Util::MUTEX_LOCK(&mutex);
+			float *a = acc->get_data();
+			size_t size = (size_t)nxc*ny;
+			for (size_t l = 0; l < size; l++) a[l] += d[l];
+			if (weighted) {
+				float *w = &(*wsum)[0];
+				for (size_t l = 0; l < q.size(); l++) w[l] += q[l]*q[l];
+			}
+			Util::MUTEX_UNLOCK(&mutex);
+
+			delete fft;
+		}
+	}
+
+  private:
+	const vector<EMData *> &frames;
+	const vector<float> &traj;
+	const vector<float> &exposure;
+	float apix;
+	float kv;
+	EMData *acc;
+	vector<float> *wsum;
+	MUTEX mutex;
+};
+
+MovieAligner::MovieAligner() :
+	dark(0), gain(0), box(512), step(400), shrink(4), highpass(3.0f), alpha(0.5f),
+	dose(0), pre_dose(0), kv(300.0f), nthreads(0), verbose(0)
+{
+}
+
+MovieAligner::~MovieAligner()
+{
+	if (dark) delete dark;
+	if (gain) delete gain;
+}
+
+void MovieAligner::set_references(EMData *d, EMData *g)
+{
+	if (dark) delete dark;
+	if (gain) delete gain;
+	dark = d ? d->copy() : 0;
+	gain = g ? g->copy() : 0;
+}
+
+void MovieAligner::set_tiles(int b, int s)
+{
+	if (b < 16 || s < 1) throw InvalidValueException(b, "MovieAligner: tile size must be >= 16 and step >= 1");
+	box = b;
+	step = s;
+}
+
+void MovieAligner::set_shrink(int n)
+{
+	shrink = n > 1 ? n : 1;
+}
+
+void MovieAligner::set_dose(float per_frame, float pre_exposure, float voltage)
+{
+	dose = per_frame;
+	pre_dose = pre_exposure;
+	kv = voltage;
+}
+
+int MovieAligner::threads() const
+{
+	return nthreads > 0 ? nthreads : Parallel::get_threads();
+}
+
+void MovieAligner::correct(const vector<EMData *> &frames) const
+{
+	if (frames.empty() || (!dark && !gain)) return;
+
+	for (size_t i = 0; i < frames.size(); i++) {
+		if ((dark && !EMUtil::is_same_size(frames[i], dark)) || (gain && !EMUtil::is_same_size(frames[i], gain))) {
+			throw ImageDimensionException("MovieAligner: frames and references differ in size");
+		}
+	}
+
+	CorrectTask task(frames, dark, gain);
+	Parallel::run(task, frames.size(), 1, threads());
+}
+
+vector<float> MovieAligner::align(const vector<EMData *> &frames)
+{
+	int n = (int)frames.size();
+	if (n < 2) throw InvalidValueException(n, "MovieAligner: at least 2 frames are needed");
+
+	int nx = frames[0]->get_xsize();
+	int ny = frames[0]->get_ysize();
+	for (int i = 1; i < n; i++) {
+		if (frames[i]->get_xsize() != nx || frames[i]->get_ysize() != ny || frames[i]->get_zsize() != 1) {
+			throw InvalidValueException(i, "MovieAligner: frames must be 2-D and the same size");
+		}
+	}
+
+	// tile layout in shrunk pixels, laid out as e2ddd_movie.py does. Frames too
+	// small for that get a single centered tile.
+	int snx = nx/shrink;
+	int sny = ny/shrink;
+	int sbox = (box/shrink) & ~1;
+	int sstep = std::max(1, step/shrink);
+	vector<int> origins;
+	for (int x = sbox/2; x < snx-sbox; x += sstep) {
+		for (int y = sbox/2; y < sny-sbox; y += sstep) {
+			origins.push_back(x);
+			origins.push_back(y);
+		}
+	}
+	if (origins.empty()) {
+		sbox = std::min(sbox, std::min(snx, sny)) & ~1;
+		if (sbox < 8) throw InvalidValueException(sbox, "MovieAligner: frames too small to align");
+		origins.push_back((snx-sbox)/2);
+		origins.push_back((sny-sbox)/2);
+	}
+
+	// Factory registries are built on first use, which must not happen concurrently
+	Factory<Processor>::get_list();
+
+	if (verbose) printf("MovieAligner: %d frames, %d tiles of %d\n", n, (int)origins.size()/2, sbox);
+
+	vector< vector<float> > tiles(n);
+	TileTask ttask(frames, shrink, sbox, origins, highpass, tiles);
+	Parallel::run(ttask, n, 1, threads());
+
+	vector<int> pair_i, pair_j;
+	for (int i = 0; i < n-1; i++) {
+		for (int j = i+1; j < n; j++) {
+			pair_i.push_back(i);
+			pair_j.push_back(j);
+		}
+	}
+
+	pairs.assign(3*pair_i.size(), 0.0f);
+	PairTask ptask(tiles, pair_i, pair_j, sbox, shrink, pairs);
+	Parallel::run(ptask, pair_i.size(), 4, threads());
+
+	vector<float> traj = solve(n);
+
+	quality.assign(n, 0.0f);
+	for (size_t p = 0; p < pair_i.size(); p++) {
+		quality[pair_i[p]] += pairs[3*p+2];
+		quality[pair_j[p]] += pairs[3*p+2];
+	}
+
+	return traj;
+}
+
+vector<float> MovieAligner::solve(int n)
+{
+	int m = n-1;
+	vector<float> traj(2*n, 0.0f);
+
+	// unknowns are the steps u_k between frames k and k+1; pair (i,j) measures
+	// t_j-t_i, the sum of u_i..u_(j-1). Up to 3 passes, dropping pairs which
+	// disagree with the fit.
+	for (int pass = 0; pass < 3; pass++) {
+		vector<double> mat((size_t)m*m, 0.0);
+		vector<double> rhs(2*m, 0.0);
+		size_t p = 0;
+
+		for (int i = 0; i < m; i++) {
+			for (int j = i+1; j <= m; j++, p++) {
+				double w = pairs[3*p+2];
+				if (w <= 0) continue;
+				for (int k = i; k < j; k++) {
+					for (int l = i; l < j; l++) mat[k*m+l] += w;
+					rhs[k] += w*pairs[3*p];
+					rhs[m+k] += w*pairs[3*p+1];
+				}
+			}
+		}
+
+		double diag = 0;
+		for (int k = 0; k < m; k++) diag += mat[k*m+k];
+		diag = diag > 0 ? diag/m : 1.0;
+		double ridge = alpha > 0 ? alpha*diag : 1.0e-6*diag;
+		for (int k = 0; k < m; k++) mat[k*m+k] += ridge;
+
+		cholesky_solve(mat, rhs, m, 2);
+
+		for (int k = 0; k < m; k++) {
+			traj[2*(k+1)] = traj[2*k] + (float)rhs[k];
+			traj[2*(k+1)+1] = traj[2*k+1] + (float)rhs[m+k];
+		}
+
+		vector<float> resid;
+		vector<float> allres(pairs.size()/3, 0.0f);
+		p = 0;
+		for (int i = 0; i < m; i++) {
+			for (int j = i+1; j <= m; j++, p++) {
+				float dx = traj[2*j] - traj[2*i] - pairs[3*p];
+				float dy = traj[2*j+1] - traj[2*i+1] - pairs[3*p+1];
+				allres[p] = hypot(dx, dy);
+				if (pairs[3*p+2] > 0) resid.push_back(allres[p]);
+			}
+		}
+		if (resid.empty()) break;
+
+		std::nth_element(resid.begin(), resid.begin() + resid.size()/2, resid.end());
+		float limit = std::max(1.0f, 3.0f*1.4826f*resid[resid.size()/2]);
+
+		int dropped = 0;
+		for (p = 0; p < allres.size(); p++) {
+			if (pairs[3*p+2] > 0 && allres[p] > limit) {
+				pairs[3*p+2] = 0;
+				dropped++;
+			}
+		}
+		if (verbose > 1) printf("MovieAligner: pass %d, %d pairs dropped (limit %1.2f)\n", pass, dropped, limit);
+		if (!dropped) break;
+	}
+
+	return traj;
+}
+
+EMData *MovieAligner::average(const vector<EMData *> &frames, const vector<float> &traj, bool dose_weight) const
+{
+	int n = (int)frames.size();
+	if (n < 1) throw InvalidValueException(n, "MovieAligner: no frames to average");
+	if ((int)traj.size() != 2*n) throw InvalidValueException((int)traj.size(), "MovieAligner: trajectory length must be 2*frames");
+	if (dose_weight && dose <= 0) throw InvalidCallException("MovieAligner: set_dose() must be called before dose weighting");
+
+	int nx = frames[0]->get_xsize();
+	int ny = frames[0]->get_ysize();
+	for (int i = 1; i < n; i++) {
+		if (!EMUtil::is_same_size(frames[i], frames[0])) throw InvalidValueException(i, "MovieAligner: frames must be the same size");
+	}
+
+	float apix = frames[0]->get_attr_default("apix_x", 1.0f);
+	vector<float> exposure;
+	vector<float> wsum;
+	if (dose_weight) {
+		for (int i = 0; i < n; i++) exposure.push_back(pre_dose + (i+0.5f)*dose);
+		wsum.assign((size_t)(nx/2+1)*ny, 0.0f);
+	}
+
+	EMData *acc = new EMData();
+	acc->set_size(nx + (nx%2 ? 1 : 2), ny, 1);
+	acc->to_zero();
+	acc->set_complex(true);
+	acc->set_ri(true);
+	acc->set_fftpad(true);
+	acc->set_fftodd(nx%2 == 1);
+
+	try {
+		SumTask task(frames, traj, exposure, apix, kv, acc, &wsum);
+		Parallel::run(task, n, 1, threads());
+	}
+	catch (...) {
+		delete acc;
+		throw;
+	}
+
+	// Weighted frames are normalized to keep the noise power of a plain average
+	float *a = acc->get_data();
+	int nxh = acc->get_xsize()/2;
+	for (int y = 0; y < ny; y++) {
+		for (int x = 0; x < nxh; x++) {
+			size_t l = (size_t)y*nxh + x;
+			float norm = dose_weight ? (wsum[l] > 0 ? 1.0f/sqrt(n*wsum[l]) : 0.0f) : 1.0f/n;
+			a[2*l] *= norm;
+			a[2*l+1] *= norm;
+		}
+	}
+	acc->update();
+
+	EMData *ret = acc->do_ift();
+	delete acc;
+
+	ret->set_attr("apix_x", apix);
+	ret->set_attr("apix_y", (float)frames[0]->get_attr_default("apix_y", apix));
+	ret->set_attr("apix_z", (float)frames[0]->get_attr_default("apix_z", apix));
+	ret->set_attr("movie_frames", n);
+	if (dose_weight) ret->set_attr("movie_exposure", pre_dose + n*dose);
+	ret->update();
+
+	return ret;
+}
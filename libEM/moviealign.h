@@ -0,0 +1,160 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+#ifndef eman_moviealign_h__
+#define eman_moviealign_h__ 1
+
+#include "emobject.h"
+
+namespace EMAN
+{
+	class EMData;
+
+	/** MovieAligner does whole-frame alignment of direct detector movies, the work
+	 * done in Python by e2ddd_movie.py. Frames are dark/gain corrected, downsampled
+	 * and cut into overlapping tiles. Each tile is Fourier transformed once, and the
+	 * transforms are reused for every pair of frames. The cross-correlation of a pair
+	 * is accumulated over tiles in Fourier space, so each pair costs one small inverse
+	 * FFT. Pairs are computed in parallel (see Parallel).
+	 *
+	 * The pairwise shifts are combined by a weighted least squares fit of per-frame
+	 * steps, with a ridge penalty on the step size and outlying pairs removed. The
+	 * result is a trajectory: the translation which brings each frame onto frame 0,
+	 * as (x0,y0,x1,y1,...), the same layout e2ddd_movie.py stores in
+	 * "ddd_alignment_trans".
+	 *
+	 * average() shifts the frames in Fourier space (subpixel) and averages them,
+	 * optionally weighting each frame by its accumulated exposure using the critical
+	 * exposure curve of Grant & Grigorieff, eLife 2015.
+	 *
+	 @code
+	 *	MovieAligner ma;
+	 *	ma.set_references(dark,gain);
+	 *	ma.set_dose(1.2f);
+	 *	ma.correct(frames);
+	 *	vector<float> traj=ma.align(frames);
+	 *	EMData *avg=ma.average(frames,traj,true);
+	 @endcode
+	 */
+	class MovieAligner
+	{
+	  public:
+		MovieAligner();
+		~MovieAligner();
+
+		/** Dark and gain references used by correct(). Either may be NULL. Both are copied. */
+		void set_references(EMData *dark, EMData *gain);
+
+		/** Tiles used for alignment, in unshrunk pixels
+		 * @param box tile size
+		 * @param step distance between tile origins
+		 */
+		void set_tiles(int box, int step);
+
+		/** Frames are mean-shrunk by this factor before tiling. 1 disables shrinking. */
+		void set_shrink(int n);
+
+		/** Gaussian high-pass applied to the tiles, as a radius in Fourier pixels of the shrunk tile */
+		void set_highpass(float pixels) { highpass = pixels; }
+
+		/** Ridge penalty on frame-to-frame steps, relative to the mean diagonal of the
+		 * normal equations. 0 gives an unpenalized fit. */
+		void set_alpha(float a) { alpha = a; }
+
+		/** Exposure used by average() for dose weighting.
+		 * @param per_frame electrons/A^2 per frame
+		 * @param pre_exposure electrons/A^2 before the first frame
+		 * @param voltage accelerating voltage in kV. Critical exposures are scaled by 0.8 at 200 kV or below.
+		 */
+		void set_dose(float per_frame, float pre_exposure=0, float voltage=300.0f);
+
+		/** @param n number of threads, 0 for Parallel::get_threads() */
+		void set_threads(int n) { nthreads = n; }
+
+		void set_verbose(int v) { verbose = v; }
+
+		/** Subtract the dark reference from each frame and multiply by the gain, in place.
+		 * @exception ImageDimensionException if a reference and the frames differ in size
+		 */
+		void correct(const vector<EMData *> &frames) const;
+
+		/** Align the frames to each other. The frames are not modified.
+		 * @return 2*n values, the x,y translation of each frame onto frame 0
+		 * @exception InvalidValueException with fewer than 2 frames, or frames of different sizes
+		 */
+		vector<float> align(const vector<EMData *> &frames);
+
+		/** @return for each frame from the last align(), the summed peak strength of the pairs it was part of */
+		vector<float> get_quality() const { return quality; }
+
+		/** @return for the last align(), the measured shift of each pair (i<j, in order) as dx,dy,weight triples.
+		 * Pairs rejected by the fit have weight 0. */
+		vector<float> get_pair_shifts() const { return pairs; }
+
+		/** Shift and average frames.
+		 * @param frames the frames
+		 * @param traj 2*n translations, as returned by align()
+		 * @param dose_weight weight each frame by its exposure, see set_dose()
+		 * @return a new image, owned by the caller
+		 * @exception InvalidCallException for dose weighting without a dose
+		 */
+		EMData *average(const vector<EMData *> &frames, const vector<float> &traj, bool dose_weight=false) const;
+
+	  private:
+		class CorrectTask;
+		class TileTask;
+		class PairTask;
+		class SumTask;
+
+		/** Least squares trajectory from the pair shifts in 'pairs', updating their weights */
+		vector<float> solve(int n);
+
+		int threads() const;
+
+		EMData *dark;
+		EMData *gain;
+		int box;
+		int step;
+		int shrink;
+		float highpass;
+		float alpha;
+		float dose;
+		float pre_dose;
+		float kv;
+		int nthreads;
+		int verbose;
+		vector<float> quality;
+		vector<float> pairs;
+
+		// not copyable, owns the references
+		MovieAligner(const MovieAligner &);
+		MovieAligner &operator=(const MovieAligner &);
+	};
+}
+
+#endif	//eman_moviealign_h__
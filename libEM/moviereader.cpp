@@ -0,0 +1,462 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+#include "moviereader.h"
+#include "byteorder.h"
+#include "emdata.h"
+#include "emutil.h"
+#include "portable_fileio.h"
+#include <cstring>
+
+#ifdef USE_TIFF
+#include <tiffio.h>
+#endif
+
+using namespace EMAN;
+
+namespace {
+	template < class T >
+	void correct(const T *in, float *out, int n, const float *dark, const float *gain, float sign)
+	{
+		if (dark && gain) {
+			for (int x = 0; x < n; x++) out[x] = (sign*in[x] - dark[x])*gain[x];
+		}
+		else if (gain) {
+			for (int x = 0; x < n; x++) out[x] = sign*in[x]*gain[x];
+		}
+		else if (dark) {
+			for (int x = 0; x < n; x++) out[x] = sign*in[x] - dark[x];
+		}
+		else {
+			for (int x = 0; x < n; x++) out[x] = sign*in[x];
+		}
+	}
+
+	// 4-bit pixels to one byte each; 'high_first' is TIFF's default fill order, MRC stores the low nibble first
+	void unpack_nibbles(const unsigned char *in, size_t first, unsigned char *out, int n, bool high_first)
+	{
+		for (int x = 0; x < n; x++) {
+			size_t p = first + x;
+			unsigned char v = in[p/2];
+			bool high = (p%2 == 0) == high_first;
+			out[x] = high ? (v >> 4) : (v & 15);
+		}
+	}
+
+	// raw rows converted per block, small enough to stay in cache
+	const size_t BLOCK_BYTES = 1 << 20;
+}
+
+MovieReader::MovieReader(const string &fname) :
+	filename(fname), format(MOVIE_MRC), nx(0), ny(0), nframes(0), bits(0), is_signed(false),
+	is_float(false), swap(false), negate(false), prefetch(true), apix(0), file(0), data_offset(0),
+#ifdef USE_TIFF
+	tiff(0),
+#endif
+	running(false), next_frame(-1), next_data(0)
+{
+	EMUtil::ImageType type = EMUtil::get_image_type(filename);
+
+	if (type == EMUtil::IMAGE_MRC) {
+		open_mrc();
+	}
+	else if (type == EMUtil::IMAGE_TIFF) {
+#ifdef USE_TIFF
+		open_tiff();
+#else
+		throw ImageReadException(filename, "TIFF support is not compiled in");
+#endif
+	}
+	else {
+		throw ImageReadException(filename, "movies must be MRC or TIFF");
+	}
+}
+
+MovieReader::~MovieReader()
+{
+	join();
+	if (next_data) EMUtil::em_free(next_data);
+	if (file) fclose(file);
+#ifdef USE_TIFF
+	if (tiff) TIFFClose(tiff);
+#endif
+}
+
+void MovieReader::open_mrc()
+{
+	format = MOVIE_MRC;
+	file = fopen(filename.c_str(), "rb");
+	if (!file) throw ImageReadException(filename, "cannot open movie");
+
+	int hdr[256];
+	if (portable_pread(file, hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+		throw ImageReadException(filename, "short MRC header");
+	}
+
+	// mode and dimensions are small positive numbers only in the right byte order
+	if (hdr[3] < 0 || hdr[3] > 0xffff || hdr[0] <= 0 || hdr[0] > 0xfffff || hdr[1] <= 0 || hdr[1] > 0xfffff) {
+		ByteOrder::swap_bytes(hdr, 256);
+		swap = true;
+	}
+
+	nx = hdr[0];
+	ny = hdr[1];
+	nframes = hdr[2];
+	data_offset = sizeof(hdr) + hdr[23];
+
+	float xlen = 0;
+	memcpy(&xlen, &hdr[10], sizeof(float));
+	if (hdr[7] > 0 && xlen > 0) apix = xlen/hdr[7];
+
+	switch (hdr[3]) {
+	case 0:
+		bits = 8;
+		break;
+	case 1:
+		bits = 16;
+		is_signed = true;
+		break;
+	case 2:
+		bits = 32;
+		is_float = true;
+		break;
+	case 6:
+		bits = 16;
+		break;
+	case 101:
+		bits = 4;
+		break;
+	default:
+		throw ImageReadException(filename, "unsupported MRC mode for a movie");
+	}
+
+	if (nx <= 0 || ny <= 0 || nframes <= 0) throw ImageReadException(filename, "bad MRC dimensions");
+}
+
+#ifdef USE_TIFF
+void MovieReader::open_tiff()
+{
+	format = MOVIE_TIFF;
+	TIFFSetWarningHandler(0);
+	tiff = TIFFOpen(filename.c_str(), "r");
+	if (!tiff) throw ImageReadException(filename, "cannot open movie");
+
+	if (TIFFIsTiled(tiff)) throw ImageReadException(filename, "tiled TIFF movies are not supported");
+
+	uint32 w = 0, h = 0;
+	uint16 bps = 0, spp = 1, fmt = SAMPLEFORMAT_UINT, photometric = PHOTOMETRIC_MINISBLACK;
+	TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &w);
+	TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &h);
+	TIFFGetField(tiff, TIFFTAG_BITSPERSAMPLE, &bps);
+	TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLESPERPIXEL, &spp);
+	TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLEFORMAT, &fmt);
+	TIFFGetField(tiff, TIFFTAG_PHOTOMETRIC, &photometric);
+
+	if (spp != 1) throw ImageReadException(filename, "only greyscale TIFF movies are supported");
+	if (bps != 4 && bps != 8 && bps != 16 && bps != 32) {
+		throw ImageReadException(filename, "TIFF movies must have 4, 8, 16 or 32 bits per sample");
+	}
+
+	nx = w;
+	ny = h;
+	bits = bps;
+	is_signed = (fmt == SAMPLEFORMAT_INT);
+	is_float = (fmt == SAMPLEFORMAT_IEEEFP);
+	negate = (photometric == PHOTOMETRIC_MINISWHITE);
+
+	nframes = 0;
+	do {
+		nframes++;
+	} while (TIFFReadDirectory(tiff));
+
+	if (nx <= 0 || ny <= 0) throw ImageReadException(filename, "bad TIFF dimensions");
+}
+#else
+void MovieReader::open_tiff()
+{
+}
+#endif
+
+void MovieReader::set_references(EMData *d, EMData *g)
+{
+	if ((d && (d->get_xsize() != nx || d->get_ysize() != ny)) || (g && (g->get_xsize() != nx || g->get_ysize() != ny))) {
+		throw ImageDimensionException("MovieReader: references must match the frame size");
+	}
+
+	join();
+	dark.clear();
+	gain.clear();
+	if (d) dark.assign(d->get_data(), d->get_data() + (size_t)nx*ny);
+	if (g) gain.assign(g->get_data(), g->get_data() + (size_t)nx*ny);
+
+	// a prefetched frame was decoded with the old references
+	if (next_data) {
+		EMUtil::em_free(next_data);
+		next_data = 0;
+	}
+}
+
+void MovieReader::set_defects(EMData *mask)
+{
+	if (mask && (mask->get_xsize() != nx || mask->get_ysize() != ny)) {
+		throw ImageDimensionException("MovieReader: defect mask must match the frame size");
+	}
+
+	join();
+	defects.clear();
+	bad.clear();
+	if (mask) {
+		const float *m = mask->get_data();
+		bad.assign((size_t)nx*ny, 0);
+		for (size_t i = 0; i < (size_t)nx*ny; i++) {
+			if (m[i] != 0) {
+				defects.push_back(i);
+				bad[i] = 1;
+			}
+		}
+	}
+
+	if (next_data) {
+		EMUtil::em_free(next_data);
+		next_data = 0;
+	}
+}
+
+void MovieReader::convert_row(const unsigned char *raw, int nbits, float *out, int y) const
+{
+	const float *d = dark.empty() ? 0 : &dark[(size_t)y*nx];
+	const float *g = gain.empty() ? 0 : &gain[(size_t)y*nx];
+	float sign = negate ? -1.0f : 1.0f;
+
+	if (nbits == 8) {
+		if (is_signed) correct((const signed char *)raw, out, nx, d, g, sign);
+		else correct(raw, out, nx, d, g, sign);
+	}
+	else if (nbits == 16) {
+		if (is_signed) correct((const short *)raw, out, nx, d, g, sign);
+		else correct((const unsigned short *)raw, out, nx, d, g, sign);
+	}
+	else if (is_float) {
+		correct((const float *)raw, out, nx, d, g, sign);
+	}
+	else if (is_signed) {
+		correct((const int *)raw, out, nx, d, g, sign);
+	}
+	else {
+		correct((const unsigned int *)raw, out, nx, d, g, sign);
+	}
+}
+
+void MovieReader::fix_defects(float *out) const
+{
+	for (size_t i = 0; i < defects.size(); i++) {
+		int x = (int)(defects[i] % nx);
+		int y = (int)(defects[i] / nx);
+		float sum = 0;
+		int n = 0;
+
+		for (int yy = std::max(0, y-1); yy <= std::min(ny-1, y+1); yy++) {
+			for (int xx = std::max(0, x-1); xx <= std::min(nx-1, x+1); xx++) {
+				size_t l = (size_t)yy*nx + xx;
+				if (!bad[l]) {
+					sum += out[l];
+					n++;
+				}
+			}
+		}
+		out[defects[i]] = n ? sum/n : 0.0f;
+	}
+}
+
+void MovieReader::decode(int frame, float *out)
+{
+	if (format == MOVIE_MRC) decode_mrc(frame, out);
+	else decode_tiff(frame, out);
+
+	if (!defects.empty()) fix_defects(out);
+}
+
+void MovieReader::decode_mrc(int frame, float *out)
+{
+	if (bits == 4) {
+		// each row is padded to a whole byte; the frame is small enough to read whole
+		size_t row_bytes = ((size_t)nx + 1)/2;
+		size_t bytes = row_bytes*ny;
+		vector<unsigned char> raw(bytes);
+		vector<unsigned char> row(nx);
+
+		if (portable_pread(file, &raw[0], bytes, data_offset + (off_t)frame*bytes) != bytes) {
+			throw ImageReadException(filename, "short read of MRC frame");
+		}
+		for (int y = 0; y < ny; y++) {
+			unpack_nibbles(&raw[y*row_bytes], 0, &row[0], nx, false);
+			convert_row(&row[0], 8, out + (size_t)y*nx, y);
+		}
+		return;
+	}
+
+	size_t row_bytes = (size_t)nx*bits/8;
+	int block = (int)std::max((size_t)1, BLOCK_BYTES/row_bytes);
+	vector<unsigned char> raw(row_bytes*std::min(block, ny));
+	off_t frame_offset = data_offset + (off_t)frame*row_bytes*ny;
+
+	for (int y0 = 0; y0 < ny; y0 += block) {
+		int nrows = std::min(block, ny - y0);
+		size_t bytes = row_bytes*nrows;
+
+		if (portable_pread(file, &raw[0], bytes, frame_offset + (off_t)y0*row_bytes) != bytes) {
+			throw ImageReadException(filename, "short read of MRC frame");
+		}
+		if (swap && bits == 16) ByteOrder::swap_bytes((short *)&raw[0], bytes/2);
+		else if (swap && bits == 32) ByteOrder::swap_bytes((int *)&raw[0], bytes/4);
+
+		for (int r = 0; r < nrows; r++) {
+			convert_row(&raw[r*row_bytes], bits, out + (size_t)(y0 + r)*nx, y0 + r);
+		}
+	}
+}
+
+#ifdef USE_TIFF
+void MovieReader::decode_tiff(int frame, float *out)
+{
+	if (!TIFFSetDirectory(tiff, frame)) throw ImageReadException(filename, "cannot find TIFF frame");
+
+	uint32 w = 0, h = 0, rps = 0;
+	TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &w);
+	TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &h);
+	if ((int)w != nx || (int)h != ny) throw ImageReadException(filename, "TIFF frames differ in size");
+	TIFFGetFieldDefaulted(tiff, TIFFTAG_ROWSPERSTRIP, &rps);
+	rps = std::min(rps, h);
+
+	tsize_t strip_size = TIFFStripSize(tiff);
+	uint32 nstrips = TIFFNumberOfStrips(tiff);
+	size_t row_bytes = bits == 4 ? ((size_t)nx + 1)/2 : (size_t)nx*bits/8;
+	vector<unsigned char> raw(strip_size);
+	vector<unsigned char> row(bits == 4 ? nx : 0);
+
+	// TIFF stores the top row first; EMData's first row is the bottom
+	for (uint32 s = 0; s < nstrips; s++) {
+		if (TIFFReadEncodedStrip(tiff, s, &raw[0], strip_size) == -1) {
+			throw ImageReadException(filename, "TIFF strip decode failed");
+		}
+
+		int first = s*rps;
+		int nrows = std::min((int)rps, ny - first);
+		for (int r = 0; r < nrows; r++) {
+			int y = ny - 1 - (first + r);
+			const unsigned char *src = &raw[r*row_bytes];
+			if (bits == 4) {
+				unpack_nibbles(src, 0, &row[0], nx, true);
+				convert_row(&row[0], 8, out + (size_t)y*nx, y);
+			}
+			else {
+				convert_row(src, bits, out + (size_t)y*nx, y);
+			}
+		}
+	}
+}
+#else
+void MovieReader::decode_tiff(int, float *)
+{
+}
+#endif
+
+void *MovieReader::prefetch_thread(void *arg)
+{
+	MovieReader *r = static_cast < MovieReader * >(arg);
+
+	try {
+		r->decode(r->next_frame, r->next_data);
+	}
+	catch (E2Exception & e) {
+		r->next_error = e.what();
+	}
+	catch (...) {
+		r->next_error = "decode failed";
+	}
+
+	return 0;
+}
+
+void MovieReader::join()
+{
+	if (running) {
+		pthread_join(worker, 0);
+		running = false;
+	}
+}
+
+EMData *MovieReader::read_frame(int i)
+{
+	if (i < 0 || i >= nframes) throw OutofRangeException(0, nframes-1, i, "movie frame");
+
+	join();
+
+	float *data = 0;
+	if (next_data) {
+		// a failed prefetch is retried below, so its exception reaches the caller
+		if (next_frame == i && next_error.empty()) data = next_data;
+		else EMUtil::em_free(next_data);
+		next_data = 0;
+	}
+
+	size_t size = (size_t)nx*ny*sizeof(float);
+	if (!data) {
+		data = (float *)EMUtil::em_malloc(size);
+		if (!data) throw BadAllocException("MovieReader: cannot allocate frame");
+		try {
+			decode(i, data);
+		}
+		catch (...) {
+			EMUtil::em_free(data);
+			throw;
+		}
+	}
+
+	if (prefetch && i+1 < nframes) {
+		next_frame = i+1;
+		next_error = "";
+		next_data = (float *)EMUtil::em_malloc(size);
+		if (next_data && pthread_create(&worker, 0, prefetch_thread, this) == 0) running = true;
+		else if (next_data) {
+			EMUtil::em_free(next_data);
+			next_data = 0;
+		}
+	}
+
+	EMData *ret = new EMData(data, nx, ny, 1);
+	ret->set_attr("source_path", filename);
+	ret->set_attr("source_n", i);
+	if (apix > 0) {
+		ret->set_attr("apix_x", apix);
+		ret->set_attr("apix_y", apix);
+		ret->set_attr("apix_z", apix);
+	}
+	ret->update();
+	return ret;
+}
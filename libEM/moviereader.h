@@ -0,0 +1,156 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+#ifndef eman_moviereader_h__
+#define eman_moviereader_h__ 1
+
+#include "emobject.h"
+#include <cstdio>
+#include <pthread.h>
+
+#ifdef USE_TIFF
+typedef struct tiff TIFF;
+#endif
+
+namespace EMAN
+{
+	class EMData;
+
+	/** MovieReader reads direct detector movies one frame at a time, applying
+	 * dark subtraction, gain correction and defect repair while the raw pixels are
+	 * converted to float. This replaces a float read followed by separate
+	 * full-frame sub/mult passes (as in e2ddd_movie.py --dark/--gain).
+	 *
+	 * Supported inputs are MRC stacks (modes 0, 1, 2, 6 and 4-bit packed 101) and
+	 * multi-directory TIFF movies with 4, 8, 16 or 32-bit strips, including LZW or
+	 * other libtiff compression. Raw data is converted in blocks of rows straight
+	 * into the frame, so the undecoded frame never exists as floats.
+	 *
+	 * With prefetch on (the default), reading frame i starts decoding frame i+1 on
+	 * a second thread, so the caller's processing of one frame overlaps I/O and
+	 * decompression of the next. Frames come out in the orientation EMData uses for
+	 * the format; TIFF rows are flipped as TiffIO does.
+	 *
+	 @code
+	 *	MovieReader mr("movie.tif");
+	 *	mr.set_references(dark,gain);
+	 *	for (int i=0; i<mr.get_nframes(); i++) {
+	 *		EMData *frame=mr.read_frame(i);
+	 *		...
+	 *	}
+	 @endcode
+	 */
+	class MovieReader
+	{
+	  public:
+		/** @exception ImageReadException if the file isn't a readable MRC or TIFF movie */
+		explicit MovieReader(const string &filename);
+		~MovieReader();
+
+		int get_nframes() const { return nframes; }
+		int get_xsize() const { return nx; }
+		int get_ysize() const { return ny; }
+
+		/** Dark and gain references, applied as (raw-dark)*gain. Either may be NULL.
+		 * @exception ImageDimensionException if a reference differs in size from the frames
+		 */
+		void set_references(EMData *dark, EMData *gain);
+
+		/** Pixels which are nonzero in 'mask' are replaced by the mean of their good
+		 * 8-neighbours after correction. NULL clears the list.
+		 * @exception ImageDimensionException if the mask differs in size from the frames
+		 */
+		void set_defects(EMData *mask);
+
+		/** Decode the next frame in the background after each read_frame() */
+		void set_prefetch(bool p) { prefetch = p; }
+
+		/** @return frame i, corrected. The caller owns the image.
+		 * @exception OutofRangeException for a bad index
+		 * @exception ImageReadException on a read or decode failure
+		 */
+		EMData *read_frame(int i);
+
+	  private:
+		enum Format { MOVIE_MRC, MOVIE_TIFF };
+
+		static void *prefetch_thread(void *reader);
+
+		void open_mrc();
+		void open_tiff();
+
+		/** Decode one frame into out (nx*ny floats). Only one decode runs at a time. */
+		void decode(int frame, float *out);
+		void decode_mrc(int frame, float *out);
+		void decode_tiff(int frame, float *out);
+
+		/** Convert one row of raw 8, 16 or 32-bit pixels to floats, applying the references for output row 'y' */
+		void convert_row(const unsigned char *raw, int nbits, float *out, int y) const;
+
+		void fix_defects(float *out) const;
+
+		/** Wait for a running prefetch */
+		void join();
+
+		string filename;
+		Format format;
+		int nx;
+		int ny;
+		int nframes;
+		int bits;
+		bool is_signed;
+		bool is_float;
+		bool swap;
+		bool negate;
+		bool prefetch;
+		float apix;
+
+		FILE *file;
+		off_t data_offset;
+#ifdef USE_TIFF
+		TIFF *tiff;
+#endif
+
+		vector<float> dark;
+		vector<float> gain;
+		vector<size_t> defects;
+		vector<char> bad;
+
+		pthread_t worker;
+		bool running;
+		int next_frame;
+		float *next_data;
+		string next_error;
+
+		// not copyable, owns the file and the prefetch buffer
+		MovieReader(const MovieReader &);
+		MovieReader &operator=(const MovieReader &);
+	};
+}
+
+#endif	//eman_moviereader_h__
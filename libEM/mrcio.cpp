@@ -678,9 +678,8 @@ int MrcIO::read_fei_header(Dict & dict, int image_index, const Region * area, bo
 
 	FeiMrcExtHeader feiexth;
 
-	portable_fseek(mrcfile, sizeof(FeiMrcHeader)+sizeof(FeiMrcExtHeader)*image_index, SEEK_SET);
-
-	if (fread(&feiexth, sizeof(FeiMrcExtHeader), 1, mrcfile) != 1) {
+	if (portable_pread(mrcfile, &feiexth, sizeof(FeiMrcExtHeader),
+			sizeof(FeiMrcHeader)+sizeof(FeiMrcExtHeader)*image_index) != sizeof(FeiMrcExtHeader)) {
 		throw ImageReadException(filename, "FEI MRC extended header");
 	}
 
@@ -1007,21 +1006,28 @@ int MrcIO::read_data(float *rdata, int image_index, const Region * area, bool)
 		return 1;
 	}
 
-	signed char *    scdata = (signed char *)    rdata;
 	unsigned char *  cdata  = (unsigned char *)  rdata;
-	short *          sdata  = (short *)          rdata;
-	unsigned short * usdata = (unsigned short *) rdata;
 
 	size_t size = 0;
 	int xlen = 0, ylen = 0, zlen = 0;
 
+	// A file opened READ_ONLY is read positionally, leaving mrcfile's
+	// position alone so concurrent readers don't interfere.
+
+	off_t offset = sizeof(MrcHeader) + (isFEI ? feimrch.next : mrch.nsymbt);
+
+	if (rw_mode != READ_ONLY) {
+		portable_fseek(mrcfile, offset, SEEK_SET);
+		offset = -1;
+	}
+
 	if (isFEI) {	// FEI extended MRC
 		check_region(area, FloatSize(feimrch.nx, feimrch.ny, feimrch.nz), is_new_file, false);
-		portable_fseek(mrcfile, sizeof(MrcHeader)+feimrch.next, SEEK_SET);
 
 		EMUtil::process_region_io(cdata, mrcfile, READ_ONLY,
 								  image_index, mode_size,
-								  feimrch.nx, feimrch.ny, feimrch.nz, area);
+								  feimrch.nx, feimrch.ny, feimrch.nz, area,
+								  false, EMUtil::IMAGE_UNKNOWN, 0, 0, offset);
 
 		EMUtil::get_region_dims(area, feimrch.nx, &xlen, feimrch.ny, &ylen, feimrch.nz, &zlen);
 
@@ -1029,7 +1035,6 @@ int MrcIO::read_data(float *rdata, int image_index, const Region * area, bool)
 	}
 	else {	// regular MRC
 		check_region(area, FloatSize(mrch.nx, mrch.ny, mrch.nz), is_new_file, false);
-		portable_fseek(mrcfile, sizeof(MrcHeader)+mrch.nsymbt, SEEK_SET);
 
 		size_t modesize;
 
@@ -1045,24 +1050,14 @@ int MrcIO::read_data(float *rdata, int image_index, const Region * area, bool)
 
 		EMUtil::process_region_io(cdata, mrcfile, READ_ONLY,
 								  image_index, modesize,
-								  mrch.nx, mrch.ny, mrch.nz, area);
+								  mrch.nx, mrch.ny, mrch.nz, area,
+								  false, EMUtil::IMAGE_UNKNOWN, 0, 0, offset);
 
 		EMUtil::get_region_dims(area, mrch.nx, &xlen, mrch.ny, &ylen, mrch.nz, &zlen);
 
 		size = (size_t)xlen * ylen * zlen;
 	}
 
-	if (mrch.mode != MRC_UCHAR  &&  mrch.mode != MRC_CHAR  &&
-	    mrch.mode != MRC_UHEX) {
-
-		if (mode_size == sizeof(short)) {
-			become_host_endian < short >(sdata, size);
-		}
-		else if (mode_size == sizeof(float)) {
-			become_host_endian < float >(rdata, size);
-		}
-	}
-
 	if (mrch.mode == MRC_UHEX) {
 		size_t num_pairs = size / 2;
 		size_t num_pts   = num_pairs * 2;
@@ -1077,7 +1072,45 @@ int MrcIO::read_data(float *rdata, int image_index, const Region * area, bool)
 			rdata[ipt] = (float)(v & 15); // v % 16;
 		}
 	}
-	else if (mrch.mode == MRC_UCHAR) {
+	else {
+		to_float(rdata, size);
+	}
+
+	if (is_transpose) {
+		transpose(rdata, xlen, ylen, zlen);
+	}
+
+	if (is_complex_mode()) {
+		if (! is_ri) {
+			Util::ap2ri(rdata, size);
+		}
+
+		Util::flip_complex_phase(rdata, size);
+		Util::rotate_phase_origin(rdata, xlen, ylen, zlen);
+	}
+
+	EXITFUNC;
+
+	return 0;
+}
+
+void MrcIO::to_float(float *rdata, size_t size)
+{
+	signed char *    scdata = (signed char *)    rdata;
+	unsigned char *  cdata  = (unsigned char *)  rdata;
+	short *          sdata  = (short *)          rdata;
+	unsigned short * usdata = (unsigned short *) rdata;
+
+	if (mrch.mode != MRC_UCHAR  &&  mrch.mode != MRC_CHAR) {
+		if (mode_size == sizeof(short)) {
+			become_host_endian < short >(sdata, size);
+		}
+		else if (mode_size == sizeof(float)) {
+			become_host_endian < float >(rdata, size);
+		}
+	}
+
+	if (mrch.mode == MRC_UCHAR) {
 		for (size_t i = 0; i < size; ++i) {
 			size_t j = size - 1 - i;
 			// rdata[i] = static_cast<float>(cdata[i]/100.0f - 1.28f);
@@ -1103,19 +1136,47 @@ int MrcIO::read_data(float *rdata, int image_index, const Region * area, bool)
 			rdata[j] = static_cast < float >(usdata[j]);
 		}
 	}
+}
 
-	if (is_transpose) {
-		transpose(rdata, xlen, ylen, zlen);
+int MrcIO::read_data_block(float *data, int first_index, int n,
+						   size_t image_size, bool is_3d)
+{
+	ENTERFUNC;
+
+	check_read_access(first_index, data);
+
+	int nx = isFEI ? feimrch.nx : mrch.nx;
+	int ny = isFEI ? feimrch.ny : mrch.ny;
+
+	// Only plain stacks of 2D images are contiguous in the file as
+	// they are in memory; anything else goes image by image.
+
+	if (! (isFEI || is_stack) || is_transpose || is_complex_mode() ||
+		mrch.mode == MRC_UHEX || image_size != (size_t)nx * ny) {
+		return ImageIO::read_data_block(data, first_index, n, image_size, is_3d);
 	}
 
-	if (is_complex_mode()) {
-		if (! is_ri) {
-			Util::ap2ri(rdata, size);
-		}
+	check_read_access(first_index + n - 1);
 
-		Util::flip_complex_phase(rdata, size);
-		Util::rotate_phase_origin(rdata, xlen, ylen, zlen);
+	size_t size = image_size * n;
+	size_t nbytes = size * mode_size;
+	off_t offset = sizeof(MrcHeader) + (isFEI ? feimrch.next : mrch.nsymbt) +
+				   (off_t)image_size * mode_size * first_index;
+	size_t nread = 0;
+
+	if (rw_mode == READ_ONLY) {
+		nread = portable_pread(mrcfile, data, nbytes, offset);
 	}
+	else {
+		portable_fseek(mrcfile, offset, SEEK_SET);
+		nread = fread(data, 1, nbytes, mrcfile);
+	}
+
+	if (nread != nbytes) {
+		throw ImageReadException(filename, "incomplete data read");
+	}
+
+	to_float(data, size);
 
 	EXITFUNC;
 
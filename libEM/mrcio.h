@@ -63,6 +63,11 @@ namespace EMAN
 
 		int get_nimg();
 
+		/** Images of an MRC stack are contiguous, so a run of them is
+		 * read with one request. */
+		int read_data_block(float *data, int first_index, int n,
+							size_t image_size, bool is_3d = false);
+
 	private:
 		enum MrcMode {
 			MRC_UCHAR = 0,
@@ -311,6 +316,10 @@ namespace EMAN
 		int read_mrc_header(Dict & dict, int image_index = 0, const Region * area = 0, bool is_3d = false);
 		int read_fei_header(Dict & dict, int image_index = 0, const Region * area = 0, bool is_3d = false);
 
+		/** Convert 'size' values of the file's data type, read into the start of
+		 * 'rdata', to host-endian floats in place. Not for MRC_UHEX. */
+		void to_float(float *rdata, size_t size);
+
 		//utility funciton to tranpose x and y dimension in case the source mrc image is mapc=2,mapr=1
 		int transpose(float *data, int nx, int ny, int nz) const;
 	};
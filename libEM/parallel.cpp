@@ -0,0 +1,196 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA 
+ */
+
+#include "parallel.h"
+#include "util.h"
+#include "exception.h"
+#include <algorithm>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+using namespace EMAN;
+
+int Parallel::num_threads = 0;
+
+namespace {
+#ifdef WIN32
+	__declspec(thread) int worker_flag = 0;
+#else
+	__thread int worker_flag = 0;
+#endif
+
+	/** Shared state for the threads of one Parallel::run call */
+	struct ParallelJob {
+		ParallelTask *task;
+		size_t n;
+		size_t chunk;
+		size_t next;
+		bool failed;
+		string error;
+		MUTEX mutex;
+	};
+
+	struct ParallelWorker {
+		ParallelJob *job;
+		int thread;
+	};
+
+	void worker_loop(ParallelJob *job, int thread)
+	{
+		worker_flag = 1;
+		while (1) {
+			Util::MUTEX_LOCK(&job->mutex);
+			if (job->failed || job->next >= job->n) {
+				Util::MUTEX_UNLOCK(&job->mutex);
+				break;
+			}
+			size_t begin = job->next;
+			size_t end = std::min(job->n,begin+job->chunk);
+			job->next = end;
+			Util::MUTEX_UNLOCK(&job->mutex);
+
+			string err;
+			try {
+				job->task->run(begin,end,thread);
+			}
+			catch (std::exception &e) {
+				err = e.what();
+			}
+			catch (...) {
+				err = "unknown exception";
+			}
+
+			if (!err.empty()) {
+				Util::MUTEX_LOCK(&job->mutex);
+				if (!job->failed) {
+					job->failed = true;
+					job->error = err;
+				}
+				Util::MUTEX_UNLOCK(&job->mutex);
+				break;
+			}
+		}
+		worker_flag = 0;
+	}
+
+#ifdef WIN32
+	unsigned __stdcall worker_start(void *arg)
+	{
+		ParallelWorker *w = (ParallelWorker *)arg;
+		worker_loop(w->job,w->thread);
+		return 0;
+	}
+#else
+	void *worker_start(void *arg)
+	{
+		ParallelWorker *w = (ParallelWorker *)arg;
+		worker_loop(w->job,w->thread);
+		return NULL;
+	}
+#endif
+}
+
+int Parallel::get_threads()
+{
+	if (num_threads > 0) return num_threads;
+
+	int n = 1;
+#ifdef WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	n = (int)info.dwNumberOfProcessors;
+#else
+	n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return n>0 ? n : 1;
+}
+
+void Parallel::set_threads(int n)
+{
+	num_threads = n>0 ? n : 0;
+}
+
+bool Parallel::in_worker()
+{
+	return worker_flag != 0;
+}
+
+void Parallel::run(ParallelTask &task, size_t n, size_t chunk, int nthreads)
+{
+	if (n == 0) return;
+	if (chunk < 1) chunk = 1;
+	if (nthreads <= 0) nthreads = get_threads();
+	size_t nchunks = (n + chunk - 1)/chunk;
+	if ((size_t)nthreads > nchunks) nthreads = (int)nchunks;
+
+	// Serial when there is nothing to share, or when already inside a parallel task
+	if (nthreads <= 1 || worker_flag) {
+		task.run(0,n,0);
+		return;
+	}
+
+	ParallelJob job;
+	job.task = &task;
+	job.n = n;
+	job.chunk = chunk;
+	job.next = 0;
+	job.failed = false;
+	Util::MUTEX_INIT(&job.mutex);
+
+	vector<ParallelWorker> workers(nthreads);
+	for (int i = 0; i < nthreads; i++) {
+		workers[i].job = &job;
+		workers[i].thread = i;
+	}
+
+	// thread 0 is the calling thread
+#ifdef WIN32
+	vector<HANDLE> threads(nthreads,(HANDLE)0);
+	for (int i = 1; i < nthreads; i++) threads[i] = (HANDLE)_beginthreadex(NULL,0,&worker_start,&workers[i],0,NULL);
+	worker_loop(&job,0);
+	for (int i = 1; i < nthreads; i++) {
+		if (!threads[i]) continue;
+		WaitForSingleObject(threads[i],INFINITE);
+		CloseHandle(threads[i]);
+	}
+	CloseHandle(job.mutex);
+#else
+	vector<pthread_t> threads(nthreads);
+	vector<bool> started(nthreads,false);
+	for (int i = 1; i < nthreads; i++) started[i] = (pthread_create(&threads[i],NULL,&worker_start,&workers[i]) == 0);
+	worker_loop(&job,0);
+	for (int i = 1; i < nthreads; i++) {
+		if (started[i]) pthread_join(threads[i],NULL);
+	}
+	pthread_mutex_destroy(&job.mutex);
+#endif
+
+	// threads which failed to start leave their share to the others, so all items are done unless a task failed
+	if (job.failed) throw UnexpectedBehaviorException("Parallel task failed: " + job.error);
+}
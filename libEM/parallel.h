@@ -0,0 +1,97 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA 
+ */
+
+#ifndef eman_parallel_h__
+#define eman_parallel_h__ 1
+
+#include <cstddef>
+
+namespace EMAN
+{
+	/** ParallelTask is a unit of work for Parallel::run. run() is called from
+	 * several threads at once, each time with a different, non-overlapping range of
+	 * item indices, so implementations must only write to per-item or per-thread
+	 * storage.
+	 */
+	class ParallelTask
+	{
+	  public:
+		virtual ~ParallelTask() {}
+
+		/** Process items [begin,end).
+		 * @param begin first item
+		 * @param end one past the last item
+		 * @param thread index of the calling thread, 0 to Parallel::get_threads()-1
+		 */
+		virtual void run(size_t begin, size_t end, int thread) = 0;
+	};
+
+	/** Parallel runs a ParallelTask over a range of items on a set of threads.
+	 * Items are handed out dynamically in chunks from a shared counter, so threads
+	 * finishing early keep taking work until none remains. This balances uneven
+	 * per-item costs (eg - alignments which converge at different rates).
+	 *
+	 * Calls made from inside a running task execute serially in the calling thread,
+	 * so nested parallel code can't oversubscribe the machine. An exception thrown by
+	 * any thread stops the remaining work, and run() then throws an
+	 * UnexpectedBehaviorException carrying its message; the original type is lost.
+	 * When run() works serially the task's exception passes through unchanged.
+	 *
+	 @code
+	 *	class MyTask : public ParallelTask { ... };
+	 *	MyTask task(...);
+	 *	Parallel::run(task, n);
+	 @endcode
+	 */
+	class Parallel
+	{
+	  public:
+		/** Run task over items [0,n).
+		 * @param task the work to do
+		 * @param n number of items
+		 * @param chunk number of items handed to a thread at a time
+		 * @param nthreads number of threads to use, 0 for get_threads()
+		 */
+		static void run(ParallelTask &task, size_t n, size_t chunk=1, int nthreads=0);
+
+		/** @return the default number of threads, the number of CPUs unless set_threads() was called */
+		static int get_threads();
+
+		/** Set the default number of threads used by run().
+		 * @param n number of threads. <=0 restores the default of one per CPU.
+		 */
+		static void set_threads(int n);
+
+		/** @return true if called from inside a task started by run() */
+		static bool in_worker();
+
+	  private:
+		static int num_threads;
+	};
+}
+
+#endif	//eman_parallel_h__
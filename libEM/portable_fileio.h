@@ -37,7 +37,12 @@
 #define __portable_fileio_h__
 
 #include <cstdio>
+#include <cerrno>
 #include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 
 inline int portable_fseek(FILE * fp, off_t offset, int whence)
@@ -64,6 +69,51 @@ inline off_t portable_ftell(FILE * fp)
 #endif
 }
 
+/** Read 'size' bytes starting at absolute 'offset' in the file. On POSIX systems this
+ * is a pread() on the underlying descriptor, so neither the FILE position nor its
+ * buffer is used and several threads may read the same FILE at once. The file must
+ * not have unflushed writes. Elsewhere it falls back to fseek+fread, which is not
+ * safe for concurrent use.
+ * @return the number of bytes actually read.
+ */
+inline size_t portable_pread(FILE * fp, void * buf, size_t size, off_t offset)
+{
+#ifdef _WIN32
+	if (portable_fseek(fp, offset, SEEK_SET) != 0) return 0;
+	return fread(buf, 1, size, fp);
+#else
+	int fd = fileno(fp);
+	char * p = static_cast < char * >(buf);
+	size_t done = 0;
+
+	while (done < size) {
+		ssize_t n = pread(fd, p + done, size - done, offset + (off_t) done);
+
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+
+		done += n;
+	}
+
+	return done;
+#endif
+}
+
+/** @return the sub-second part of st's modification time in nanoseconds, or 0 where
+ * stat() doesn't provide it. Together with st_mtime it tells apart writes made within
+ * the same second.
+ */
+inline long portable_mtime_nsec(const struct stat & st)
+{
+#if defined(__APPLE__)
+	return (long)st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+	return 0;
+#else
+	return (long)st.st_mtim.tv_nsec;
+#endif
+}
+
 
 
 #endif
@@ -42,6 +42,10 @@
 #include "symmetry.h"
 #include "averager.h"
 #include "util.h"
+#include "resample.h"
+#include "fsc.h"
+#include "emfft.h"
+#include "parallel.h"
 
 #include <gsl/gsl_randist.h>
 #include <gsl/gsl_statistics.h>
@@ -221,6 +225,7 @@ const string CTFCorrProcessor::NAME = "filter.ctfcorr.simple";
 const string SNRProcessor::NAME = "eman1.filter.snr";
 const string FileFourierProcessor::NAME = "eman1.filter.byfile";
 const string FSCFourierProcessor::NAME = "filter.wiener.byfsc";
+const string LocalFSCProcessor::NAME = "math.localfsc";
 const string SymSearchProcessor::NAME = "misc.symsearch";
 const string MaskPackProcessor::NAME = "misc.mask.pack";
 const string LocalNormProcessor::NAME = "normalize.local";
@@ -492,6 +497,7 @@ template <> Factory < Processor >::Factory()
 //	force_add<SNRProcessor>();
 	force_add<CTFCorrProcessor>();
 	force_add<FSCFourierProcessor>();
+	force_add<LocalFSCProcessor>();
 
 	force_add<XGradientProcessor>();
 	force_add<YGradientProcessor>();
@@ -7173,6 +7179,287 @@ EMData *FSCFourierProcessor::process(EMData const *image)
 	return ret;
 }
 
+namespace {
+	// Spatial frequency (in units of ds) where a local FSC curve falls below 'cutoff', by the
+	// same rules as e2fsc.py. Shell 0 is ignored. 'last' receives the last shell taken to be
+	// above the cutoff, which is the radius of the local low-pass filter.
+	float local_fsc_crossing(const vector<float> &fsc, float cutoff, float ds, int &last)
+	{
+		int nf = (int)fsc.size()-1;
+		const float *fy = &fsc[1];		// fy[i] is at frequency (i+1)*ds
+
+		int si;
+		float res;
+		if (fy[0]<cutoff && fy[1]<cutoff) {
+			si = 1;
+			res = 2.0f*ds;
+		}
+		else {
+			for (si = 0; si < nf-1; si++) {
+				if (fy[si]>cutoff && fy[si+1]<cutoff) break;
+			}
+			// e2fsc.py extrapolates from the last two shells if the curve never crosses the
+			// cutoff. That is meaningless for a flat curve, so it is taken to reach Nyquist.
+			if (si==nf-1) {
+				si = nf-2;
+				res = nf*ds;
+			}
+			else res = (cutoff-fy[si])*ds/(fy[si+1]-fy[si]) + (si+1)*ds;
+		}
+		if (res<0) res = 0;
+		if (res>nf*ds) res = nf*ds;		// This makes the resolution at Nyquist, which is not a good thing
+		last = si+1;
+		return res;
+	}
+
+	// One row of windows per item. Rows run in the same call must not overlap if 'filt' is set,
+	// since each window adds into the filtered map.
+	class LocalFSCTask : public ParallelTask {
+	  public:
+		const float *d1, *d2;
+		int nx, ny, nz;
+		int lnx, step;
+		int off[3], nt[3];
+		const float *cenmask, *avgmask;
+		float thresh1, thresh2, cutoff, apix;
+		const FourierShellCorrelator *fscr;
+		float *res;
+		float *filt, *norm;
+		const vector<size_t> *rows;
+		vector< vector<float> > *work;		// 4 buffers per thread
+
+		void run(size_t begin, size_t end, int thread) {
+			for (size_t i = begin; i < end; i++) {
+				int oy = (int)((*rows)[i]%nt[1]);
+				int oz = (int)((*rows)[i]/nt[1]);
+				for (int ox = 0; ox < nt[0]; ox++) window(ox,oy,oz,thread);
+			}
+		}
+
+	  private:
+		void window(int ox, int oy, int oz, int thread) {
+			size_t n3 = (size_t)lnx*lnx*lnx;
+			int lsd = lnx+2-lnx%2;
+			size_t nc = (size_t)lsd*lnx*lnx;
+
+			// separate allocations, so each buffer has the alignment the cached FFT plans expect
+			vector<float> *w = &(*work)[4*thread];
+			if (w[0].empty()) {
+				w[0].resize(n3);
+				w[1].resize(n3);
+				w[2].resize(nc);
+				w[3].resize(nc);
+			}
+			float *r1 = &w[0][0], *r2 = &w[1][0], *c1 = &w[2][0], *c2 = &w[3][0];
+
+			int x0 = off[0]+ox*step, y0 = off[1]+oy*step, z0 = off[2]+oz*step;
+			size_t t = ox + (size_t)nt[0]*(oy + (size_t)nt[1]*oz);
+
+			float max1 = -FLT_MAX, max2 = -FLT_MAX;
+			size_t k = 0;
+			for (int z = 0; z < lnx; z++) {
+				for (int y = 0; y < lnx; y++) {
+					size_t l = x0 + (size_t)nx*((y0+y) + (size_t)ny*(z0+z));
+					const float *a = d1+l, *b = d2+l;
+					for (int x = 0; x < lnx; x++, k++) {
+						r1[k] = a[x]*cenmask[k];
+						r2[k] = b[x]*cenmask[k];
+						if (r1[k]>max1) max1 = r1[k];
+						if (r2[k]>max2) max2 = r2[k];
+					}
+				}
+			}
+			if (max1<thresh1 || max2<thresh2) {
+				res[t] = 0;
+				return;
+			}
+
+			EMfft::real_to_complex_nd(r1,c1,lnx,lnx,lnx);
+			EMfft::real_to_complex_nd(r2,c2,lnx,lnx,lnx);
+
+			int ns = fscr->get_nshells();
+			vector<double> cross(ns), pw1(ns), pw2(ns);
+			fscr->shell_power(c1,&pw1[0]);
+			fscr->shell_cross(c1,c2,&cross[0],&pw2[0]);
+			vector<float> fsc(ns,0.0f);
+			for (int i = 0; i < ns; i++) {
+				if (pw1[i]>0 && pw2[i]>0) fsc[i] = float(cross[i]/std::sqrt(pw1[i]*pw2[i]));
+			}
+
+			int last;
+			res[t] = local_fsc_crossing(fsc,cutoff,1.0f/(2.0f*(ns-1)*apix),last);
+			if (!filt || res[t]==0) return;
+
+			// the unmasked mean of the two windows, low-pass filtered (filter.lowpass.tophat) at 'last'
+			k = 0;
+			for (int z = 0; z < lnx; z++) {
+				for (int y = 0; y < lnx; y++) {
+					size_t l = x0 + (size_t)nx*((y0+y) + (size_t)ny*(z0+z));
+					for (int x = 0; x < lnx; x++, k++) r1[k] = 0.5f*(d1[l+x]+d2[l+x]);
+				}
+			}
+			EMfft::real_to_complex_nd(r1,c1,lnx,lnx,lnx);
+			int h = lnx/2;
+			float *c = c1;
+			for (int z = 0; z < lnx; z++) {
+				int kz = z>h ? z-lnx : z;
+				for (int y = 0; y < lnx; y++) {
+					int ky = y>h ? y-lnx : y;
+					for (int x = 0; x < lsd/2; x++, c+=2) {
+						if (x*x+ky*ky+kz*kz > last*last) c[0] = c[1] = 0;
+					}
+				}
+			}
+			EMfft::complex_to_real_nd(c1,r1,lnx,lnx,lnx);
+
+			float scale = 1.0f/n3;
+			k = 0;
+			for (int z = 0; z < lnx; z++) {
+				for (int y = 0; y < lnx; y++) {
+					size_t l = x0 + (size_t)nx*((y0+y) + (size_t)ny*(z0+z));
+					for (int x = 0; x < lnx; x++, k++) {
+						filt[l+x] += r1[k]*scale*avgmask[k];
+						norm[l+x] += avgmask[k];
+					}
+				}
+			}
+		}
+	};
+}
+
+void LocalFSCProcessor::process_inplace(EMData *image)
+{
+	EMData *tmp = process(image);
+	image->set_size(tmp->get_xsize(),tmp->get_ysize(),tmp->get_zsize());
+	memcpy(image->get_data(),tmp->get_const_data(),(size_t)tmp->get_xsize()*tmp->get_ysize()*tmp->get_zsize()*sizeof(float));
+	const char *attrs[] = { "apix_x", "apix_y", "apix_z", "origin_x", "origin_y", "origin_z" };
+	for (int i = 0; i < 6; i++) image->set_attr(attrs[i],tmp->get_attr(attrs[i]));
+	image->update();
+	delete tmp;
+}
+
+EMData *LocalFSCProcessor::process(EMData const *image)
+{
+	ENTERFUNC;
+
+	EMData *with = params.set_default("with",(EMData *)NULL);
+	if (!with) throw InvalidParameterException("math.localfsc: the second half map ('with') is required");
+	if (image->is_complex() || with->is_complex()) throw ImageFormatException("math.localfsc: real space half maps required");
+	if (!EMUtil::is_same_size(image,with)) throw ImageDimensionException("math.localfsc: the half maps must be the same size");
+
+	int nx = image->get_xsize();
+	int ny = image->get_ysize();
+	int nz = image->get_zsize();
+	if (nz==1) throw ImageDimensionException("math.localfsc: 3D volumes only");
+
+	float apix = params.set_default("apix",(float)image->get_attr("apix_x"));
+	int overlap = params.set_default("overlap",4);
+	float cutoff = params.set_default("cutoff",0.143f);
+	if (overlap<1) throw InvalidValueException(overlap,"math.localfsc: overlap must be >=1");
+
+	int lnx;
+	if (params.has_key("localsize")) lnx = params["localsize"];
+	else {
+		lnx = std::max(int(32.0f/apix),16);
+		lnx = ((lnx-1)/overlap+1)*overlap;
+	}
+	if (lnx<8 || lnx>nx || lnx>ny || lnx>nz) throw InvalidValueException(lnx,"math.localfsc: localsize must be at least 8 and fit in the volume");
+	if (overlap>lnx) overlap = lnx;
+	int step = lnx/overlap;
+
+	// windows at off+i*step, all inside the volume
+	int off[3], nt[3], n[3] = { nx, ny, nz };
+	for (int i = 0; i < 3; i++) {
+		off[i] = (n[i]%step)/2;
+		nt[i] = off[i]+lnx<=n[i] ? (n[i]-lnx-off[i])/step+1 : 0;
+	}
+	if (nt[0]==0 || nt[1]==0 || nt[2]==0) throw InvalidValueException(lnx,"math.localfsc: localsize must fit in the volume");
+
+	// the same masks as e2fsc.py. cenmask localizes the FSC, avgmask blends the filtered windows
+	EMData cenmask(lnx,lnx,lnx);
+	cenmask.to_one();
+	cenmask.process_inplace("mask.gaussian",Dict("inner_radius",lnx/6.0f,"outer_radius",lnx/6.0f));
+	EMData avgmask(lnx,lnx,lnx);
+	avgmask.to_one();
+	avgmask.process_inplace("mask.gaussian",Dict("outer_radius",3.0f*step/log(8.0f)));
+
+	EMData *ret = new EMData(nt[0],nt[1],nt[2]);
+	ret->set_attr("apix_x",apix*step);
+	ret->set_attr("apix_y",apix*step);
+	ret->set_attr("apix_z",apix*step);
+	ret->set_attr("origin_x",(off[0]+lnx/2)*apix);
+	ret->set_attr("origin_y",(off[1]+lnx/2)*apix);
+	ret->set_attr("origin_z",(off[2]+lnx/2)*apix);
+
+	EMData *filtered = params.set_default("filtered",(EMData *)NULL);
+	vector<float> norm;
+	if (filtered) {
+		filtered->set_size(nx,ny,nz);
+		filtered->to_zero();
+		filtered->set_attr("apix_x",apix);
+		filtered->set_attr("apix_y",apix);
+		filtered->set_attr("apix_z",apix);
+		norm.resize((size_t)nx*ny*nz,0.0f);
+	}
+
+	vector< vector<float> > work(4*Parallel::get_threads());
+	vector<size_t> rows;
+
+	LocalFSCTask task;
+	task.d1 = image->get_const_data();
+	task.d2 = with->get_const_data();
+	task.nx = nx;
+	task.ny = ny;
+	task.nz = nz;
+	task.lnx = lnx;
+	task.step = step;
+	for (int i = 0; i < 3; i++) {
+		task.off[i] = off[i];
+		task.nt[i] = nt[i];
+	}
+	task.cenmask = cenmask.get_const_data();
+	task.avgmask = avgmask.get_const_data();
+	task.thresh1 = (float)image->get_attr("mean")+(float)image->get_attr("sigma");
+	task.thresh2 = (float)with->get_attr("mean")+(float)with->get_attr("sigma");
+	task.cutoff = cutoff;
+	task.apix = apix;
+	task.fscr = FourierShellCorrelator::get(lnx,lnx,lnx);
+	task.res = ret->get_data();
+	task.filt = filtered ? filtered->get_data() : 0;
+	task.norm = filtered ? &norm[0] : 0;
+	task.rows = &rows;
+	task.work = &work;
+
+	size_t nrows = (size_t)nt[1]*nt[2];
+	if (!filtered) {
+		for (size_t i = 0; i < nrows; i++) rows.push_back(i);
+		Parallel::run(task,rows.size());
+	}
+	else {
+		// rows more than a window apart in both y and z never touch the same voxels, so each
+		// pass runs one such set of rows. The sums don't depend on the number of threads.
+		int nc = (lnx+step-1)/step;
+		for (int cz = 0; cz < nc; cz++) {
+			for (int cy = 0; cy < nc; cy++) {
+				rows.clear();
+				for (int oz = cz; oz < nt[2]; oz += nc) {
+					for (int oy = cy; oy < nt[1]; oy += nc) rows.push_back(oy + (size_t)nt[1]*oz);
+				}
+				if (!rows.empty()) Parallel::run(task,rows.size());
+			}
+		}
+
+		// the blending masks don't quite sum to a constant, so the sum is normalized
+		float *f = filtered->get_data();
+		for (size_t i = 0; i < norm.size(); i++) f[i] = norm[i]>0 ? f[i]/norm[i] : 0;
+		filtered->update();
+	}
+	ret->update();
+
+	EXITFUNC;
+	return ret;
+}
+
 void SNRProcessor::process_inplace(EMData * image)
 {
 	if (!image) {
@@ -10054,7 +10341,6 @@ float* TransformProcessor::transform(const EMData* const image, const Transform&
 	int nx = image->get_xsize();
 	int ny = image->get_ysize();
 	int nz = image->get_zsize();
-	int nxy = nx*ny;
 	int N	= ny;
 
 	int zerocorners = params.set_default("zerocorners",0);
@@ -10064,43 +10350,20 @@ float* TransformProcessor::transform(const EMData* const image, const Transform&
 	float *des_data = (float *) EMUtil::em_calloc(sizeof(float)*nx,ny*nz);
 
 	if ((nz == 1)&&(image -> is_real()))  {
-		Vec2f offset(nx/2,ny/2);
+		// source coordinates are generated a row at a time and handed to the block kernel,
+		// which zeroes anything falling outside the image. It may be tempting to use the
+		// mean there but in fact this is not a good thing to do. Talk to S.Ludtke about it.
+		float ox = (float)(nx/2), oy = (float)(ny/2);
+		vector<float> xs(nx), ys(nx);
 		for (int j = 0; j < ny; j++) {
+			float y = (float)(j-ny/2);
+			float y0 = inv[0][1]*y, y1 = inv[1][1]*y;
 			for (int i = 0; i < nx; i++) {
-				Vec2f coord(i-nx/2,j-ny/2);
-				Vec2f soln = inv*coord;
-				soln += offset;
-
-				float x2 = soln[0];
-				float y2 = soln[1];
-
-				if (x2 < 0 || x2 >= nx || y2 < 0 || y2 >= ny ) {
-					des_data[i + j * nx] = 0; // It may be tempting to set this value to the
-					// mean but in fact this is not a good thing to do. Talk to S.Ludtke about it.
-				}
-				else {
-					int ii = Util::fast_floor(x2);
-					int jj = Util::fast_floor(y2);
-					int k0 = ii + jj * nx;
-					int k1 = k0 + 1;
-					int k2 = k0 + nx;
-					int k3 = k0 + nx + 1;
-
-					if (ii == nx - 1) {
-						k1--;
-						k3--;
-					}
-					if (jj == ny - 1) {
-						k2 -= nx;
-						k3 -= nx;
-					}
-
-					float t = x2 - ii;
-					float u = y2 - jj;
-
-					des_data[i + j * nx] = Util::bilinear_interpolate(src_data[k0],src_data[k1], src_data[k2], src_data[k3],t,u);
-				}
+				float x = (float)(i-nx/2);
+				xs[i] = inv[0][0]*x + y0 + inv[0][3] + ox;
+				ys[i] = inv[1][0]*x + y1 + inv[1][3] + oy;
 			}
+			Resampler::bilinear(src_data,nx,ny,&xs[0],&ys[0],nx,des_data+(size_t)j*nx);
 		}
 	}
 	if ((nz == 1)&&(image -> is_complex())&&(nx%2==0)&&((2*(nx-ny)-3)*(2*(nx-ny)-3)==1)&&(zerocorners==0) )	 {
@@ -10902,66 +11165,22 @@ float* TransformProcessor::transform(const EMData* const image, const Transform&
 		}}}	 // end z, y, x loops through new coordinates
 	}	//	end	 rotations in Fourier Space	 3D
 	if ((nz > 1)&&(image -> is_real())) {
-		size_t l=0, ii, k0, k1, k2, k3, k4, k5, k6, k7;
-		Vec3f offset(nx/2,ny/2,nz/2);
-		float x2, y2, z2, tuvx, tuvy, tuvz;
-		int ix, iy, iz;
+		float ox = (float)(nx/2), oy = (float)(ny/2), oz = (float)(nz/2);
+		vector<float> xs(nx), ys(nx), zs(nx);
+		float *dst = des_data;
 		for (int k = 0; k < nz; ++k) {
-			for (int j = 0; j < ny; ++j) {
-				for (int i = 0; i < nx; ++i,++l) {
-					Vec3f coord(i-nx/2,j-ny/2,k-nz/2);
-					Vec3f soln = inv*coord;
-					soln += offset;
-
-					x2 = soln[0];
-					y2 = soln[1];
-					z2 = soln[2];
-
-					if (x2 < 0 || y2 < 0 || z2 < 0 || x2 >= nx	|| y2 >= ny	 || z2>= nz ) {
-						des_data[l] = 0;
-					}
-					else {
-						ix = Util::fast_floor(x2);
-						iy = Util::fast_floor(y2);
-						iz = Util::fast_floor(z2);
-						tuvx = x2-ix;
-						tuvy = y2-iy;
-						tuvz = z2-iz;
-						ii = ix + iy * nx + iz * nxy;
-
-						k0 = ii;
-						k1 = k0 + 1;
-						k2 = k0 + nx;
-						k3 = k0 + nx+1;
-						k4 = k0 + nxy;
-						k5 = k1 + nxy;
-						k6 = k2 + nxy;
-						k7 = k3 + nxy;
-
-						if (ix == nx - 1) {
-							k1--;
-							k3--;
-							k5--;
-							k7--;
-						}
-						if (iy == ny - 1) {
-							k2 -= nx;
-							k3 -= nx;
-							k6 -= nx;
-							k7 -= nx;
-						}
-						if (iz == nz - 1) {
-							k4 -= nxy;
-							k5 -= nxy;
-							k6 -= nxy;
-							k7 -= nxy;
-						}
-
-						des_data[l] = Util::trilinear_interpolate(src_data[k0],
-								src_data[k1], src_data[k2], src_data[k3], src_data[k4],
-								src_data[k5], src_data[k6], src_data[k7], tuvx, tuvy, tuvz);
-					}
-				}
+			float z = (float)(k-nz/2);
+			for (int j = 0; j < ny; ++j, dst += nx) {
+				float y = (float)(j-ny/2);
+				float y0 = inv[0][1]*y, y1 = inv[1][1]*y, y2 = inv[2][1]*y;
+				float z0 = inv[0][2]*z, z1 = inv[1][2]*z, z2 = inv[2][2]*z;
+				for (int i = 0; i < nx; ++i) {
+					float x = (float)(i-nx/2);
+					xs[i] = inv[0][0]*x + y0 + z0 + inv[0][3] + ox;
+					ys[i] = inv[1][0]*x + y1 + z1 + inv[1][3] + oy;
+					zs[i] = inv[2][0]*x + y2 + z2 + inv[2][3] + oz;
+				}
+				Resampler::trilinear(src_data,nx,ny,nz,&xs[0],&ys[0],&zs[0],nx,dst);
 			}
 		}
 	}
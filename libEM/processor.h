@@ -6814,6 +6814,59 @@ since the SSNR is being computed as FSC/(1-FSC). Ie - the SSNR of the combined h
 		static const string NAME;
 	};
 
+	/** Local resolution from two half maps, as computed by e2fsc.py. The FSC between the half maps is
+	 * computed in overlapping cubic windows, each multiplied by a central Gaussian mask. The image becomes
+	 * a map with one value per window: the spatial frequency (1/A) at which the local FSC falls below
+	 * 'cutoff', or 0 for windows with no density above mean+sigma. Optionally the mean of the half maps is
+	 * also low-pass filtered at the local resolution, window by window, and the overlapping windows blended.
+	 *
+	 * Windows are FFTed into reused per-thread buffers, their FSCs summed with FourierShellCorrelator, and
+	 * rows of windows are run in parallel (see Parallel).
+	 * @param with the second half map
+	 * @param localsize window size in pixels. Default is 32 A, at least 16 pixels, rounded up to a multiple of overlap
+	 * @param overlap windows per window size along each axis, ie - the step is localsize/overlap. Default=4
+	 * @param cutoff FSC threshold defining the local resolution. Default=0.143
+	 * @param apix A/pixel, default is apix_x of the image
+	 * @param filtered if provided, this image receives the locally filtered mean of the half maps
+	 */
+	class LocalFSCProcessor:public Processor
+	{
+	  public:
+		virtual EMData* process(EMData const *image);
+		virtual void process_inplace(EMData *image);
+
+		virtual string get_name() const
+		{
+			return NAME;
+		}
+
+		static Processor *NEW()
+		{
+			return new LocalFSCProcessor();
+		}
+
+		virtual string get_desc() const
+		{
+			return "Computes a local resolution map from two half maps, using the FSC in overlapping Gaussian masked windows, as e2fsc.py. \
+Each output voxel is the spatial frequency (1/A) where the FSC of one window falls below the cutoff, or 0 for empty windows. \
+Optionally produces the mean of the half maps, low-pass filtered at the local resolution.";
+		}
+
+		virtual TypeDict get_param_types() const
+		{
+			TypeDict d;
+			d.put("with", EMObject::EMDATA, "The second half map. Required");
+			d.put("localsize", EMObject::INT, "Window size in pixels. Default is 32 A (at least 16 pixels), rounded up to a multiple of overlap");
+			d.put("overlap", EMObject::INT, "Number of window steps per window size along each axis. Default=4");
+			d.put("cutoff", EMObject::FLOAT, "FSC threshold defining the local resolution. Default=0.143");
+			d.put("apix", EMObject::FLOAT, "A/pixel. Default is apix_x of the image");
+			d.put("filtered", EMObject::EMDATA, "If provided, this image receives the mean of the half maps, low-pass filtered at the local resolution");
+			return d;
+		}
+
+		static const string NAME;
+	};
+
 	/** Processor the images by the estimated SNR in each image.if parameter 'wiener' is 1, then wiener processor the images using the estimated SNR with CTF amplitude correction.
 	 * @param defocus mean defocus in microns
 	 * @param voltage microscope voltage in Kv
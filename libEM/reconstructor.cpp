@@ -38,8 +38,12 @@
 #include "ctf.h"
 #include "emassert.h"
 #include "symmetry.h"
+#include "parallel.h"
+#include "emfft.h"
 #include <cstring>
+#include <cfloat>
 #include <fstream>
+#include <stdint.h>
 #include <iomanip>
 
 #include <gsl/gsl_statistics_double.h>
@@ -105,6 +109,304 @@ template <> Factory < Reconstructor >::Factory()
 //	force_add<XYZReconstructor>();
 }
 
+namespace {
+
+// Reconstructor state blobs: a header holding the reconstructor name and volume dimensions, followed by
+// two sections, the complex Fourier volume and the weight volume. Each section stores a list of
+// (start,length) spans covering its non-zero values, followed by the values of those spans as 32 bit
+// floats, or as 16 bit floats to be multiplied by a per-section scale.
+const char STATE_MAGIC[4] = { 'E', 'M', 'R', 'S' };
+const uint32_t STATE_VERSION = 1;
+const uint32_t STATE_BYTE_ORDER = 0x01020304;
+const uint32_t STATE_FLOAT32 = 0;
+const uint32_t STATE_FLOAT16 = 1;
+// zero gaps shorter than this are stored rather than starting a new span
+const size_t STATE_MIN_GAP = 8;
+// scaled weights are kept below the largest finite half float, 65504
+const float STATE_HALF_MAX = 65000.0f;
+
+uint16_t float_to_half(float f)
+{
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
+	uint32_t sign = (x >> 16) & 0x8000u;
+	uint32_t mant = x & 0x7fffffu;
+	int fexp = (x >> 23) & 0xff;
+	if (fexp == 0xff) return (uint16_t)(sign | 0x7c00u | (mant ? 0x200u : 0u));
+
+	int exp = fexp - 127 + 15;
+	if (exp >= 31) return (uint16_t)(sign | 0x7c00u);
+	if (exp <= 0) {
+		// subnormal half, rounded to nearest even
+		if (exp < -10) return (uint16_t)sign;
+		mant |= 0x800000u;
+		int shift = 14 - exp;
+		uint32_t h = mant >> shift;
+		uint32_t rem = mant & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (rem > halfway || (rem == halfway && (h & 1u))) h++;
+		return (uint16_t)(sign | h);
+	}
+	uint32_t h = ((uint32_t)exp << 10) | (mant >> 13);
+	uint32_t rem = mant & 0x1fffu;
+	if (rem > 0x1000u || (rem == 0x1000u && (h & 1u))) h++;	// a carry into the exponent is still correct
+	return (uint16_t)(sign | h);
+}
+
+float half_to_float(uint16_t h)
+{
+	uint32_t sign = (uint32_t)(h & 0x8000u) << 16;
+	uint32_t exp = (h >> 10) & 0x1fu;
+	uint32_t mant = h & 0x3ffu;
+	uint32_t x;
+	if (exp == 0) {
+		if (mant == 0) x = sign;
+		else {
+			exp = 127 - 15 + 1;
+			while (!(mant & 0x400u)) { mant <<= 1; exp--; }
+			x = sign | (exp << 23) | ((mant & 0x3ffu) << 13);
+		}
+	}
+	else if (exp == 31) x = sign | 0x7f800000u | (mant << 13);
+	else x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+template <class T> void state_put(string& out, const T& v)
+{
+	out.append((const char*)&v, sizeof(T));
+}
+
+/** Sequential reader over a state blob, throwing rather than reading past the end */
+class StateReader
+{
+  public:
+	StateReader(const string& s) : data(s), pos(0) {}
+
+	void read(void* dst, size_t n)
+	{
+		if (n > data.size() - pos) throw InvalidValueException(0, "Reconstructor state is truncated");
+		memcpy(dst, data.data() + pos, n);
+		pos += n;
+	}
+
+	template <class T> T get()
+	{
+		T v;
+		read(&v, sizeof(T));
+		return v;
+	}
+
+	bool at_end() const { return pos == data.size(); }
+
+  private:
+	const string& data;
+	size_t pos;
+};
+
+void put_state_header(string& out, const string& name, const int* ddims, const int* wdims)
+{
+	out.append(STATE_MAGIC, 4);
+	state_put(out, STATE_VERSION);
+	state_put(out, STATE_BYTE_ORDER);
+	state_put(out, (uint32_t)name.size());
+	out.append(name);
+	for (int d = 0; d < 3; d++) state_put(out, (int32_t)ddims[d]);
+	for (int d = 0; d < 3; d++) state_put(out, (int32_t)wdims[d]);
+}
+
+/** Read the header of a state, returning the reconstructor name and the dimensions of the two sections */
+string get_state_header(StateReader& in, int* ddims, int* wdims)
+{
+	char magic[4];
+	in.read(magic, 4);
+	if (memcmp(magic, STATE_MAGIC, 4) != 0) throw InvalidValueException(0, "Not a reconstructor state");
+	uint32_t version = in.get<uint32_t>();
+	if (version != STATE_VERSION) throw InvalidValueException(version, "Unsupported reconstructor state version");
+	if (in.get<uint32_t>() != STATE_BYTE_ORDER) throw InvalidValueException(0, "Reconstructor state has foreign byte order");
+	uint32_t len = in.get<uint32_t>();
+	if (len > 256) throw InvalidValueException(len, "Reconstructor state is corrupt");
+	string name(len, ' ');
+	if (len) in.read(&name[0], len);
+	for (int d = 0; d < 6; d++) {
+		int& dim = d < 3 ? ddims[d] : wdims[d - 3];
+		dim = in.get<int32_t>();
+		if (dim < 0) throw InvalidValueException(dim, "Reconstructor state is corrupt");
+	}
+	return name;
+}
+
+/** Append a section holding the non-zero spans of the n values in v */
+void put_state_section(string& out, const float* v, size_t n, bool half)
+{
+	vector<uint64_t> spans;
+	size_t i = 0;
+	while (i < n) {
+		while (i < n && v[i] == 0.0f) i++;
+		if (i == n) break;
+		size_t start = i, end = i;
+		// extend across non-zero values and zero gaps shorter than STATE_MIN_GAP
+		while (i < n) {
+			if (v[i] != 0.0f) end = ++i;
+			else if (i - end < STATE_MIN_GAP) i++;
+			else break;
+		}
+		spans.push_back(start);
+		spans.push_back(end - start);
+		i = end;
+	}
+
+	float scale = 1.0f;
+	if (half) {
+		float vmax = 0;
+		for (size_t j = 0; j < spans.size(); j += 2) {
+			for (size_t k = spans[j]; k < spans[j] + spans[j + 1]; k++) {
+				float a = fabs(v[k]);
+				if (a > vmax) vmax = a;
+			}
+		}
+		if (vmax > STATE_HALF_MAX) scale = vmax / STATE_HALF_MAX;
+	}
+
+	state_put(out, half ? STATE_FLOAT16 : STATE_FLOAT32);
+	state_put(out, scale);
+	state_put(out, (uint64_t)(spans.size() / 2));
+	if (!spans.empty()) out.append((const char*)&spans[0], spans.size() * sizeof(uint64_t));
+
+	for (size_t j = 0; j < spans.size(); j += 2) {
+		const float* src = v + spans[j];
+		size_t len = spans[j + 1];
+		if (half) {
+			vector<uint16_t> packed(len);
+			float iscale = 1.0f / scale;
+			for (size_t k = 0; k < len; k++) packed[k] = float_to_half(src[k] * iscale);
+			out.append((const char*)&packed[0], len * sizeof(uint16_t));
+		}
+		else out.append((const char*)src, len * sizeof(float));
+	}
+}
+
+/** Read a section holding n values, adding its spans into dst */
+void add_state_section(StateReader& in, float* dst, size_t n)
+{
+	uint32_t encoding = in.get<uint32_t>();
+	if (encoding != STATE_FLOAT32 && encoding != STATE_FLOAT16) throw InvalidValueException(encoding, "Reconstructor state is corrupt");
+	float scale = in.get<float>();
+	uint64_t nspans = in.get<uint64_t>();
+	if (nspans > n) throw InvalidValueException(0, "Reconstructor state is corrupt");
+
+	vector<uint64_t> spans((size_t)nspans * 2);
+	if (nspans) in.read(&spans[0], spans.size() * sizeof(uint64_t));
+	vector<float> vals;
+	vector<uint16_t> packed;
+	for (size_t j = 0; j < spans.size(); j += 2) {
+		uint64_t start = spans[j], len = spans[j + 1];
+		if (start > n || len > n - start) throw InvalidValueException(0, "Reconstructor state is corrupt");
+		float* out = dst + start;
+		if (encoding == STATE_FLOAT16) {
+			packed.resize((size_t)len);
+			if (len) in.read(&packed[0], (size_t)len * sizeof(uint16_t));
+			for (size_t k = 0; k < len; k++) out[k] += half_to_float(packed[k]) * scale;
+		}
+		else {
+			vals.resize((size_t)len);
+			if (len) in.read(&vals[0], (size_t)len * sizeof(float));
+			for (size_t k = 0; k < len; k++) out[k] += vals[k];
+		}
+	}
+}
+
+void check_state_dims(const int* dims, const EMData* img)
+{
+	if (dims[0] != img->get_xsize() || dims[1] != img->get_ysize() || dims[2] != img->get_zsize())
+		throw ImageDimensionException("Reconstructor state does not match the size of the reconstruction");
+}
+
+}
+
+string Reconstructor::get_state(bool half_weights)
+{
+	EMData *data = 0, *weights = 0;
+	if (!get_accumulators(data, weights)) throw InvalidCallException(get_name() + " does not support get_state");
+	if (data == 0 || weights == 0) throw InvalidCallException("get_state requires a reconstructor which has been set up");
+
+	string out;
+	int ddims[3] = { data->get_xsize(), data->get_ysize(), data->get_zsize() };
+	int wdims[3] = { weights->get_xsize(), weights->get_ysize(), weights->get_zsize() };
+	put_state_header(out, get_name(), ddims, wdims);
+	put_state_section(out, data->get_const_data(), data->get_size(), false);
+	put_state_section(out, weights->get_const_data(), weights->get_size(), half_weights);
+	return out;
+}
+
+void Reconstructor::apply_state(const string& state, bool add)
+{
+	EMData *data = 0, *weights = 0;
+	if (!get_accumulators(data, weights)) throw InvalidCallException(get_name() + " does not support set_state");
+	if (data == 0 || weights == 0) throw InvalidCallException("set_state requires a reconstructor which has been set up");
+
+	StateReader in(state);
+	int ddims[3], wdims[3];
+	if (get_state_header(in, ddims, wdims) != get_name()) throw InvalidValueException(0, "Reconstructor state was produced by a different reconstructor");
+	check_state_dims(ddims, data);
+	check_state_dims(wdims, weights);
+
+	if (!add) {
+		data->to_zero();
+		weights->to_zero();
+	}
+	add_state_section(in, data->get_data(), data->get_size());
+	add_state_section(in, weights->get_data(), weights->get_size());
+	if (!in.at_end()) throw InvalidValueException(0, "Reconstructor state has trailing data");
+	data->update();
+	weights->update();
+}
+
+void Reconstructor::set_state(const string& state)
+{
+	apply_state(state, false);
+}
+
+void Reconstructor::merge_state(const string& state)
+{
+	apply_state(state, true);
+}
+
+string Reconstructor::merge_states(const vector<string>& states, bool half_weights)
+{
+	if (states.empty()) throw InvalidValueException(0, "merge_states requires at least one state");
+
+	string name;
+	int ddims[3], wdims[3];
+	vector<float> data, weights;
+	for (size_t i = 0; i < states.size(); i++) {
+		StateReader in(states[i]);
+		int dd[3], wd[3];
+		string sname = get_state_header(in, dd, wd);
+		if (i == 0) {
+			name = sname;
+			memcpy(ddims, dd, sizeof(ddims));
+			memcpy(wdims, wd, sizeof(wdims));
+			data.assign((size_t)dd[0] * dd[1] * dd[2], 0.0f);
+			weights.assign((size_t)wd[0] * wd[1] * wd[2], 0.0f);
+		}
+		else if (sname != name || memcmp(dd, ddims, sizeof(ddims)) != 0 || memcmp(wd, wdims, sizeof(wdims)) != 0)
+			throw InvalidValueException(i, "Reconstructor states to merge are not compatible");
+
+		add_state_section(in, data.empty() ? 0 : &data[0], data.size());
+		add_state_section(in, weights.empty() ? 0 : &weights[0], weights.size());
+		if (!in.at_end()) throw InvalidValueException(i, "Reconstructor state has trailing data");
+	}
+
+	string out;
+	put_state_header(out, name, ddims, wdims);
+	put_state_section(out, data.empty() ? 0 : &data[0], data.size(), false);
+	put_state_section(out, weights.empty() ? 0 : &weights[0], weights.size(), half_weights);
+	return out;
+}
+
 class ctf_store_real
 {
 public:
@@ -524,7 +826,7 @@ int FourierIterReconstructor::insert_slice(const EMData* const slice, const Tran
 
 //	if (slice->get_attr_default("reconstruct_preproc",(int) 0)) throw ImageDimensionException("ERROR: FourierIterReconstructor requires preprocess_slice() to be called in advance");
 
-	vector<Transform> syms = Symmetry3D::get_symmetries((string)params["sym"]);
+	const vector<Transform>& syms = Symmetry3D::get_cached_symmetries((string)params["sym"]);
 
 	float inx=(float)(slice->get_xsize());		// x/y dimensions of the input image
 	float iny=(float)(slice->get_ysize());
@@ -1081,7 +1383,7 @@ void FourierReconstructor::do_insert_slice_work(const EMData* const input_slice,
 // 	if (input_slice->is_fftodd()) x_in -= 1;
 // 	else x_in -= 2;
 
-	vector<Transform> syms = Symmetry3D::get_symmetries((string)params["sym"]);
+	const vector<Transform>& syms = Symmetry3D::get_cached_symmetries((string)params["sym"]);
 
 	float inx=(float)(input_slice->get_xsize());		// x/y dimensions of the input image
 	float iny=(float)(input_slice->get_ysize());
@@ -1205,7 +1507,7 @@ void FourierReconstructor::do_compare_slice_work(EMData* input_slice, const Tran
 	float dt[3];	// This stores the complex and weight from the volume
 	float dt2[2];	// This stores the local image complex
 	float *dat = input_slice->get_data();
-	vector<Transform> syms = Symmetry3D::get_symmetries((string)params["sym"]);
+	const vector<Transform>& syms = Symmetry3D::get_cached_symmetries((string)params["sym"]);
 
 	float inx=(float)(input_slice->get_xsize());		// x/y dimensions of the input image
 	float iny=(float)(input_slice->get_ysize());
@@ -1387,6 +1689,307 @@ bool FourierReconstructor::pixel_at(const float& xx, const float& yy, const floa
 }
 
 
+namespace {
+
+// Gaussian widths of the gauss_n insertion kernels in real space, as used with math.gausskernelfix
+float gauss_kernel_width(const string& mode)
+{
+	if (mode == "gauss_2") return 4.0f;
+	if (mode == "gauss_3") return 6.4f;
+	if (mode == "gauss_5") return 10.4f;
+	return 0.0f;
+}
+
+bool kernel_correction_supported(const string& mode)
+{
+	return gauss_kernel_width(mode) > 0 || mode == "gridding_5" || mode == "gridding_7";
+}
+
+/** The real-space correction math.gausskernelfix or math.gridkernelfix would apply to an n[0] x n[1] x n[2]
+ * volume reconstructed with a given insertion mode, evaluated one voxel at a time from small per-axis tables
+ * instead of from a correction volume. The gaussian correction is separable. The gridding correction is the
+ * reciprocal of the inverse transform of the kernel, which is a sum over the few kernel taps of products of
+ * per-axis cosines, so set_plane() and set_row() fold the z and y terms before voxels along a row are evaluated.
+ * Table entry i along axis d is the voxel lo[d]+i voxels from the phase origin.
+ */
+class KernelCorrection
+{
+  public:
+	KernelCorrection(const string& mode, const int* n, const int* lo, const int* len) : nk(0), gz(1.0f), gy(1.0f), kmax(1.0f)
+	{
+		float width = gauss_kernel_width(mode);
+		if (mode == "gridding_5") set_kernel(&FourierInserter3DMode7::kernel[0][0][0], 3, 9);
+		else if (mode == "gridding_7") set_kernel(&FourierInserter3DMode11::kernel[0][0][0], 4, 12);
+		else if (width == 0) throw InvalidParameterException("No kernel correction for insertion mode " + mode);
+
+		if (nk) {
+			// math.gridkernelfix scales the kernel transform by its maximum over the whole volume, which
+			// isn't at the origin. The transform is even along each axis, so one octant is searched.
+			int qlo[3] = { 0, 0, 0 };
+			int qlen[3] = { n[0] / 2 + 1, n[1] / 2 + 1, n[2] / 2 + 1 };
+			set_tables(n, qlo, qlen, 0);
+			vector<float> planemax(qlen[2]);
+			KernelMaxTask task(*this, planemax);
+			Parallel::run(task, qlen[2]);
+			kmax = *std::max_element(planemax.begin(), planemax.end());
+		}
+		set_tables(n, lo, len, width);
+	}
+
+	void set_plane(int z)
+	{
+		if (nk == 0) {
+			gz = tab[2][z];
+			return;
+		}
+		for (int ab = 0; ab < nk * nk; ab++) {
+			float sum = 0;
+			for (int c = 0; c < nk; c++) sum += kern[ab * nk + c] * tab[2][(size_t)c * len[2] + z];
+			plane[ab] = sum;
+		}
+	}
+
+	void set_row(int y)
+	{
+		if (nk == 0) {
+			gy = gz * tab[1][y];
+			return;
+		}
+		for (int a = 0; a < nk; a++) {
+			float sum = 0;
+			for (int b = 0; b < nk; b++) sum += plane[a * nk + b] * tab[1][(size_t)b * len[1] + y];
+			row[a] = sum;
+		}
+	}
+
+	float operator()(int x) const
+	{
+		if (nk == 0) return gy * tab[0][x];
+
+		// as math.gridkernelfix: scale the peak to 2, take the reciprocal and clamp to +-4
+		float f = transform_at(x) * (2.0f / kmax);
+		if (f == 0) return 0;
+		return Util::get_min(Util::get_max(1.0f / f, -4.0f), 4.0f);
+	}
+
+  private:
+	/** Finds the maximum of the kernel transform in each z plane */
+	class KernelMaxTask : public ParallelTask
+	{
+	  public:
+		KernelMaxTask(const KernelCorrection& c, vector<float>& m) : corr(c), planemax(m) {}
+
+		void run(size_t begin, size_t end, int)
+		{
+			KernelCorrection k(corr);
+			for (size_t z = begin; z < end; z++) {
+				k.set_plane((int)z);
+				float m = -FLT_MAX;
+				for (int y = 0; y < k.len[1]; y++) {
+					k.set_row(y);
+					for (int x = 0; x < k.len[0]; x++) m = Util::get_max(m, k.transform_at(x));
+				}
+				planemax[z] = m;
+			}
+		}
+
+	  private:
+		const KernelCorrection& corr;
+		vector<float>& planemax;
+	};
+	friend class KernelMaxTask;
+
+	/** Keep taps [0,taps) along each axis of a tn^3 kernel table, which is 3x oversampled */
+	void set_kernel(const float* table, int taps, int tn)
+	{
+		nk = taps;
+		kern.resize(nk * nk * nk);
+		for (int a = 0; a < nk; a++) {
+			for (int b = 0; b < nk; b++) {
+				for (int c = 0; c < nk; c++) kern[(a * nk + b) * nk + c] = table[((size_t)a * 3 * tn + b * 3) * tn + c * 3];
+			}
+		}
+		plane.resize(nk * nk);
+		row.resize(nk);
+	}
+
+	void set_tables(const int* n, const int* lo, const int* l, float width)
+	{
+		for (int d = 0; d < 3; d++) {
+			len[d] = l[d];
+			if (nk == 0) {
+				// matches math.gausskernelfix, which scales all axes by ny
+				float s = width / ((float)n[1] * n[1]);
+				tab[d].resize(len[d]);
+				for (int i = 0; i < len[d]; i++) {
+					float r = (float)(lo[d] + i);
+					tab[d][i] = exp(r * r * s);
+				}
+			}
+			else {
+				// kernel taps at |k|>0 appear twice in the full spectrum
+				tab[d].resize((size_t)nk * len[d]);
+				for (int a = 0; a < nk; a++) {
+					for (int i = 0; i < len[d]; i++) {
+						tab[d][(size_t)a * len[d] + i] = (a == 0 ? 1.0f : 2.0f) * cos(2.0 * M_PI * a * (lo[d] + i) / n[d]);
+					}
+				}
+			}
+		}
+	}
+
+	float transform_at(int x) const
+	{
+		float f = 0;
+		for (int a = 0; a < nk; a++) f += row[a] * tab[0][(size_t)a * len[0] + x];
+		return f;
+	}
+
+	int nk;
+	int len[3];
+	vector<float> tab[3];
+	vector<float> kern;
+	vector<float> plane;
+	vector<float> row;
+	float gz, gy;
+	float kmax;
+};
+
+/** Copies the phase-origin-centered crop of an inverse transformed volume, still in the padded FFT
+ * layout, into a real-space volume, applying the FFT scaling and an optional kernel correction.
+ * One item per output z plane.
+ */
+class RealSpaceCropTask : public ParallelTask
+{
+  public:
+	RealSpaceCropTask(const float* s, size_t sx, size_t sxy, float* d, const int* olen, const vector<int>* src_idx, float sc, const KernelCorrection* c) :
+		src(s), src_nx(sx), src_nxy(sxy), dst(d), srcidx(src_idx), scale(sc), corr(c)
+	{
+		for (int i = 0; i < 3; i++) on[i] = olen[i];
+	}
+
+	void run(size_t begin, size_t end, int)
+	{
+		// the correction keeps per-plane state, so each call works on its own copy
+		KernelCorrection* k = corr ? new KernelCorrection(*corr) : 0;
+		for (size_t z = begin; z < end; z++) {
+			if (k) k->set_plane((int)z);
+			float* out = dst + z * (size_t)on[0] * on[1];
+			for (int y = 0; y < on[1]; y++, out += on[0]) {
+				const float* in = src + (size_t)srcidx[2][z] * src_nxy + (size_t)srcidx[1][y] * src_nx;
+				if (k) {
+					k->set_row(y);
+					for (int x = 0; x < on[0]; x++) out[x] = in[srcidx[0][x]] * scale * (*k)(x);
+				}
+				else {
+					for (int x = 0; x < on[0]; x++) out[x] = in[srcidx[0][x]] * scale;
+				}
+			}
+		}
+		delete k;
+	}
+
+  private:
+	const float* src;
+	size_t src_nx, src_nxy;
+	float* dst;
+	int on[3];
+	const vector<int>* srcidx;
+	float scale;
+	const KernelCorrection* corr;
+};
+
+}
+
+bool FourierReconstructor::real_space_params(int* outsize, bool& kernelfix)
+{
+	kernelfix = params.set_default("kernelfix", false);
+	bool crop = params.has_key("outsize");
+	if (!kernelfix && !crop) return false;
+
+	if (subx0 != 0 || suby0 != 0 || subz0 != 0 || subnx != nx || subny != ny || subnz != nz)
+		throw InvalidParameterException("outsize and kernelfix can't be used when reconstructing a subvolume");
+	if (kernelfix && !kernel_correction_supported((string)params["mode"]))
+		throw InvalidParameterException("kernelfix is only available for the gauss_2, gauss_3, gauss_5, gridding_5 and gridding_7 modes");
+
+	int offset = image->is_fftodd() ? 1 : 2;
+	int n[3] = { image->get_xsize() - offset, image->get_ysize(), image->get_zsize() };
+	for (int d = 0; d < 3; d++) outsize[d] = n[d];
+	if (crop) {
+		vector<int> size = params["outsize"];
+		if (size.size() != 3) throw InvalidParameterException("outsize must have 3 elements");
+		for (int d = 0; d < 3; d++) {
+			if (size[d] < 1 || size[d] > n[d]) throw InvalidParameterException("outsize must be between 1 and the padded reconstruction size");
+			outsize[d] = size[d];
+		}
+	}
+	return true;
+}
+
+EMData* FourierReconstructor::finish_real_space(const int* outsize, bool kernelfix)
+{
+	int offset = image->is_fftodd() ? 1 : 2;
+	int n[3] = { image->get_xsize() - offset, image->get_ysize(), image->get_zsize() };
+	bool crop = outsize[0] != n[0] || outsize[1] != n[1] || outsize[2] != n[2];
+
+	// As do_ift_inplace, but the FFTW scaling is deferred to the pass below
+	float* data = image->get_data();
+	EMfft::complex_to_real_nd(data, data, n[0], n[1], n[2]);
+	float scale = 1.0f;
+#if defined USE_FFTW3
+	scale = 1.0f / ((size_t)n[0] * n[1] * n[2]);
+#endif
+	image->set_fftpad(true);
+	image->set_complex(false);
+	image->set_ri(false);
+
+	// voxel i of the phase-origin-centered volume is n/2 voxels right of the origin, at index (i-n/2+n)%n of
+	// the transform; the crop starts (n-outsize)/2 voxels into the centered volume
+	int lo[3];
+	vector<int> srcidx[3];
+	for (int d = 0; d < 3; d++) {
+		lo[d] = (n[d] - outsize[d]) / 2 - n[d] / 2;
+		srcidx[d].resize(outsize[d]);
+		for (int i = 0; i < outsize[d]; i++) srcidx[d][i] = (lo[d] + i + n[d]) % n[d];
+	}
+	KernelCorrection* corr = kernelfix ? new KernelCorrection((string)params["mode"], n, lo, outsize) : 0;
+
+	EMData* ret = image;
+	try {
+		if (crop) {
+			ret = new EMData(outsize[0], outsize[1], outsize[2]);
+			RealSpaceCropTask task(data, n[0] + offset, (size_t)(n[0] + offset) * n[1], ret->get_data(), outsize, srcidx, scale, corr);
+			Parallel::run(task, outsize[2]);
+			const char* apix[3] = { "apix_x", "apix_y", "apix_z" };
+			for (int d = 0; d < 3; d++) {
+				if (image->has_attr(apix[d])) ret->set_attr(apix[d], image->get_attr(apix[d]));
+			}
+			delete image;
+			image = ret;
+		}
+		else {
+			// without a crop the shift is a permutation of the whole volume, which the existing in place
+			// processors handle, so only the scaling and correction are fused
+			image->depad();
+			image->process_inplace("xform.phaseorigin.tocenter");
+			for (int d = 0; d < 3; d++) {
+				for (int i = 0; i < n[d]; i++) srcidx[d][i] = i;
+			}
+			data = image->get_data();
+			RealSpaceCropTask task(data, n[0], (size_t)n[0] * n[1], data, outsize, srcidx, scale, corr);
+			Parallel::run(task, n[2]);
+		}
+	}
+	catch (...) {
+		if (ret != image) delete ret;
+		delete corr;
+		throw;
+	}
+	delete corr;
+	ret->update();
+	return ret;
+}
+
 EMData *FourierReconstructor::finish(bool doift)
 {
 // 	float *norm = tmp_data->get_data();
@@ -1399,6 +2002,10 @@ EMData *FourierReconstructor::finish(bool doift)
 	}
 #endif
 	
+	int outsize[3];
+	bool kernelfix;
+	bool fused=doift && real_space_params(outsize,kernelfix);
+
 	bool sqrtnorm=params.set_default("sqrtnorm",false);
 	normalize_threed(sqrtnorm);
 //	printf("%f\t%f\t%f\n",tmp_data->get_value_at(67,19,1),image->get_value_at(135,19,1),image->get_value_at(134,19,1));
@@ -1432,7 +2039,17 @@ EMData *FourierReconstructor::finish(bool doift)
 
 /*	image->process_inplace("xform.fourierorigin.tocorner");*/
 
-	if (doift) {
+	// the weights aren't needed once normalized, so release them before the inverse transform
+	if (params.has_key("savenorm") && strlen((const char *)params["savenorm"])>0) {
+		if (tmp_data->get_ysize()%2==0 && tmp_data->get_zsize()%2==0) tmp_data->process_inplace("xform.fourierorigin.tocenter");
+		tmp_data->write_image((const char *)params["savenorm"]);
+	}
+
+	delete tmp_data;
+	tmp_data=0;
+
+	if (fused) finish_real_space(outsize,kernelfix);
+	else if (doift) {
 		image->do_ift_inplace();
 		image->depad();
 		image->process_inplace("xform.phaseorigin.tocenter");
@@ -1455,13 +2072,6 @@ EMData *FourierReconstructor::finish(bool doift)
 
 	image->update();
 	
-	if (params.has_key("savenorm") && strlen((const char *)params["savenorm"])>0) {
-		if (tmp_data->get_ysize()%2==0 && tmp_data->get_zsize()%2==0) tmp_data->process_inplace("xform.fourierorigin.tocenter");
-		tmp_data->write_image((const char *)params["savenorm"]);
-	}
-
-	delete tmp_data;
-	tmp_data=0;
 	//Since we give up the ownership of the pointer to-be-returned,	it's caller's responsibility to delete the returned image.
 	//So we wrap this function with return_value_policy< manage_new_object >() in libpyReconstructor2.cpp to hand over ownership to Python.
 	EMData *ret=image;
@@ -1509,7 +2119,7 @@ int WienerFourierReconstructor::insert_slice(const EMData* const input_slice, co
 void WienerFourierReconstructor::do_insert_slice_work(const EMData* const input_slice, const Transform & arg,const float inweight)
 {
 
-	vector<Transform> syms = Symmetry3D::get_symmetries((string)params["sym"]);
+	const vector<Transform>& syms = Symmetry3D::get_cached_symmetries((string)params["sym"]);
 
 	float inx=(float)(input_slice->get_xsize());		// x/y dimensions of the input image
 	float iny=(float)(input_slice->get_ysize());
@@ -1611,7 +2221,7 @@ void WienerFourierReconstructor::do_compare_slice_work(EMData* input_slice, cons
 	float dt[3];	// This stores the complex and weight from the volume
 	float dt2[2];	// This stores the local image complex
 	float *dat = input_slice->get_data();
-	vector<Transform> syms = Symmetry3D::get_symmetries((string)params["sym"]);
+	const vector<Transform>& syms = Symmetry3D::get_cached_symmetries((string)params["sym"]);
 
 	float inx=(float)(input_slice->get_xsize());		// x/y dimensions of the input image
 	float iny=(float)(input_slice->get_ysize());
@@ -1751,17 +2361,14 @@ bool WienerFourierReconstructor::pixel_at(const float& xx, const float& yy, cons
 EMData *WienerFourierReconstructor::finish(bool doift)
 {
 
+	int outsize[3];
+	bool kernelfix;
+	bool fused=doift && real_space_params(outsize,kernelfix);
+
 	bool sqrtnorm=params.set_default("sqrtnorm",false);
 	normalize_threed(sqrtnorm,true);		// true is the wiener filter
 
-	if (doift) {
-		image->do_ift_inplace();
-		image->depad();
-		image->process_inplace("xform.phaseorigin.tocenter");
-	}
-
-	image->update();
-	
+	// the weights aren't needed once normalized, so release them before the inverse transform
 	if (params.has_key("savenorm") && strlen((const char *)params["savenorm"])>0) {
 		if (tmp_data->get_ysize()%2==0 && tmp_data->get_zsize()%2==0) tmp_data->process_inplace("xform.fourierorigin.tocenter");
 		tmp_data->write_image((const char *)params["savenorm"]);
@@ -1769,6 +2376,16 @@ EMData *WienerFourierReconstructor::finish(bool doift)
 
 	delete tmp_data;
 	tmp_data=0;
+
+	if (fused) finish_real_space(outsize,kernelfix);
+	else if (doift) {
+		image->do_ift_inplace();
+		image->depad();
+		image->process_inplace("xform.phaseorigin.tocenter");
+	}
+
+	image->update();
+	
 	EMData *ret=image;
 	image=0;
 	
@@ -2029,7 +2646,7 @@ int BaldwinWoolfordReconstructor::insert_slice(const EMData* const input_slice,
 	int tny = tmp_data->get_ysize();
 	int tnz = tmp_data->get_zsize();
 
-	vector<Transform> syms = Symmetry3D::get_symmetries((string)params["sym"]);
+	const vector<Transform>& syms = Symmetry3D::get_cached_symmetries((string)params["sym"]);
 // 	float weight = params.set_default("weight",1.0f);
 
 	rotation->set_scale(1.0); rotation->set_mirror(false); rotation->set_trans(0,0,0);
@@ -2883,17 +3500,123 @@ int nn4Reconstructor::insert_slice(const EMData* const slice, const Transform& t
 	return 0;
 }
 
+namespace {
+	/** The orientations and weights a slice is inserted with by the nn4 family: each
+	 * symmetry related copy of t, spread over the volume's "smear" list of (phi, theta,
+	 * psi, weight) SPIDER quadruples when it has one.
+	 */
+	void smeared_sym_proj(EMData* volume, const Transform& t, const string& symmetry, float weight, vector<Transform>& tfs, vector<float>& weights)
+	{
+		vector<float> abc_list;
+		if (volume->has_attr("smear")) abc_list = volume->get_attr("smear");
+
+		vector<Transform> tsym = t.get_sym_proj(symmetry);
+		tfs.clear();
+		weights.clear();
+		for (unsigned int isym=0; isym < tsym.size(); isym++) {
+			if (abc_list.empty()) {
+				tfs.push_back(tsym[isym]);
+				weights.push_back(weight);
+			} else {
+				for (size_t i = 0; i + 3 < abc_list.size(); i += 4) {
+					tfs.push_back(tsym[isym] * Transform(Dict("type", "SPIDER", "phi",  abc_list[i], "theta", abc_list[i+1], "psi", abc_list[i+2])));
+					weights.push_back(weight * abc_list[i+3]);
+				}
+			}
+		}
+	}
+
+	/** Runs one per z plane step of a nn4 family finish() over the planes [1,nz], a plane
+	 * per item. A step only writes to its own plane of the volumes and to its own part of
+	 * the Nn4FinishPlanes outputs, so the result doesn't depend on the number of threads.
+	 */
+	template <class R>
+	class FinishPlanesTask : public ParallelTask
+	{
+	  public:
+		typedef void (R::*Step)(int iz, Nn4FinishPlanes& args);
+
+		FinishPlanesTask(R* r, Step s, Nn4FinishPlanes& a) : rec(r), step(s), args(a) {}
+
+		void run(size_t begin, size_t end, int)
+		{
+			for (size_t i = begin; i < end; i++) (rec->*step)((int)i + 1, args);
+		}
+
+	  private:
+		R* rec;
+		Step step;
+		Nn4FinishPlanes& args;
+	};
+
+	template <class R>
+	void run_finish_planes(R* rec, typename FinishPlanesTask<R>::Step step, Nn4FinishPlanes& args, int nz)
+	{
+		FinishPlanesTask<R> task(rec, step, args);
+		Parallel::run(task, nz);
+	}
+}
+
 int nn4Reconstructor::insert_padfft_slice( EMData* padfft, const Transform& t, float weight )
 {
 	Assert( padfft != NULL );
 
 	vector<Transform> tsym = t.get_sym_proj(m_symmetry);
-	for (unsigned int isym=0; isym < tsym.size(); isym++)  m_volume->nn( m_wptr, padfft, tsym[isym], weight);
+	m_volume->nn_batch( m_wptr, padfft, tsym, weight);
 	
 	return 0;
 }
 
 
+void nn4Reconstructor::normalize_plane(int iz, Nn4FinishPlanes& args)
+{
+	int ix,iy;
+	for (iy = 1; iy <= m_vnyp; iy++) {
+		for (ix = 0; ix <= m_vnxc; ix++) {
+			if ( (*m_wptr)(ix,iy,iz) > 0) {//(*v) should be treated as complex!!
+				float tmp = (-2*((ix+iy+iz)%2)+1)/((*m_wptr)(ix,iy,iz)+m_osnr);
+				if( m_weighting == ESTIMATE && false) {  // HERE
+					int cx = ix;
+					int cy = (iy<=m_vnyc) ? iy - 1 : iy - 1 - m_vnyp;
+					int cz = (iz<=m_vnzc) ? iz - 1 : iz - 1 - m_vnzp;
+					float sum = 0.0;
+					for( int ii = -args.kc; ii <= args.kc; ++ii ) {
+						int nbrcx = cx + ii;
+						if( nbrcx >= m_vnxc ) continue;
+						for( int jj= -args.kc; jj <= args.kc; ++jj ) {
+							int nbrcy = cy + jj;
+							if( nbrcy <= -m_vnyc || nbrcy >= m_vnyc ) continue;
+
+							int kcz = (m_ndim==3) ? args.kc : 0;
+							for( int kk = -kcz; kk <= kcz; ++kk ) {
+								int nbrcz = cz + kk;
+								if( nbrcz <= -m_vnyc || nbrcz >= m_vnyc ) continue;
+								if( nbrcx < 0 ) {
+									nbrcx = -nbrcx;
+						    			nbrcy = -nbrcy;
+						    			nbrcz = -nbrcz;
+								}
+								int nbrix = nbrcx;
+								int nbriy = nbrcy >= 0 ? nbrcy + 1 : nbrcy + 1 + m_vnyp;
+								int nbriz = nbrcz >= 0 ? nbrcz + 1 : nbrcz + 1 + m_vnzp;
+								if( (*m_wptr)( nbrix, nbriy, nbriz ) == 0 ) {
+									int c = m_ndim*args.kc+1 - std::abs(ii) - std::abs(jj) - std::abs(kk);
+									sum = sum + args.pow_a[c];
+								}
+							}
+						}
+					}
+					float wght = 1.0f / ( 1.0f - args.alpha * sum );
+					tmp = tmp * wght;
+				}
+//cout<<" mvol "<<ix<<"  "<<iy<<"  "<<iz<<"  "<<(*m_volume)(2*ix,iy,iz)<<"  "<<(*m_volume)(2*ix+1,iy,iz)<<"  "<<tmp<<"  "<<m_osnr<<endl;
+				(*m_volume)(2*ix,iy,iz)   *= tmp;
+				(*m_volume)(2*ix+1,iy,iz) *= tmp;
+			}
+		}
+	}
+}
+
 EMData* nn4Reconstructor::finish(bool) {
 
 	if( m_ndim == 3 ) {
@@ -2927,53 +3650,11 @@ EMData* nn4Reconstructor::finish(bool) {
 		float max = max2d( kc, pow_a );
 		alpha = ( 1.0f - 1.0f/(float)ara ) / max;
 	}
-	int ix,iy,iz;
-	for (iz = 1; iz <= m_vnzp; iz++) {
-		for (iy = 1; iy <= m_vnyp; iy++) {
-			for (ix = 0; ix <= m_vnxc; ix++) {
-				if ( (*m_wptr)(ix,iy,iz) > 0) {//(*v) should be treated as complex!!
-					float tmp = (-2*((ix+iy+iz)%2)+1)/((*m_wptr)(ix,iy,iz)+m_osnr);
-					if( m_weighting == ESTIMATE && false) {  // HERE
-						int cx = ix;
-						int cy = (iy<=m_vnyc) ? iy - 1 : iy - 1 - m_vnyp;
-						int cz = (iz<=m_vnzc) ? iz - 1 : iz - 1 - m_vnzp;
-						float sum = 0.0;
-						for( int ii = -kc; ii <= kc; ++ii ) {
-							int nbrcx = cx + ii;
-							if( nbrcx >= m_vnxc ) continue;
-							for( int jj= -kc; jj <= kc; ++jj ) {
-								int nbrcy = cy + jj;
-								if( nbrcy <= -m_vnyc || nbrcy >= m_vnyc ) continue;
-
-								int kcz = (m_ndim==3) ? kc : 0;
-								for( int kk = -kcz; kk <= kcz; ++kk ) {
-									int nbrcz = cz + kk;
-									if( nbrcz <= -m_vnyc || nbrcz >= m_vnyc ) continue;
-									if( nbrcx < 0 ) {
-										nbrcx = -nbrcx;
-							    			nbrcy = -nbrcy;
-							    			nbrcz = -nbrcz;
-									}
-									int nbrix = nbrcx;
-									int nbriy = nbrcy >= 0 ? nbrcy + 1 : nbrcy + 1 + m_vnyp;
-									int nbriz = nbrcz >= 0 ? nbrcz + 1 : nbrcz + 1 + m_vnzp;
-									if( (*m_wptr)( nbrix, nbriy, nbriz ) == 0 ) {
-										int c = m_ndim*kc+1 - std::abs(ii) - std::abs(jj) - std::abs(kk);
-										sum = sum + pow_a[c];
-									}
-								}
-							}
-						}
-						float wght = 1.0f / ( 1.0f - alpha * sum );
-						tmp = tmp * wght;
-					}
-//cout<<" mvol "<<ix<<"  "<<iy<<"  "<<iz<<"  "<<(*m_volume)(2*ix,iy,iz)<<"  "<<(*m_volume)(2*ix+1,iy,iz)<<"  "<<tmp<<"  "<<m_osnr<<endl;
-					(*m_volume)(2*ix,iy,iz)   *= tmp;
-					(*m_volume)(2*ix+1,iy,iz) *= tmp;
-				}
-			}
-		}
-	}
+	Nn4FinishPlanes args;
+	args.pow_a = pow_a;
+	args.kc = kc;
+	args.alpha = alpha;
+	run_finish_planes(this, &nn4Reconstructor::normalize_plane, args, m_vnzp);
 
 	//if(m_ndim==2) printImage( m_volume );
 
@@ -3227,8 +3908,7 @@ int nn4_rectReconstructor::insert_padfft_slice( EMData* padded, const Transform&
 	Assert( padded != NULL );
 		
 	vector<Transform> tsym = t.get_sym_proj(m_symmetry);
-	for (unsigned int isym=0; isym < tsym.size(); isym++)
-		m_volume->insert_rect_slice(m_wptr, padded, tsym[isym], m_sizeofprojection, m_xratio, m_yratio, m_zratio, m_npad, weight);
+	m_volume->insert_rect_slice_batch(m_wptr, padded, tsym, m_sizeofprojection, m_xratio, m_yratio, m_zratio, m_npad, weight);
 
 	return 0;
 
@@ -3314,6 +3994,56 @@ void circumfnn_rect( EMData* win , int npad)
 }
 #undef tw 
 
+void nn4_rectReconstructor::normalize_plane(int iz, Nn4FinishPlanes& args)
+{
+	int ix,iy;
+	for (iy = 1; iy <= m_vnyp; iy++) {
+		for (ix = 0; ix <= m_vnxc; ix++) {
+			if ( (*m_wptr)(ix,iy,iz) > 0) {//(*v) should be treated as complex!!
+				float tmp;
+				tmp = (-2*((ix+iy+iz)%2)+1)/((*m_wptr)(ix,iy,iz)+m_osnr);
+				
+				if( m_weighting == ESTIMATE ) {
+					int cx = ix;
+					int cy = (iy<=m_vnyc) ? iy - 1 : iy - 1 - m_vnyp;
+					int cz = (iz<=m_vnzc) ? iz - 1 : iz - 1 - m_vnzp;
+					float sum = 0.0;
+					for( int ii = -args.kc; ii <= args.kc; ++ii ) {
+						int nbrcx = cx + ii;
+						if( nbrcx >= m_vnxc ) continue;
+						for( int jj= -args.kc; jj <= args.kc; ++jj ) {
+							int nbrcy = cy + jj;
+							if( nbrcy <= -m_vnyc || nbrcy >= m_vnyc ) continue;
+
+							int kcz = (m_ndim==3) ? args.kc : 0;
+							for( int kk = -kcz; kk <= kcz; ++kk ) {
+								int nbrcz = cz + kk;
+								if( nbrcz <= -m_vnyc || nbrcz >= m_vnyc ) continue;
+								if( nbrcx < 0 ) {
+									nbrcx = -nbrcx;
+						    			nbrcy = -nbrcy;
+						    			nbrcz = -nbrcz;
+								}
+								int nbrix = nbrcx;
+								int nbriy = nbrcy >= 0 ? nbrcy + 1 : nbrcy + 1 + m_vnyp;
+								int nbriz = nbrcz >= 0 ? nbrcz + 1 : nbrcz + 1 + m_vnzp;
+								if( (*m_wptr)( nbrix, nbriy, nbriz ) == 0 ) {
+									int c = m_ndim*args.kc+1 - std::abs(ii) - std::abs(jj) - std::abs(kk);
+									sum = sum + args.pow_a[c];
+								}
+							}
+						}
+					}
+					float wght = 1.0f / ( 1.0f - args.alpha * sum );
+					tmp = tmp * wght;
+				}
+				(*m_volume)(2*ix,iy,iz)   *= tmp;
+				(*m_volume)(2*ix+1,iy,iz) *= tmp;
+			}
+		}
+	}
+}
+
 EMData* nn4_rectReconstructor::finish(bool)
 {
 	
@@ -3349,54 +4079,11 @@ EMData* nn4_rectReconstructor::finish(bool)
 		alpha = ( 1.0f - 1.0f/(float)ara ) / max;
 	}
 
-	int ix,iy,iz;
-	for (iz = 1; iz <= m_vnzp; iz++) {
-		for (iy = 1; iy <= m_vnyp; iy++) {
-			for (ix = 0; ix <= m_vnxc; ix++) {
-				if ( (*m_wptr)(ix,iy,iz) > 0) {//(*v) should be treated as complex!!
-					float tmp;
-					tmp = (-2*((ix+iy+iz)%2)+1)/((*m_wptr)(ix,iy,iz)+m_osnr);
-					
-					if( m_weighting == ESTIMATE ) {
-						int cx = ix;
-						int cy = (iy<=m_vnyc) ? iy - 1 : iy - 1 - m_vnyp;
-						int cz = (iz<=m_vnzc) ? iz - 1 : iz - 1 - m_vnzp;
-						float sum = 0.0;
-						for( int ii = -kc; ii <= kc; ++ii ) {
-							int nbrcx = cx + ii;
-							if( nbrcx >= m_vnxc ) continue;
-							for( int jj= -kc; jj <= kc; ++jj ) {
-								int nbrcy = cy + jj;
-								if( nbrcy <= -m_vnyc || nbrcy >= m_vnyc ) continue;
-
-								int kcz = (m_ndim==3) ? kc : 0;
-								for( int kk = -kcz; kk <= kcz; ++kk ) {
-									int nbrcz = cz + kk;
-									if( nbrcz <= -m_vnyc || nbrcz >= m_vnyc ) continue;
-									if( nbrcx < 0 ) {
-										nbrcx = -nbrcx;
-							    			nbrcy = -nbrcy;
-							    			nbrcz = -nbrcz;
-									}
-									int nbrix = nbrcx;
-									int nbriy = nbrcy >= 0 ? nbrcy + 1 : nbrcy + 1 + m_vnyp;
-									int nbriz = nbrcz >= 0 ? nbrcz + 1 : nbrcz + 1 + m_vnzp;
-									if( (*m_wptr)( nbrix, nbriy, nbriz ) == 0 ) {
-										int c = m_ndim*kc+1 - std::abs(ii) - std::abs(jj) - std::abs(kk);
-										sum = sum + pow_a[c];
-									}
-								}
-							}
-						}
-						float wght = 1.0f / ( 1.0f - alpha * sum );
-						tmp = tmp * wght;
-					}
-					(*m_volume)(2*ix,iy,iz)   *= tmp;
-					(*m_volume)(2*ix+1,iy,iz) *= tmp;
-				}
-			}
-		}
-	}
+	Nn4FinishPlanes args;
+	args.pow_a = pow_a;
+	args.kc = kc;
+	args.alpha = alpha;
+	run_finish_planes(this, &nn4_rectReconstructor::normalize_plane, args, m_vnzp);
 
 	//if(m_ndim==2) printImage( m_volume );
 
@@ -3896,25 +4583,80 @@ int nn4_ctfReconstructor::insert_buffed_slice( const EMData* buffed, float weigh
 int nn4_ctfReconstructor::insert_padfft_slice( EMData* padfft, EMData* ctf2d2, const Transform& t, float weight)
 {
 	Assert( padfft != NULL );
-	
-	vector<float> abc_list;
-	int abc_list_len = 0;	
-	if (m_volume->has_attr("smear"))
-	{
-		abc_list = m_volume->get_attr("smear");
-		abc_list_len = abc_list.size();
-	}
-				
-	vector<Transform> tsym = t.get_sym_proj(m_symmetry);
-	for (unsigned int isym=0; isym < tsym.size(); isym++) {
-		if (abc_list_len == 0)
-			m_volume->nn_ctf_exists(m_wptr, padfft, ctf2d2, tsym[isym], weight);
-		else
-			for (int i = 0; i < abc_list_len; i += 4) {
-				m_volume->nn_ctf_exists(m_wptr, padfft, ctf2d2, tsym[isym] * Transform(Dict("type", "SPIDER", "phi",  abc_list[i], "theta", abc_list[i+1], "psi", abc_list[i+2])), weight * abc_list[i+3]);
+
+	vector<Transform> tfs;
+	vector<float> weights;
+	smeared_sym_proj(m_volume, t, m_symmetry, weight, tfs, weights);
+	m_volume->nn_ctf_exists_batch(m_wptr, padfft, ctf2d2, tfs, weights);
+	return 0;
+}
+
+void nn4_ctfReconstructor::normalize_plane(int iz, Nn4FinishPlanes& args)
+{
+	float osnr = 1.0f/m_snr;
+	int ix,iy;
+	for (iy = 1; iy <= m_vnyp; iy++) {
+		for (ix = 0; ix <= m_vnxc; ix++) {
+			if ( (*m_wptr)(ix,iy,iz) > 0.0f) {//(*v) should be treated as complex!!
+				float tmp=0.0f;
+				if( m_varsnr )  {
+				    int iyp = (iy<=m_vnyc) ? iy - 1 : iy-m_vnyp-1;
+				    int izp = (iz<=m_vnzc) ? iz - 1 : iz-m_vnzp-1;
+					float freq = sqrt( (float)(ix*ix+iyp*iyp+izp*izp) );
+					tmp = (-2*((ix+iy+iz)%2)+1)/((*m_wptr)(ix,iy,iz)+freq*osnr);//*m_sign;
+				} else  {
+					tmp = (-2*((ix+iy+iz)%2)+1)/((*m_wptr)(ix,iy,iz)+osnr);//*m_sign;
+				}
+
+		if( m_weighting == ESTIMATE ) {
+			int cx = ix;
+			int cy = (iy<=m_vnyc) ? iy - 1 : iy - 1 - m_vnyp;
+			int cz = (iz<=m_vnzc) ? iz - 1 : iz - 1 - m_vnzp;
+			float sum = 0.0;
+			for( int ii = -args.kc; ii <= args.kc; ++ii ) {
+				int nbrcx = cx + ii;
+				if( nbrcx >= m_vnxc ) continue;
+				for( int jj= -args.kc; jj <= args.kc; ++jj ) {
+					int nbrcy = cy + jj;
+					if( nbrcy <= -m_vnyc || nbrcy >= m_vnyc ) continue;
+					for( int kk = -args.kc; kk <= args.kc; ++kk ) {
+						int nbrcz = cz + jj;
+						if( nbrcz <= -m_vnyc || nbrcz >= m_vnyc ) continue;
+						if( nbrcx < 0 ) {
+							nbrcx = -nbrcx;
+							nbrcy = -nbrcy;
+							nbrcz = -nbrcz;
+						}
+
+						int nbrix = nbrcx;
+						int nbriy = nbrcy >= 0 ? nbrcy + 1 : nbrcy + 1 + m_vnyp;
+						int nbriz = nbrcz >= 0 ? nbrcz + 1 : nbrcz + 1 + m_vnzp;
+						if( (*m_wptr)( nbrix, nbriy, nbriz ) == 0.0 ) {
+							int c = 3*args.kc+1 - std::abs(ii) - std::abs(jj) - std::abs(kk);
+							sum = sum + args.pow_a[c];
+				          		  // if(ix%20==0 && iy%20==0 && iz%20==0)
+				           		 //   std::cout << boost::format( "%4d %4d %4d %4d %10.3f" ) % nbrix % nbriy % nbriz % c % sum << std::endl;
+						}
+					}
+				}
+			}
+			float wght = 1.0f / ( 1.0f - args.alpha * sum );
+/*
+                        if(ix%10==0 && iy%10==0)
+                        {
+                            std::cout << boost::format( "%4d %4d %4d " ) % ix % iy %iz;
+                            std::cout << boost::format( "%10.3f %10.3f %10.3f " )  % tmp % wght % sum;
+                            std::  << boost::format( "%10.3f %10.3e " ) % pow_b[r] % args.alpha;
+                            std::cout << std::endl;
+                        }
+ */
+			tmp = tmp * wght;
 			}
+			(*m_volume)(2*ix,iy,iz) *= tmp;
+			(*m_volume)(2*ix+1,iy,iz) *= tmp;
+			}
+		}
 	}
-	return 0;
 }
 
 EMData* nn4_ctfReconstructor::finish(bool)
@@ -3933,74 +4675,13 @@ EMData* nn4_ctfReconstructor::finish(bool)
 
 	float max = max3d( kc, pow_a );
 	float alpha = ( 1.0f - 1.0f/(float)vol ) / max;
-	float osnr = 1.0f/m_snr;
 
 	// normalize
-	int ix,iy,iz;
-	for (iz = 1; iz <= m_vnzp; iz++) {
-		for (iy = 1; iy <= m_vnyp; iy++) {
-			for (ix = 0; ix <= m_vnxc; ix++) {
-				if ( (*m_wptr)(ix,iy,iz) > 0.0f) {//(*v) should be treated as complex!!
-					float tmp=0.0f;
-					if( m_varsnr )  {
-					    int iyp = (iy<=m_vnyc) ? iy - 1 : iy-m_vnyp-1;
-					    int izp = (iz<=m_vnzc) ? iz - 1 : iz-m_vnzp-1;
-						float freq = sqrt( (float)(ix*ix+iyp*iyp+izp*izp) );
-						tmp = (-2*((ix+iy+iz)%2)+1)/((*m_wptr)(ix,iy,iz)+freq*osnr);//*m_sign;
-					} else  {
-						tmp = (-2*((ix+iy+iz)%2)+1)/((*m_wptr)(ix,iy,iz)+osnr);//*m_sign;
-					}
-
-			if( m_weighting == ESTIMATE ) {
-				int cx = ix;
-				int cy = (iy<=m_vnyc) ? iy - 1 : iy - 1 - m_vnyp;
-				int cz = (iz<=m_vnzc) ? iz - 1 : iz - 1 - m_vnzp;
-				float sum = 0.0;
-				for( int ii = -kc; ii <= kc; ++ii ) {
-					int nbrcx = cx + ii;
-					if( nbrcx >= m_vnxc ) continue;
-					for( int jj= -kc; jj <= kc; ++jj ) {
-						int nbrcy = cy + jj;
-						if( nbrcy <= -m_vnyc || nbrcy >= m_vnyc ) continue;
-						for( int kk = -kc; kk <= kc; ++kk ) {
-							int nbrcz = cz + jj;
-							if( nbrcz <= -m_vnyc || nbrcz >= m_vnyc ) continue;
-							if( nbrcx < 0 ) {
-								nbrcx = -nbrcx;
-								nbrcy = -nbrcy;
-								nbrcz = -nbrcz;
-							}
-
-							int nbrix = nbrcx;
-							int nbriy = nbrcy >= 0 ? nbrcy + 1 : nbrcy + 1 + m_vnyp;
-							int nbriz = nbrcz >= 0 ? nbrcz + 1 : nbrcz + 1 + m_vnzp;
-							if( (*m_wptr)( nbrix, nbriy, nbriz ) == 0.0 ) {
-								int c = 3*kc+1 - std::abs(ii) - std::abs(jj) - std::abs(kk);
-								sum = sum + pow_a[c];
-					          		  // if(ix%20==0 && iy%20==0 && iz%20==0)
-					           		 //   std::cout << boost::format( "%4d %4d %4d %4d %10.3f" ) % nbrix % nbriy % nbriz % c % sum << std::endl;
-							}
-						}
-					}
-				}
-				float wght = 1.0f / ( 1.0f - alpha * sum );
-/*
-                        if(ix%10==0 && iy%10==0)
-                        {
-                            std::cout << boost::format( "%4d %4d %4d " ) % ix % iy %iz;
-                            std::cout << boost::format( "%10.3f %10.3f %10.3f " )  % tmp % wght % sum;
-                            std::  << boost::format( "%10.3f %10.3e " ) % pow_b[r] % alpha;
-                            std::cout << std::endl;
-                        }
- */
-				tmp = tmp * wght;
-				}
-				(*m_volume)(2*ix,iy,iz) *= tmp;
-				(*m_volume)(2*ix+1,iy,iz) *= tmp;
-				}
-			}
-		}
-	}
+	Nn4FinishPlanes args;
+	args.pow_a = pow_a;
+	args.kc = kc;
+	args.alpha = alpha;
+	run_finish_planes(this, &nn4_ctfReconstructor::normalize_plane, args, m_vnzp);
 
 	// back fft
 	m_volume->do_ift_inplace();
@@ -4193,24 +4874,86 @@ int nn4_ctfwReconstructor::insert_padfft_slice_weighted( EMData* padfft, EMData*
 {
 	Assert( padfft != NULL );
 
-	vector<float> abc_list;
-	int abc_list_len = 0;	
-	if (m_volume->has_attr("smear")) {
-		abc_list = m_volume->get_attr("smear");
-		abc_list_len = abc_list.size();
-	}
+	vector<Transform> tfs;
+	vector<float> weights;
+	smeared_sym_proj(m_volume, t, m_symmetry, weight, tfs, weights);
+	m_volume->nn_ctfw_batch(m_wptr, padfft, ctf2d2, m_npad, bckgnoise, tfs, weights);
+	return 0;
+}
 
-	vector<Transform> tsym = t.get_sym_proj(m_symmetry);
-	for (unsigned int isym=0; isym < tsym.size(); isym++) {
-		if (abc_list_len == 0)
-			m_volume->nn_ctfw(m_wptr, padfft, ctf2d2, m_npad, bckgnoise, tsym[isym], weight);
-		else
-			for (int i = 0; i < abc_list_len; i += 4) 
-				m_volume->nn_ctfw(m_wptr, padfft, ctf2d2, m_npad, bckgnoise, tsym[isym] * Transform(Dict("type", "SPIDER", "phi",  abc_list[i], "theta", abc_list[i+1], "psi", abc_list[i+2])), weight * abc_list[i+3]);
+
+void nn4_ctfwReconstructor::sigma2_plane(int iz, Nn4FinishPlanes& args)
+{
+	float* sigma2 = &args.sigma2[(size_t)(iz-1)*args.nbin];
+	float* count = &args.count[(size_t)(iz-1)*args.nbin];
+	int ix,iy;
+	int   izp = (iz<=m_vnzc) ? iz - 1 : iz-m_vnzp-1;
+	float argz = float(izp*izp);
+	for (iy = 1; iy <= m_vnyp; iy++) {
+		int   iyp = (iy<=m_vnyc) ? iy - 1 : iy-m_vnyp-1;
+		float argy = argz + float(iyp*iyp);
+		for (ix = 0; ix <= m_vnxc; ix++) {
+			if(ix>0 || (izp>=0 && (iyp>=0 || izp!=0))) {  //Skip Friedel related values
+				float r = std::sqrt(argy + float(ix*ix));
+				int  ir = int(r);
+				if (ir <= args.limitres) {
+					float frac = r - float(ir);
+					float qres = 1.0f - frac;
+					float temp = (*m_wptr)(ix,iy,iz);
+					//cout<<" WEIGHTS "<<jx<<"  "<<jy<<"  "<<ir<<"  "<<temp<<"  "<<frac<<endl;
+					//cout<<" WEIGHTS "<<ix<<"  "<<iy-1<<"  "<<iz-1<<"  "<<temp<<"  "<<endl;
+					sigma2[ir]   += temp*qres;
+					sigma2[ir+1] += temp*frac;
+					count[ir]    += qres;
+					count[ir+1]  += frac;
+				}
+			}
+		}
 	}
-	return 0;
 }
 
+void nn4_ctfwReconstructor::normalize_plane(int iz, Nn4FinishPlanes& args)
+{
+	float osnr = 0.0f;
+	int ix,iy;
+	int   izp = (iz<=m_vnzc) ? iz - 1 : iz-m_vnzp-1;
+	float argz = float(izp*izp);
+	for (iy = 1; iy <= m_vnyp; iy++) {
+		int   iyp = (iy<=m_vnyc) ? iy - 1 : iy-m_vnyp-1;
+		float argy = argz + float(iyp*iyp);
+		for (ix = 0; ix <= m_vnxc; ix++) {
+			float r = std::sqrt(argy + float(ix*ix));
+			int  ir = int(r);
+			if (ir <= args.limitres) {
+				if ( (*m_wptr)(ix,iy,iz) > 0.0f) {
+					if( args.refvol_present) {
+						float frac = r - float(ir);
+						float qres = 1.0f - frac;
+						osnr = qres*(*m_refvol)(ir) + frac*(*m_refvol)(ir+1);
+						//if(osnr == 0.0f)  osnr = 1.0f/(0.001*(*m_wptr)(ix,iy,iz));
+						//cout<<"  "<<iz<<"   "<<iy<<"   "<<"   "<<ix<<"   "<<ir<<"   "<<(*m_wptr)(ix,iy,iz)<<"   "<<osnr<<"      "<<(*m_volume)(2*ix,iy,iz)<<"      "<<(*m_volume)(2*ix+1,iy,iz)<<endl;
+					}  else osnr = 0.0f;
+
+					float tmp = ((*m_wptr)(ix,iy,iz)+osnr);
+
+					if(args.do_invert){
+						if(tmp>0.0f) {
+						//cout<<" mvol "<<ix<<"  "<<iy<<"  "<<iz<<"  "<<(*m_volume)(2*ix,iy,iz)<<"  "<<(*m_volume)(2*ix+1,iy,iz)<<"  "<<tmp<<"  "<<osnr<<endl;
+							(*m_volume)(2*ix,iy,iz)   /= tmp;
+							(*m_volume)(2*ix+1,iy,iz) /= tmp;
+						} else {
+							(*m_volume)(2*ix,iy,iz)   = 0.0f;
+							(*m_volume)(2*ix+1,iy,iz) = 0.0f;
+						}
+					}  else (*m_wptr)(ix,iy,iz) = tmp;
+				}
+			} else {
+				(*m_volume)(2*ix,iy,iz)   = 0.0f;
+				(*m_volume)(2*ix+1,iy,iz) = 0.0f;
+			}
+		}
+	}
+}
 
 EMData* nn4_ctfwReconstructor::finish(bool compensate)
 {
@@ -4236,7 +4979,7 @@ EMData* nn4_ctfwReconstructor::finish(bool compensate)
 	*/
 
 
-	int ix,iy,iz;
+	int ix,iz;
 	//  refvol carries fsc
 	int  limitres = m_vnyc-1;
 	if( refvol_present )  { // If fsc is set to zero, it will be straightforward reconstruction with snr = 1
@@ -4247,33 +4990,20 @@ EMData* nn4_ctfwReconstructor::finish(bool compensate)
 	} else {
 //cout<<"   limitres   "<<limitres<<endl;
 
+		//  compute sigma2, summing each plane separately and then the planes in order
+		Nn4FinishPlanes args;
+		args.limitres = limitres;
+		args.nbin = m_vnyc+1;
+		args.sigma2.assign((size_t)m_vnzp*args.nbin, 0.0f);
+		args.count.assign((size_t)m_vnzp*args.nbin, 0.0f);
+		run_finish_planes(this, &nn4_ctfwReconstructor::sigma2_plane, args, m_vnzp);
+
 		vector<float> count(m_vnyc+1, 0.0f);
 		vector<float> sigma2(m_vnyc+1, 0.0f);
-
-		//  compute sigma2
-		for (iz = 1; iz <= m_vnzp; iz++) {
-			int   izp = (iz<=m_vnzc) ? iz - 1 : iz-m_vnzp-1;
-			float argz = float(izp*izp);
-			for (iy = 1; iy <= m_vnyp; iy++) {
-				int   iyp = (iy<=m_vnyc) ? iy - 1 : iy-m_vnyp-1;
-				float argy = argz + float(iyp*iyp);
-				for (ix = 0; ix <= m_vnxc; ix++) {
-					if(ix>0 || (izp>=0 && (iyp>=0 || izp!=0))) {  //Skip Friedel related values
-						float r = std::sqrt(argy + float(ix*ix));
-						int  ir = int(r);
-						if (ir <= limitres) {
-							float frac = r - float(ir);
-							float qres = 1.0f - frac;
-							float temp = (*m_wptr)(ix,iy,iz);
-							//cout<<" WEIGHTS "<<jx<<"  "<<jy<<"  "<<ir<<"  "<<temp<<"  "<<frac<<endl;
-							//cout<<" WEIGHTS "<<ix<<"  "<<iy-1<<"  "<<iz-1<<"  "<<temp<<"  "<<endl;
-							sigma2[ir]   += temp*qres;
-							sigma2[ir+1] += temp*frac;
-							count[ir]    += qres;
-							count[ir+1]  += frac;
-						}
-					}
-				}
+		for (iz = 0; iz < m_vnzp; iz++) {
+			for (ix = 0; ix <= m_vnyc; ix++) {
+				sigma2[ix] += args.sigma2[(size_t)iz*args.nbin + ix];
+				count[ix]  += args.count[(size_t)iz*args.nbin + ix];
 			}
 		}
 		for (ix = 0; ix <= m_vnyc; ix++) {
@@ -4293,46 +5023,11 @@ EMData* nn4_ctfwReconstructor::finish(bool compensate)
 
 
 	// normalize
-	float osnr = 0.0f;
-	for (iz = 1; iz <= m_vnzp; iz++) {
-		int   izp = (iz<=m_vnzc) ? iz - 1 : iz-m_vnzp-1;
-		float argz = float(izp*izp);
-		for (iy = 1; iy <= m_vnyp; iy++) {
-			int   iyp = (iy<=m_vnyc) ? iy - 1 : iy-m_vnyp-1;
-			float argy = argz + float(iyp*iyp);
-			for (ix = 0; ix <= m_vnxc; ix++) {
-				float r = std::sqrt(argy + float(ix*ix));
-				int  ir = int(r);
-				if (ir <= limitres) {
-					if ( (*m_wptr)(ix,iy,iz) > 0.0f) {
-						if( refvol_present) {
-							float frac = r - float(ir);
-							float qres = 1.0f - frac;
-							osnr = qres*(*m_refvol)(ir) + frac*(*m_refvol)(ir+1);
-							//if(osnr == 0.0f)  osnr = 1.0f/(0.001*(*m_wptr)(ix,iy,iz));
-							//cout<<"  "<<iz<<"   "<<iy<<"   "<<"   "<<ix<<"   "<<ir<<"   "<<(*m_wptr)(ix,iy,iz)<<"   "<<osnr<<"      "<<(*m_volume)(2*ix,iy,iz)<<"      "<<(*m_volume)(2*ix+1,iy,iz)<<endl;
-						}  else osnr = 0.0f;
-
-						float tmp = ((*m_wptr)(ix,iy,iz)+osnr);
-
-						if(do_invert){
-							if(tmp>0.0f) {
-							//cout<<" mvol "<<ix<<"  "<<iy<<"  "<<iz<<"  "<<(*m_volume)(2*ix,iy,iz)<<"  "<<(*m_volume)(2*ix+1,iy,iz)<<"  "<<tmp<<"  "<<osnr<<endl;
-								(*m_volume)(2*ix,iy,iz)   /= tmp;
-								(*m_volume)(2*ix+1,iy,iz) /= tmp;
-							} else {
-								(*m_volume)(2*ix,iy,iz)   = 0.0f;
-								(*m_volume)(2*ix+1,iy,iz) = 0.0f;
-							}
-						}  else (*m_wptr)(ix,iy,iz) = tmp;
-					}
-				} else {
-					(*m_volume)(2*ix,iy,iz)   = 0.0f;
-					(*m_volume)(2*ix+1,iy,iz) = 0.0f;
-				}
-			}
-		}
-	}
+	Nn4FinishPlanes args;
+	args.limitres = limitres;
+	args.refvol_present = refvol_present;
+	args.do_invert = do_invert;
+	run_finish_planes(this, &nn4_ctfwReconstructor::normalize_plane, args, m_vnzp);
 
 	if(do_invert)  {
 		m_volume->center_origin_fft();
@@ -4807,21 +5502,10 @@ int nn4_ctfwsReconstructor::insert_padfft_slice_weighted( EMData* padfft, EMData
 {
 	Assert( padfft != NULL );
 
-	vector<float> abc_list;
-	int abc_list_len = 0;	
-	if (m_volume->has_attr("smear")) {
-		abc_list = m_volume->get_attr("smear");
-		abc_list_len = abc_list.size();
-	}
-
-	vector<Transform> tsym = t.get_sym_proj(m_symmetry);
-	for (unsigned int isym=0; isym < tsym.size(); isym++) {
-		if (abc_list_len == 0)
-			m_volume->nn_ctfw(m_wptr, padfft, ctf2d2, m_npad, bckgnoise, tsym[isym], weight);
-		else
-			for (int i = 0; i < abc_list_len; i += 4) 
-				m_volume->nn_ctfw(m_wptr, padfft, ctf2d2, m_npad, bckgnoise, tsym[isym] * Transform(Dict("type", "SPIDER", "phi",  abc_list[i], "theta", abc_list[i+1], "psi", abc_list[i+2])), weight * abc_list[i+3]);
-	}
+	vector<Transform> tfs;
+	vector<float> weights;
+	smeared_sym_proj(m_volume, t, m_symmetry, weight, tfs, weights);
+	m_volume->nn_ctfw_batch(m_wptr, padfft, ctf2d2, m_npad, bckgnoise, tfs, weights);
 	return 0;
 }
 
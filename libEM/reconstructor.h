@@ -176,6 +176,41 @@ namespace EMAN
 		*/
 		virtual void clear() {throw; }
 
+		/** Export the partially accumulated Fourier volume and weights as a compact binary blob, so partial
+		 * reconstructions from several processes can be summed. Only the non-zero spans of each volume are
+		 * stored. The blob is in native byte order and may only be restored into a reconstructor of the same
+		 * type, set up with the same parameters.
+		 * @param half_weights store the weight volume as scaled 16 bit floats rather than 32 bit floats
+		 * @return the binary state
+		 * @exception InvalidCallException if the reconstructor has no exportable state or has not been set up
+		 */
+		string get_state(bool half_weights=false);
+
+		/** Replace the accumulated volume and weights with a state produced by get_state() or merge_states().
+		 * setup() must already have been called with the parameters used to produce the state.
+		 * @param state the binary state
+		 * @exception InvalidValueException if the state is corrupt or was produced by another reconstructor
+		 * @exception ImageDimensionException if the state does not match the current volume size
+		 */
+		void set_state(const string& state);
+
+		/** Add a state produced by get_state() or merge_states() to the current accumulators.
+		 * @param state the binary state
+		 * @exception InvalidValueException if the state is corrupt or was produced by another reconstructor
+		 * @exception ImageDimensionException if the state does not match the current volume size
+		 */
+		void merge_state(const string& state);
+
+		/** Sum several states into one without needing a reconstructor. Since the result is itself a state,
+		 * this can be applied at each node of a reduction tree, and the root restored with set_state(). States
+		 * are summed in the order given.
+		 * @param states the binary states to sum, all from the same reconstructor and volume size
+		 * @param half_weights store the summed weight volume as scaled 16 bit floats
+		 * @return the summed state
+		 * @exception InvalidValueException if a state is corrupt or the states are not compatible
+		 */
+		static string merge_states(const vector<string>& states, bool half_weights=false);
+
 		/** Print the current parameters to std::out
 		 */
 		void print_params() const
@@ -191,7 +226,16 @@ namespace EMAN
 
 		EMObject& operator[]( const string& key ) { return params[key]; }
 
+	  protected:
+		/** Reconstructors supporting get_state() return the volumes they accumulate into. data is the
+		 * complex Fourier volume, weights the real weight volume, half as wide as data in x.
+		 * @return false if this reconstructor has no exportable state
+		 */
+		virtual bool get_accumulators(EMData*& data, EMData*& weights) { return false; }
+
 	  private:
+		void apply_state(const string& state, bool add);
+
 		// Disallow copy construction
 		Reconstructor(const Reconstructor& that);
 		Reconstructor& operator=(const Reconstructor& );
@@ -497,6 +541,8 @@ namespace EMAN
 			d.put("quiet", EMObject::BOOL, "Optional. If false, print verbose information.");
 			d.put("subvolume",EMObject::INTARRAY, "Optional. (xorigin,yorigin,zorigin,xsize,ysize,zsize) all in Fourier pixels. Useful for parallelism.");
 			d.put("savenorm",EMObject::STRING, "Debug. Will cause the normalization volume to be written directly to the specified file when finish() is called.");
+			d.put("outsize",EMObject::INTARRAY, "Optional. Real-space (x,y,z) size of the volume returned by finish(True), which crops away the padding around the center in the same pass as the kernel correction rather than after it. Not for subvolumes.");
+			d.put("kernelfix",EMObject::BOOL, "Optional. finish(True) corrects the real-space falloff of the gauss_2, gauss_3, gauss_5, gridding_5 and gridding_7 insertion kernels, as math.gausskernelfix or math.gridkernelfix would, without allocating a correction volume. Default is false.");
 			return d;
 		}
 		
@@ -535,6 +581,25 @@ namespace EMAN
 		 */
 		virtual bool pixel_at(const float& xx, const float& yy, const float& zz, float *dt);
 
+		virtual bool get_accumulators(EMData*& data, EMData*& weights) { data = image; weights = tmp_data; return true; }
+
+		/** Inverse transform the normalized image in place and return the real-space volume. The FFT scaling,
+		 * the phase origin shift, the "kernelfix" correction and the crop to "outsize" are applied in a single
+		 * pass over the data, and the cropped volume is the only additional allocation.
+		 * @param outsize real-space size of the returned volume
+		 * @param kernelfix whether to correct for the insertion kernel falloff
+		 * @return the volume, either image itself or a new cropped volume which replaces image
+		 */
+		virtual EMData* finish_real_space(const int* outsize, bool kernelfix);
+
+		/** Read and check the "outsize" and "kernelfix" parameters before finish() modifies anything.
+		 * @param outsize returns the real-space size of the finished volume
+		 * @param kernelfix returns whether to correct for the insertion kernel falloff
+		 * @return true if finish(True) should use finish_real_space()
+		 * @exception InvalidParameterException if the parameters can't be applied to this reconstruction
+		 */
+		bool real_space_params(int* outsize, bool& kernelfix);
+
 		/// A pixel inserter pointer which inserts pixels into the 3D volume using one of a variety of insertion methods
 		FourierPixelInserter3D* inserter;
 
@@ -904,6 +969,24 @@ namespace EMAN
      */
 	EMData* padfft_slice( const EMData* const slice, const Transform& t, int npad );
 
+	/** Inputs and outputs of the per z plane steps of the nn4 family finish(), which
+	 * run a plane per thread (see Parallel).
+	 */
+	struct Nn4FinishPlanes
+	{
+		Nn4FinishPlanes() : kc(0), alpha(0.0f), limitres(0), refvol_present(false), do_invert(false), nbin(0) {}
+
+		vector<float> pow_a;	///< ESTIMATE weighting, neighbor weights
+		int kc;					///< ESTIMATE weighting, neighborhood half width
+		float alpha;			///< ESTIMATE weighting, scale
+		int limitres;			///< nn4_ctfw, highest radius kept
+		bool refvol_present;	///< nn4_ctfw, SNR taken from the FSC in refvol
+		bool do_invert;			///< nn4_ctfw, divide the volume by the weights
+		int nbin;				///< nn4_ctfw, radial bins per plane in sigma2 and count
+		vector<float> sigma2;	///< nn4_ctfw, per plane sums of weights by radius
+		vector<float> count;	///< nn4_ctfw, per plane counts by radius
+	};
+
 	class nn4Reconstructor:public Reconstructor
 	{
 	  public:
@@ -964,6 +1047,9 @@ namespace EMAN
 
 		static const string NAME;
 
+	  protected:
+		virtual bool get_accumulators(EMData*& data, EMData*& weights) { data = m_volume; weights = m_wptr; return true; }
+
 	  private:
 		EMData* m_volume;
 		EMData* m_wptr;
@@ -984,6 +1070,8 @@ namespace EMAN
 		{
 			//params["use_weights"] = false;
 		}
+		/** finish() normalization of plane iz */
+		void normalize_plane(int iz, Nn4FinishPlanes& args);
 	};
 
 
@@ -1058,6 +1146,9 @@ namespace EMAN
 
 		static const string NAME;
 
+	  protected:
+		virtual bool get_accumulators(EMData*& data, EMData*& weights) { data = m_volume; weights = m_wptr; return true; }
+
 	  private:
 		EMData* m_volume;
 		EMData* m_wptr;
@@ -1082,6 +1173,8 @@ namespace EMAN
 		{
 			//params["use_weights"] = false;
 		}
+		/** finish() normalization of plane iz */
+		void normalize_plane(int iz, Nn4FinishPlanes& args);
 	};
 
 
@@ -1234,6 +1327,9 @@ namespace EMAN
 
 		static const string NAME;
 		
+	  protected:
+		virtual bool get_accumulators(EMData*& data, EMData*& weights) { data = m_volume; weights = m_wptr; return true; }
+
 	  private:
 		EMData* m_volume;
 		EMData* m_wptr;
@@ -1251,6 +1347,8 @@ namespace EMAN
 
 		void buildFFTVolume();
 		void buildNormVolume();
+		/** finish() normalization of plane iz */
+		void normalize_plane(int iz, Nn4FinishPlanes& args);
 
 	};
 
@@ -1325,6 +1423,9 @@ namespace EMAN
 
 		static const string NAME;
 
+	  protected:
+		virtual bool get_accumulators(EMData*& data, EMData*& weights) { data = m_volume; weights = m_wptr; return true; }
+
 	  private:
 		EMData* m_volume;
 		EMData* m_wptr;
@@ -1344,6 +1445,10 @@ namespace EMAN
 
 		void buildFFTVolume();
 		void buildNormVolume();
+		/** finish() sums of the weights of plane iz by radius */
+		void sigma2_plane(int iz, Nn4FinishPlanes& args);
+		/** finish() normalization of plane iz */
+		void normalize_plane(int iz, Nn4FinishPlanes& args);
 
 	};
 	
@@ -1417,6 +1522,9 @@ namespace EMAN
 
 		static const string NAME;
 
+	  protected:
+		virtual bool get_accumulators(EMData*& data, EMData*& weights) { data = m_volume; weights = m_wptr; return true; }
+
 	  private:
 		EMData* m_volume;
 		EMData* m_wptr;
@@ -1506,6 +1614,9 @@ namespace EMAN
 		
 		static const string NAME;
 		
+	  protected:
+		virtual bool get_accumulators(EMData*& data, EMData*& weights) { data = m_volume; weights = m_wptr; return true; }
+
 	  private:
 		EMData* m_volume;
 		EMData* m_wptr;
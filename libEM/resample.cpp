@@ -0,0 +1,301 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA 
+ */
+
+#include "resample.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace EMAN;
+
+namespace {
+	/** As restrict1() in sparx: wrap x into [0,n), without a data dependent loop */
+	inline float wrap(float x, int n)
+	{
+		float r = x - n*std::floor(x/n);
+		r -= n*(float)(r >= n);
+		return r + n*(float)(r < 0);
+	}
+
+	/** clamp x into [0,n-1] so it can always be used as an index */
+	inline float clampf(float x, int n)
+	{
+		return std::min(std::max(x,0.0f),(float)(n-1));
+	}
+
+	inline void store(float *out, const float *res, int m, bool accumulate)
+	{
+		if (accumulate) {
+			for (int k = 0; k < m; k++) out[k] += res[k];
+		}
+		else {
+			for (int k = 0; k < m; k++) out[k] = res[k];
+		}
+	}
+}
+
+const int Resampler::BLOCK;
+
+void Resampler::bilinear(const float *src, int nx, int ny, const float *xs, const float *ys, int n, float *out)
+{
+	int k0[BLOCK], dx[BLOCK], dy[BLOCK], in[BLOCK];
+	float t[BLOCK], u[BLOCK];
+
+	for (int b = 0; b < n; b += BLOCK) {
+		int m = std::min(BLOCK,n-b);
+		const float *x = xs+b;
+		const float *y = ys+b;
+
+		for (int k = 0; k < m; k++) {
+			int ii = (int)clampf(x[k],nx);
+			int jj = (int)clampf(y[k],ny);
+			in[k] = (x[k] >= 0) & (x[k] < nx) & (y[k] >= 0) & (y[k] < ny);
+			dx[k] = ii < nx-1;
+			dy[k] = (jj < ny-1)*nx;
+			k0[k] = ii + jj*nx;
+			t[k] = x[k] - ii;
+			u[k] = y[k] - jj;
+		}
+
+		for (int k = 0; k < m; k++) {
+			int i0 = k0[k];
+			float v = Util::bilinear_interpolate(src[i0],src[i0+dx[k]],src[i0+dy[k]],src[i0+dx[k]+dy[k]],t[k],u[k]);
+			out[b+k] = in[k] ? v : 0;
+		}
+	}
+}
+
+void Resampler::trilinear(const float *src, int nx, int ny, int nz,
+						  const float *xs, const float *ys, const float *zs, int n, float *out)
+{
+	size_t nxy = (size_t)nx*ny;
+	size_t k0[BLOCK];
+	int dx[BLOCK], dy[BLOCK];
+	size_t dz[BLOCK];
+	int in[BLOCK];
+	float t[BLOCK], u[BLOCK], v[BLOCK];
+
+	for (int b = 0; b < n; b += BLOCK) {
+		int m = std::min(BLOCK,n-b);
+		const float *x = xs+b;
+		const float *y = ys+b;
+		const float *z = zs+b;
+
+		for (int k = 0; k < m; k++) {
+			int ii = (int)clampf(x[k],nx);
+			int jj = (int)clampf(y[k],ny);
+			int kk = (int)clampf(z[k],nz);
+			in[k] = (x[k] >= 0) & (x[k] < nx) & (y[k] >= 0) & (y[k] < ny) & (z[k] >= 0) & (z[k] < nz);
+			dx[k] = ii < nx-1;
+			dy[k] = (jj < ny-1)*nx;
+			dz[k] = (kk < nz-1)*nxy;
+			k0[k] = ii + jj*(size_t)nx + kk*nxy;
+			t[k] = x[k] - ii;
+			u[k] = y[k] - jj;
+			v[k] = z[k] - kk;
+		}
+
+		for (int k = 0; k < m; k++) {
+			size_t p = k0[k], q = k0[k]+dz[k];
+			int a = dx[k], c = dy[k];
+			float r = Util::trilinear_interpolate(src[p],src[p+a],src[p+c],src[p+a+c],src[q],src[q+a],src[q+c],src[q+a+c],t[k],u[k],v[k]);
+			out[b+k] = in[k] ? r : 0;
+		}
+	}
+}
+
+void Resampler::bilinear_cyclic(const float *src, int nx, int ny, const float *xs, const float *ys, int n,
+								float *out, bool accumulate)
+{
+	int i00[BLOCK], i10[BLOCK], i01[BLOCK], i11[BLOCK];
+	float t[BLOCK], u[BLOCK], res[BLOCK];
+
+	for (int b = 0; b < n; b += BLOCK) {
+		int m = std::min(BLOCK,n-b);
+		const float *x = xs+b;
+		const float *y = ys+b;
+
+		for (int k = 0; k < m; k++) {
+			float xo = wrap(x[k],nx);
+			float yo = wrap(y[k],ny);
+			int xf = (int)xo;
+			int yf = (int)yo;
+			int xp = (xf+1)*(xf < nx-1);
+			int yp = (yf+1)*(yf < ny-1);
+			t[k] = xo - xf;
+			u[k] = yo - yf;
+			i00[k] = xf + yf*nx;
+			i10[k] = xp + yf*nx;
+			i01[k] = xf + yp*nx;
+			i11[k] = xp + yp*nx;
+		}
+
+		for (int k = 0; k < m; k++) {
+			float p1 = src[i00[k]];
+			float p2 = src[i10[k]];
+			float p3 = src[i11[k]];
+			float p4 = src[i01[k]];
+			res[k] = p1 + u[k] * ( p4 - p1) + t[k] * ( p2 - p1 + u[k] *(p3-p2-p4+p1));
+		}
+		store(out+b,res,m,accumulate);
+	}
+}
+
+void Resampler::trilinear_cyclic(const float *src, int nx, int ny, int nz,
+								 const float *xs, const float *ys, const float *zs, int n, float *out, bool accumulate)
+{
+	size_t nxy = (size_t)nx*ny;
+	size_t k0[BLOCK], dz[BLOCK];
+	int dx[BLOCK], dy[BLOCK];
+	float fx[BLOCK], fy[BLOCK], fz[BLOCK], res[BLOCK];
+
+	for (int b = 0; b < n; b += BLOCK) {
+		int m = std::min(BLOCK,n-b);
+		const float *x = xs+b;
+		const float *y = ys+b;
+		const float *z = zs+b;
+
+		for (int k = 0; k < m; k++) {
+			float xo = wrap(x[k],nx);
+			float yo = wrap(y[k],ny);
+			float zo = wrap(z[k],nz);
+			int ix = (int)xo;
+			int iy = (int)yo;
+			int iz = (int)zo;
+			dx[k] = ix < nx-1;
+			dy[k] = (iy < ny-1)*nx;
+			dz[k] = (iz < nz-1)*nxy;
+			k0[k] = ix + iy*(size_t)nx + iz*nxy;
+			fx[k] = xo - ix;
+			fy[k] = yo - iy;
+			fz[k] = zo - iz;
+		}
+
+		for (int k = 0; k < m; k++) {
+			size_t i = k0[k], j = k0[k]+dz[k];
+			int a = dx[k], c = dy[k];
+			float ddx = fx[k], ddy = fy[k], ddz = fz[k];
+			float p0 = src[i], pa = src[i+a], pc = src[i+c], pac = src[i+a+c];
+			float q0 = src[j], qa = src[j+a], qc = src[j+c], qac = src[j+a+c];
+
+			float a1 = p0;
+			float a2 = pa - p0;
+			float a3 = pc - p0;
+			float a4 = q0 - p0;
+			float a5 = p0 - pa - pc + pac;
+			float a6 = p0 - pa - q0 + qa;
+			float a7 = p0 - pc - q0 + qc;
+			float a8 = pa + pc + q0 - p0 - pac - qa - qc + qac;
+			res[k] = a1 + ddz*(a4 + a6*ddx + (a7 + a8*ddx)*ddy) + a3*ddy + ddx*(a2 + a5*ddy);
+		}
+		store(out+b,res,m,accumulate);
+	}
+}
+
+void Resampler::quadratic(const float *src, int nx, int ny, const float *xs, const float *ys, int n, float *out)
+{
+	// indices are 0-based here, the coordinates are 1-based as in Util::quadri
+	int i0[BLOCK], ip[BLOCK], im[BLOCK], j0[BLOCK], jp[BLOCK], jm[BLOCK];
+	float fx[BLOCK], fy[BLOCK];
+
+	for (int b = 0; b < n; b += BLOCK) {
+		int m = std::min(BLOCK,n-b);
+		const float *x = xs+b;
+		const float *y = ys+b;
+
+		for (int k = 0; k < m; k++) {
+			float xo = wrap(x[k]-1.0f,nx);
+			float yo = wrap(y[k]-1.0f,ny);
+			int i = (int)xo;
+			int j = (int)yo;
+			fx[k] = xo - i;
+			fy[k] = yo - j;
+			i0[k] = i;
+			ip[k] = (i+1)*(i < nx-1);
+			im[k] = i - 1 + nx*(i == 0);
+			j0[k] = j*nx;
+			jp[k] = (j+1)*(j < ny-1)*nx;
+			jm[k] = (j - 1 + ny*(j == 0))*nx;
+		}
+
+		for (int k = 0; k < m; k++) {
+			float f0 = src[i0[k] + j0[k]];
+			float c1 = src[ip[k] + j0[k]] - f0;
+			float c2 = (c1 - f0 + src[im[k] + j0[k]]) * 0.5f;
+			float c3 = src[i0[k] + jp[k]] - f0;
+			float c4 = (c3 - f0 + src[i0[k] + jm[k]]) * 0.5f;
+			// the fractional parts are never negative, so the diagonal neighbour is always (+1,+1)
+			float c5 = src[ip[k] + jp[k]] - f0 - c1 - c3;
+			float dx0 = fx[k], dy0 = fy[k];
+			out[b+k] = f0 + dx0 * (c1 + (dx0-1) * c2 + dy0 * c5) + dy0 * (c3 + (dy0-1) * c4);
+		}
+	}
+}
+
+void Resampler::gridding(const float *src, int nx, int ny, const float *xs, const float *ys, int n,
+						 float *out, const Util::KaiserBessel &kb)
+{
+	const int W = 7;
+	int xi[W][BLOCK], yi[W][BLOCK];
+	float wx[W][BLOCK], wy[W][BLOCK];
+
+	for (int b = 0; b < n; b += BLOCK) {
+		int m = std::min(BLOCK,n-b);
+		const float *x = xs+b;
+		const float *y = ys+b;
+
+		// window indices (wrapped) and table weights for each tap
+		for (int k = 0; k < m; k++) {
+			float xo = wrap(x[k],nx);
+			float yo = wrap(y[k],ny);
+			int ix = (int)(xo+0.5f);
+			int iy = (int)(yo+0.5f);
+			for (int w = 0; w < W; w++) {
+				int xx = ix-3+w;
+				int yy = iy-3+w;
+				xi[w][k] = xx < 0 ? xx+nx : (xx >= nx ? xx-nx : xx);
+				yi[w][k] = (yy < 0 ? yy+ny : (yy >= ny ? yy-ny : yy))*nx;
+				wx[w][k] = kb.i0win_tab(xo-ix+(3-w));
+				wy[w][k] = kb.i0win_tab(yo-iy+(3-w));
+			}
+		}
+
+		for (int k = 0; k < m; k++) {
+			float pixel = 0, sx = 0, sy = 0;
+			for (int wj = 0; wj < W; wj++) {
+				const float *row = src + yi[wj][k];
+				float s = 0;
+				for (int wi = 0; wi < W; wi++) s += row[xi[wi][k]]*wx[wi][k];
+				pixel += s*wy[wj][k];
+			}
+			for (int w = 0; w < W; w++) {
+				sx += wx[w][k];
+				sy += wy[w][k];
+			}
+			out[b+k] = pixel/(sx*sy);
+		}
+	}
+}
@@ -0,0 +1,95 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA 
+ */
+
+#ifndef eman_resample_h__
+#define eman_resample_h__ 1
+
+#include "util.h"
+
+namespace EMAN
+{
+	/** Resampler holds the interpolation kernels used when rotating, shifting and
+	 * scaling images. Callers compute the source coordinates for a row of output
+	 * pixels (normally one vectorizable loop, with the parts of the transform which
+	 * depend only on the row hoisted out), then a kernel interpolates the whole row.
+	 *
+	 * Kernels work in blocks of pixels. Coordinates are converted to indices and
+	 * weights in branch-free loops which the compiler vectorizes, then the samples
+	 * are gathered and blended in a second loop. That loop becomes hardware gathers
+	 * where the target supports them (eg - AVX2). Out-of-range coordinates are
+	 * clamped before the gather, so no branch is needed on the memory access.
+	 *
+	 * Each kernel gives the same result, up to float rounding, as the per-pixel code
+	 * it replaces. That code is named in the kernel's comment.
+	 */
+	class Resampler
+	{
+	  public:
+		/** Bilinear interpolation, 0 outside [0,nx) x [0,ny). The last row/column is
+		 * repeated rather than wrapped. As TransformProcessor for real 2-D images.
+		 * @param src nx*ny image
+		 * @param xs x coordinate of each output pixel
+		 * @param ys y coordinate of each output pixel
+		 * @param n number of output pixels
+		 * @param out n output values
+		 */
+		static void bilinear(const float *src, int nx, int ny, const float *xs, const float *ys, int n, float *out);
+
+		/** Trilinear interpolation, 0 outside the volume, edges repeated. As TransformProcessor
+		 * for real 3-D images. */
+		static void trilinear(const float *src, int nx, int ny, int nz,
+							  const float *xs, const float *ys, const float *zs, int n, float *out);
+
+		/** Bilinear interpolation with coordinates wrapped into the image (circulant).
+		 * As the 2-D case of EMData::rot_scale_trans.
+		 * @param accumulate add to 'out' rather than replacing it
+		 */
+		static void bilinear_cyclic(const float *src, int nx, int ny, const float *xs, const float *ys, int n,
+									float *out, bool accumulate=false);
+
+		/** Trilinear interpolation with coordinates wrapped into the volume and the +1
+		 * neighbours clamped to the last plane. As the 3-D case of EMData::rot_scale_trans.
+		 * @param accumulate add to 'out' rather than replacing it
+		 */
+		static void trilinear_cyclic(const float *src, int nx, int ny, int nz,
+									 const float *xs, const float *ys, const float *zs, int n, float *out, bool accumulate=false);
+
+		/** Quadratic interpolation with wrap-around, as Util::quadri. Coordinates are
+		 * 1-based (Fortran) as in Util::quadri. */
+		static void quadratic(const float *src, int nx, int ny, const float *xs, const float *ys, int n, float *out);
+
+		/** Kaiser-Bessel gridding interpolation with wrap-around, as the 2-D case of
+		 * Util::get_pixel_conv_new (7 point window). */
+		static void gridding(const float *src, int nx, int ny, const float *xs, const float *ys, int n,
+							 float *out, const Util::KaiserBessel &kb);
+
+		/** number of pixels processed per block by the kernels */
+		static const int BLOCK = 64;
+	};
+}
+
+#endif	//eman_resample_h__
@@ -0,0 +1,377 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "simmx.h"
+#include "aligner.h"
+#include "cmp.h"
+#include "emdata.h"
+#include "emutil.h"
+#include "parallel.h"
+#include "processor.h"
+#include "transform.h"
+#include "util.h"
+#include <cstdio>
+#include <algorithm>
+
+using namespace EMAN;
+
+namespace {
+	void free_images(vector<EMData *> &images)
+	{
+		for (size_t i = 0; i < images.size(); i++) {
+			if (images[i]) delete images[i];
+		}
+		images.clear();
+	}
+
+	void free_images(vector< vector<EMData *> > &images)
+	{
+		for (size_t i = 0; i < images.size(); i++) free_images(images[i]);
+	}
+}
+
+// One row per item. Each thread copies the references the first time it runs
+class SimilarityMatrix::RowTask : public ParallelTask {
+  public:
+	RowTask(const SimilarityMatrix *s, const vector<EMData *> &r, vector< vector<EMData *> > &l,
+			const vector<EMData *> &p, EMData *m, vector<float> &o) :
+		smx(s), refs(r), local(l), ptcls(p), msk(m), out(o) {}
+
+	void run(size_t begin, size_t end, int thread) {
+		vector<EMData *> &lrefs = local[thread];
+		if (lrefs.size() != refs.size()) {
+			for (size_t i = 0; i < refs.size(); i++) lrefs.push_back(refs[i]->copy());
+		}
+		size_t rowlen = 6*refs.size();
+		for (size_t i = begin; i < end; i++) {
+			if (ptcls[i]) smx->compute_row(ptcls[i],lrefs,msk,&out[i*rowlen]);
+		}
+	}
+
+  private:
+	const SimilarityMatrix *smx;
+	const vector<EMData *> &refs;
+	vector< vector<EMData *> > &local;
+	const vector<EMData *> &ptcls;
+	EMData *msk;
+	vector<float> &out;
+};
+
+SimilarityMatrix::SimilarityMatrix(const string &cmpname, const Dict &cmpparams) :
+	cmp_name(cmpname), cmp_params(cmpparams), align_name(""), aligncmp_name("dot"),
+	ralign_name(""), raligncmp_name("dot"), mask(0), shrink(0), nthreads(0), block_size(0), verbose(0)
+{
+}
+
+SimilarityMatrix::~SimilarityMatrix()
+{
+	if (mask) delete mask;
+}
+
+void SimilarityMatrix::set_align(const string &name, const Dict &params, const string &cmpname, const Dict &cmpparams)
+{
+	align_name = name;
+	align_params = params;
+	aligncmp_name = cmpname;
+	aligncmp_params = cmpparams;
+}
+
+void SimilarityMatrix::set_ralign(const string &name, const Dict &params, const string &cmpname, const Dict &cmpparams)
+{
+	ralign_name = name;
+	ralign_params = params;
+	raligncmp_name = cmpname;
+	raligncmp_params = cmpparams;
+}
+
+void SimilarityMatrix::set_mask(EMData *m)
+{
+	if (mask) delete mask;
+	mask = m ? m->copy() : 0;
+}
+
+void SimilarityMatrix::set_shrink(float s)
+{
+	shrink = s>1.0f ? s : 0;
+}
+
+void SimilarityMatrix::set_exclude(const vector<int> &rows)
+{
+	exclude.clear();
+	exclude.insert(rows.begin(),rows.end());
+}
+
+string SimilarityMatrix::checkpoint_file(const string &outfile)
+{
+	return outfile + ".chk";
+}
+
+void SimilarityMatrix::prepare(EMData *image, EMData *msk) const
+{
+	if (shrink>1.0f) image->process_inplace("math.fft.resample",Dict("n",shrink));
+	if (msk) image->mult(*msk);
+}
+
+void SimilarityMatrix::compute_row(EMData *ptcl, const vector<EMData *> &refs, EMData *msk, float *out) const
+{
+	float scale_correction = shrink>1.0f ? shrink : 1.0f;
+
+	for (size_t c = 0; c < refs.size(); c++) {
+		float *o = out + 6*c;
+		EMData *ref = refs[c];
+
+		// bad reference, marked so it can never be the best match
+		if ((float)ref->get_attr("sigma")==0) {
+			o[0] = -1.0e38f;
+			o[1] = o[2] = o[3] = o[4] = o[5] = 0;
+			continue;
+		}
+
+		if (align_name.empty()) {
+			o[0] = ptcl->cmp(cmp_name,ref,cmp_params);
+			o[1] = o[2] = o[3] = o[4] = 0;
+			o[5] = 1.0f;
+		}
+		else {
+			if (ref->has_attr("xform.align2d")) ref->del_attr("xform.align2d");
+			EMData *ta = ref->align(align_name,ptcl,align_params,aligncmp_name,aligncmp_params);
+
+			if (!ralign_name.empty()) {
+				Dict rparams(ralign_params);
+				rparams["xform.align2d"] = ta->get_attr("xform.align2d");
+				delete ta;
+				if (ref->has_attr("xform.align2d")) ref->del_attr("xform.align2d");
+				ta = ref->align(ralign_name,ptcl,rparams,raligncmp_name,raligncmp_params);
+			}
+
+			Transform *t = ta->get_attr("xform.align2d");
+			t->invert();
+			Dict p = t->get_params("2d");
+			delete t;
+
+			if (msk) {
+				ta->mult(*msk);
+				EMData *ptcl2 = ptcl->copy();
+				ptcl2->mult(*msk);
+				o[0] = ptcl2->cmp(cmp_name,ta,cmp_params);
+				delete ptcl2;
+			}
+			else o[0] = ptcl->cmp(cmp_name,ta,cmp_params);
+			delete ta;
+
+			o[1] = scale_correction*(float)p["tx"];
+			o[2] = scale_correction*(float)p["ty"];
+			o[3] = p["alpha"];
+			o[4] = p["mirror"];
+			o[5] = p["scale"];
+		}
+
+		// NaN or inf scores are replaced, as math.finite does in e2simmx.py
+		if (!Util::goodf(&o[0])) o[0] = 1.0e24f;
+	}
+}
+
+void SimilarityMatrix::compute_rows(const vector<EMData *> &refs, vector< vector<EMData *> > &local,
+									const vector<EMData *> &ptcls, EMData *msk, vector<float> &out) const
+{
+	// Factory registries are built on first use, which must not happen concurrently
+	Factory<Aligner>::get_list();
+	Factory<Cmp>::get_list();
+	Factory<Processor>::get_list();
+
+	// the mask and the particles are shared or handed to one thread, so their statistics must be current
+	if (msk) msk->get_attr("sigma");
+
+	RowTask task(this,refs,local,ptcls,msk,out);
+	Parallel::run(task,ptcls.size(),1,(int)local.size());
+}
+
+vector<EMData *> SimilarityMatrix::compute(const vector<EMData *> &refs, const vector<EMData *> &ptcls, bool saveali)
+{
+	ENTERFUNC;
+
+	size_t ncol = refs.size();
+	size_t nrow = ptcls.size();
+	int nt = nthreads>0 ? nthreads : Parallel::get_threads();
+
+	EMData *msk = 0;
+	vector<EMData *> prefs, pptcls(nrow,(EMData *)0);
+	vector< vector<EMData *> > local(nt);
+	vector<float> out(nrow*6*ncol,0.0f);
+	try {
+		if (mask) {
+			msk = mask->copy();
+			prepare(msk,0);
+		}
+		for (size_t c = 0; c < ncol; c++) {
+			prefs.push_back(refs[c]->copy());
+			prepare(prefs[c],0);
+		}
+		for (size_t r = 0; r < nrow; r++) {
+			if (!ptcls[r] || exclude.count((int)r)) continue;
+			pptcls[r] = ptcls[r]->copy();
+			prepare(pptcls[r],msk);
+		}
+		compute_rows(prefs,local,pptcls,msk,out);
+	}
+	catch (...) {
+		free_images(prefs);
+		free_images(pptcls);
+		free_images(local);
+		if (msk) delete msk;
+		throw;
+	}
+	free_images(prefs);
+	free_images(pptcls);
+	free_images(local);
+	if (msk) delete msk;
+
+	vector<EMData *> ret;
+	int nimg = saveali ? 6 : 1;
+	for (int k = 0; k < nimg; k++) {
+		EMData *mx = new EMData((int)ncol,(int)nrow,1);
+		float *d = mx->get_data();
+		for (size_t i = 0; i < nrow*ncol; i++) d[i] = out[i*6+k];
+		mx->update();
+		ret.push_back(mx);
+	}
+
+	EXITFUNC;
+	return ret;
+}
+
+void SimilarityMatrix::compute_file(const string &reffile, const string &ptclfile, const string &outfile,
+									int c0, int c1, int r0, int r1, bool saveali)
+{
+	ENTERFUNC;
+
+	int nref = EMUtil::get_image_count(reffile);
+	int nptcl = EMUtil::get_image_count(ptclfile);
+	if (c1<0) c1 = nref;
+	if (r1<0) r1 = nptcl;
+	if (c0<0 || c1>nref || c0>=c1) throw InvalidValueException(c0,"SimilarityMatrix: invalid reference range");
+	if (r0<0 || r1>nptcl || r0>=r1) throw InvalidValueException(r0,"SimilarityMatrix: invalid particle range");
+
+	int nimg = saveali ? 6 : 1;
+	int ncol = c1-c0;
+	int nt = nthreads>0 ? nthreads : Parallel::get_threads();
+	int block = block_size>0 ? block_size : std::max(4*nt,16);
+
+	// Resume after the last block recorded in the checkpoint, if it was written for the same job
+	string chk = checkpoint_file(outfile);
+	int next = r0;
+	if (Util::is_file_exist(outfile)) {
+		FILE *in = fopen(chk.c_str(),"r");
+		if (in) {
+			int v[6];
+			if (fscanf(in," simmx %d %d %d %d %d %d",v,v+1,v+2,v+3,v+4,v+5)==6
+				&& v[0]==c0 && v[1]==c1 && v[2]==r0 && v[3]==r1 && v[4]==nimg && v[5]>=r0 && v[5]<=r1) {
+				next = v[5];
+				if (verbose>0) printf("Resuming similarity matrix at row %d\n",next);
+			}
+			fclose(in);
+		}
+	}
+	else {
+		EMData mx(nref,nptcl,1);
+		mx.to_zero();
+		mx.set_attr("projection_file",reffile);
+		mx.set_attr("particle_file",ptclfile);
+		for (int k = 0; k < nimg; k++) mx.write_image(outfile,k);
+	}
+
+	EMData *msk = 0;
+	vector<EMData *> refs, ptcls;
+	vector< vector<EMData *> > local(nt);
+	try {
+		if (mask) {
+			msk = mask->copy();
+			prepare(msk,0);
+		}
+		for (int c = c0; c < c1; c++) {
+			EMData *e = new EMData();
+			refs.push_back(e);
+			e->read_image(reffile,c);
+			prepare(e,0);
+		}
+
+		for (int r = next; r < r1; r += block) {
+			int nr = std::min(block,r1-r);
+			ptcls.assign(nr,(EMData *)0);
+			for (int i = 0; i < nr; i++) {
+				if (exclude.count(r+i)) continue;
+				ptcls[i] = new EMData();
+				ptcls[i]->read_image(ptclfile,r+i);
+				prepare(ptcls[i],msk);
+			}
+
+			vector<float> out((size_t)nr*6*ncol,0.0f);
+			compute_rows(refs,local,ptcls,msk,out);
+			free_images(ptcls);
+
+			Region reg(c0,r,0,ncol,nr,1);
+			for (int k = 0; k < nimg; k++) {
+				EMData blk(ncol,nr,1);
+				float *d = blk.get_data();
+				for (size_t i = 0; i < (size_t)nr*ncol; i++) d[i] = out[i*6+k];
+				blk.update();
+				blk.write_image(outfile,k,EMUtil::IMAGE_UNKNOWN,false,&reg);
+			}
+
+			// The rows are on disk before the checkpoint claims them. The rename keeps a
+			// partly written checkpoint from ever being read.
+			string tmp = chk + ".tmp";
+			FILE *o = fopen(tmp.c_str(),"w");
+			if (!o) throw FileAccessException(tmp);
+			fprintf(o,"simmx %d %d %d %d %d %d\n",c0,c1,r0,r1,nimg,r+nr);
+			fclose(o);
+#ifdef WIN32
+			remove(chk.c_str());
+#endif
+			if (rename(tmp.c_str(),chk.c_str())!=0) throw FileAccessException(chk);
+
+			if (verbose>0) {
+				printf("%d/%d\r",r+nr,r1);
+				fflush(stdout);
+			}
+		}
+	}
+	catch (...) {
+		free_images(refs);
+		free_images(ptcls);
+		free_images(local);
+		if (msk) delete msk;
+		throw;
+	}
+	free_images(refs);
+	free_images(local);
+	if (msk) delete msk;
+
+	remove(chk.c_str());
+
+	EXITFUNC;
+}
@@ -0,0 +1,162 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef eman_simmx_h__
+#define eman_simmx_h__ 1
+
+#include "emobject.h"
+#include <set>
+
+namespace EMAN
+{
+	class EMData;
+
+	/** SimilarityMatrix computes the e2simmx.py similarity matrix natively. Every
+	 * particle (row) is optionally aligned to every reference (column), then
+	 * compared. This is the same work as EMAN2_utils.cmponetomany(), without
+	 * a call through Python for each pair.
+	 *
+	 * Rows are handed to threads dynamically (see Parallel), so rows whose
+	 * alignments converge slowly don't stall the others. Each thread keeps its own
+	 * copy of the references, since aligners cache derived data (eg - rotational
+	 * footprints) on the images they are given.
+	 *
+	 * compute_file() writes the matrix in the usual e2simmx format: image 0
+	 * is the score, and with saveali images 1-5 are dx, dy, alpha, mirror and
+	 * scale. Rows are written in blocks as they are finished. After each block the
+	 * progress is recorded in '<output>.chk', so a killed job run again with the
+	 * same arguments resumes after the last block written.
+	 *
+	 * Typical usage:
+	 @code
+	 *	SimilarityMatrix smx("dot",Dict("normalize",1));
+	 *	smx.set_align("rotate_translate_tree",Dict(),"ccc",Dict());
+	 *	smx.compute_file("projections.hdf","particles.hdf","simmx.hdf",0,-1,0,-1,true);
+	 @endcode
+	 */
+	class SimilarityMatrix
+	{
+	  public:
+		/** @param cmp_name comparator used for the final score
+		 * @param cmp_params its parameters
+		 */
+		SimilarityMatrix(const string &cmp_name, const Dict &cmp_params=Dict());
+		~SimilarityMatrix();
+
+		/** Align each reference to the particle before comparison
+		 * @param name aligner name, "" for no alignment
+		 */
+		void set_align(const string &name, const Dict &params=Dict(), const string &cmp_name="dot", const Dict &cmp_params=Dict());
+
+		/** Refine the first alignment with a second aligner, which is passed the first result as "xform.align2d" */
+		void set_ralign(const string &name, const Dict &params=Dict(), const string &cmp_name="dot", const Dict &cmp_params=Dict());
+
+		/** Mask applied to the particle, and to each aligned reference before comparison. The mask is copied. */
+		void set_mask(EMData *mask);
+
+		/** Downsample references, particles and the mask by this factor (math.fft.resample) before
+		 * any other processing. Alignment translations are scaled back to the original sampling.
+		 * @param shrink <=1 disables shrinking
+		 */
+		void set_shrink(float shrink);
+
+		/** Rows listed here are skipped, leaving zeros in the matrix */
+		void set_exclude(const vector<int> &rows);
+
+		/** @param n number of threads, 0 for Parallel::get_threads() */
+		void set_threads(int n) { nthreads = n; }
+
+		/** @param n number of rows computed between writes to the output file, 0 to choose from the thread count */
+		void set_block_size(int n) { block_size = n; }
+
+		void set_verbose(int v) { verbose = v; }
+
+		/** Compute the matrix for images in memory. ptcls may contain NULL, for
+		 * rows which should be left at zero.
+		 * @return ncols x nrows images: the score, followed by dx, dy, alpha, mirror and scale if saveali is set.
+		 * The caller owns the returned images.
+		 */
+		vector<EMData *> compute(const vector<EMData *> &refs, const vector<EMData *> &ptcls, bool saveali=false);
+
+		/** Compute the matrix between two image files and write it to 'outfile'. If
+		 * 'outfile' doesn't exist, it is created at full size (all references x all
+		 * particles) and zeroed, so a sub-range may be filled later by another call.
+		 * If a checkpoint for the same range exists, completed rows are not recomputed.
+		 * @param reffile references (columns)
+		 * @param ptclfile particles (rows)
+		 * @param outfile output matrix file
+		 * @param c0 first column
+		 * @param c1 one past the last column, <0 for all
+		 * @param r0 first row
+		 * @param r1 one past the last row, <0 for all
+		 * @param saveali also write the alignment parameter images
+		 * @exception ImageReadException, ImageWriteException, InvalidValueException for an invalid range
+		 */
+		void compute_file(const string &reffile, const string &ptclfile, const string &outfile,
+						  int c0=0, int c1=-1, int r0=0, int r1=-1, bool saveali=false);
+
+		/** @return the checkpoint file used by compute_file() for 'outfile' */
+		static string checkpoint_file(const string &outfile);
+
+	  private:
+		class RowTask;
+
+		/** Shrink an image in place, then multiply by msk if it isn't NULL */
+		void prepare(EMData *image, EMData *msk) const;
+
+		/** Align and compare one particle against all references. 'out' receives 6 values per column. */
+		void compute_row(EMData *ptcl, const vector<EMData *> &refs, EMData *msk, float *out) const;
+
+		/** Compute rows for prepared particles, leaving NULL rows untouched. 'local' holds the
+		 * per-thread reference copies, and may be reused across calls. out is 6*ncols floats per row. */
+		void compute_rows(const vector<EMData *> &refs, vector< vector<EMData *> > &local,
+						  const vector<EMData *> &ptcls, EMData *msk, vector<float> &out) const;
+
+		string cmp_name;
+		Dict cmp_params;
+		string align_name;
+		Dict align_params;
+		string aligncmp_name;
+		Dict aligncmp_params;
+		string ralign_name;
+		Dict ralign_params;
+		string raligncmp_name;
+		Dict raligncmp_params;
+		EMData *mask;
+		float shrink;
+		std::set<int> exclude;
+		int nthreads;
+		int block_size;
+		int verbose;
+
+		// not copyable, owns the mask
+		SimilarityMatrix(const SimilarityMatrix &);
+		SimilarityMatrix &operator=(const SimilarityMatrix &);
+	};
+}
+
+#endif	//eman_simmx_h__
@@ -36,6 +36,8 @@
 #include <stack>
 #include "ctf.h"
 #include "emdata.h"
+#include "resample.h"
+#include "parallel.h"
 #include <iostream>
 #include <cmath>
 #include <cstring>
@@ -1188,7 +1190,7 @@ EMData* EMData::average_circ_sub() const
 //  Helper functions for method nn
 
 
-void EMData::onelinenn(int j, int n, int n2, EMData* wptr, EMData* bi, const Transform& tf)
+void EMData::onelinenn(int j, int n, int n2, EMData* wptr, EMData* bi, const Transform& tf, int izlo, int izhi)
 {
         //std::cout<<"   onelinenn  "<<j<<"  "<<n<<"  "<<n2<<"  "<<std::endl;
 	int nnd4 = n*n/4;
@@ -1218,6 +1220,8 @@ void EMData::onelinenn(int j, int n, int n2, EMData* wptr, EMData* bi, const Tra
 			if (izn >= 0)  iza = izn + 1;
 			else	       iza = n + izn + 1;
 
+			if (iza < izlo || iza > izhi) continue;
+
 			if (iyn >= 0) iya = iyn + 1;
 			else	      iya = n + iyn + 1;
 
@@ -1257,7 +1261,7 @@ void EMData::onelinenn(int j, int n, int n2, EMData* wptr, EMData* bi, const Tra
 }
 
 
-void EMData::onelinenn_mult(int j, int n, int n2, EMData* wptr, EMData* bi, const Transform& tf, float mult)
+void EMData::onelinenn_mult(int j, int n, int n2, EMData* wptr, EMData* bi, const Transform& tf, float mult, int izlo, int izhi)
 {
         //std::cout<<"   onelinenn  "<<j<<"  "<<n<<"  "<<n2<<"  "<<std::endl;
 	int jp = (j >= 0) ? j+1 : n+j+1;
@@ -1287,6 +1291,8 @@ void EMData::onelinenn_mult(int j, int n, int n2, EMData* wptr, EMData* bi, cons
 			if (izn >= 0)  iza = izn + 1;
 			else	       iza = n + izn + 1;
 
+			if (iza < izlo || iza > izhi) continue;
+
 			if (iyn >= 0) iya = iyn + 1;
 			else	      iya = n + iyn + 1;
 
@@ -1320,6 +1326,78 @@ void EMData::onelinenn_mult(int j, int n, int n2, EMData* wptr, EMData* bi, cons
 	}
 }
 
+namespace {
+	/** Inserts a list of Fourier slices into one nn4-family volume, a z slab of the
+	 * volume per item. Each slab walks every slice and row in the serial order but only
+	 * accumulates the voxels whose z index lies inside it, so every voxel receives the same
+	 * additions in the same order as repeated single slice insertions and the result is
+	 * identical for any number of threads. The caller sets the array offsets.
+	 */
+	class SliceInsertTask : public ParallelTask
+	{
+	  public:
+		enum Kind { NN, NN_CTF_EXISTS, NN_CTFW, RECT };
+
+		SliceInsertTask(Kind k, EMData *v, EMData *wt, EMData *f, EMData *c, const vector<Transform> &t, const vector<float> &wg, int ns)
+			: kind(k), vol(v), w(wt), fft(f), c2(c), tfs(t), weights(wg), nslab(ns), bckgnoise(0),
+			  npad(1), sizeofprojection(0), xratio(1.0f), yratio(1.0f), zratio(1.0f)
+		{
+			nz = vol->get_zsize();
+			ny = vol->get_ysize();
+			if (kind == NN || kind == NN_CTF_EXISTS) nxc = vol->get_attr("nxc");
+			else nxc = 0;
+		}
+
+		void run(size_t begin, size_t end, int)
+		{
+			for (size_t s = begin; s < end; s++) {
+				int izlo = 1 + (int)(s*nz/nslab);
+				int izhi = (int)((s+1)*nz/nslab);
+				for (size_t k = 0; k < tfs.size(); k++) insert(tfs[k], weights[k], izlo, izhi);
+			}
+		}
+
+	  private:
+		void insert(const Transform &tf, float weight, int izlo, int izhi)
+		{
+			if (kind == NN) {
+				if (weight == 1) {
+					for (int iy = -ny/2 + 1; iy <= ny/2; iy++) vol->onelinenn(iy, ny, nxc, w, fft, tf, izlo, izhi);
+				} else {
+					for (int iy = -ny/2 + 1; iy <= ny/2; iy++) vol->onelinenn_mult(iy, ny, nxc, w, fft, tf, weight, izlo, izhi);
+				}
+			} else if (kind == NN_CTF_EXISTS) {
+				for (int iy = -ny/2 + 1; iy <= ny/2; iy++) vol->onelinenn_ctf_exists(iy, ny, nxc, w, fft, c2, tf, weight, izlo, izhi);
+			} else if (kind == NN_CTFW) {
+				int mynx = fft->get_xsize()/2;
+				int myny = fft->get_ysize();
+				for (int iy = -myny/2 + 1; iy <= myny/2; iy++) vol->onelinetr_ctfw(iy, ny, myny, mynx, npad, w, fft, c2, *bckgnoise, tf, weight, izlo, izhi);
+			} else {
+				vol->insert_rect_slice_window(w, fft, tf, sizeofprojection, xratio, yratio, zratio, npad, weight, izlo, izhi);
+			}
+		}
+
+		Kind kind;
+		EMData *vol, *w, *fft, *c2;
+		const vector<Transform> &tfs;
+		const vector<float> &weights;
+		int nslab, ny, nz, nxc;
+
+	  public:
+		/** Extra inputs of the NN_CTFW and RECT kinds */
+		const vector<float> *bckgnoise;
+		int npad, sizeofprojection;
+		float xratio, yratio, zratio;
+	};
+
+	/** Number of z slabs for SliceInsertTask, one per thread */
+	int insert_slabs(int nz)
+	{
+		if (Parallel::in_worker()) return 1;
+		return std::max(1, std::min(Parallel::get_threads(), nz));
+	}
+}
+
 void EMData::nn(EMData* wptr, EMData* myfft, const Transform& tf, float mult)
 {
 	ENTERFUNC;
@@ -1334,9 +1412,9 @@ void EMData::nn(EMData* wptr, EMData* myfft, const Transform& tf, float mult)
 	//Dict tt = tf.get_rotation("spider");
 	//std::cout << static_cast<float>(tt["phi"]) << " " << static_cast<float>(tt["theta"]) << " " << static_cast<float>(tt["psi"]) << std::endl;
 	if( mult == 1 ) {
-		for (int iy = -ny/2 + 1; iy <= ny/2; iy++) onelinenn(iy, ny, nxc, wptr, myfft, tf);
+		for (int iy = -ny/2 + 1; iy <= ny/2; iy++) onelinenn(iy, ny, nxc, wptr, myfft, tf, 1, nz);
 	} else {
-		for (int iy = -ny/2 + 1; iy <= ny/2; iy++) onelinenn_mult(iy, ny, nxc, wptr, myfft, tf, mult);
+		for (int iy = -ny/2 + 1; iy <= ny/2; iy++) onelinenn_mult(iy, ny, nxc, wptr, myfft, tf, mult, 1, nz);
 	}
 
 	set_array_offsets(saved_offsets);
@@ -1344,6 +1422,24 @@ void EMData::nn(EMData* wptr, EMData* myfft, const Transform& tf, float mult)
 	EXITFUNC;
 }
 
+void EMData::nn_batch(EMData* wptr, EMData* myfft, const vector<Transform>& tfs, float mult)
+{
+	ENTERFUNC;
+	vector<int> saved_offsets = get_array_offsets();
+	vector<int> myfft_saved_offsets = myfft->get_array_offsets();
+	set_array_offsets(0,1,1);
+	myfft->set_array_offsets(0,1);
+
+	vector<float> weights(tfs.size(), mult);
+	int nslab = insert_slabs(nz);
+	SliceInsertTask task(SliceInsertTask::NN, this, wptr, myfft, 0, tfs, weights, nslab);
+	Parallel::run(task, nslab);
+
+	set_array_offsets(saved_offsets);
+	myfft->set_array_offsets(myfft_saved_offsets);
+	EXITFUNC;
+}
+
 
 void EMData::insert_rect_slice(EMData* w, EMData* myfft, const Transform& trans, int sizeofprojection, float xratio, float yratio, float zratio, int npad, float mult)
 {
@@ -1352,7 +1448,37 @@ void EMData::insert_rect_slice(EMData* w, EMData* myfft, const Transform& trans,
 	vector<int> myfft_saved_offsets = myfft->get_array_offsets();
 	set_array_offsets(0,1,1);
 	myfft->set_array_offsets(0,1);
-	
+	insert_rect_slice_window(w, myfft, trans, sizeofprojection, xratio, yratio, zratio, npad, mult, 1, nz);
+	set_array_offsets(saved_offsets);
+	myfft->set_array_offsets(myfft_saved_offsets);
+	EXITFUNC;
+}
+
+void EMData::insert_rect_slice_batch(EMData* w, EMData* myfft, const vector<Transform>& tfs, int sizeofprojection, float xratio, float yratio, float zratio, int npad, float mult)
+{
+	ENTERFUNC;
+	vector<int> saved_offsets = get_array_offsets();
+	vector<int> myfft_saved_offsets = myfft->get_array_offsets();
+	set_array_offsets(0,1,1);
+	myfft->set_array_offsets(0,1);
+
+	vector<float> weights(tfs.size(), mult);
+	int nslab = insert_slabs(nz);
+	SliceInsertTask task(SliceInsertTask::RECT, this, w, myfft, 0, tfs, weights, nslab);
+	task.sizeofprojection = sizeofprojection;
+	task.xratio = xratio;
+	task.yratio = yratio;
+	task.zratio = zratio;
+	task.npad = npad;
+	Parallel::run(task, nslab);
+
+	set_array_offsets(saved_offsets);
+	myfft->set_array_offsets(myfft_saved_offsets);
+	EXITFUNC;
+}
+
+void EMData::insert_rect_slice_window(EMData* w, EMData* myfft, const Transform& trans, int sizeofprojection, float xratio, float yratio, float zratio, int npad, float mult, int izlo, int izhi)
+{
 	// insert rectangular fft from my nn4_rect code
 
 	Vec2f coordinate_2d_square;
@@ -1405,6 +1531,26 @@ void EMData::insert_rect_slice(EMData* w, EMData* myfft, const Transform& trans,
 				coordinate_3dnew[0] = xnew*xratio;
 				coordinate_3dnew[1] = ynew*yratio;
 				coordinate_3dnew[2] = znew*zratio;
+
+				//nearest neighborhood target, found first so voxels outside [izlo,izhi] skip the interpolation
+				bool flip = coordinate_3dnew[0] < 0.;
+				if ( flip ) {
+					coordinate_3dnew[0] = -coordinate_3dnew[0];
+					coordinate_3dnew[1] = -coordinate_3dnew[1];
+					coordinate_3dnew[2] = -coordinate_3dnew[2];
+					}
+				int ixn = int(coordinate_3dnew[0] + 0.5 + nx) - nx;
+				int iyn = int(coordinate_3dnew[1] + 0.5 + ny) - ny;
+				int izn = int(coordinate_3dnew[2] + 0.5 + nz) - nz;
+
+				int iza, iya;
+				if (izn >= 0)  iza = izn + 1;
+				else	       iza = nz + izn + 1;
+
+				if (iza < izlo || iza > izhi) continue;
+
+				if (iyn >= 0) iya = iyn + 1;
+				else	      iya = ny + iyn + 1;
 				
 				//bilinear interpolation
 				float xp = coordinate_2d_square[0];
@@ -1431,28 +1577,7 @@ void EMData::insert_rect_slice(EMData* w, EMData* myfft, const Transform& trans,
 				}
 					
 				c1 = lin_interpolated;
-				
-				//now nearest neighborhood interpolation
-				
-				std::complex<float> btq;
-				if ( coordinate_3dnew[0] < 0.) {
-					coordinate_3dnew[0] = -coordinate_3dnew[0];
-					coordinate_3dnew[1] = -coordinate_3dnew[1];
-					coordinate_3dnew[2] = -coordinate_3dnew[2];
-					btq = conj(c1);
-					} else {
-					btq = c1;
-					}
-				int ixn = int(coordinate_3dnew[0] + 0.5 + nx) - nx;
-				int iyn = int(coordinate_3dnew[1] + 0.5 + ny) - ny;
-				int izn = int(coordinate_3dnew[2] + 0.5 + nz) - nz;
-
-				int iza, iya;
-				if (izn >= 0)  iza = izn + 1;
-				else	       iza = nz + izn + 1;
-
-				if (iyn >= 0) iya = iyn + 1;
-				else	      iya = ny + iyn + 1;
+				std::complex<float> btq = flip ? conj(c1) : c1;
 
 				cmplx(ixn,iya,iza) += btq * mult;
 				(*w)(ixn,iya,iza) += mult;
@@ -1464,11 +1589,6 @@ void EMData::insert_rect_slice(EMData* w, EMData* myfft, const Transform& trans,
 
 
 	//end insert rectanular fft
-		
-	set_array_offsets(saved_offsets);
-	myfft->set_array_offsets(myfft_saved_offsets);
-	EXITFUNC;
-
 }
 
 
@@ -1543,6 +1663,42 @@ void EMData::nn_SSNR(EMData* wptr, EMData* wptr2, EMData* myfft, const Transform
 
 
 
+namespace {
+	/** The interior of the x=0 plane symmetrization in symplane0, symplane0_ctf and
+	 * symplane0_rect, one z index in [2,nz/2] per item. An item only touches planes iza
+	 * and nz-iza+2, so items are independent. The caller sets offsets (0,1,1).
+	 */
+	class SymPlaneTask : public ParallelTask
+	{
+	  public:
+		SymPlaneTask(EMData *v, EMData *wt, int nyy, int nzz, int nycc)
+			: vol(v), w(wt), ny(nyy), nz(nzz), nyc(nycc) {}
+
+		size_t size() const { return nz/2 > 1 ? nz/2 - 1 : 0; }
+
+		void run(size_t begin, size_t end, int)
+		{
+			for (size_t i = begin; i < end; i++) {
+				int iza = (int)i + 2;
+				for (int iya = 2; iya <= nyc; iya++) {
+					vol->cmplx(0,iya,iza) += conj(vol->cmplx(0,ny-iya+2,nz-iza+2));
+					(*w)(0,iya,iza) += (*w)(0,ny-iya+2,nz-iza+2);
+					vol->cmplx(0,ny-iya+2,nz-iza+2) = conj(vol->cmplx(0,iya,iza));
+					(*w)(0,ny-iya+2,nz-iza+2) = (*w)(0,iya,iza);
+					vol->cmplx(0,ny-iya+2,iza) += conj(vol->cmplx(0,iya,nz-iza+2));
+					(*w)(0,ny-iya+2,iza) += (*w)(0,iya,nz-iza+2);
+					vol->cmplx(0,iya,nz-iza+2) = conj(vol->cmplx(0,ny-iya+2,iza));
+					(*w)(0,iya,nz-iza+2) = (*w)(0,ny-iya+2,iza);
+				}
+			}
+		}
+
+	  private:
+		EMData *vol, *w;
+		int ny, nz, nyc;
+	};
+}
+
 void EMData::symplane0(EMData* wptr) {
 	ENTERFUNC;
 	int nxc = attr_dict["nxc"];
@@ -1550,18 +1706,8 @@ void EMData::symplane0(EMData* wptr) {
 
 	vector<int> saved_offsets = get_array_offsets();
 	set_array_offsets(0,1,1);
-	for (int iza = 2; iza <= nxc; iza++) {
-		for (int iya = 2; iya <= nxc; iya++) {
-			cmplx(0,iya,iza) += conj(cmplx(0,n-iya+2,n-iza+2));
-			(*wptr)(0,iya,iza) += (*wptr)(0,n-iya+2,n-iza+2);
-			cmplx(0,n-iya+2,n-iza+2) = conj(cmplx(0,iya,iza));
-			(*wptr)(0,n-iya+2,n-iza+2) = (*wptr)(0,iya,iza);
-			cmplx(0,n-iya+2,iza) += conj(cmplx(0,iya,n-iza+2));
-			(*wptr)(0,n-iya+2,iza) += (*wptr)(0,iya,n-iza+2);
-			cmplx(0,iya,n-iza+2) = conj(cmplx(0,n-iya+2,iza));
-			(*wptr)(0,iya,n-iza+2) = (*wptr)(0,n-iya+2,iza);
-		}
-	}
+	SymPlaneTask task(this, wptr, n, n, nxc);
+	Parallel::run(task, task.size());
 	for (int iya = 2; iya <= nxc; iya++) {
 		cmplx(0,iya,1) += conj(cmplx(0,n-iya+2,1));
 		(*wptr)(0,iya,1) += (*wptr)(0,n-iya+2,1);
@@ -1681,18 +1827,8 @@ void EMData::symplane0_ctf(EMData* w) {
 	vector<int> saved_offsets = get_array_offsets();
 	set_array_offsets(0,1,1);
 
-	for (int iza = 2; iza <= nxc; iza++) {
-		for (int iya = 2; iya <= nxc; iya++) {
-			cmplx(0,iya,iza) += conj(cmplx(0,n-iya+2,n-iza+2));
-			(*w)(0,iya,iza) += (*w)(0,n-iya+2,n-iza+2);
-			cmplx(0,n-iya+2,n-iza+2) = conj(cmplx(0,iya,iza));
-			(*w)(0,n-iya+2,n-iza+2) = (*w)(0,iya,iza);
-			cmplx(0,n-iya+2,iza) += conj(cmplx(0,iya,n-iza+2));
-			(*w)(0,n-iya+2,iza) += (*w)(0,iya,n-iza+2);
-			cmplx(0,iya,n-iza+2) = conj(cmplx(0,n-iya+2,iza));
-			(*w)(0,iya,n-iza+2) = (*w)(0,n-iya+2,iza);
-		}
-	}
+	SymPlaneTask task(this, w, n, n, nxc);
+	Parallel::run(task, task.size());
 	for (int iya = 2; iya <= nxc; iya++) {
 		cmplx(0,iya,1) += conj(cmplx(0,n-iya+2,1));
 		(*w)(0,iya,1) += (*w)(0,n-iya+2,1);
@@ -1804,18 +1940,8 @@ void EMData::symplane0_rect(EMData* w) {
 	// let's treat the local data as a matrix
 	vector<int> saved_offsets = get_array_offsets();
 	set_array_offsets(0,1,1);
-	for (int iza = 2; iza <= nzc; iza++) {
-		for (int iya = 2; iya <= nyc; iya++) {
-			cmplx(0,iya,iza) += conj(cmplx(0,ny-iya+2,nz-iza+2));
-			(*w)(0,iya,iza) += (*w)(0,ny-iya+2,nz-iza+2);
-			cmplx(0,ny-iya+2,nz-iza+2) = conj(cmplx(0,iya,iza));
-			(*w)(0,ny-iya+2,nz-iza+2) = (*w)(0,iya,iza);
-			cmplx(0,ny-iya+2,iza) += conj(cmplx(0,iya,nz-iza+2));
-			(*w)(0,ny-iya+2,iza) += (*w)(0,iya,nz-iza+2);
-			cmplx(0,iya,nz-iza+2) = conj(cmplx(0,ny-iya+2,iza));
-			(*w)(0,iya,nz-iza+2) = (*w)(0,ny-iya+2,iza);
-		}
-	}
+	SymPlaneTask task(this, w, ny, nz, nyc);
+	Parallel::run(task, task.size());
 	for (int iya = 2; iya <= nyc; iya++) {
 		cmplx(0,iya,1) += conj(cmplx(0,ny-iya+2,1));
 		(*w)(0,iya,1) += (*w)(0,ny-iya+2,1);
@@ -2028,7 +2154,7 @@ void EMData::onelinenn_ctfw(int j, int n, int n2,
 
 //  Helper functions for method nn4_ctfw with tri-linear interpolation
 void EMData::onelinetr_ctfw(int j, int bign, int n, int n2, int npad,
-		          EMData* w, EMData* bi, EMData* c2, vector<float> bckgnoise, const Transform& tf, float weight) {
+		          EMData* w, EMData* bi, EMData* c2, const vector<float>& bckgnoise, const Transform& tf, float weight, int izlo, int izhi) {
 //std::cout<<"   onelinetr_ctfw  "<<j<<"  "<<n<<"   "<<bign<<"  "<<n<<"  "<<n2<<"  "<<npad<<std::endl;
 
 	int nnd4 = n*n/4;
@@ -2048,6 +2174,22 @@ void EMData::onelinetr_ctfw(int j, int bign, int n, int n2, int npad,
 				btq = conj(bi->cmplx(i,jp));
 			} else  btq = bi->cmplx(i,jp);
 
+			// the two z planes touched come first, so points outside [izlo,izhi] are skipped early
+			int izn = int(znew + bign);  // Here bign has no particular meaning, it only matters it is much larger than -xnew
+			float dz = znew + bign - izn;
+			izn -= bign;
+
+			int iza;
+			if (izn >= 0)  iza = izn + 1;
+			else           iza = bign + izn + 1;  // Here bign has correct meaning
+
+			int iz1 = iza + 1;
+			if (iz1 > bign) iz1 -= bign;
+
+			bool inza = iza >= izlo && iza <= izhi;
+			bool inz1 = iz1 >= izlo && iz1 <= izhi;
+			if (!inza && !inz1) continue;
+
 			// linear interpolation of 1D bckgnoise
 			float rr = std::sqrt(float(r2));
 			int   ir = int(rr);
@@ -2060,13 +2202,11 @@ void EMData::onelinetr_ctfw(int j, int bign, int n, int n2, int npad,
 			float denominator = c2val * mult * weight;
 
 
-			int ixn = int(xnew + bign); // Here bign has no particular meaning, it only matters it is much larger than -xnew
+			int ixn = int(xnew + bign);
 			int iyn = int(ynew + bign);
-			int izn = int(znew + bign);
 
 			float dx = xnew + bign - ixn;
 			float dy = ynew + bign - iyn;
-			float dz = znew + bign - izn;
 			float qdx = 1.0f - dx;
 			float qdy = 1.0f - dy;
 			float qdz = 1.0f - dz;
@@ -2082,81 +2222,36 @@ void EMData::onelinetr_ctfw(int j, int bign, int n, int n2, int npad,
 
 			ixn -= bign;
 			iyn -= bign;
-			izn -= bign;
-
-
-
-/*
-			int iza, iya;
-			if (izn >= 0)  iza = izn + 1;
-			else           iza = n + izn + 1;
 
+			int iya;
 			if (iyn >= 0) iya = iyn + 1;
-			else          iya = n + iyn + 1;
-
-            cout <<"  "<<jp<<"  "<<i<<"  "<<j<<"  "<<rr<<"  "<<ir<<"  "<<c2val<<"  "<<mult<<"  "<<1.0f/mult<<"  "<<btq<<"  "<<weight<<endl;
-			// cmplx(ixn, iya, iza) += btq*ctf*mult*weight;
-			// (*w)(ixn, iya, iza)  += ctf*ctf*mult*weight;
-			cmplx(ixn, iya, iza) +=  btq * mult * weight;
-			(*w)(ixn, iya, iza)  += c2val * mult * weight;
-*/
-//cout <<"  "<<jp<<"  "<<i<<"  "<<j<<"  "<<ixn<<"  "<<iyn<<"  "<<izn<<"  "<<n<<endl;
-
-			int iza, iya;
-			if (iyn >= 0) iya = iyn + 1;
-			else          iya = bign + iyn + 1;  // Here bign has correct meaning
-
-			if (izn >= 0)  iza = izn + 1;
-			else           iza = bign + izn + 1;
+			else          iya = bign + iyn + 1;
 
 			int ix1 = ixn + 1;
 
 			int iy1 = iya + 1;
 			if (iy1 > bign) iy1 -= bign;
 
-			int iz1 = iza + 1;
-			if (iz1 > bign) iz1 -= bign;
-
-
-/*
-			int iy1 = iyn +1;
-			if (iy1 >= 0) iy1 = iy1 + 1;
-			else          iy1 = bign + iy1 + 1;
-
-			int iz1 = izn +1;
-			if (iz1 >= 0) iz1 = iz1 + 1;
-			else          iz1 = bign + iz1 + 1;
-*/
-            //cout <<" onetrl "<<jp<<"  "<<i<<"  "<<j<<"  "<<ixn<<"  "<<iya<<"  "<<iza<<"  "<<endl;
-			// cmplx(ixn, iya, iza) += btq*ctf*mult*weight;
-			// (*w)(ixn, iya, iza)  += ctf*ctf*mult*weight;
-/*
-	if(ixn<0 or ixn >=n2*npad)  cout<<"  error   ixn  "<<ixn<<endl;
-	if(iya<1 or iya >bign)  cout<<"  error   iya  "<<iya<<endl;
-	if(iza<1 or iza >bign)  cout<<"  error   iza  "<<iza<<endl;
-	if(iy1<1 or iy1 >bign)  cout<<"  error   iy1  "<<iy1<<endl;
-	if(iz1<1 or iz1 >bign)  cout<<"  error   iz1  "<<iz1<<endl;
-*/
-			// numerator
-			cmplx(ixn, iya, iza) += qq000 * numerator;
-			cmplx(ixn, iy1, iza) += qq010 * numerator;
-			cmplx(ix1, iya, iza) += qq100 * numerator;
-			cmplx(ix1, iy1, iza) += qq110 * numerator;
-			cmplx(ixn, iya, iz1) += qq001 * numerator;
-			cmplx(ixn, iy1, iz1) += qq011 * numerator;
-			cmplx(ix1, iya, iz1) += qq101 * numerator;
-			cmplx(ix1, iy1, iz1) += qq111 * numerator;
-			// denominator
-			(*w)(ixn, iya, iza) += qq000 * denominator;
-			(*w)(ixn, iy1, iza) += qq010 * denominator;
-			(*w)(ix1, iy1, iza) += qq110 * denominator;
-			(*w)(ix1, iya, iza) += qq100 * denominator;
-			(*w)(ixn, iya, iz1) += qq001 * denominator;
-			(*w)(ixn, iy1, iz1) += qq011 * denominator;
-			(*w)(ix1, iya, iz1) += qq101 * denominator;
-			(*w)(ix1, iy1, iz1) += qq111 * denominator;
-
-
+			if (inza) {
+				cmplx(ixn, iya, iza) += qq000 * numerator;
+				cmplx(ixn, iy1, iza) += qq010 * numerator;
+				cmplx(ix1, iya, iza) += qq100 * numerator;
+				cmplx(ix1, iy1, iza) += qq110 * numerator;
+				(*w)(ixn, iya, iza) += qq000 * denominator;
+				(*w)(ixn, iy1, iza) += qq010 * denominator;
+				(*w)(ix1, iy1, iza) += qq110 * denominator;
+				(*w)(ix1, iya, iza) += qq100 * denominator;
+			}
+			if (inz1) {
+				cmplx(ixn, iya, iz1) += qq001 * numerator;
+				cmplx(ixn, iy1, iz1) += qq011 * numerator;
+				cmplx(ix1, iya, iz1) += qq101 * numerator;
+				cmplx(ix1, iy1, iz1) += qq111 * numerator;
+				(*w)(ixn, iya, iz1) += qq001 * denominator;
+				(*w)(ixn, iy1, iz1) += qq011 * denominator;
+				(*w)(ix1, iya, iz1) += qq101 * denominator;
+				(*w)(ix1, iy1, iz1) += qq111 * denominator;
+			}
 		}
 	}
 }
@@ -2208,7 +2303,7 @@ void EMData::onelinenn_ctf_applied(int j, int n, int n2,
 }
 
 void EMData::onelinenn_ctf_exists(int j, int n, int n2,
-		          EMData* w, EMData* bi, EMData* c2, const Transform& tf, float weight) {
+		          EMData* w, EMData* bi, EMData* c2, const Transform& tf, float weight, int izlo, int izhi) {
 	//std::cout<<"   onelinenn_ctf  "<<j<<"  "<<n<<"  "<<n2<<"  "<<std::endl;
     //int remove = bi->get_attr_default( "remove", 0 );
 
@@ -2217,8 +2312,7 @@ void EMData::onelinenn_ctf_exists(int j, int n, int n2,
 	// loop over x
 	for (int i = 0; i <= n2; i++) {
 	    int r2 = i*i + j*j;
-		if ( (r2 < n*n/4) && !((0 == i) && (j < 0)) ) {
-			float ctf = ctf_store::get_ctf( r2, i, j ); //This is in 2D projection plane
+		if ( (r2 < nnd4) && !((0 == i) && (j < 0)) ) {
 			//	   if ( !((0 == i) && (j < 0))) {
 			float xnew = i*tf[0][0] + j*tf[1][0];
 			float ynew = i*tf[0][1] + j*tf[1][1];
@@ -2241,6 +2335,8 @@ void EMData::onelinenn_ctf_exists(int j, int n, int n2,
 			if (izn >= 0)  iza = izn + 1;
 			else           iza = n + izn + 1;
 
+			if (iza < izlo || iza > izhi) continue;
+
 			if (iyn >= 0) iya = iyn + 1;
 			else          iya = n + iyn + 1;
 
@@ -2292,7 +2388,30 @@ void EMData::nn_ctfw(EMData* w, EMData* myfft, EMData* ctf2d2, int npad, vector<
 	int myny = myfft->get_ysize();
 	//cout<<"  dimensions in nn_ctfw  "<<nx<<"   "<<ny<<"   "<<mynx<<"   "<<myny<<endl;
 	// loop over frequencies in y
-	for (int iy = -myny/2 + 1; iy <= myny/2; iy++) onelinetr_ctfw(iy, ny, myny, mynx, npad, w, myfft, ctf2d2, bckgnoise, tf, weight);
+	for (int iy = -myny/2 + 1; iy <= myny/2; iy++) onelinetr_ctfw(iy, ny, myny, mynx, npad, w, myfft, ctf2d2, bckgnoise, tf, weight, 1, nz);
+	set_array_offsets(saved_offsets);
+	myfft->set_array_offsets(myfft_saved_offsets);
+	ctf2d2->set_array_offsets(ctf2d2_saved_offsets);
+	EXITFUNC;
+}
+
+void EMData::nn_ctfw_batch(EMData* w, EMData* myfft, EMData* ctf2d2, int npad, const vector<float>& bckgnoise, const vector<Transform>& tfs, const vector<float>& weights)
+{
+	ENTERFUNC;
+	if (weights.size() != tfs.size()) throw InvalidParameterException("nn_ctfw_batch needs one weight per transform");
+	vector<int> saved_offsets = get_array_offsets();
+	vector<int> myfft_saved_offsets = myfft->get_array_offsets();
+	vector<int> ctf2d2_saved_offsets = ctf2d2->get_array_offsets();
+	set_array_offsets(0,1,1);
+	myfft->set_array_offsets(0,1);
+	ctf2d2->set_array_offsets(0,1);
+
+	int nslab = insert_slabs(nz);
+	SliceInsertTask task(SliceInsertTask::NN_CTFW, this, w, myfft, ctf2d2, tfs, weights, nslab);
+	task.bckgnoise = &bckgnoise;
+	task.npad = npad;
+	Parallel::run(task, nslab);
+
 	set_array_offsets(saved_offsets);
 	myfft->set_array_offsets(myfft_saved_offsets);
 	ctf2d2->set_array_offsets(ctf2d2_saved_offsets);
@@ -2332,7 +2451,28 @@ void EMData::nn_ctf_exists(EMData* w, EMData* myfft, EMData* ctf2d2, const Trans
 	ctf2d2->set_array_offsets(0,1);
 
 	// loop over frequencies in y
-	for (int iy = -ny/2 + 1; iy <= ny/2; iy++) onelinenn_ctf_exists(iy, ny, nxc, w, myfft, ctf2d2, tf, weight);
+	for (int iy = -ny/2 + 1; iy <= ny/2; iy++) onelinenn_ctf_exists(iy, ny, nxc, w, myfft, ctf2d2, tf, weight, 1, nz);
+	set_array_offsets(saved_offsets);
+	myfft->set_array_offsets(myfft_saved_offsets);
+	ctf2d2->set_array_offsets(ctf2d2_saved_offsets);
+	EXITFUNC;
+}
+
+void EMData::nn_ctf_exists_batch(EMData* w, EMData* myfft, EMData* ctf2d2, const vector<Transform>& tfs, const vector<float>& weights)
+{
+	ENTERFUNC;
+	if (weights.size() != tfs.size()) throw InvalidParameterException("nn_ctf_exists_batch needs one weight per transform");
+	vector<int> saved_offsets = get_array_offsets();
+	vector<int> myfft_saved_offsets = myfft->get_array_offsets();
+	vector<int> ctf2d2_saved_offsets = ctf2d2->get_array_offsets();
+	set_array_offsets(0,1,1);
+	myfft->set_array_offsets(0,1);
+	ctf2d2->set_array_offsets(0,1);
+
+	int nslab = insert_slabs(nz);
+	SliceInsertTask task(SliceInsertTask::NN_CTF_EXISTS, this, w, myfft, ctf2d2, tfs, weights, nslab);
+	Parallel::run(task, nslab);
+
 	set_array_offsets(saved_offsets);
 	myfft->set_array_offsets(myfft_saved_offsets);
 	ctf2d2->set_array_offsets(ctf2d2_saved_offsets);
@@ -2857,19 +2997,22 @@ EMData* EMData::rot_scale_trans2D(float angDeg, float delx, float dely, float sc
 		// trig
 		float cang = cos(ang);
 		float sang = sin(ang);
+		vector<float> xs(nx), ys(nx);
+		float* des = ret->get_data();
 			for (int iy = 0; iy < ny; iy++) {
 				float y = float(iy) - shiftyc;
 				float ycang = y*cang/scale + yc;
 				float ysang = -y*sang/scale + xc;
 				for (int ix = 0; ix < nx; ix++) {
 					float x = float(ix) - shiftxc;
-					float xold = x*cang/scale + ysang ;
-					float yold = x*sang/scale + ycang ;
-					//  quadri is taking care of cyclic count
-					(*ret)(ix,iy) = Util::quadri(xold+1.0f, yold+1.0f, nx, ny, get_data());
-					   //have to add one as quadri uses Fortran counting
+					//have to add one as quadri uses Fortran counting
+					xs[ix] = x*cang/scale + ysang + 1.0f;
+					ys[ix] = x*sang/scale + ycang + 1.0f;
 				}
+				//  the kernel is taking care of cyclic count, as quadri does
+				Resampler::quadratic(get_data(), nx, ny, &xs[0], &ys[0], nx, des + (size_t)iy*nx);
 			}
+		ret->update();
 		set_array_offsets(saved_offsets);
 		return ret;
 	} else {
@@ -2936,7 +3079,6 @@ EMData::rot_scale_trans(const Transform &RA, EMData* ret) {
 
 	if (1 >= ny)  throw ImageDimensionException("Can't rotate 1D image");
 	if (nz < 2) {
-		float  p1, p2, p3, p4;
 		float delx = translations.at(0);
 		float dely = translations.at(1);
 		delx = restrict2(delx, nx);
@@ -2946,50 +3088,21 @@ EMData::rot_scale_trans(const Transform &RA, EMData* ret) {
 	//         shifted center for rotation
 		float shiftxc = xc + delx;
 		float shiftyc = yc + dely;
+		vector<float> xs(nx), ys(nx);
+		float *out = ret->get_data();
 			for (int iy = 0; iy < ny; iy++) {
 				float y = float(iy) - shiftyc;
 				float ysang = y*RAinv[0][1]+xc;
 				float ycang = y*RAinv[1][1]+yc;
 				for (int ix = 0; ix < nx; ix++) {
 					float x = float(ix) - shiftxc;
-					float xold = x*RAinv[0][0] + ysang;
-					float yold = x*RAinv[1][0] + ycang;
-
-					xold = restrict1(xold, nx);
-					yold = restrict1(yold, ny);
-
-					int xfloor = int(xold);
-					int yfloor = int(yold);
-					float t = xold-xfloor;
-					float u = yold-yfloor;
-					if(xfloor == nx -1 && yfloor == ny -1) {
-
-						p1 =in[xfloor   + yfloor*ny];
-						p2 =in[ yfloor*ny];
-						p3 =in[0];
-						p4 =in[xfloor];
-					} else if(xfloor == nx - 1) {
-
-						p1 =in[xfloor   + yfloor*ny];
-						p2 =in[           yfloor*ny];
-						p3 =in[          (yfloor+1)*ny];
-						p4 =in[xfloor   + (yfloor+1)*ny];
-					} else if(yfloor == ny - 1) {
-
-						p1 =in[xfloor   + yfloor*ny];
-						p2 =in[xfloor+1 + yfloor*ny];
-						p3 =in[xfloor+1 ];
-						p4 =in[xfloor   ];
-					} else {
-						p1 =in[xfloor   + yfloor*ny];
-						p2 =in[xfloor+1 + yfloor*ny];
-						p3 =in[xfloor+1 + (yfloor+1)*ny];
-						p4 =in[xfloor   + (yfloor+1)*ny];
-					}
-					if (ret_is_initially_null) (*ret)(ix,iy) = p1 + u * ( p4 - p1) + t * ( p2 - p1 + u *(p3-p2-p4+p1));
-					else (*ret)(ix,iy) += p1 + u * ( p4 - p1) + t * ( p2 - p1 + u *(p3-p2-p4+p1));
-				} //ends x loop
+					xs[ix] = x*RAinv[0][0] + ysang;
+					ys[ix] = x*RAinv[1][0] + ycang;
+				}
+				// cyclic bilinear interpolation, rows are nx long
+				Resampler::bilinear_cyclic(in, nx, ny, &xs[0], &ys[0], nx, out + (size_t)iy*nx, !ret_is_initially_null);
 			} // ends y loop
+			ret->update();
 			set_array_offsets(saved_offsets);
 			return ret;
 	} else {
@@ -3008,6 +3121,8 @@ EMData::rot_scale_trans(const Transform &RA, EMData* ret) {
 		float shiftxc = xc + delx;
 		float shiftyc = yc + dely;
 		float shiftzc = zc + delz;
+		vector<float> xs(nx), ys(nx), zs(nx);
+		float *out = ret->get_data();
 
 		for (int iz = 0; iz < nz; iz++) {
 			float z = float(iz) - shiftzc;
@@ -3021,45 +3136,16 @@ EMData::rot_scale_trans(const Transform &RA, EMData* ret) {
 				float zoldzy = zoldz + y*RAinv[2][1] ;
 				for (int ix = 0; ix < nx; ix++) {
 					float x = float(ix) - shiftxc;
-					float xold = xoldzy + x*RAinv[0][0] ;
-					float yold = yoldzy + x*RAinv[1][0] ;
-					float zold = zoldzy + x*RAinv[2][0] ;
-
-					xold = restrict1(xold, nx);
-					yold = restrict1(yold, ny);
-					zold = restrict1(zold, nz);
-
-
-					int IOX = int(xold);
-					int IOY = int(yold);
-					int IOZ = int(zold);
-
-					int IOXp1 = std::min( nx-1 ,IOX+1);
-
-					int IOYp1 = std::min( ny-1 ,IOY+1);
-
-					int IOZp1 = std::min( nz-1 ,IOZ+1);
-
-					float dx = xold-IOX;
-					float dy = yold-IOY;
-					float dz = zold-IOZ;
-
-					float a1 = in(IOX,IOY,IOZ);
-					float a2 = in(IOXp1,IOY,IOZ) - in(IOX,IOY,IOZ);
-					float a3 = in(IOX,IOYp1,IOZ) - in(IOX,IOY,IOZ);
-					float a4 = in(IOX,IOY,IOZp1) - in(IOX,IOY,IOZ);
-					float a5 = in(IOX,IOY,IOZ) - in(IOXp1,IOY,IOZ) - in(IOX,IOYp1,IOZ) + in(IOXp1,IOYp1,IOZ);
-					float a6 = in(IOX,IOY,IOZ) - in(IOXp1,IOY,IOZ) - in(IOX,IOY,IOZp1) + in(IOXp1,IOY,IOZp1);
-					float a7 = in(IOX,IOY,IOZ) - in(IOX,IOYp1,IOZ) - in(IOX,IOY,IOZp1) + in(IOX,IOYp1,IOZp1);
-					float a8 = in(IOXp1,IOY,IOZ) + in(IOX,IOYp1,IOZ)+ in(IOX,IOY,IOZp1)
-							- in(IOX,IOY,IOZ)- in(IOXp1,IOYp1,IOZ) - in(IOXp1,IOY,IOZp1)
-							- in(IOX,IOYp1,IOZp1) + in(IOXp1,IOYp1,IOZp1);
-					if (ret_is_initially_null) (*ret)(ix,iy,iz) = a1 + dz*(a4 + a6*dx + (a7 + a8*dx)*dy) + a3*dy + dx*(a2 + a5*dy);
-					else (*ret)(ix,iy,iz) += a1 + dz*(a4 + a6*dx + (a7 + a8*dx)*dy) + a3*dy + dx*(a2 + a5*dy);
-				} //ends x loop
+					xs[ix] = xoldzy + x*RAinv[0][0] ;
+					ys[ix] = yoldzy + x*RAinv[1][0] ;
+					zs[ix] = zoldzy + x*RAinv[2][0] ;
+				}
+				Resampler::trilinear_cyclic(in, nx, ny, nz, &xs[0], &ys[0], &zs[0], nx,
+											out + ((size_t)iz*ny + iy)*nx, !ret_is_initially_null);
 			} // ends y loop
 		} // ends z loop
 
+		ret->update();
 		set_array_offsets(saved_offsets);
 		return ret;
 	}
@@ -3821,18 +3907,21 @@ EMData* EMData::rot_scale_conv_new(float ang, float delx, float dely, Util::Kais
 
 	float cang = cos(ang);
 	float sang = sin(ang);
+	vector<float> xs(nxn), ys(nxn);
+	float* out = ret->get_data();
 	for (int iy = 0; iy < nyn; iy++) {
 		float y = float(iy) - shiftyc;
 		float ycang = y*cang/scale + yc;
 		float ysang = -y*sang/scale + xc;
 		for (int ix = 0; ix < nxn; ix++) {
 			float x = float(ix) - shiftxc;
-			float xold = x*cang/scale + ysang-ixs;// have to add the fraction on account on odd-sized images for which Fourier zero-padding changes the center location
-			float yold = x*sang/scale + ycang-iys;
-
-			(*ret)(ix,iy) = Util::get_pixel_conv_new(nx, ny, 1, xold, yold, 1, data, kb);
+			xs[ix] = x*cang/scale + ysang-ixs;// have to add the fraction on account on odd-sized images for which Fourier zero-padding changes the center location
+			ys[ix] = x*sang/scale + ycang-iys;
 		}
+		// same 7x7 window as get_pixel_conv_new, evaluated a row at a time
+		Resampler::gridding(data, nx, ny, &xs[0], &ys[0], nxn, out + (size_t)iy*nxn, kb);
 	}
+	ret->update();
 	set_array_offsets(saved_offsets);
 	return ret;
 }
@@ -169,10 +169,12 @@ EMData* average_circ_sub() const;
  * @param wptr Normalization matrix [0:n2][1:n][1:n]
  * @param bi Fourier transform matrix [0:n2][1:n]
  * @param tf Transform reference
+ * @param izlo first z index [1:n] to accumulate into
+ * @param izhi last z index to accumulate into
  */
-void onelinenn(int j, int n, int n2, EMData* wptr, EMData* bi, const Transform& tf);
+void onelinenn(int j, int n, int n2, EMData* wptr, EMData* bi, const Transform& tf, int izlo, int izhi);
 
-void onelinenn_mult(int j, int n, int n2, EMData* wptr, EMData* bi, const Transform& tf, float mult);
+void onelinenn_mult(int j, int n, int n2, EMData* wptr, EMData* bi, const Transform& tf, float mult, int izlo, int izhi);
 
 /** Nearest Neighbor interpolation.
  *  Modifies the current object.
@@ -183,7 +185,24 @@ void onelinenn_mult(int j, int n, int n2, EMData* wptr, EMData* bi, const Transf
  * @param mult
  */
 void nn(EMData* wptr, EMData* myfft, const Transform& tf, float mult=1);
+
+/** Nearest Neighbor interpolation of one slice in each of several orientations,
+ *  the same as calling nn() for each of them in turn. The volume is split into z
+ *  slabs filled by separate threads (see Parallel), each voxel being summed in the
+ *  serial order, so the result doesn't depend on the number of threads.
+ *  Modifies the current object.
+ *
+ * @param wptr Normalization data.
+ * @param myfft FFT data.
+ * @param tfs orientations, usually the symmetry related copies of one projection
+ * @param mult
+ */
+void nn_batch(EMData* wptr, EMData* myfft, const vector<Transform>& tfs, float mult=1);
 void insert_rect_slice( EMData* w, EMData* myfft,const Transform& trans, int sizeofprojection, float xratio, float yratio, float zratio, int npad, float mult);
+/** insert_rect_slice() accumulating only into z indices [izlo,izhi]. Array offsets must already be set. */
+void insert_rect_slice_window( EMData* w, EMData* myfft,const Transform& trans, int sizeofprojection, float xratio, float yratio, float zratio, int npad, float mult, int izlo, int izhi);
+/** insert_rect_slice() for each of several orientations, threaded over z slabs like nn_batch() */
+void insert_rect_slice_batch( EMData* w, EMData* myfft, const vector<Transform>& tfs, int sizeofprojection, float xratio, float yratio, float zratio, int npad, float mult);
 
 /** Nearest Neighbor interpolation, meanwhile return necessary data such as
  *  Kn, sum_k(F_k^n) ans sum_k(|F_k^n|^2)
@@ -288,8 +307,10 @@ void onelinenn_ctfw(int j, int n, int n2, EMData* w, EMData* bi, EMData* c2, vec
  * @param bi Fourier transform matrix [0:n2][1:n]
  * @param tf Transform reference
  * @param mult
+ * @param izlo first z index [1:bign] to accumulate into
+ * @param izhi last z index to accumulate into
  */
-void onelinetr_ctfw(int j, int bign, int n, int n2, int npad, EMData* w, EMData* bi, EMData* c2, vector<float> bckgnoise, const Transform& tf, float weight);
+void onelinetr_ctfw(int j, int bign, int n, int n2, int npad, EMData* w, EMData* bi, EMData* c2, const vector<float>& bckgnoise, const Transform& tf, float weight, int izlo, int izhi);
 
 
 /** Nearest Neighbor interpolation.
@@ -320,7 +341,7 @@ void insert_rect_slice_ctf_applied(EMData* w, EMData* myfft, const Transform& tr
  * @param mult
  */
 void onelinenn_ctf_applied(int j, int n, int n2, EMData* w, EMData* bi, const Transform& tf, float mult);
-void onelinenn_ctf_exists(int j, int n, int n2, EMData* w, EMData* bi, EMData* c2, const Transform& tf, float weight);
+void onelinenn_ctf_exists(int j, int n, int n2, EMData* w, EMData* bi, EMData* c2, const Transform& tf, float weight, int izlo, int izhi);
 
 /** Nearest Neighbor interpolation.
  *  Modifies the current object.
@@ -335,6 +356,16 @@ void nn_ctf_applied(EMData* w, EMData* myfft, const Transform& tf, float mult );
 
 void nn_ctf_exists(EMData* w, EMData* myfft, EMData* ctf2d2, const Transform& tf, float weight);
 
+/** nn_ctf_exists() for each of several orientations, threaded over z slabs like nn_batch()
+ *
+ * @param w Normalization data.
+ * @param myfft FFT data.
+ * @param ctf2d2 squared CTF
+ * @param tfs orientations
+ * @param weights one weight per orientation
+ */
+void nn_ctf_exists_batch(EMData* w, EMData* myfft, EMData* ctf2d2, const vector<Transform>& tfs, const vector<float>& weights);
+
 /** Helper functions for method nn4_ctf.
  *
  * @param j y fourier index (frequency)
@@ -347,6 +378,18 @@ void nn_ctf_exists(EMData* w, EMData* myfft, EMData* ctf2d2, const Transform& tf
  */
 void nn_ctfw(EMData* w, EMData* myfft, EMData* ctf2d2, int npad, vector<float> bckgnoise, const Transform& tf, float weight);
 
+/** nn_ctfw() for each of several orientations, threaded over z slabs like nn_batch()
+ *
+ * @param w Normalization data.
+ * @param myfft FFT data.
+ * @param ctf2d2 squared CTF
+ * @param npad padding factor
+ * @param bckgnoise 1D background noise
+ * @param tfs orientations
+ * @param weights one weight per orientation
+ */
+void nn_ctfw_batch(EMData* w, EMData* myfft, EMData* ctf2d2, int npad, const vector<float>& bckgnoise, const vector<Transform>& tfs, const vector<float>& weights);
+
 
 /** Symmetrize volume in real space.
  *
@@ -42,6 +42,7 @@
 #include <iostream>
 #include <ctime>
 #include <algorithm>
+#include <cstring>
 
 using namespace EMAN;
 
@@ -214,9 +215,17 @@ int SpiderIO::read_header(Dict & dict, int image_index, const Region * area, boo
 	}
 	else {
 		cur_image_hed = static_cast < SpiderHeader * >(calloc(1, sizeof(SpiderHeader)));
-		portable_fseek(spider_file, offset, SEEK_SET);
 
-		if (fread(cur_image_hed, sizeof(SpiderHeader), 1, spider_file) != 1) {
+		size_t nread = 0;
+		if (rw_mode == READ_ONLY) {
+			nread = portable_pread(spider_file, cur_image_hed, sizeof(SpiderHeader), offset);
+		}
+		else {
+			portable_fseek(spider_file, offset, SEEK_SET);
+			nread = fread(cur_image_hed, 1, sizeof(SpiderHeader), spider_file);
+		}
+
+		if (nread != sizeof(SpiderHeader)) {
 			char desc[1024];
 			sprintf(desc, "read spider header with image_index = %d failed", image_index);
 			throw ImageReadException(filename, desc);
@@ -556,15 +565,19 @@ int SpiderIO::read_data(float *data, int image_index, const Region * area, bool)
 
 	size_t size = static_cast < size_t > (first_h->nsam * first_h->nrow * first_h->nslice);
 	size_t single_image_size = static_cast < size_t > (first_h->headlen + size * sizeof(float));
-	off_t offset = overall_headlen + single_image_size * image_index;
-	portable_fseek(spider_file, offset, SEEK_SET);
+	off_t offset = overall_headlen + single_image_size * image_index + (int) first_h->headlen;
 
-	portable_fseek(spider_file, (int) first_h->headlen, SEEK_CUR);
+	// Positional read for READ_ONLY files, so readers can share this SpiderIO
+	if (rw_mode != READ_ONLY) {
+		portable_fseek(spider_file, offset, SEEK_SET);
+		offset = -1;
+	}
 
 #if 1
 	EMUtil::process_region_io(data, spider_file, READ_ONLY, 0, sizeof(float),
 							  (int) first_h->nsam, (int) first_h->nrow,
-							  (int) first_h->nslice, area);
+							  (int) first_h->nslice, area, false, EMUtil::IMAGE_UNKNOWN,
+							  0, 0, offset);
 #endif
 #if 0
 	unsigned int nz = static_cast < unsigned int >(first_h->nslice);
@@ -586,6 +599,52 @@ int SpiderIO::read_data(float *data, int image_index, const Region * area, bool)
 	return 0;
 }
 
+int SpiderIO::read_data_block(float *data, int first_index, int n,
+							  size_t image_size, bool is_3d)
+{
+	ENTERFUNC;
+
+	check_read_access(first_index, data);
+
+	size_t size = static_cast < size_t > (first_h->nsam * first_h->nrow * first_h->nslice);
+
+	if (first_h->istack <= 0 || image_size != size || n <= 1) {
+		return ImageIO::read_data_block(data, first_index, n, image_size, is_3d);
+	}
+
+	check_read_access(first_index + n - 1);
+
+	size_t headlen = static_cast < size_t > (first_h->headlen);
+	size_t image_bytes = size * sizeof(float);
+	size_t stride = headlen + image_bytes;
+	size_t nbytes = stride * (n - 1) + image_bytes;
+	off_t offset = headlen + stride * first_index + headlen;
+
+	vector < char > buf(nbytes);
+	size_t nread = 0;
+
+	if (rw_mode == READ_ONLY) {
+		nread = portable_pread(spider_file, &buf[0], nbytes, offset);
+	}
+	else {
+		portable_fseek(spider_file, offset, SEEK_SET);
+		nread = fread(&buf[0], 1, nbytes, spider_file);
+	}
+
+	if (nread != nbytes) {
+		throw ImageReadException(filename, "incomplete data read");
+	}
+
+	for (int i = 0; i < n; i++) {
+		memcpy(data + size * i, &buf[stride * i], image_bytes);
+	}
+
+	become_host_endian(data, size * n);
+
+	EXITFUNC;
+	return 0;
+}
+
 int SpiderIO::write_data(float *data, int image_index, const Region* area,
 						 EMUtil::EMDataType, bool use_host_endian)
 {
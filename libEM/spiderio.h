@@ -88,6 +88,11 @@ namespace EMAN
 		 * */
 		int get_nimg();
 
+		/** Read a run of stacked images with one request, skipping
+		 * the per-image headers between them. */
+		int read_data_block(float *data, int first_index, int n,
+							size_t image_size, bool is_3d = false);
+
 	protected:
 		struct SpiderHeader
 		{
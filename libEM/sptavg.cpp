@@ -0,0 +1,331 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "sptavg.h"
+#include "emdata.h"
+#include "parallel.h"
+#include "transform.h"
+#include "util.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace EMAN;
+
+// One item per buffer, each summing its own contiguous range of particles in order,
+// so the sums don't depend on which thread runs which item
+class SubtomoAverager::AddTask : public ParallelTask {
+  public:
+	AddTask(const SubtomoAverager *a, const vector<EMData *> &i, const vector<Transform> &x,
+			const vector<float> &w, vector< vector<float> > &acc, vector<double> &cov, size_t nb) :
+		avg(a), images(i), xforms(x), weights(w), accum(acc), coverage(cov), nbuf(nb) {}
+
+	void run(size_t begin, size_t end, int) {
+		for (size_t b = begin; b < end; b++) {
+			vector<float> &acc = accum[b];
+			if (acc.empty()) acc.assign((size_t)3*(avg->size/2+1)*avg->size*avg->size,0.0f);
+
+			size_t first = b*images.size()/nbuf;
+			size_t last = (b+1)*images.size()/nbuf;
+			for (size_t i = first; i < last; i++) {
+				EMData *image = images[i];
+				if (!image) continue;
+
+				EMData *fft = image->is_complex() ? image : image->do_fft();
+				float w = weights.empty() ? 1.0f : weights[i];
+				try {
+					coverage[b] += avg->insert(fft,xforms[i],w,&acc[0]);
+				}
+				catch (...) {
+					if (fft!=image) delete fft;
+					throw;
+				}
+				if (fft!=image) delete fft;
+			}
+		}
+	}
+
+  private:
+	const SubtomoAverager *avg;
+	const vector<EMData *> &images;
+	const vector<Transform> &xforms;
+	const vector<float> &weights;
+	vector< vector<float> > &accum;
+	vector<double> &coverage;
+	size_t nbuf;
+};
+
+SubtomoAverager::SubtomoAverager() :
+	size(0), thresh_sigma(0.5f), maxtilt(90.0f), nthreads(0), nimg(0)
+{
+	apix[0] = apix[1] = apix[2] = 1.0f;
+}
+
+SubtomoAverager::~SubtomoAverager()
+{
+}
+
+void SubtomoAverager::clear()
+{
+	accum.clear();
+	coverage.clear();
+	size = 0;
+	nimg = 0;
+}
+
+void SubtomoAverager::add_image(EMData *image, const Transform &xform, float weight)
+{
+	add_images(vector<EMData *>(1,image),vector<Transform>(1,xform),vector<float>(1,weight));
+}
+
+void SubtomoAverager::add_images(const vector<EMData *> &images, const vector<Transform> &xforms,
+								 const vector<float> &weights)
+{
+	ENTERFUNC;
+
+	if (xforms.size()!=images.size()) throw InvalidParameterException("SubtomoAverager: one transform is needed per image");
+	if (!weights.empty() && weights.size()!=images.size()) throw InvalidParameterException("SubtomoAverager: one weight is needed per image");
+
+	int n0 = size;
+	int count = 0;
+	for (size_t i = 0; i < images.size(); i++) {
+		EMData *image = images[i];
+		if (!image) continue;
+
+		int n = image->get_ysize();
+		bool cube = image->is_complex() ? image->get_xsize()==n+2 && image->get_zsize()==n
+										: image->get_xsize()==n && image->get_zsize()==n;
+		if (!cube || n%2!=0) throw ImageDimensionException("SubtomoAverager: particles must be cubes with an even edge");
+		if (n0==0) {
+			n0 = n;
+			apix[0] = image->get_attr_default("apix_x",1.0f);
+			apix[1] = image->get_attr_default("apix_y",1.0f);
+			apix[2] = image->get_attr_default("apix_z",1.0f);
+		}
+		else if (n!=n0) throw ImageDimensionException("SubtomoAverager: particles must all be the same size");
+
+		if (fabs(xforms[i].get_scale()-1.0f)>1.0e-5f) throw InvalidParameterException("SubtomoAverager: scaled transforms are not supported");
+		count++;
+	}
+	if (count==0) return;
+	size = n0;
+
+	// the number of buffers is fixed, not the thread count, so the result is the same for any nthreads
+	size_t nbuf = std::min((size_t)NBUF,images.size());
+	if (accum.size()<nbuf) {
+		accum.resize(nbuf);
+		coverage.resize(nbuf,0.0);
+	}
+
+	int nt = nthreads>0 ? nthreads : Parallel::get_threads();
+	AddTask task(this,images,xforms,weights,accum,coverage,nbuf);
+	Parallel::run(task,nbuf,1,nt);
+	nimg += count;
+
+	EXITFUNC;
+}
+
+double SubtomoAverager::insert(EMData *fft, const Transform &xform, float weight, float *acc) const
+{
+	int n = size;
+	int h = n/2;
+	int nc = h+1;
+	const float *d = fft->get_const_data();
+
+	// Which of the particle's voxels were measured, by the same tests as TomoAverager and mask.wedgefill
+	bool dosigma = thresh_sigma>0.0f;
+	bool dotilt = maxtilt<90.0f;
+	float tilt = maxtilt*(float)M_PI/180.0f;
+	vector<float> threshv;
+	if (dosigma) {
+		threshv = fft->calc_radial_dist(nc,0,1,4);
+		for (int i = 0; i < nc; i++) threshv[i] *= threshv[i]*thresh_sigma;
+	}
+
+	vector<unsigned char> meas((size_t)nc*n*n,0);
+	size_t nin = 0, nmeas = 0;
+	size_t idx = 0;
+	for (int z = 0; z < n; z++) {
+		int az = z<h ? z : n-z;
+		for (int y = 0; y < n; y++) {
+			int ay = y<h ? y : n-y;
+			for (int x = 0; x < nc; x++, idx++) {
+				int r = int(Util::hypot3(x,ay,az));
+				if (r>h) continue;
+				nin++;
+				if (dosigma && Util::square_sum(d[2*idx],d[2*idx+1])<threshv[r]) continue;
+				if (dotilt && r>=3 && atan2((float)az,(float)x)>=tilt) continue;	// too few points at r<3 to consider any "missing"
+				meas[idx] = 1;
+				nmeas++;
+			}
+		}
+	}
+
+	// The xform processor maps x -> A(x-c)+c+t about the center c=n/2, so the
+	// transform of the result at k is F(A'k) exp(-2 pi i k.(c+t)/n) exp(2 pi i (A'k).c/n).
+	// Interpolating F(s)(-1)^s, the transform of the particle centered on the origin,
+	// leaves (-1)^k and the translation as phases on the output.
+	vector<float> m = xform.get_matrix();
+	float tx = m[3], ty = m[7], tz = m[11];
+	bool shift = tx!=0.0f || ty!=0.0f || tz!=0.0f;
+	float pscale = -2.0f*(float)M_PI/n;
+
+	size_t o = 0;
+	for (int z = 0; z < n; z++) {
+		int kz = z<h ? z : z-n;
+		for (int y = 0; y < n; y++) {
+			int ky = y<h ? y : y-n;
+			for (int kx = 0; kx < nc; kx++, o++) {
+				if (int(Util::hypot3(kx,ky,kz))>h) continue;
+
+				float sx = m[0]*kx + m[4]*ky + m[8]*kz;
+				float sy = m[1]*kx + m[5]*ky + m[9]*kz;
+				float sz = m[2]*kx + m[6]*ky + m[10]*kz;
+
+				// only x>=0 is stored, F(-s) is the conjugate of F(s)
+				bool flip = sx<0;
+				if (flip) {
+					sx = -sx;
+					sy = -sy;
+					sz = -sz;
+				}
+
+				int x0 = (int)floor(sx), y0 = (int)floor(sy), z0 = (int)floor(sz);
+				float fx[2], fy[2], fz[2];
+				fx[1] = sx-x0;
+				fy[1] = sy-y0;
+				fz[1] = sz-z0;
+				fx[0] = 1.0f-fx[1];
+				fy[0] = 1.0f-fy[1];
+				fz[0] = 1.0f-fz[1];
+
+				float re = 0, im = 0, wt = 0;
+				for (int dz = 0; dz < 2; dz++) {
+					int iz = ((z0+dz)%n+n)%n;
+					for (int dy = 0; dy < 2; dy++) {
+						int iy = ((y0+dy)%n+n)%n;
+						float wyz = fy[dy]*fz[dz];
+						for (int dx = 0; dx < 2; dx++) {
+							int ix = x0+dx;
+							float w = fx[dx]*wyz;
+							if (ix>h || w==0.0f) continue;
+							size_t i = ix + (size_t)nc*(iy + (size_t)n*iz);
+							if (!meas[i]) continue;
+							float sw = (ix+iy+iz)&1 ? -w : w;
+							re += sw*d[2*i];
+							im += sw*d[2*i+1];
+							wt += w;
+						}
+					}
+				}
+				if (wt==0.0f) continue;
+
+				if (flip) im = -im;
+				if ((kx+ky+kz)&1) {
+					re = -re;
+					im = -im;
+				}
+				if (shift) {
+					float p = pscale*(kx*tx + ky*ty + kz*tz);
+					float c = cos(p), s = sin(p);
+					float r = re*c - im*s;
+					im = re*s + im*c;
+					re = r;
+				}
+
+				acc[3*o] += weight*re;
+				acc[3*o+1] += weight*im;
+				acc[3*o+2] += weight*wt;
+			}
+		}
+	}
+
+	return nin ? (double)nmeas/nin : 0.0;
+}
+
+EMData *SubtomoAverager::finish(EMData *weights)
+{
+	ENTERFUNC;
+
+	// the first buffer collects the others, in buffer order
+	vector<float> *sum = 0;
+	for (size_t t = 0; t < accum.size(); t++) {
+		if (accum[t].empty()) continue;
+		if (!sum) {
+			sum = &accum[t];
+			continue;
+		}
+		float *a = &(*sum)[0];
+		const float *b = &accum[t][0];
+		for (size_t i = 0; i < sum->size(); i++) a[i] += b[i];
+		vector<float>().swap(accum[t]);
+	}
+	if (!sum || nimg==0) {
+		clear();
+		return 0;
+	}
+
+	int n = size;
+	int nc = n/2+1;
+	size_t nvox = (size_t)nc*n*n;
+	const float *a = &(*sum)[0];
+
+	EMData *result = new EMData(n+2,n,n);
+	result->set_complex(true);
+	result->set_ri(true);
+	result->set_fftpad(true);
+	result->set_fftodd(false);
+	result->set_attr("apix_x",apix[0]);
+	result->set_attr("apix_y",apix[1]);
+	result->set_attr("apix_z",apix[2]);
+	float *rd = result->get_data();
+	for (size_t i = 0; i < nvox; i++) {
+		float w = a[3*i+2];
+		rd[2*i] = w>0 ? a[3*i]/w : 0;
+		rd[2*i+1] = w>0 ? a[3*i+1]/w : 0;
+	}
+	result->update();
+
+	if (weights) {
+		weights->set_size(nc,n,n);
+		float *wd = weights->get_data();
+		for (size_t i = 0; i < nvox; i++) wd[i] = a[3*i+2];
+		weights->update();
+	}
+
+	double cov = 0;
+	for (size_t t = 0; t < coverage.size(); t++) cov += coverage[t];
+
+	EMData *ret = result->do_ift();
+	delete result;
+	ret->set_attr("ptcl_repr",nimg);
+	ret->set_attr("mean_coverage",(float)(cov/nimg));
+
+	clear();
+
+	EXITFUNC;
+	return ret;
+}
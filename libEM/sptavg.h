@@ -0,0 +1,141 @@
+/*
+ * This software is issued under a joint BSD/GNU license. You may use the
+ * source code in this file under either license. However, note that the
+ * complete EMAN2 and SPARX software packages have some GPL dependencies,
+ * so you are responsible for compliance with the licenses of these packages
+ * if you opt to use BSD licensing. The warranty disclaimer below holds
+ * in either instance.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef eman_sptavg_h__
+#define eman_sptavg_h__ 1
+
+#include "emobject.h"
+
+namespace EMAN
+{
+	class EMData;
+	class Transform;
+
+	/** SubtomoAverager averages subtomograms in Fourier space, with the same
+	 * missing wedge handling as the mean.tomo averager (TomoAverager). Rather
+	 * than rotating each particle in real space with the xform processor and
+	 * transforming the result, the particle's own transform is sampled along the
+	 * rotated grid. Particles which are already complex are used as they are, so a
+	 * set of FFTs computed once may be averaged again with new orientations.
+	 *
+	 * Each Fourier voxel of a particle is 'measured' if its intensity is at least
+	 * thresh_sigma times the mean intensity at that radius, as in TomoAverager,
+	 * and, when maxtilt is set, if it lies within the tilt range (as mask.wedgefill).
+	 * Unmeasured voxels get zero weight. Values and weights are interpolated
+	 * together, so the average at each voxel is the weighted mean of the measured
+	 * data which fell near it.
+	 *
+	 * The particles of each add_images() call are split into at most NBUF contiguous
+	 * ranges, each summed in order into its own buffer by one thread, and finish() adds
+	 * the buffers in order. The split doesn't depend on the thread count, so neither
+	 * does the result.
+	 *
+	 * Typical usage:
+	 @code
+	 *	SubtomoAverager avg;
+	 *	avg.set_maxtilt(60.0f);
+	 *	avg.add_images(ptcls,xforms);
+	 *	EMData *weights = new EMData();
+	 *	EMData *result = avg.finish(weights);
+	 @endcode
+	 */
+	class SubtomoAverager
+	{
+	  public:
+		SubtomoAverager();
+		~SubtomoAverager();
+
+		/** @param t Fourier voxels with intensity below t times the mean intensity at their radius
+		 * are treated as missing. <=0 disables the test.
+		 */
+		void set_thresh_sigma(float t) { thresh_sigma = t; }
+
+		/** @param t maximum tilt angle in degrees, for a tilt axis along Y. >=90 disables the test.
+		 */
+		void set_maxtilt(float t) { maxtilt = t; }
+
+		/** @param n number of threads, 0 for Parallel::get_threads() */
+		void set_threads(int n) { nthreads = n; }
+
+		/** Add one particle, see add_images() */
+		void add_image(EMData *image, const Transform &xform, float weight=1.0f);
+
+		/** Add particles to the average. Each particle contributes as if it had been
+		 * transformed in real space by the xform processor with its transform.
+		 * @param images cubic volumes with an even edge, or their FFTs. NULL entries are skipped.
+		 * @param xforms one transform per image. Scaling isn't supported.
+		 * @param weights per image weights, empty for 1.0
+		 * @exception ImageDimensionException if the images aren't even cubes of the same size
+		 * @exception InvalidParameterException for mismatched lists or a scaled transform
+		 */
+		void add_images(const vector<EMData *> &images, const vector<Transform> &xforms,
+						const vector<float> &weights=vector<float>());
+
+		/** @return the number of particles added since the last finish() */
+		int get_count() const { return nimg; }
+
+		/** Normalize the average and return it in real space. The averager is then
+		 * empty, ready for a new set of particles.
+		 * @param weights if not NULL, receives the summed weight at each Fourier voxel, as
+		 * a real (n/2+1) x n x n image with the same layout as the complex average
+		 * @return the average, or NULL if no particles were added. The caller owns it.
+		 * The average has "ptcl_repr", the number of particles, and "mean_coverage",
+		 * the mean fraction of each particle's Fourier voxels which were measured.
+		 */
+		EMData *finish(EMData *weights=0);
+
+	  private:
+		class AddTask;
+
+		/// number of partial sums, which bounds both the memory and the threads used
+		enum { NBUF = 8 };
+
+		/** Interpolate one particle FFT onto the rotated grid and add it to acc.
+		 * @return the fraction of the particle's voxels which were measured
+		 */
+		double insert(EMData *fft, const Transform &xform, float weight, float *acc) const;
+
+		void clear();
+
+		int size;
+		float thresh_sigma;
+		float maxtilt;
+		int nthreads;
+		int nimg;
+		float apix[3];
+
+		/// partial sums, 3 floats (real, imaginary, weight) per Fourier voxel
+		vector< vector<float> > accum;
+		vector<double> coverage;
+
+		// not copyable, the buffers may be large
+		SubtomoAverager(const SubtomoAverager &);
+		SubtomoAverager &operator=(const SubtomoAverager &);
+	};
+}
+
+#endif	//eman_sptavg_h__
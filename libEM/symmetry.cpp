@@ -34,6 +34,9 @@
 #include "vec3.h"
 #include "exception.h"
 #include "util.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cfloat>
 
 using namespace EMAN;
 
@@ -184,6 +187,30 @@ vector<Transform> Symmetry3D::gen_orientations(const string& generatorname, cons
 	return ret;
 }
 
+TransformBatch Symmetry3D::gen_orientations_batch(const string& generatorname, const Dict& parms)
+{
+	ENTERFUNC;
+	OrientationGenerator *g = Factory < OrientationGenerator >::get(Util::str_to_lower(generatorname), parms);
+	TransformBatch ret;
+	try {
+		ret = g->gen_orientations_batch(this);
+	}
+	catch (...) {
+		delete g;
+		throw;
+	}
+	delete g;
+
+	EXITFUNC;
+
+	return ret;
+}
+
+TransformBatch OrientationGenerator::gen_orientations_batch(const Symmetry3D* const sym) const
+{
+	return TransformBatch(gen_orientations(sym));
+}
+
 void OrientationGenerator::get_az_max(const Symmetry3D* const sym, const float& altmax, const bool inc_mirror, const float& alt_iterator,const float& h,bool& d_odd_mirror_flag, float& azmax_adjusted) const
 {
 
@@ -298,6 +325,20 @@ bool OrientationGenerator::add_orientation(vector<Transform>& v, const float& az
 	return true;
 }
 
+bool OrientationGenerator::add_orientation(TransformBatch& v, const float& az, const float& alt) const
+{
+	bool randphi = params.set_default("random_phi",false);
+	float phi = 0.0f;
+	if (randphi) phi = Util::get_frand(0.0f,359.99999f);
+	float phitoo = params.set_default("phitoo",0.0f);
+	if ( phitoo < 0 ) throw InvalidValueException(phitoo, "Error, if you specify phitoo is must be positive");
+	v.push_back_eman(az,alt,phi);
+	if ( phitoo != 0 ) {
+		for ( float p = phitoo; p <= 360.0f-phitoo; p+= phitoo ) v.push_back_eman(az,alt,fmod(phi+p,360));
+	}
+	return true;
+}
+
 float EmanOrientationGenerator::get_az_delta(const float& delta,const float& altitude, const int) const
 {
 	// convert altitude into radians
@@ -387,6 +428,11 @@ int EmanOrientationGenerator::get_orientations_tally(const Symmetry3D* const sym
 }
 
 vector<Transform> EmanOrientationGenerator::gen_orientations(const Symmetry3D* const sym) const
+{
+	return gen_orientations_batch(sym).to_vector();
+}
+
+TransformBatch EmanOrientationGenerator::gen_orientations_batch(const Symmetry3D* const sym) const
 {
 	float delta = params.set_default("delta", 0.0f);
 	int n = params.set_default("n", 0);
@@ -423,7 +469,7 @@ vector<Transform> EmanOrientationGenerator::gen_orientations(const Symmetry3D* c
 	// #to the altmax... the object is a h symmetry then it knows its alt_min...
 	if (sym->is_h_sym()) alt_iterator = delimiters["alt_min"];
 
-	vector<Transform> ret;
+	TransformBatch ret;
 	while ( alt_iterator <= altmax ) {
 		float h = get_az_delta(delta,alt_iterator, sym->get_max_csym() );
 
@@ -492,22 +538,21 @@ vector<Transform> EmanOrientationGenerator::gen_orientations(const Symmetry3D* c
 	// With breaksym, values are generated for one asymmetric unit as if symmetry were imposed, then
 	// the symmetry equivalent points are generated. Used with asymmetric structures with pseudosymmetry
 	if (breaksym) {
-		// no iterators here since we are making the list longer as we go
-		int nwithsym=ret.size();	// transforms in one asym unit
 		int nsym=sym->get_nsym();	// number of asymmetric units to generate
+		TransformBatch asym(ret);	// transforms in one asym unit
 		for (int j=1; j<nsym; j++) {
-			Transform t=sym->get_sym(j);
-			for (int i=0; i<nwithsym; i++) {
-				ret.push_back(ret[i]*t);		// add the symmetry modified transform to the end of the vector
-			}
+			TransformBatch symmed(asym);
+			symmed.right_multiply(sym->get_sym(j));		// add the symmetry modified transforms to the end
+			ret.append(symmed);
 		}
 		if (breaksymreal) return ret;
 		// Now we get rid of anything in the bottom half of the unit sphere if requested
 		if (!inc_mirror_real) {
-			vector<Transform> ret2;
-			for (vector<Transform>::iterator t=ret.begin(); t!=ret.end(); ++t) {
-				if ((*t)[2][2]>=0) ret2.push_back(*t); 
-//				printf("%f\n",t[2][2]);
+			TransformBatch ret2;
+			ret2.reserve(ret.size());
+			const float *m22 = ret.element(2,2);
+			for (size_t i=0; i<ret.size(); i++) {
+				if (m22[i]>=0) ret2.push_back(ret.get(i));
 			}
 			return ret2;
 		}
@@ -959,7 +1004,7 @@ vector<Vec3f> OptimumOrientationGenerator::optimize_distances(const vector<Trans
 
 
 
-Symmetry3D::Symmetry3D() : cached_au_planes(0),cache_size(0),num_triangles(0),au_sym_triangles() {}
+Symmetry3D::Symmetry3D() : cached_au_planes(0),cache_size(0),num_triangles(0),au_sym_triangles(),cached_syms() {}
 Symmetry3D::~Symmetry3D() {
 	if (cached_au_planes != 0 ) {
 		delete_au_planes();
@@ -984,20 +1029,70 @@ Transform Symmetry3D::reduce(const Transform& t, int n) const
 	}
 
 	// Get the symmetry operation corresponding to the intersection asymmetric unit
-	Transform nt = get_sym(soln);
+	Transform nt = cached_syms[soln];
 	// Transpose it (invert it)
 	nt.invert();
 	// Now we can transform the argument orientation into the default asymmetric unit
 	nt  = t*nt;
 	// Now that we're at the default asymmetric unit, we can map into the requested asymmunit by doing this
 	if ( n != 0 ) {
-		nt = nt*get_sym(n);
+		nt = nt*cached_sym(n);
 	}
 	// Done!
 	return nt;
 
 }
 
+TransformBatch Symmetry3D::reduce_batch(const TransformBatch& t, int n) const
+{
+	vector<int> asym;
+	return reduce_batch(t,asym,n);
+}
+
+TransformBatch Symmetry3D::reduce_batch(const TransformBatch& t, vector<int>& asym, int n) const
+{
+	size_t num = t.size();
+	asym = in_which_asym_unit_batch(t);
+	if (num == 0) return TransformBatch();
+
+	int nsym = get_nsym();
+	vector<Transform> syminv(nsym);
+	for (int i = 0; i < nsym; i++) syminv[i] = cached_syms[i].inverse();
+
+	// every orientation is multiplied by the inverse of the operator for its asymmetric unit
+	TransformBatch rhs(num);
+	for (size_t i = 0; i < num; i++) {
+		if (asym[i] == -1) cout << "error, no solution found!" << endl;
+		else rhs.set(i,syminv[asym[i]]);
+	}
+
+	TransformBatch ret;
+	TransformBatch::multiply(t,rhs,ret);
+	if ( n != 0 ) ret.right_multiply(cached_sym(n));
+
+	// orientations without a solution are returned unchanged, as reduce does
+	for (size_t i = 0; i < num; i++) {
+		if (asym[i] == -1) ret.set(i,t.get(i));
+	}
+
+	return ret;
+}
+
+vector<int> Symmetry3D::in_which_asym_unit_batch(const TransformBatch& t) const
+{
+	size_t num = t.size();
+	vector<int> ret(num);
+	if (num == 0) return ret;
+	if (au_lookup_start.empty()) cache_au_lookup();
+
+	// As in_which_asym_unit, the direction is found by applying the inverse to z
+	vector<float> x(num), y(num), z(num);
+	t.inverse().transform(0,0,1,&x[0],&y[0],&z[0]);
+
+	for (size_t i = 0; i < num; i++) ret[i] = lookup_asym_unit(x[i],y[i],z[i]);
+	return ret;
+}
+
 int Symmetry3D::in_which_asym_unit(const Transform& t3d) const
 {
 	// Here it is assumed that final destination of the orientation (as encapsulated in the t3d object) is
@@ -1017,8 +1112,18 @@ int Symmetry3D::in_which_asym_unit(const Transform& t3d) const
 }
 
 
+const Transform& Symmetry3D::cached_sym(int n) const
+{
+	if (cached_au_planes == 0) cache_au_planes();
+	int nsym = (int)cached_syms.size();
+	n %= nsym;
+	if (n < 0) n += nsym;
+	return cached_syms[n];
+}
+
 void Symmetry3D::cache_au_planes() const {
 	if (cached_au_planes == 0 ) {
+		cached_syms = get_syms();
 		vector< vector<Vec3f> > au_triangles = get_asym_unit_triangles(true);
 		num_triangles = au_triangles.size();
 		cache_size = get_nsym()*au_triangles.size();
@@ -1042,7 +1147,7 @@ void Symmetry3D::cache_au_planes() const {
 					for (vector<Vec3f>::iterator iit = points.begin(); iit != points.end(); ++iit ) {
 						// Rotate the points in the triangle so that the triangle occupies the
 						// space of the current asymmetric unit
-						*iit = (*iit)*get_sym(i);
+						*iit = (*iit)*cached_syms[i];
 					}
 				}
 
@@ -1152,6 +1257,190 @@ int Symmetry3D::point_in_which_asym_unit(const Vec3f& p) const
 
 	return -1;
 }
+namespace {
+	const int AU_TRI_STRIDE = 17;
+	/// Cells along each edge of a face of the cube map
+	const int AU_LOOKUP_N = 16;
+	/// Barycentric margin used to bound each triangle, well beyond the tolerance of point_in_which_asym_unit
+	const double AU_LOOKUP_EPS = 0.05;
+
+	inline void normalize3(double v[3])
+	{
+		double l = sqrt(v[0]*v[0]+v[1]*v[1]+v[2]*v[2]);
+		if (l > 0) { v[0] /= l; v[1] /= l; v[2] /= l; }
+	}
+
+	/// The direction through face coordinates (a,b) in [-1,1] of a face of the cube map
+	void cube_dir(int face, double a, double b, double v[3])
+	{
+		int axis = face/2;
+		v[axis] = face%2 ? -1.0 : 1.0;
+		v[(axis+1)%3] = a;
+		v[(axis+2)%3] = b;
+		normalize3(v);
+	}
+
+	/// The cube map cell containing the direction (x,y,z), -1 if it has none (zero or non-finite)
+	inline int cube_cell(float x, float y, float z)
+	{
+		float ax = fabs(x), ay = fabs(y), az = fabs(z);
+		int axis;
+		float m, a, b;
+		if (ax >= ay && ax >= az) { axis = 0; m = x; a = y; b = z; }
+		else if (ay >= az) { axis = 1; m = y; a = z; b = x; }
+		else { axis = 2; m = z; a = x; b = y; }
+		float am = fabs(m);
+		if (!(am > 0) || am > FLT_MAX || a != a || b != b) return -1;
+
+		int i = (int)((a/am + 1.0f)*0.5f*AU_LOOKUP_N);
+		int j = (int)((b/am + 1.0f)*0.5f*AU_LOOKUP_N);
+		if (i < 0) i = 0;
+		if (i >= AU_LOOKUP_N) i = AU_LOOKUP_N-1;
+		if (j < 0) j = 0;
+		if (j >= AU_LOOKUP_N) j = AU_LOOKUP_N-1;
+		int face = axis*2 + (m < 0 ? 1 : 0);
+		return (face*AU_LOOKUP_N + i)*AU_LOOKUP_N + j;
+	}
+}
+
+void Symmetry3D::cache_au_lookup() const
+{
+	if (cached_au_planes == 0) cache_au_planes();
+
+	// The terms point_in_which_asym_unit computes for each triangle before it looks at the point
+	int ntri = cache_size;
+	au_lookup_tri.resize((size_t)ntri*AU_TRI_STRIDE);
+	for (int k = 0; k < ntri; k++) {
+		const vector<Vec3f>& points = au_sym_triangles[k];
+		Vec3f v = points[2]-points[0];
+		Vec3f u = points[1]-points[0];
+		float *f = &au_lookup_tri[(size_t)k*AU_TRI_STRIDE];
+		for (int i = 0; i < 4; i++) f[i] = cached_au_planes[k][i];
+		for (int i = 0; i < 3; i++) {
+			f[4+i] = points[0][i];
+			f[7+i] = u[i];
+			f[10+i] = v[i];
+		}
+		f[13] = u.dot(u);
+		f[14] = u.dot(v);
+		f[15] = v.dot(v);
+		f[16] = 1.0f/(f[14]*f[14] - f[13]*f[15]);
+	}
+
+	// Bound each triangle, grown by AU_LOOKUP_EPS, by a cone around its center. The directions reaching
+	// a planar triangle form a convex cone, so the cone holding its corners holds all of it.
+	vector<double> tcen(3*ntri);
+	vector<double> trad(ntri);
+	vector<bool> tall(ntri,false);
+	for (int k = 0; k < ntri; k++) {
+		const float *f = &au_lookup_tri[(size_t)k*AU_TRI_STRIDE];
+		const double st[3][2] = { {-AU_LOOKUP_EPS,-AU_LOOKUP_EPS}, {1+2*AU_LOOKUP_EPS,-AU_LOOKUP_EPS}, {-AU_LOOKUP_EPS,1+2*AU_LOOKUP_EPS} };
+		double corner[3][3];
+		double *c = &tcen[3*k];
+		c[0] = c[1] = c[2] = 0;
+		for (int n = 0; n < 3; n++) {
+			for (int i = 0; i < 3; i++) corner[n][i] = f[4+i] + st[n][0]*f[7+i] + st[n][1]*f[10+i];
+			normalize3(corner[n]);
+			for (int i = 0; i < 3; i++) c[i] += corner[n][i];
+		}
+		normalize3(c);
+		double mindot = 1.0;
+		for (int n = 0; n < 3; n++) mindot = std::min(mindot, c[0]*corner[n][0]+c[1]*corner[n][1]+c[2]*corner[n][2]);
+
+		// a plane through (or nearly through) the origin, or a very large triangle, is tested everywhere
+		double nlen = sqrt((double)f[0]*f[0]+(double)f[1]*f[1]+(double)f[2]*f[2]);
+		double size = sqrt(std::max((double)f[13],(double)f[15]));
+		if (nlen == 0 || fabs(f[3])/nlen < 1.0e-3*size || mindot < 0.2) tall[k] = true;
+		else trad[k] = acos(mindot);
+	}
+
+	int ncell = 6*AU_LOOKUP_N*AU_LOOKUP_N;
+	au_lookup_start.resize(ncell+1);
+	au_lookup_list.clear();
+	double step = 2.0/AU_LOOKUP_N;
+	for (int face = 0; face < 6; face++) {
+		for (int i = 0; i < AU_LOOKUP_N; i++) {
+			for (int j = 0; j < AU_LOOKUP_N; j++) {
+				int cell = (face*AU_LOOKUP_N + i)*AU_LOOKUP_N + j;
+				au_lookup_start[cell] = au_lookup_list.size();
+
+				double a0 = -1.0 + i*step, b0 = -1.0 + j*step;
+				double cen[3], corner[3];
+				cube_dir(face, a0+step/2, b0+step/2, cen);
+				double crad = 0;
+				for (int n = 0; n < 4; n++) {
+					cube_dir(face, a0+(n&1)*step, b0+(n>>1)*step, corner);
+					crad = std::max(crad, acos(std::min(1.0, cen[0]*corner[0]+cen[1]*corner[1]+cen[2]*corner[2])));
+				}
+
+				// candidates stay in triangle order, so the first hit is the one a full search finds
+				for (int k = 0; k < ntri; k++) {
+					const double *c = &tcen[3*k];
+					double cdot = std::max(-1.0, std::min(1.0, cen[0]*c[0]+cen[1]*c[1]+cen[2]*c[2]));
+					if (tall[k] || acos(cdot) <= trad[k] + crad + 1.0e-3) au_lookup_list.push_back(k);
+				}
+			}
+		}
+	}
+	au_lookup_start[ncell] = au_lookup_list.size();
+}
+
+int Symmetry3D::lookup_asym_unit(float x, float y, float z) const
+{
+	int cell = cube_cell(x,y,z);
+	if (cell < 0) return point_in_which_asym_unit(Vec3f(x,y,z));
+
+	// exactly the arithmetic of point_in_which_asym_unit, on the candidates for this cell
+	float epsNow=0.01f;
+	for (int c = au_lookup_start[cell]; c < au_lookup_start[cell+1]; c++) {
+		int k = au_lookup_list[c];
+		const float *f = &au_lookup_tri[(size_t)k*AU_TRI_STRIDE];
+
+		float scale = f[0]*x+f[1]*y+f[2]*z;
+		if ( scale != 0 )
+			scale = -f[3]/scale;
+		else continue;
+		if (scale <= 0) continue;
+
+		float wx = x*scale - f[4];
+		float wy = y*scale - f[5];
+		float wz = z*scale - f[6];
+
+		float udotu = f[13];
+		float udotv = f[14];
+		float udotw = f[7]*wx + f[8]*wy + f[9]*wz;
+		float vdotv = f[15];
+		float vdotw = f[10]*wx + f[11]*wy + f[12]*wz;
+
+		float d = f[16];
+		float s = udotv*vdotw - vdotv*udotw;
+		s *= d;
+
+		float t = udotv*udotw - udotu*vdotw;
+		t *= d;
+
+		if (fabs(s) < Transform::ERR_LIMIT ) s = 0;
+		if (fabs(t) < Transform::ERR_LIMIT ) t = 0;
+
+		if ( fabs((fabs(s)-1.0)) < Transform::ERR_LIMIT ){
+			if (s>0)
+				s = 1;
+			else
+				s = -1;
+		}
+		if ( fabs((fabs(t)-1.0)) < Transform::ERR_LIMIT ){
+			if (t>0)
+				t = 1;
+			else
+				t = -1;
+		}
+
+		if ( s >= -epsNow && t >= -epsNow && (s+t) <= 1+epsNow ) return k/num_triangles;
+	}
+
+	return -1;
+}
+
 vector<Transform> Symmetry3D::get_touching_au_transforms(bool inc_mirror) const
 {
 	vector<Transform>  ret;
@@ -1237,12 +1526,51 @@ vector<Transform> Symmetry3D::get_syms() const
 	return ret;
 }
 
+TransformBatch Symmetry3D::get_syms_batch() const
+{
+	if (cached_au_planes == 0) cache_au_planes();
+	return TransformBatch(cached_syms);
+}
+
 vector<Transform> Symmetry3D::get_symmetries(const string& symmetry)
 {
-	Symmetry3D* sym = Factory<Symmetry3D>::get(Util::str_to_lower(symmetry));
-	vector<Transform> ret = sym->get_syms();
+	return get_cached_symmetries(symmetry);
+}
+
+namespace {
+	pthread_mutex_t sym_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+	/// entries are never removed, so references handed out stay valid
+	map<string, vector<Transform>* > sym_cache;
+}
+
+const vector<Transform>& Symmetry3D::get_cached_symmetries(const string& symmetry)
+{
+	string name = Util::str_to_lower(symmetry);
+
+	pthread_mutex_lock(&sym_cache_lock);
+	map<string, vector<Transform>* >::const_iterator it = sym_cache.find(name);
+	if (it != sym_cache.end()) {
+		const vector<Transform>& ret = *it->second;
+		pthread_mutex_unlock(&sym_cache_lock);
+		return ret;
+	}
+	pthread_mutex_unlock(&sym_cache_lock);
+
+	// built outside the lock, Factory may throw for an unknown name
+	Symmetry3D* sym = Factory<Symmetry3D>::get(name);
+	vector<Transform>* syms = new vector<Transform>(sym->get_syms());
 	delete sym;
-	return ret;
+
+	pthread_mutex_lock(&sym_cache_lock);
+	it = sym_cache.find(name);
+	if (it != sym_cache.end()) {
+		// another thread got there first
+		delete syms;
+		syms = it->second;
+	}
+	else sym_cache[name] = syms;
+	pthread_mutex_unlock(&sym_cache_lock);
+	return *syms;
 }
 
 // C Symmetry stuff
@@ -2069,3 +2397,263 @@ vector<Vec3f> TetrahedralSym::get_asym_unit_points(bool inc_mirror) const
 
 
 
+
+namespace {
+	/// Ranges of at most this many points are searched directly rather than split
+	const int KD_LEAF = 8;
+
+	/// The unit projection direction of an orientation, the direction z comes from
+	inline void proj_dir(const Transform& t, float d[3])
+	{
+		Vec3f v = t.get_matrix3_row(2);
+		float l = v.length();
+		if (l > 0) v /= l;
+		d[0] = v[0]; d[1] = v[1]; d[2] = v[2];
+	}
+
+	inline float dist2(const float *a, const float *b)
+	{
+		float dx = a[0]-b[0], dy = a[1]-b[1], dz = a[2]-b[2];
+		return dx*dx + dy*dy + dz*dz;
+	}
+
+	/// Degrees between two unit vectors from their squared chord length
+	inline float chord2_to_angle(float d2)
+	{
+		float h = sqrt(d2)/2.0f;
+		if (h > 1.0f) h = 1.0f;
+		return (float)(2.0*asin(h)*EMConsts::rad2deg);
+	}
+
+	struct AxisLess
+	{
+		const vector<float>& p;
+		int a;
+		AxisLess(const vector<float>& p_, int a_) : p(p_), a(a_) {}
+		bool operator()(int i, int j) const { return p[3*i+a] < p[3*j+a]; }
+	};
+
+	/** Order point indices [lo,hi) into an implicit k-d tree. Each range is split at its middle point,
+	 * along the axis of greatest spread, with smaller points before and larger after. */
+	void build_kd(vector<int>& order, const vector<float>& p, vector<unsigned char>& axis, int lo, int hi)
+	{
+		if (hi - lo <= KD_LEAF) return;
+
+		float mn[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, mx[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (int i = lo; i < hi; i++) {
+			for (int a = 0; a < 3; a++) {
+				mn[a] = std::min(mn[a], p[3*order[i]+a]);
+				mx[a] = std::max(mx[a], p[3*order[i]+a]);
+			}
+		}
+		int a = 0;
+		if (mx[1]-mn[1] > mx[a]-mn[a]) a = 1;
+		if (mx[2]-mn[2] > mx[a]-mn[a]) a = 2;
+
+		int mid = (lo + hi)/2;
+		std::nth_element(order.begin()+lo, order.begin()+mid, order.begin()+hi, AxisLess(p,a));
+		axis[mid] = (unsigned char)a;
+		build_kd(order, p, axis, lo, mid);
+		build_kd(order, p, axis, mid+1, hi);
+	}
+
+	/// OrientationIndex::nearest_batch, a range of queries per call
+	class OrientationIndexTask : public ParallelTask
+	{
+	  public:
+		OrientationIndexTask(const OrientationIndex& index_, const vector<Transform>& t_, int k_, vector<int>& out_)
+			: index(index_), t(t_), k(k_), out(out_) {}
+
+		virtual void run(size_t begin, size_t end, int)
+		{
+			for (size_t i = begin; i < end; i++) {
+				vector<int> r = index.nearest(t[i], k);
+				std::copy(r.begin(), r.end(), out.begin() + i*k);
+			}
+		}
+
+	  private:
+		const OrientationIndex& index;
+		const vector<Transform>& t;
+		int k;
+		vector<int>& out;
+	};
+}
+
+struct OrientationIndex::Best
+{
+	size_t k;
+	vector<pair<float,int> > items;		// (squared chord, reference), unordered
+	float worst;						// the largest distance kept, once k are kept
+
+	Best(int k_) : k(k_), worst(FLT_MAX) { items.reserve(k); }
+
+	void add(int r, float d2)
+	{
+		if (items.size() == k && d2 >= worst) return;
+		for (size_t i = 0; i < items.size(); i++) {
+			if (items[i].second == r) {
+				// another symmetry copy of a reference already kept
+				if (d2 < items[i].first) {
+					items[i].first = d2;
+					update_worst();
+				}
+				return;
+			}
+		}
+		if (items.size() < k) items.push_back(pair<float,int>(d2,r));
+		else {
+			for (size_t i = 0; i < items.size(); i++) {
+				if (items[i].first == worst) {
+					items[i] = pair<float,int>(d2,r);
+					break;
+				}
+			}
+		}
+		update_worst();
+	}
+
+	void update_worst()
+	{
+		if (items.size() < k) return;
+		worst = items[0].first;
+		for (size_t i = 1; i < items.size(); i++) worst = std::max(worst, items[i].first);
+	}
+};
+
+OrientationIndex::OrientationIndex(const vector<Transform>& refs, const string& sym)
+	: nrefs((int)refs.size()), syms(Symmetry3D::get_cached_symmetries(sym))
+{
+	int nsym = (int)syms.size();
+	int n = nrefs*nsym;
+	vector<float> p(3*(size_t)n);
+	vector<int> r(n);
+	for (int i = 0; i < nrefs; i++) {
+		for (int s = 0; s < nsym; s++) {
+			int j = i*nsym + s;
+			proj_dir(refs[i]*syms[s], &p[3*(size_t)j]);
+			r[j] = i;
+		}
+	}
+
+	vector<int> order(n);
+	for (int i = 0; i < n; i++) order[i] = i;
+	axis.resize(n);
+	build_kd(order, p, axis, 0, n);
+
+	pts.resize(3*(size_t)n);
+	ref.resize(n);
+	for (int i = 0; i < n; i++) {
+		std::copy(&p[3*(size_t)order[i]], &p[3*(size_t)order[i]]+3, &pts[3*(size_t)i]);
+		ref[i] = r[order[i]];
+	}
+}
+
+void OrientationIndex::search_nearest(int lo, int hi, const float *q, Best & best) const
+{
+	if (hi - lo <= KD_LEAF) {
+		for (int i = lo; i < hi; i++) best.add(ref[i], dist2(q, &pts[3*(size_t)i]));
+		return;
+	}
+
+	int mid = (lo + hi)/2;
+	best.add(ref[mid], dist2(q, &pts[3*(size_t)mid]));
+	float diff = q[axis[mid]] - pts[3*(size_t)mid + axis[mid]];
+	if (diff < 0) {
+		search_nearest(lo, mid, q, best);
+		if (diff*diff < best.worst) search_nearest(mid+1, hi, q, best);
+	}
+	else {
+		search_nearest(mid+1, hi, q, best);
+		if (diff*diff < best.worst) search_nearest(lo, mid, q, best);
+	}
+}
+
+void OrientationIndex::search_within(int lo, int hi, const float *q, float maxd2, vector<pair<float,int> > & found) const
+{
+	if (hi - lo <= KD_LEAF) {
+		for (int i = lo; i < hi; i++) {
+			float d2 = dist2(q, &pts[3*(size_t)i]);
+			if (d2 <= maxd2) found.push_back(pair<float,int>(d2,ref[i]));
+		}
+		return;
+	}
+
+	int mid = (lo + hi)/2;
+	float d2 = dist2(q, &pts[3*(size_t)mid]);
+	if (d2 <= maxd2) found.push_back(pair<float,int>(d2,ref[mid]));
+	float diff = q[axis[mid]] - pts[3*(size_t)mid + axis[mid]];
+	if (diff < 0 || diff*diff <= maxd2) search_within(lo, mid, q, maxd2, found);
+	if (diff >= 0 || diff*diff <= maxd2) search_within(mid+1, hi, q, maxd2, found);
+}
+
+void OrientationIndex::nearest(const Transform& t, int k, vector<int>& idx, vector<float>& ang) const
+{
+	idx.clear();
+	ang.clear();
+	if (k <= 0 || nrefs == 0) return;
+
+	float q[3];
+	proj_dir(t, q);
+	Best best(std::min(k, nrefs));
+	search_nearest(0, (int)ref.size(), q, best);
+
+	std::sort(best.items.begin(), best.items.end());
+	for (size_t i = 0; i < best.items.size(); i++) {
+		idx.push_back(best.items[i].second);
+		ang.push_back(chord2_to_angle(best.items[i].first));
+	}
+}
+
+vector<int> OrientationIndex::nearest(const Transform& t, int k) const
+{
+	vector<int> idx;
+	vector<float> ang;
+	nearest(t, k, idx, ang);
+	return idx;
+}
+
+vector<int> OrientationIndex::within(const Transform& t, float maxang) const
+{
+	vector<int> ret;
+	if (maxang < 0 || nrefs == 0) return ret;
+
+	float q[3];
+	proj_dir(t, q);
+	float maxd2 = maxang >= 180.0f ? 4.0f : (float)pow(2.0*sin(maxang/2.0*EMConsts::deg2rad), 2.0);
+	vector<pair<float,int> > found;
+	search_within(0, (int)ref.size(), q, maxd2, found);
+
+	// keep the nearest copy of each reference, then order by distance
+	vector<pair<int,float> > byref(found.size());
+	for (size_t i = 0; i < found.size(); i++) byref[i] = pair<int,float>(found[i].second, found[i].first);
+	std::sort(byref.begin(), byref.end());
+	found.clear();
+	for (size_t i = 0; i < byref.size(); i++) {
+		if (i == 0 || byref[i].first != byref[i-1].first) found.push_back(pair<float,int>(byref[i].second, byref[i].first));
+	}
+	std::sort(found.begin(), found.end());
+	for (size_t i = 0; i < found.size(); i++) ret.push_back(found[i].second);
+	return ret;
+}
+
+vector<int> OrientationIndex::nearest_batch(const vector<Transform>& t, int k, int nthreads) const
+{
+	if (k <= 0) return vector<int>();
+	vector<int> ret(t.size()*k, -1);
+	OrientationIndexTask task(*this, t, k, ret);
+	Parallel::run(task, t.size(), 256, nthreads);
+	return ret;
+}
+
+float OrientationIndex::angle(const Transform& t1, const Transform& t2) const
+{
+	float d1[3], d2[3];
+	proj_dir(t1, d1);
+	float best = FLT_MAX;
+	for (size_t s = 0; s < syms.size(); s++) {
+		proj_dir(t2*syms[s], d2);
+		best = std::min(best, dist2(d1, d2));
+	}
+	return chord2_to_angle(best);
+}
@@ -143,6 +143,14 @@ namespace EMAN {
 		 */
 		vector<Transform> gen_orientations(const string& generatorname="eman", const Dict& parms=Dict());
 
+		/** As gen_orientations, but the orientations are returned as a TransformBatch. Generators
+		 * which produce very many orientations build the batch directly.
+		 * @param generatorname the string name of the OrientationGenerator
+		 * @param parms the parameters handed to OrientationGenerator::set_params after initial construction
+		 * @return a set of orientations in the unit sphere
+		 */
+		TransformBatch gen_orientations_batch(const string& generatorname="eman", const Dict& parms=Dict());
+
 		/** A function to be used when generating orientations over portion of the unit sphere
 		 * defined by parameters returned by get_delimiters. In platonic symmetry altitude and azimuth
 		 * alone are not enough to correctly demarcate the asymmetric unit. See the get_delimiters comments.
@@ -164,6 +172,30 @@ namespace EMAN {
 		 */
 		virtual Transform reduce(const Transform& t3d, int n=0) const;
 
+		/** Reduce many orientations at once, giving the same results as calling reduce on each.
+		 * The unit vectors and the symmetry products are computed over the whole batch.
+		 * @param t3d the orientations
+		 * @param n the number of the asymmetric unit to map the orientations into
+		 * @return the reduced orientations
+		 */
+		TransformBatch reduce_batch(const TransformBatch& t3d, int n=0) const;
+
+		/** As reduce_batch, also returning the asymmetric unit each orientation was found in.
+		 * @param t3d the orientations
+		 * @param asym filled with in_which_asym_unit of each orientation, -1 where none was found
+		 * @param n the number of the asymmetric unit to map the orientations into
+		 * @return the reduced orientations
+		 */
+		TransformBatch reduce_batch(const TransformBatch& t3d, vector<int>& asym, int n=0) const;
+
+		/** in_which_asym_unit for every orientation in a batch, with identical results.
+		 * Rather than testing each direction against every asymmetric unit triangle, only the
+		 * triangles which can reach the direction's cell on a cube map of the sphere are tested.
+		 * @param t3d the orientations
+		 * @return the asymmetric unit number of each orientation, -1 where none was found
+		 */
+		vector<int> in_which_asym_unit_batch(const TransformBatch& t3d) const;
+
 
 		/** A function that will determine in which asymmetric unit a given orientation resides
 		 * The asymmetric unit 'number' will depend entirely on the order in which different symmetry operations are return by the
@@ -200,7 +232,19 @@ namespace EMAN {
 		virtual vector<Transform> get_touching_au_transforms(bool inc_mirror = true) const;
 
 		virtual vector<Transform> get_syms() const;
+
+		/** @return all of the symmetry operators, get_sym(0) ... get_sym(get_nsym()-1) */
+		TransformBatch get_syms_batch() const;
 		static vector<Transform> get_symmetries(const string& symmetry);
+
+		/** The operators of a named symmetry, as get_symmetries returns them, from a process-wide cache.
+		 * Each symmetry is built once, on first use, and the reference stays valid for the life of the
+		 * process, so per-particle code can use this instead of constructing the operators every time.
+		 * Safe to call from several threads.
+		 * @param symmetry the symmetry name, eg "c4" or "icos"
+		 * @return the operators, get_sym(0) ... get_sym(get_nsym()-1)
+		 */
+		static const vector<Transform>& get_cached_symmetries(const string& symmetry);
 	protected:
 		/// The asymmetric unit planes are cached to provide a great speed up
 		/// the point_in_which_asym_unit function, which is called by reduce and by in_which_asym_unit
@@ -219,6 +263,24 @@ namespace EMAN {
 		/** Clear the asymmetric unit planes cache
 		*/
 		void delete_au_planes();
+
+		/// The operators get_sym(0) ... get_sym(get_nsym()-1), filled by cache_au_planes so reduce needn't rebuild them
+		mutable vector<Transform> cached_syms;
+
+		/** Cached operator n, with n wrapped into [0,nsym) the way get_sym() accepts any n */
+		const Transform& cached_sym(int n) const;
+
+		/// Plane, first corner and edge terms of each cached triangle, a fixed number of floats apiece
+		mutable vector<float> au_lookup_tri;
+		/// Cube map cell c lists its candidate triangles in au_lookup_list[au_lookup_start[c]] ... [au_lookup_start[c+1]-1]
+		mutable vector<int> au_lookup_start;
+		mutable vector<int> au_lookup_list;
+		/** Establish the triangle lookup used by in_which_asym_unit_batch
+		*/
+		void cache_au_lookup() const;
+		/** point_in_which_asym_unit using the triangle lookup
+		*/
+		int lookup_asym_unit(float x, float y, float z) const;
 	private:
 		/** Disallow copy construction */
 		Symmetry3D(const Symmetry3D&);
@@ -1008,6 +1070,13 @@ class Icosahedral2Sym : public PlatonicSym
 		 */
 		virtual vector<Transform> gen_orientations(const Symmetry3D* const sym) const  = 0;
 
+		/** generate orientations as a TransformBatch. The default converts the result of
+		 * gen_orientations, generators which produce large sets should override it.
+		 * @param sym the symmetry which defines the interesting asymmetric unit
+		 * @return the generated set of orientations
+		 */
+		virtual TransformBatch gen_orientations_batch(const Symmetry3D* const sym) const;
+
 		virtual TypeDict get_param_types() const
 		{
 			TypeDict d;
@@ -1034,6 +1103,10 @@ class Icosahedral2Sym : public PlatonicSym
 		 */
 		bool add_orientation(vector<Transform>& v, const float& az, const float& alt) const;
 
+		/** As add_orientation, but appends to a TransformBatch without going through a Dict
+		 */
+		bool add_orientation(TransformBatch& v, const float& az, const float& alt) const;
+
 
 
 		/** This function gets the optimal value of the delta (or angular spacing) of the orientations
@@ -1128,6 +1201,13 @@ class EmanOrientationGenerator : public OrientationGenerator
 		 */
 		virtual vector<Transform> gen_orientations(const Symmetry3D* const sym) const;
 
+		/** generate orientations given some symmetry type, as a TransformBatch. With breaksym
+		 * the symmetry expansion is done over the whole batch.
+		 * @param sym the symmetry which defines the interesting asymmetric unit
+		 * @return the set of evenly distributed orientations
+		 */
+		virtual TransformBatch gen_orientations_batch(const Symmetry3D* const sym) const;
+
 		/// The name of this class - used to access it from factories etc. Should be "icos"
 		static const string NAME;
 	private:
@@ -1506,6 +1586,81 @@ class OptimumOrientationGenerator : public OrientationGenerator
 	void dump_orientgens();
 	/// Can be used to get useful information about the OrientationGenerator factory
 	map<string, vector<string> > dump_orientgens_list();
+
+	/** OrientationIndex finds the reference orientations nearest to a query orientation, eg - the
+	 * projections from OrientationGenerator::gen_orientations nearest to a particle, without comparing
+	 * the query to every reference. Orientations are compared by the angle between their projection
+	 * directions, so the in-plane rotation is ignored. With a symmetry, each reference stands for all
+	 * of its symmetry related orientations and the smallest angle among them is used.
+	 *
+	 * The projection directions of the references, expanded by the symmetry, are kept in a k-d tree.
+	 * Queries are exact, and may be made from several threads at once.
+	 */
+	class OrientationIndex
+	{
+	public:
+		/** @param refs the reference orientations
+		 * @param sym the symmetry relating equivalent orientations, "c1" for none
+		 */
+		OrientationIndex(const vector<Transform>& refs, const string& sym = "c1");
+
+		/** @return the number of references */
+		int get_nrefs() const { return nrefs; }
+
+		/** Find the nearest references to an orientation.
+		 * @param t the query orientation
+		 * @param k the number of references to find
+		 * @return the indices of up to k references, nearest first
+		 */
+		vector<int> nearest(const Transform& t, int k) const;
+
+		/** Find the nearest references to an orientation, with their distances.
+		 * @param t the query orientation
+		 * @param k the number of references to find
+		 * @param idx filled with the indices of up to k references, nearest first
+		 * @param ang filled with the angle in degrees to each of them
+		 */
+		void nearest(const Transform& t, int k, vector<int>& idx, vector<float>& ang) const;
+
+		/** Find every reference within an angle of an orientation.
+		 * @param t the query orientation
+		 * @param maxang the largest angle in degrees
+		 * @return the indices of the references, nearest first
+		 */
+		vector<int> within(const Transform& t, float maxang) const;
+
+		/** nearest for many orientations, spread over several threads.
+		 * @param t the query orientations
+		 * @param k the number of references to find for each
+		 * @param nthreads the number of threads, 0 for Parallel::get_threads()
+		 * @return k indices per query, query after query. Unused places are -1
+		 */
+		vector<int> nearest_batch(const vector<Transform>& t, int k, int nthreads = 0) const;
+
+		/** @return the angle in degrees between the projection directions of two orientations, allowing for the symmetry */
+		float angle(const Transform& t1, const Transform& t2) const;
+
+	private:
+		/** Disallow copy construction */
+		OrientationIndex(const OrientationIndex&);
+		/** Disallow assignment */
+		OrientationIndex& operator=(const OrientationIndex&);
+
+		/// A bounded set of the best distinct references found so far
+		struct Best;
+		void search_nearest(int lo, int hi, const float *q, Best & best) const;
+		void search_within(int lo, int hi, const float *q, float maxd2, vector<pair<float,int> > & found) const;
+
+		int nrefs;
+		/// The symmetry operators
+		vector<Transform> syms;
+		/// Unit projection directions, 3 floats per point, in tree order
+		vector<float> pts;
+		/// The reference each point is a symmetry copy of
+		vector<int> ref;
+		/// Splitting axis of the node at the middle of each range
+		vector<unsigned char> axis;
+	};
 } // namespace EMAN
 
 #endif // eman__symmetry_h__
@@ -38,6 +38,8 @@
 #include "emobject.h"
 #include <cctype> // for std::tolower
 #include <cstring>  // for memcpy
+#include <map>
+#include <pthread.h>
 #include "symmetry.h"
 using namespace EMAN;
 
@@ -1322,6 +1324,358 @@ Transform EMAN::operator*(const Transform & M2, const Transform & M1)     // YYY
 	return result;
 }
 
+namespace {
+	/** The rotation matrix for EMAN Euler angles, exactly as Transform::set_rotation computes it */
+	inline void eman_rotation(double az, double alt, double phi, float r[9])
+	{
+		double azp  =  az*EMConsts::deg2rad;
+		double altp = alt*EMConsts::deg2rad;
+		double phip = phi*EMConsts::deg2rad;
+		double caz = cos(azp), saz = sin(azp);
+		double calt = cos(altp), salt = sin(altp);
+		double cphi = cos(phip), sphi = sin(phip);
+
+		r[0] = (float)(cphi*caz - calt*saz*sphi);
+		r[1] = (float)(cphi*saz + calt*caz*sphi);
+		r[2] = (float)(salt*sphi);
+		r[3] = (float)(-sphi*caz - calt*saz*cphi);
+		r[4] = (float)(-sphi*saz + calt*caz*cphi);
+		r[5] = (float)(salt*cphi);
+		r[6] = (float)(salt*saz);
+		r[7] = (float)(-salt*caz);
+		r[8] = (float)calt;
+	}
+
+	/** Scale and x mirroring of a 3x3 matrix, as Transform::get_scale_and_mirror */
+	inline void scale_and_mirror(const float r[9], float& scale, bool& x_mirror)
+	{
+		double det2;
+		det2  = r[0]*((double)r[4]*r[8]-(double)r[7]*r[5]);
+		det2 -= r[1]*((double)r[3]*r[8]-(double)r[6]*r[5]);
+		det2 += r[2]*((double)r[3]*r[7]-(double)r[6]*r[4]);
+		float det = (float)det2;
+		Util::apply_precision(det,Transform::ERR_LIMIT);
+
+		x_mirror = false;
+		if (det < 0) {
+			x_mirror = true;
+			det *= -1;
+		}
+		if (det != 1) {
+			scale = std::pow(det,1.0f/3.0f);
+			int int_scale = static_cast<int>(scale);
+			if (scale-static_cast<float>(int_scale) < Transform::ERR_LIMIT) scale = static_cast<float>(int_scale);
+		}
+		else scale = 1;
+
+		Util::apply_precision(scale,Transform::ERR_LIMIT);
+	}
+}
+
+TransformBatch::TransformBatch() : n(0) {}
+
+TransformBatch::TransformBatch(size_t size) : n(0)
+{
+	resize(size);
+}
+
+TransformBatch::TransformBatch(const vector<Transform>& v) : n(0)
+{
+	reserve(v.size());
+	for (vector<Transform>::const_iterator it = v.begin(); it != v.end(); ++it) push_back(*it);
+}
+
+void TransformBatch::resize(size_t newsize)
+{
+	for (int k = 0; k < 12; k++) m[k].resize(newsize, (k == 0 || k == 5 || k == 10) ? 1.0f : 0.0f);
+	n = newsize;
+}
+
+void TransformBatch::reserve(size_t cap)
+{
+	for (int k = 0; k < 12; k++) m[k].reserve(cap);
+}
+
+void TransformBatch::clear()
+{
+	for (int k = 0; k < 12; k++) m[k].clear();
+	n = 0;
+}
+
+void TransformBatch::push_back(const Transform& t)
+{
+	for (int k = 0; k < 12; k++) m[k].push_back(t[k/4][k%4]);
+	n++;
+}
+
+void TransformBatch::push_back_eman(double az, double alt, double phi)
+{
+	float r[9];
+	eman_rotation(az,alt,phi,r);
+	for (int k = 0; k < 9; k++) m[k/3*4+k%3].push_back(r[k]);
+	for (int k = 3; k < 12; k += 4) m[k].push_back(0.0f);
+	n++;
+}
+
+void TransformBatch::append(const TransformBatch& b)
+{
+	for (int k = 0; k < 12; k++) m[k].insert(m[k].end(),b.m[k].begin(),b.m[k].end());
+	n += b.n;
+}
+
+Transform TransformBatch::get(size_t i) const
+{
+	if (i >= n) throw OutofRangeException(0,(int)n-1,(int)i,"TransformBatch index");
+	Transform t;
+	for (int k = 0; k < 12; k++) t[k/4][k%4] = m[k][i];
+	return t;
+}
+
+void TransformBatch::set(size_t i, const Transform& t)
+{
+	if (i >= n) throw OutofRangeException(0,(int)n-1,(int)i,"TransformBatch index");
+	for (int k = 0; k < 12; k++) m[k][i] = t[k/4][k%4];
+}
+
+vector<Transform> TransformBatch::to_vector() const
+{
+	vector<Transform> ret(n);
+	for (size_t i = 0; i < n; i++) {
+		for (int k = 0; k < 12; k++) ret[i][k/4][k%4] = m[k][i];
+	}
+	return ret;
+}
+
+void TransformBatch::set_rotations_eman(const float* az, const float* alt, const float* phi)
+{
+	float r[9];
+	for (size_t i = 0; i < n; i++) {
+		eman_rotation(az[i],alt[i],phi[i],r);
+		for (int k = 0; k < 9; k++) m[k/3*4+k%3][i] = r[k];
+	}
+}
+
+void TransformBatch::get_rotations_eman(float* az, float* alt, float* phi) const
+{
+	for (size_t i = 0; i < n; i++) {
+		float r[9];
+		for (int k = 0; k < 9; k++) r[k] = m[k/3*4+k%3][i];
+
+		float scale;
+		bool x_mirror;
+		scale_and_mirror(r,scale,x_mirror);
+		if (scale == 0) throw UnexpectedBehaviorException("The determinant of the Transform is 0. This is unexpected.");
+
+		double cosalt = r[8]/scale;
+		double x_mirror_scale = (x_mirror ? -1.0f : 1.0f);
+		double a = 0, b = 0, c = 0;
+
+		if (cosalt >= 1) {
+			c = EMConsts::rad2deg * atan2(x_mirror_scale*r[1], x_mirror_scale*r[0]);
+		} else if (cosalt <= -1) {
+			b = 180;
+			c = EMConsts::rad2deg * atan2(-x_mirror_scale*r[1], x_mirror_scale*r[0]);
+		} else {
+			a = EMConsts::rad2deg * atan2(scale*r[6], -scale*r[7]);
+			if (r[8] == 0.0) b = 90.0;
+			else b = EMConsts::rad2deg * atan(sqrt((double)r[6]*r[6]+(double)r[7]*r[7])/fabs(r[8]));
+			if (r[8] * scale < 0) b = 180.0f-b;
+			c = EMConsts::rad2deg * atan2(x_mirror_scale*(double)r[2], (double)r[5]);
+		}
+
+		az[i] = (float)(a-360.0*floor(a/360.0));
+		alt[i] = (float)b;
+		phi[i] = (float)(c-360.0*floor(c/360.0));
+	}
+}
+
+void TransformBatch::set_rotations_quaternion(const float* e0, const float* e1, const float* e2, const float* e3)
+{
+	float *m00 = element(0,0), *m01 = element(0,1), *m02 = element(0,2);
+	float *m10 = element(1,0), *m11 = element(1,1), *m12 = element(1,2);
+	float *m20 = element(2,0), *m21 = element(2,1), *m22 = element(2,2);
+	for (size_t i = 0; i < n; i++) {
+		double q0 = e0[i], q1 = e1[i], q2 = e2[i], q3 = e3[i];
+		m00[i] = (float)(q0 * q0 + q1 * q1 - q2 * q2 - q3 * q3);
+		m01[i] = (float)(2.0f * (q1 * q2 + q0 * q3));
+		m02[i] = (float)(2.0f * (q1 * q3 - q0 * q2));
+		m10[i] = (float)(2.0f * (q2 * q1 - q0 * q3));
+		m11[i] = (float)(q0 * q0 - q1 * q1 + q2 * q2 - q3 * q3);
+		m12[i] = (float)(2.0f * (q2 * q3 + q0 * q1));
+		m20[i] = (float)(2.0f * (q3 * q1 + q0 * q2));
+		m21[i] = (float)(2.0f * (q3 * q2 - q0 * q1));
+		m22[i] = (float)(q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3);
+	}
+}
+
+void TransformBatch::get_rotations_quaternion(float* e0, float* e1, float* e2, float* e3) const
+{
+	const float *m00 = element(0,0), *m01 = element(0,1), *m02 = element(0,2);
+	const float *m10 = element(1,0), *m11 = element(1,1), *m12 = element(1,2);
+	const float *m20 = element(2,0), *m21 = element(2,1), *m22 = element(2,2);
+	for (size_t i = 0; i < n; i++) {
+		double traceR = m00[i]+m11[i]+m22[i];
+		double cosomega = (traceR-1.0)/2.0;
+		if (cosomega > 1.0) cosomega = 1.0;
+		if (cosomega < -1.0) cosomega = -1.0;
+
+		double sinOover2 = sqrt((1.0 -cosomega)/2.0);
+		double cosOover2 = sqrt(1.0 -sinOover2*sinOover2);
+		double sinomega = 2* sinOover2*cosOover2;
+		double n1 = 0, n2 = 0, n3 = 0;
+		if (sinomega > 0) {
+			n1 = (m12[i]-m21[i])/2.0/sinomega;
+			n2 = (m20[i]-m02[i])/2.0/sinomega;
+			n3 = (m01[i]-m10[i])/2.0/sinomega;
+		}
+		e0[i] = (float)cosOover2;
+		e1[i] = (float)(sinOover2 * n1);
+		e2[i] = (float)(sinOover2 * n2);
+		e3[i] = (float)(sinOover2 * n3);
+	}
+}
+
+void TransformBatch::invert()
+{
+	float *p[12];
+	for (int k = 0; k < 12; k++) p[k] = element(k/4,k%4);
+
+	for (size_t i = 0; i < n; i++) {
+		double m00 = p[0][i]; double m01 = p[1][i]; double m02 = p[2][i];
+		double m10 = p[4][i]; double m11 = p[5][i]; double m12 = p[6][i];
+		double m20 = p[8][i]; double m21 = p[9][i]; double m22 = p[10][i];
+		double v0  = p[3][i]; double v1  = p[7][i]; double v2  = p[11][i];
+
+		double cof00 = m11*m22-m12*m21;
+		double cof11 = m22*m00-m20*m02;
+		double cof22 = m00*m11-m01*m10;
+		double cof01 = m10*m22-m20*m12;
+		double cof02 = m10*m21-m20*m11;
+		double cof12 = m00*m21-m01*m20;
+		double cof10 = m01*m22-m02*m21;
+		double cof20 = m01*m12-m02*m11;
+		double cof21 = m00*m12-m10*m02;
+
+		double det = m00* cof00 + m02* cof02 -m01*cof01;
+
+		p[0][i]  =   (float)(cof00/det);
+		p[1][i]  = - (float)(cof10/det);
+		p[2][i]  =   (float)(cof20/det);
+		p[4][i]  = - (float)(cof01/det);
+		p[5][i]  =   (float)(cof11/det);
+		p[6][i]  = - (float)(cof21/det);
+		p[8][i]  =   (float)(cof02/det);
+		p[9][i]  = - (float)(cof12/det);
+		p[10][i] =   (float)(cof22/det);
+
+		p[3][i]  = (float)((- cof00*v0 + cof10*v1 - cof20*v2)/det);
+		p[7][i]  = (float)((  cof01*v0 - cof11*v1 + cof21*v2)/det);
+		p[11][i] = (float)((- cof02*v0 + cof12*v1 - cof22*v2)/det);
+	}
+}
+
+TransformBatch TransformBatch::inverse() const
+{
+	TransformBatch ret(*this);
+	ret.invert();
+	return ret;
+}
+
+void TransformBatch::right_multiply(const Transform& t)
+{
+	float b[12];
+	for (int k = 0; k < 12; k++) b[k] = t[k/4][k%4];
+
+	// each row of the product only depends on the same row of this
+	for (int r = 0; r < 3; r++) {
+		float *a0 = element(r,0), *a1 = element(r,1), *a2 = element(r,2), *a3 = element(r,3);
+		for (size_t i = 0; i < n; i++) {
+			float x = a0[i], y = a1[i], z = a2[i];
+			a0[i] = x * b[0] + y * b[4] + z * b[8];
+			a1[i] = x * b[1] + y * b[5] + z * b[9];
+			a2[i] = x * b[2] + y * b[6] + z * b[10];
+			a3[i] = x * b[3] + y * b[7] + z * b[11] + a3[i];
+		}
+	}
+}
+
+void TransformBatch::left_multiply(const Transform& t)
+{
+	float b[12];
+	for (int k = 0; k < 12; k++) b[k] = t[k/4][k%4];
+
+	// each column of the product only depends on the same column of this
+	for (int c = 0; c < 4; c++) {
+		float *a0 = element(0,c), *a1 = element(1,c), *a2 = element(2,c);
+		float d0 = c == 3 ? b[3] : 0.0f;
+		float d1 = c == 3 ? b[7] : 0.0f;
+		float d2 = c == 3 ? b[11] : 0.0f;
+		for (size_t i = 0; i < n; i++) {
+			float x = a0[i], y = a1[i], z = a2[i];
+			a0[i] = b[0] * x + b[1] * y + b[2] * z + d0;
+			a1[i] = b[4] * x + b[5] * y + b[6] * z + d1;
+			a2[i] = b[8] * x + b[9] * y + b[10] * z + d2;
+		}
+	}
+}
+
+void TransformBatch::multiply(const TransformBatch& a, const TransformBatch& b, TransformBatch& out)
+{
+	if (a.n != b.n) throw InvalidParameterException("TransformBatch::multiply requires batches of the same size");
+	size_t n = a.n;
+
+	// the product is built in separate storage, so out may be a or b
+	vector<float> res[12];
+	for (int r = 0; r < 3; r++) {
+		const float *x0 = a.element(r,0), *x1 = a.element(r,1), *x2 = a.element(r,2), *x3 = a.element(r,3);
+		for (int c = 0; c < 4; c++) {
+			const float *y0 = b.element(0,c), *y1 = b.element(1,c), *y2 = b.element(2,c);
+			vector<float>& o = res[r*4+c];
+			o.resize(n);
+			for (size_t i = 0; i < n; i++) o[i] = x0[i] * y0[i] + x1[i] * y1[i] + x2[i] * y2[i];
+			if (c == 3) {
+				for (size_t i = 0; i < n; i++) o[i] += x3[i];
+			}
+		}
+	}
+	for (int k = 0; k < 12; k++) out.m[k].swap(res[k]);
+	out.n = n;
+}
+
+void TransformBatch::transform(float x, float y, float z, float* ox, float* oy, float* oz) const
+{
+	const float *p[12];
+	for (int k = 0; k < 12; k++) p[k] = element(k/4,k%4);
+	for (size_t i = 0; i < n; i++) {
+		ox[i] = p[0][i] * x + p[1][i] * y + p[2][i] * z + p[3][i];
+		oy[i] = p[4][i] * x + p[5][i] * y + p[6][i] * z + p[7][i];
+		oz[i] = p[8][i] * x + p[9][i] * y + p[10][i] * z + p[11][i];
+	}
+}
+
+void TransformBatch::transform(const float* x, const float* y, const float* z, float* ox, float* oy, float* oz) const
+{
+	const float *p[12];
+	for (int k = 0; k < 12; k++) p[k] = element(k/4,k%4);
+	for (size_t i = 0; i < n; i++) {
+		float a = x[i], b = y[i], c = z[i];
+		ox[i] = p[0][i] * a + p[1][i] * b + p[2][i] * c + p[3][i];
+		oy[i] = p[4][i] * a + p[5][i] * b + p[6][i] * c + p[7][i];
+		oz[i] = p[8][i] * a + p[9][i] * b + p[10][i] * c + p[11][i];
+	}
+}
+
+void TransformBatch::transpose_transform(float x, float y, float z, float* ox, float* oy, float* oz) const
+{
+	const float *p[12];
+	for (int k = 0; k < 12; k++) p[k] = element(k/4,k%4);
+	for (size_t i = 0; i < n; i++) {
+		ox[i] = x * p[0][i] + y * p[4][i] + z * p[8][i];
+		oy[i] = x * p[1][i] + y * p[5][i] + z * p[9][i];
+		oz[i] = x * p[2][i] + y * p[6][i] + z * p[10][i];
+	}
+}
+
 void Transform::assert_valid_2d() const {
 	int rotation_error = 0;
 	int translation_error = 0;
@@ -1363,175 +1717,207 @@ Transform Transform::get_sym_sparx(const string & sym_name, int n) const
 	return ret;
 }
 
-vector<Transform > Transform::get_sym_proj(const string & sym_name) const
-{
-	vector<Transform> ret;
-	int nsym;
-	string lstr = Util::str_to_lower(sym_name);
-	if( lstr == "tet" ) {
-		nsym = 12;
-		static float TET[108] = {
-			  1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   1.0f,
-			   -0.5f,   0.86602540378f,   0.0f,   -0.86602540378f,   -0.5f,   0.0f,   0.0f,   0.0f,   1.0f,
-			   -0.5f,   -0.86602540378f,   0.0f,   0.86602540378f,   -0.5f,   -0.0f,   0.0f,   0.0f,   1.0f,
-			   -0.16666666667f,   0.86602540378f,   -0.47140452079f,   0.28867513459f,   0.5f,   0.81649658093f,   0.94280904158f,   0.0f,   -0.33333333333f,
-			   0.33333333333f,   0.0f,   0.94280904158f,   0.0f,   -1.0f,   0.0f,   0.94280904158f,   0.0f,   -0.33333333333f,
-			   -0.16666666667f,   -0.86602540378f,   -0.47140452079f,   -0.28867513459f,   0.5f,   -0.81649658093f,   0.94280904158f,   0.0f,   -0.33333333333f,
-			   -0.66666666667f,   -0.57735026919f,   -0.47140452079f,   -0.57735026919f,   0.0f,   0.81649658093f,   -0.47140452079f,   0.81649658093f,   -0.33333333333f,
-			   -0.16666666667f,   0.28867513459f,   0.94280904158f,   0.86602540378f,   0.5f,   0.0f,   -0.47140452079f,   0.81649658093f,   -0.33333333333f,
-			   0.83333333333f,   0.28867513459f,   -0.47140452079f,   -0.28867513459f,   -0.5f,   -0.81649658093f,   -0.47140452079f,   0.81649658093f,   -0.33333333333f,
-			   0.83333333333f,   -0.28867513459f,   -0.47140452079f,   0.28867513459f,   -0.5f,   0.81649658093f,   -0.47140452079f,   -0.81649658093f,   -0.33333333333f,
-			   -0.16666666667f,   -0.28867513459f,   0.94280904158f,   -0.86602540378f,   0.5f,   0.0f,   -0.47140452079f,   -0.81649658093f,   -0.33333333333f,
-			   -0.66666666667f,   0.57735026919f,   -0.47140452079f,   0.57735026919f,   -0.0f,   -0.81649658093f,   -0.47140452079f,   -0.81649658093f,   -0.33333333333f
-		};
-
-		for (int k=0;k<nsym;k++) {
-			Transform t;
-			for (int i=0; i<3; i++) {
-				for (int j=0; j<3; j++) {
-					t.matrix[i][j] = TET[9*k + i*3 +j];
+namespace {
+	/** The tet, oct and icos operators of SPARX, which are not oriented as the
+	 * Symmetry3D classes orient them. Empty for any other symmetry. */
+	vector<Transform> sparx_sym_ops(const string & lstr)
+	{
+		vector<Transform> ops;
+		if( lstr == "tet" ) {
+			int nsym = 12;
+			static float TET[108] = {
+				  1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   1.0f,
+				   -0.5f,   0.86602540378f,   0.0f,   -0.86602540378f,   -0.5f,   0.0f,   0.0f,   0.0f,   1.0f,
+				   -0.5f,   -0.86602540378f,   0.0f,   0.86602540378f,   -0.5f,   -0.0f,   0.0f,   0.0f,   1.0f,
+				   -0.16666666667f,   0.86602540378f,   -0.47140452079f,   0.28867513459f,   0.5f,   0.81649658093f,   0.94280904158f,   0.0f,   -0.33333333333f,
+				   0.33333333333f,   0.0f,   0.94280904158f,   0.0f,   -1.0f,   0.0f,   0.94280904158f,   0.0f,   -0.33333333333f,
+				   -0.16666666667f,   -0.86602540378f,   -0.47140452079f,   -0.28867513459f,   0.5f,   -0.81649658093f,   0.94280904158f,   0.0f,   -0.33333333333f,
+				   -0.66666666667f,   -0.57735026919f,   -0.47140452079f,   -0.57735026919f,   0.0f,   0.81649658093f,   -0.47140452079f,   0.81649658093f,   -0.33333333333f,
+				   -0.16666666667f,   0.28867513459f,   0.94280904158f,   0.86602540378f,   0.5f,   0.0f,   -0.47140452079f,   0.81649658093f,   -0.33333333333f,
+				   0.83333333333f,   0.28867513459f,   -0.47140452079f,   -0.28867513459f,   -0.5f,   -0.81649658093f,   -0.47140452079f,   0.81649658093f,   -0.33333333333f,
+				   0.83333333333f,   -0.28867513459f,   -0.47140452079f,   0.28867513459f,   -0.5f,   0.81649658093f,   -0.47140452079f,   -0.81649658093f,   -0.33333333333f,
+				   -0.16666666667f,   -0.28867513459f,   0.94280904158f,   -0.86602540378f,   0.5f,   0.0f,   -0.47140452079f,   -0.81649658093f,   -0.33333333333f,
+				   -0.66666666667f,   0.57735026919f,   -0.47140452079f,   0.57735026919f,   -0.0f,   -0.81649658093f,   -0.47140452079f,   -0.81649658093f,   -0.33333333333f
+			};
+
+			for (int k=0;k<nsym;k++) {
+				Transform t;
+				for (int i=0; i<3; i++) {
+					for (int j=0; j<3; j++) {
+						t[i][j] = TET[9*k + i*3 +j];
+					}
 				}
+				//vector<float> z = t.get_matrix();
+				//for (int i=0; i<12; i++)  cout<<z[i]<<endl;
+				ops.push_back(t);
 			}
-			//vector<float> z = t.get_matrix();
-			//for (int i=0; i<12; i++)  cout<<z[i]<<endl;
-			ret.push_back( (*this) * t );
-		}
-	} else if( lstr == "oct" ) {
-		nsym = 24;
-		static float TET[216] = {
-		   1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   1.0f,
-		   0.0f,   1.0f,   0.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   1.0f,
-		   -1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   1.0f,
-		   0.0f,   -1.0f,   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   1.0f,
-		   0.0f,   0.0f,   -1.0f,   0.0f,   1.0f,   0.0f,   1.0f,   0.0f,   0.0f,
-		   0.0f,   0.0f,   -1.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,
-		   0.0f,   0.0f,   -1.0f,   0.0f,   -1.0f,   0.0f,   -1.0f,   0.0f,   0.0f,
-		   0.0f,   0.0f,   -1.0f,   1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   0.0f,
-		   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   1.0f,   0.0f,   0.0f,
-		   -1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,   1.0f,   0.0f,
-		   0.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   -1.0f,   0.0f,   0.0f,
-		   1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,   -1.0f,   0.0f,
-		   0.0f,   0.0f,   1.0f,   0.0f,   -1.0f,   0.0f,   1.0f,   0.0f,   0.0f,
-		   0.0f,   0.0f,   1.0f,   1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,
-		   0.0f,   0.0f,   1.0f,   0.0f,   1.0f,   0.0f,   -1.0f,   0.0f,   0.0f,
-		   0.0f,   0.0f,   1.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   0.0f,
-		   0.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   1.0f,   0.0f,   0.0f,
-		   1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   0.0f,   1.0f,   0.0f,
-		   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   -1.0f,   0.0f,   0.0f,
-		   -1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   0.0f,   -1.0f,   0.0f,
-		   -1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,
-		   0.0f,   1.0f,   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   -1.0f,
-		   1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,
-		   0.0f,   -1.0f,   0.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   -1.0f
-		};
-
-		for (int k=0;k<nsym;k++) {
-			Transform t;
-			for (int i=0; i<3; i++) {
-				for (int j=0; j<3; j++) {
-					t.matrix[i][j] = TET[9*k + i*3 +j];
+		} else if( lstr == "oct" ) {
+			int nsym = 24;
+			static float TET[216] = {
+			   1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   1.0f,
+			   0.0f,   1.0f,   0.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   1.0f,
+			   -1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   1.0f,
+			   0.0f,   -1.0f,   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   1.0f,
+			   0.0f,   0.0f,   -1.0f,   0.0f,   1.0f,   0.0f,   1.0f,   0.0f,   0.0f,
+			   0.0f,   0.0f,   -1.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,
+			   0.0f,   0.0f,   -1.0f,   0.0f,   -1.0f,   0.0f,   -1.0f,   0.0f,   0.0f,
+			   0.0f,   0.0f,   -1.0f,   1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   0.0f,
+			   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   1.0f,   0.0f,   0.0f,
+			   -1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,   1.0f,   0.0f,
+			   0.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   -1.0f,   0.0f,   0.0f,
+			   1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,   -1.0f,   0.0f,
+			   0.0f,   0.0f,   1.0f,   0.0f,   -1.0f,   0.0f,   1.0f,   0.0f,   0.0f,
+			   0.0f,   0.0f,   1.0f,   1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,
+			   0.0f,   0.0f,   1.0f,   0.0f,   1.0f,   0.0f,   -1.0f,   0.0f,   0.0f,
+			   0.0f,   0.0f,   1.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   0.0f,
+			   0.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   1.0f,   0.0f,   0.0f,
+			   1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   0.0f,   1.0f,   0.0f,
+			   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   -1.0f,   0.0f,   0.0f,
+			   -1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   0.0f,   -1.0f,   0.0f,
+			   -1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,
+			   0.0f,   1.0f,   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   -1.0f,
+			   1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,
+			   0.0f,   -1.0f,   0.0f,   -1.0f,   0.0f,   0.0f,   0.0f,   0.0f,   -1.0f
+			};
+
+			for (int k=0;k<nsym;k++) {
+				Transform t;
+				for (int i=0; i<3; i++) {
+					for (int j=0; j<3; j++) {
+						t[i][j] = TET[9*k + i*3 +j];
+					}
 				}
+				//vector<float> z = t.get_matrix();
+				//for (int i=0; i<12; i++)  cout<<z[i]<<endl;
+				ops.push_back(t);
 			}
-			//vector<float> z = t.get_matrix();
-			//for (int i=0; i<12; i++)  cout<<z[i]<<endl;
-			ret.push_back( (*this) * t );
-		}
-	} else if( lstr == "icos" ) {
-		nsym = 60;
-		static float TET[540] = {
-		   1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   1.0f,
-		   0.30901699437f,   0.9510565163f,   0.0f,   -0.9510565163f,   0.30901699437f,   0.0f,   0.0f,   0.0f,   1.0f,
-		   -0.80901699437f,   0.58778525229f,   0.0f,   -0.58778525229f,   -0.80901699437f,   0.0f,   0.0f,   0.0f,   1.0f,
-		   -0.80901699437f,   -0.58778525229f,   0.0f,   0.58778525229f,   -0.80901699437f,   0.0f,   0.0f,   0.0f,   1.0f,
-		   0.30901699437f,   -0.9510565163f,   0.0f,   0.9510565163f,   0.30901699437f,   0.0f,   0.0f,   0.0f,   1.0f,
-		   0.36180339887f,   0.58778525229f,   -0.72360679775f,   -0.26286555606f,   0.80901699437f,   0.52573111212f,   0.894427191f,   0.0f,   0.4472135955f,
-		   -0.13819660113f,   0.9510565163f,   0.27639320225f,   -0.42532540418f,   -0.30901699437f,   0.85065080835f,   0.894427191f,   0.0f,   0.4472135955f,
-		   -0.4472135955f,   0.0f,   0.894427191f,   0.0f,   -1.0f,   0.0f,   0.894427191f,   0.0f,   0.4472135955f,
-		   -0.13819660113f,   -0.9510565163f,   0.27639320225f,   0.42532540418f,   -0.30901699437f,   -0.85065080835f,   0.894427191f,   0.0f,   0.4472135955f,
-		   0.36180339887f,   -0.58778525229f,   -0.72360679775f,   0.26286555606f,   0.80901699437f,   -0.52573111212f,   0.894427191f,   0.0f,   0.4472135955f,
-		   -0.4472135955f,   0.52573111212f,   -0.72360679775f,   -0.85065080835f,   0.0f,   0.52573111212f,   0.27639320225f,   0.85065080835f,   0.4472135955f,
-		   -0.9472135955f,   0.16245984812f,   0.27639320225f,   0.16245984812f,   -0.5f,   0.85065080835f,   0.27639320225f,   0.85065080835f,   0.4472135955f,
-		   -0.13819660113f,   -0.42532540418f,   0.894427191f,   0.9510565163f,   -0.30901699437f,   0.0f,   0.27639320225f,   0.85065080835f,   0.4472135955f,
-		   0.86180339887f,   -0.42532540418f,   0.27639320225f,   0.42532540418f,   0.30901699437f,   -0.85065080835f,   0.27639320225f,   0.85065080835f,   0.4472135955f,
-		   0.67082039325f,   0.16245984812f,   -0.72360679775f,   -0.68819096024f,   0.5f,   -0.52573111212f,   0.27639320225f,   0.85065080835f,   0.4472135955f,
-		   -0.63819660113f,   -0.26286555606f,   -0.72360679775f,   -0.26286555606f,   -0.80901699437f,   0.52573111212f,   -0.72360679775f,   0.52573111212f,   0.4472135955f,
-		   -0.4472135955f,   -0.85065080835f,   0.27639320225f,   0.52573111212f,   0.0f,   0.85065080835f,   -0.72360679775f,   0.52573111212f,   0.4472135955f,
-		   0.36180339887f,   -0.26286555606f,   0.894427191f,   0.58778525229f,   0.80901699437f,   0.0f,   -0.72360679775f,   0.52573111212f,   0.4472135955f,
-		   0.67082039325f,   0.68819096024f,   0.27639320225f,   -0.16245984812f,   0.5f,   -0.85065080835f,   -0.72360679775f,   0.52573111212f,   0.4472135955f,
-		   0.0527864045f,   0.68819096024f,   -0.72360679775f,   -0.68819096024f,   -0.5f,   -0.52573111212f,   -0.72360679775f,   0.52573111212f,   0.4472135955f,
-		   0.0527864045f,   -0.68819096024f,   -0.72360679775f,   0.68819096024f,   -0.5f,   0.52573111212f,   -0.72360679775f,   -0.52573111212f,   0.4472135955f,
-		   0.67082039325f,   -0.68819096024f,   0.27639320225f,   0.16245984812f,   0.5f,   0.85065080835f,   -0.72360679775f,   -0.52573111212f,   0.4472135955f,
-		   0.36180339887f,   0.26286555606f,   0.894427191f,   -0.58778525229f,   0.80901699437f,   0.0f,   -0.72360679775f,   -0.52573111212f,   0.4472135955f,
-		   -0.4472135955f,   0.85065080835f,   0.27639320225f,   -0.52573111212f,   0.0f,   -0.85065080835f,   -0.72360679775f,   -0.52573111212f,   0.4472135955f,
-		   -0.63819660113f,   0.26286555606f,   -0.72360679775f,   0.26286555606f,   -0.80901699437f,   -0.52573111212f,   -0.72360679775f,   -0.52573111212f,   0.4472135955f,
-		   0.67082039325f,   -0.16245984812f,   -0.72360679775f,   0.68819096024f,   0.5f,   0.52573111212f,   0.27639320225f,   -0.85065080835f,   0.4472135955f,
-		   0.86180339887f,   0.42532540418f,   0.27639320225f,   -0.42532540418f,   0.30901699437f,   0.85065080835f,   0.27639320225f,   -0.85065080835f,   0.4472135955f,
-		   -0.13819660113f,   0.42532540418f,   0.894427191f,   -0.9510565163f,   -0.30901699437f,   0.0f,   0.27639320225f,   -0.85065080835f,   0.4472135955f,
-		   -0.9472135955f,   -0.16245984812f,   0.27639320225f,   -0.16245984812f,   -0.5f,   -0.85065080835f,   0.27639320225f,   -0.85065080835f,   0.4472135955f,
-		   -0.4472135955f,   -0.52573111212f,   -0.72360679775f,   0.85065080835f,   0.0f,   -0.52573111212f,   0.27639320225f,   -0.85065080835f,   0.4472135955f,
-		   -0.36180339887f,   -0.26286555606f,   -0.894427191f,   -0.58778525229f,   0.80901699437f,   0.0f,   0.72360679775f,   0.52573111212f,   -0.4472135955f,
-		   -0.67082039325f,   0.68819096024f,   -0.27639320225f,   0.16245984812f,   0.5f,   0.85065080835f,   0.72360679775f,   0.52573111212f,   -0.4472135955f,
-		   -0.0527864045f,   0.68819096024f,   0.72360679775f,   0.68819096024f,   -0.5f,   0.52573111212f,   0.72360679775f,   0.52573111212f,   -0.4472135955f,
-		   0.63819660113f,   -0.26286555606f,   0.72360679775f,   0.26286555606f,   -0.80901699437f,   -0.52573111212f,   0.72360679775f,   0.52573111212f,   -0.4472135955f,
-		   0.4472135955f,   -0.85065080835f,   -0.27639320225f,   -0.52573111212f,   0.0f,   -0.85065080835f,   0.72360679775f,   0.52573111212f,   -0.4472135955f,
-		   0.13819660113f,   -0.42532540418f,   -0.894427191f,   -0.9510565163f,   -0.30901699437f,   0.0f,   -0.27639320225f,   0.85065080835f,   -0.4472135955f,
-		   -0.86180339887f,   -0.42532540418f,   -0.27639320225f,   -0.42532540418f,   0.30901699437f,   0.85065080835f,   -0.27639320225f,   0.85065080835f,   -0.4472135955f,
-		   -0.67082039325f,   0.16245984812f,   0.72360679775f,   0.68819096024f,   0.5f,   0.52573111212f,   -0.27639320225f,   0.85065080835f,   -0.4472135955f,
-		   0.4472135955f,   0.52573111212f,   0.72360679775f,   0.85065080835f,   0.0f,   -0.52573111212f,   -0.27639320225f,   0.85065080835f,   -0.4472135955f,
-		   0.9472135955f,   0.16245984812f,   -0.27639320225f,   -0.16245984812f,   -0.5f,   -0.85065080835f,   -0.27639320225f,   0.85065080835f,   -0.4472135955f,
-		   0.4472135955f,   0.0f,   -0.894427191f,   0.0f,   -1.0f,   0.0f,   -0.894427191f,   0.0f,   -0.4472135955f,
-		   0.13819660113f,   -0.9510565163f,   -0.27639320225f,   -0.42532540418f,   -0.30901699437f,   0.85065080835f,   -0.894427191f,   0.0f,   -0.4472135955f,
-		   -0.36180339887f,   -0.58778525229f,   0.72360679775f,   -0.26286555606f,   0.80901699437f,   0.52573111212f,   -0.894427191f,   0.0f,   -0.4472135955f,
-		   -0.36180339887f,   0.58778525229f,   0.72360679775f,   0.26286555606f,   0.80901699437f,   -0.52573111212f,   -0.894427191f,   0.0f,   -0.4472135955f,
-		   0.13819660113f,   0.9510565163f,   -0.27639320225f,   0.42532540418f,   -0.30901699437f,   -0.85065080835f,   -0.894427191f,   0.0f,   -0.4472135955f,
-		   0.13819660113f,   0.42532540418f,   -0.894427191f,   0.9510565163f,   -0.30901699437f,   0.0f,   -0.27639320225f,   -0.85065080835f,   -0.4472135955f,
-		   0.9472135955f,   -0.16245984812f,   -0.27639320225f,   0.16245984812f,   -0.5f,   0.85065080835f,   -0.27639320225f,   -0.85065080835f,   -0.4472135955f,
-		   0.4472135955f,   -0.52573111212f,   0.72360679775f,   -0.85065080835f,   0.0f,   0.52573111212f,   -0.27639320225f,   -0.85065080835f,   -0.4472135955f,
-		   -0.67082039325f,   -0.16245984812f,   0.72360679775f,   -0.68819096024f,   0.5f,   -0.52573111212f,   -0.27639320225f,   -0.85065080835f,   -0.4472135955f,
-		   -0.86180339887f,   0.42532540418f,   -0.27639320225f,   0.42532540418f,   0.30901699437f,   -0.85065080835f,   -0.27639320225f,   -0.85065080835f,   -0.4472135955f,
-		   -0.36180339887f,   0.26286555606f,   -0.894427191f,   0.58778525229f,   0.80901699437f,   0.0f,   0.72360679775f,   -0.52573111212f,   -0.4472135955f,
-		   0.4472135955f,   0.85065080835f,   -0.27639320225f,   0.52573111212f,   0.0f,   0.85065080835f,   0.72360679775f,   -0.52573111212f,   -0.4472135955f,
-		   0.63819660113f,   0.26286555606f,   0.72360679775f,   -0.26286555606f,   -0.80901699437f,   0.52573111212f,   0.72360679775f,   -0.52573111212f,   -0.4472135955f,
-		   -0.0527864045f,   -0.68819096024f,   0.72360679775f,   -0.68819096024f,   -0.5f,   -0.52573111212f,   0.72360679775f,   -0.52573111212f,   -0.4472135955f,
-		   -0.67082039325f,   -0.68819096024f,   -0.27639320225f,   -0.16245984812f,   0.5f,   -0.85065080835f,   0.72360679775f,   -0.52573111212f,   -0.4472135955f,
-		   -1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,
-		   -0.30901699437f,   0.9510565163f,   0.0f,   0.9510565163f,   0.30901699437f,   0.0f,   0.0f,   0.0f,   -1.0f,
-		   0.80901699437f,   0.58778525229f,   0.0f,   0.58778525229f,   -0.80901699437f,   0.0f,   0.0f,   0.0f,   -1.0f,
-		   0.80901699437f,   -0.58778525229f,   0.0f,   -0.58778525229f,   -0.80901699437f,   0.0f,   0.0f,   0.0f,   -1.0f,
-		   -0.30901699437f,   -0.9510565163f,   0.0f,   -0.9510565163f,   0.30901699437f,   0.0f,   0.0f,   0.0f,   -1.0f
-		};
-
-		for (int k=0;k<nsym;k++) {
-			Transform t;
-			for (int i=0; i<3; i++) {
-				for (int j=0; j<3; j++) {
-					t.matrix[i][j] = TET[9*k + i*3 +j];
+		} else if( lstr == "icos" ) {
+			int nsym = 60;
+			static float TET[540] = {
+			   1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   1.0f,
+			   0.30901699437f,   0.9510565163f,   0.0f,   -0.9510565163f,   0.30901699437f,   0.0f,   0.0f,   0.0f,   1.0f,
+			   -0.80901699437f,   0.58778525229f,   0.0f,   -0.58778525229f,   -0.80901699437f,   0.0f,   0.0f,   0.0f,   1.0f,
+			   -0.80901699437f,   -0.58778525229f,   0.0f,   0.58778525229f,   -0.80901699437f,   0.0f,   0.0f,   0.0f,   1.0f,
+			   0.30901699437f,   -0.9510565163f,   0.0f,   0.9510565163f,   0.30901699437f,   0.0f,   0.0f,   0.0f,   1.0f,
+			   0.36180339887f,   0.58778525229f,   -0.72360679775f,   -0.26286555606f,   0.80901699437f,   0.52573111212f,   0.894427191f,   0.0f,   0.4472135955f,
+			   -0.13819660113f,   0.9510565163f,   0.27639320225f,   -0.42532540418f,   -0.30901699437f,   0.85065080835f,   0.894427191f,   0.0f,   0.4472135955f,
+			   -0.4472135955f,   0.0f,   0.894427191f,   0.0f,   -1.0f,   0.0f,   0.894427191f,   0.0f,   0.4472135955f,
+			   -0.13819660113f,   -0.9510565163f,   0.27639320225f,   0.42532540418f,   -0.30901699437f,   -0.85065080835f,   0.894427191f,   0.0f,   0.4472135955f,
+			   0.36180339887f,   -0.58778525229f,   -0.72360679775f,   0.26286555606f,   0.80901699437f,   -0.52573111212f,   0.894427191f,   0.0f,   0.4472135955f,
+			   -0.4472135955f,   0.52573111212f,   -0.72360679775f,   -0.85065080835f,   0.0f,   0.52573111212f,   0.27639320225f,   0.85065080835f,   0.4472135955f,
+			   -0.9472135955f,   0.16245984812f,   0.27639320225f,   0.16245984812f,   -0.5f,   0.85065080835f,   0.27639320225f,   0.85065080835f,   0.4472135955f,
+			   -0.13819660113f,   -0.42532540418f,   0.894427191f,   0.9510565163f,   -0.30901699437f,   0.0f,   0.27639320225f,   0.85065080835f,   0.4472135955f,
+			   0.86180339887f,   -0.42532540418f,   0.27639320225f,   0.42532540418f,   0.30901699437f,   -0.85065080835f,   0.27639320225f,   0.85065080835f,   0.4472135955f,
+			   0.67082039325f,   0.16245984812f,   -0.72360679775f,   -0.68819096024f,   0.5f,   -0.52573111212f,   0.27639320225f,   0.85065080835f,   0.4472135955f,
+			   -0.63819660113f,   -0.26286555606f,   -0.72360679775f,   -0.26286555606f,   -0.80901699437f,   0.52573111212f,   -0.72360679775f,   0.52573111212f,   0.4472135955f,
+			   -0.4472135955f,   -0.85065080835f,   0.27639320225f,   0.52573111212f,   0.0f,   0.85065080835f,   -0.72360679775f,   0.52573111212f,   0.4472135955f,
+			   0.36180339887f,   -0.26286555606f,   0.894427191f,   0.58778525229f,   0.80901699437f,   0.0f,   -0.72360679775f,   0.52573111212f,   0.4472135955f,
+			   0.67082039325f,   0.68819096024f,   0.27639320225f,   -0.16245984812f,   0.5f,   -0.85065080835f,   -0.72360679775f,   0.52573111212f,   0.4472135955f,
+			   0.0527864045f,   0.68819096024f,   -0.72360679775f,   -0.68819096024f,   -0.5f,   -0.52573111212f,   -0.72360679775f,   0.52573111212f,   0.4472135955f,
+			   0.0527864045f,   -0.68819096024f,   -0.72360679775f,   0.68819096024f,   -0.5f,   0.52573111212f,   -0.72360679775f,   -0.52573111212f,   0.4472135955f,
+			   0.67082039325f,   -0.68819096024f,   0.27639320225f,   0.16245984812f,   0.5f,   0.85065080835f,   -0.72360679775f,   -0.52573111212f,   0.4472135955f,
+			   0.36180339887f,   0.26286555606f,   0.894427191f,   -0.58778525229f,   0.80901699437f,   0.0f,   -0.72360679775f,   -0.52573111212f,   0.4472135955f,
+			   -0.4472135955f,   0.85065080835f,   0.27639320225f,   -0.52573111212f,   0.0f,   -0.85065080835f,   -0.72360679775f,   -0.52573111212f,   0.4472135955f,
+			   -0.63819660113f,   0.26286555606f,   -0.72360679775f,   0.26286555606f,   -0.80901699437f,   -0.52573111212f,   -0.72360679775f,   -0.52573111212f,   0.4472135955f,
+			   0.67082039325f,   -0.16245984812f,   -0.72360679775f,   0.68819096024f,   0.5f,   0.52573111212f,   0.27639320225f,   -0.85065080835f,   0.4472135955f,
+			   0.86180339887f,   0.42532540418f,   0.27639320225f,   -0.42532540418f,   0.30901699437f,   0.85065080835f,   0.27639320225f,   -0.85065080835f,   0.4472135955f,
+			   -0.13819660113f,   0.42532540418f,   0.894427191f,   -0.9510565163f,   -0.30901699437f,   0.0f,   0.27639320225f,   -0.85065080835f,   0.4472135955f,
+			   -0.9472135955f,   -0.16245984812f,   0.27639320225f,   -0.16245984812f,   -0.5f,   -0.85065080835f,   0.27639320225f,   -0.85065080835f,   0.4472135955f,
+			   -0.4472135955f,   -0.52573111212f,   -0.72360679775f,   0.85065080835f,   0.0f,   -0.52573111212f,   0.27639320225f,   -0.85065080835f,   0.4472135955f,
+			   -0.36180339887f,   -0.26286555606f,   -0.894427191f,   -0.58778525229f,   0.80901699437f,   0.0f,   0.72360679775f,   0.52573111212f,   -0.4472135955f,
+			   -0.67082039325f,   0.68819096024f,   -0.27639320225f,   0.16245984812f,   0.5f,   0.85065080835f,   0.72360679775f,   0.52573111212f,   -0.4472135955f,
+			   -0.0527864045f,   0.68819096024f,   0.72360679775f,   0.68819096024f,   -0.5f,   0.52573111212f,   0.72360679775f,   0.52573111212f,   -0.4472135955f,
+			   0.63819660113f,   -0.26286555606f,   0.72360679775f,   0.26286555606f,   -0.80901699437f,   -0.52573111212f,   0.72360679775f,   0.52573111212f,   -0.4472135955f,
+			   0.4472135955f,   -0.85065080835f,   -0.27639320225f,   -0.52573111212f,   0.0f,   -0.85065080835f,   0.72360679775f,   0.52573111212f,   -0.4472135955f,
+			   0.13819660113f,   -0.42532540418f,   -0.894427191f,   -0.9510565163f,   -0.30901699437f,   0.0f,   -0.27639320225f,   0.85065080835f,   -0.4472135955f,
+			   -0.86180339887f,   -0.42532540418f,   -0.27639320225f,   -0.42532540418f,   0.30901699437f,   0.85065080835f,   -0.27639320225f,   0.85065080835f,   -0.4472135955f,
+			   -0.67082039325f,   0.16245984812f,   0.72360679775f,   0.68819096024f,   0.5f,   0.52573111212f,   -0.27639320225f,   0.85065080835f,   -0.4472135955f,
+			   0.4472135955f,   0.52573111212f,   0.72360679775f,   0.85065080835f,   0.0f,   -0.52573111212f,   -0.27639320225f,   0.85065080835f,   -0.4472135955f,
+			   0.9472135955f,   0.16245984812f,   -0.27639320225f,   -0.16245984812f,   -0.5f,   -0.85065080835f,   -0.27639320225f,   0.85065080835f,   -0.4472135955f,
+			   0.4472135955f,   0.0f,   -0.894427191f,   0.0f,   -1.0f,   0.0f,   -0.894427191f,   0.0f,   -0.4472135955f,
+			   0.13819660113f,   -0.9510565163f,   -0.27639320225f,   -0.42532540418f,   -0.30901699437f,   0.85065080835f,   -0.894427191f,   0.0f,   -0.4472135955f,
+			   -0.36180339887f,   -0.58778525229f,   0.72360679775f,   -0.26286555606f,   0.80901699437f,   0.52573111212f,   -0.894427191f,   0.0f,   -0.4472135955f,
+			   -0.36180339887f,   0.58778525229f,   0.72360679775f,   0.26286555606f,   0.80901699437f,   -0.52573111212f,   -0.894427191f,   0.0f,   -0.4472135955f,
+			   0.13819660113f,   0.9510565163f,   -0.27639320225f,   0.42532540418f,   -0.30901699437f,   -0.85065080835f,   -0.894427191f,   0.0f,   -0.4472135955f,
+			   0.13819660113f,   0.42532540418f,   -0.894427191f,   0.9510565163f,   -0.30901699437f,   0.0f,   -0.27639320225f,   -0.85065080835f,   -0.4472135955f,
+			   0.9472135955f,   -0.16245984812f,   -0.27639320225f,   0.16245984812f,   -0.5f,   0.85065080835f,   -0.27639320225f,   -0.85065080835f,   -0.4472135955f,
+			   0.4472135955f,   -0.52573111212f,   0.72360679775f,   -0.85065080835f,   0.0f,   0.52573111212f,   -0.27639320225f,   -0.85065080835f,   -0.4472135955f,
+			   -0.67082039325f,   -0.16245984812f,   0.72360679775f,   -0.68819096024f,   0.5f,   -0.52573111212f,   -0.27639320225f,   -0.85065080835f,   -0.4472135955f,
+			   -0.86180339887f,   0.42532540418f,   -0.27639320225f,   0.42532540418f,   0.30901699437f,   -0.85065080835f,   -0.27639320225f,   -0.85065080835f,   -0.4472135955f,
+			   -0.36180339887f,   0.26286555606f,   -0.894427191f,   0.58778525229f,   0.80901699437f,   0.0f,   0.72360679775f,   -0.52573111212f,   -0.4472135955f,
+			   0.4472135955f,   0.85065080835f,   -0.27639320225f,   0.52573111212f,   0.0f,   0.85065080835f,   0.72360679775f,   -0.52573111212f,   -0.4472135955f,
+			   0.63819660113f,   0.26286555606f,   0.72360679775f,   -0.26286555606f,   -0.80901699437f,   0.52573111212f,   0.72360679775f,   -0.52573111212f,   -0.4472135955f,
+			   -0.0527864045f,   -0.68819096024f,   0.72360679775f,   -0.68819096024f,   -0.5f,   -0.52573111212f,   0.72360679775f,   -0.52573111212f,   -0.4472135955f,
+			   -0.67082039325f,   -0.68819096024f,   -0.27639320225f,   -0.16245984812f,   0.5f,   -0.85065080835f,   0.72360679775f,   -0.52573111212f,   -0.4472135955f,
+			   -1.0f,   0.0f,   0.0f,   0.0f,   1.0f,   0.0f,   0.0f,   0.0f,   -1.0f,
+			   -0.30901699437f,   0.9510565163f,   0.0f,   0.9510565163f,   0.30901699437f,   0.0f,   0.0f,   0.0f,   -1.0f,
+			   0.80901699437f,   0.58778525229f,   0.0f,   0.58778525229f,   -0.80901699437f,   0.0f,   0.0f,   0.0f,   -1.0f,
+			   0.80901699437f,   -0.58778525229f,   0.0f,   -0.58778525229f,   -0.80901699437f,   0.0f,   0.0f,   0.0f,   -1.0f,
+			   -0.30901699437f,   -0.9510565163f,   0.0f,   -0.9510565163f,   0.30901699437f,   0.0f,   0.0f,   0.0f,   -1.0f
+			};
+
+			for (int k=0;k<nsym;k++) {
+				Transform t;
+				for (int i=0; i<3; i++) {
+					for (int j=0; j<3; j++) {
+						t[i][j] = TET[9*k + i*3 +j];
+					}
 				}
+				//vector<float> z = t.get_matrix();
+				//for (int i=0; i<12; i++)  cout<<z[i]<<endl;
+				ops.push_back(t);
 			}
-			//vector<float> z = t.get_matrix();
-			//for (int i=0; i<12; i++)  cout<<z[i]<<endl;
-			ret.push_back( (*this) * t );
-		}
-	} else {
-		Symmetry3D* sym = Factory<Symmetry3D>::get(lstr);
-		nsym = sym->get_nsym();
-		for (int k=0;k<nsym;k++) {
-			Transform t;
-			t =  sym->get_sym(k);
-			ret.push_back( (*this) * t );
 		}
-		delete sym;
+		return ops;
+	}
+
+	pthread_mutex_t sym_proj_lock = PTHREAD_MUTEX_INITIALIZER;
+	/// entries are never removed, so references handed out stay valid
+	map<string, vector<Transform>* > sym_proj_cache;
+
+	/** The operators get_sym_proj composes with, built once per symmetry */
+	const vector<Transform>& sym_proj_ops(const string & sym_name)
+	{
+		string lstr = Util::str_to_lower(sym_name);
+		if (lstr != "tet" && lstr != "oct" && lstr != "icos") return Symmetry3D::get_cached_symmetries(lstr);
+
+		pthread_mutex_lock(&sym_proj_lock);
+		vector<Transform>*& ops = sym_proj_cache[lstr];
+		if (ops == 0) ops = new vector<Transform>(sparx_sym_ops(lstr));
+		pthread_mutex_unlock(&sym_proj_lock);
+		return *ops;
 	}
+}
+
+vector<Transform > Transform::get_sym_proj(const string & sym_name) const
+{
+	vector<Transform> ret;
+	get_sym_proj(sym_name, ret);
 	return ret;
 }
 
+void Transform::get_sym_proj(const string & sym_name, vector<Transform> & ret) const
+{
+	const vector<Transform>& ops = sym_proj_ops(sym_name);
+	size_t nsym = ops.size();
+	ret.resize(nsym);
+	// (*this)*ops[k] for every operator, as operator* computes it, without the temporaries
+	for (size_t k = 0; k < nsym; k++) {
+		const Transform& op = ops[k];
+		Transform& t = ret[k];
+		for (int i=0; i<3; i++) {
+			for (int j=0; j<4; j++) {
+				t.matrix[i][j] = matrix[i][0] * op.matrix[0][j] + matrix[i][1] * op.matrix[1][j] + matrix[i][2] * op.matrix[2][j];
+			}
+			t.matrix[i][3] += matrix[i][3];
+		}
+	}
+}
+
 
 int Transform::get_nsym(const string & sym_name)
 {
-	Symmetry3D* sym = Factory<Symmetry3D>::get(sym_name);
-	int nsym = sym->get_nsym();
-	delete sym;
-	return nsym;
+	return (int)Symmetry3D::get_cached_symmetries(sym_name).size();
 }
 
 //
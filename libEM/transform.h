@@ -484,6 +484,13 @@ namespace EMAN
 			Transform get_sym_sparx(const string & sym, int n) const;
 			vector<Transform > get_sym_proj(const string & sym) const;
 
+			/** As get_sym_proj, filling ret (which is resized) rather than returning a new vector.
+			 * The operators for each symmetry are built once per process and shared.
+			 * @param sym the symmetry name
+			 * @param ret this Transform multiplied by each symmetry operator
+			 */
+			void get_sym_proj(const string & sym, vector<Transform> & ret) const;
+
 			/**
 			*/
 			void copy_matrix_into_array(float* const) const;
@@ -583,6 +590,136 @@ namespace EMAN
 		set_trans(trans.get_trans());
 	}
 
+	/** TransformBatch holds many Transforms in structure-of-arrays form. Element (r,c) of
+	 * every matrix is stored contiguously, so operations over the whole batch are simple
+	 * loops over float arrays, which the compiler vectorizes. It is meant for the places
+	 * where very large numbers of orientations are made or combined, eg - orientation
+	 * generation and symmetry expansion/reduction.
+	 *
+	 * Entries hold the same 3x4 matrix as a Transform, so conversion in either direction
+	 * is exact, and products/inverses follow operator* and Transform::invert.
+	 * The Euler and quaternion conversions follow Transform::set_rotation and
+	 * Transform::get_rotation, without going through a Dict.
+	 * @ingroup tested3c
+	 */
+	class TransformBatch {
+		public:
+			/** An empty batch */
+			TransformBatch();
+
+			/** A batch of n identity transforms
+			 * @param n the number of entries
+			 */
+			explicit TransformBatch(size_t n);
+
+			/** Construct from a list of Transforms
+			 * @param v the transforms to copy
+			 */
+			TransformBatch(const vector<Transform>& v);
+
+			/** @return the number of entries */
+			inline size_t size() const { return n; }
+
+			/** Change the number of entries. New entries are the identity.
+			 * @param newsize the new number of entries
+			 */
+			void resize(size_t newsize);
+
+			/** Reserve storage for at least cap entries */
+			void reserve(size_t cap);
+
+			/** Remove all entries */
+			void clear();
+
+			/** Append a Transform */
+			void push_back(const Transform& t);
+
+			/** Append a pure rotation given in the EMAN convention. This is equivalent to
+			 * push_back(Transform(Dict("type","eman","az",az,"alt",alt,"phi",phi)))
+			 */
+			void push_back_eman(double az, double alt, double phi);
+
+			/** Append all entries of another batch */
+			void append(const TransformBatch& b);
+
+			/** @return entry i as a Transform */
+			Transform get(size_t i) const;
+
+			/** Replace entry i */
+			void set(size_t i, const Transform& t);
+
+			/** @return all entries as Transforms */
+			vector<Transform> to_vector() const;
+
+			/** Direct access to matrix element (r,c) of every entry, as with Transform::operator[]
+			 * column 3 is the translation. Only valid while the size is unchanged.
+			 * @param r the row (0-2)
+			 * @param c the column (0-3)
+			 * @return an array of size() values
+			 */
+			inline float* element(int r, int c) { return n ? &m[r*4+c][0] : 0; }
+			inline const float* element(int r, int c) const { return n ? &m[r*4+c][0] : 0; }
+
+			/** Set the rotation of every entry from EMAN Euler angles (degrees). Translations
+			 * are kept, scale and mirroring are reset.
+			 * @param az size() azimuths
+			 * @param alt size() altitudes
+			 * @param phi size() phis
+			 */
+			void set_rotations_eman(const float* az, const float* alt, const float* phi);
+
+			/** Get the EMAN Euler angles (degrees) of every entry, as get_rotation("eman")
+			 * @param az output, size() azimuths
+			 * @param alt output, size() altitudes
+			 * @param phi output, size() phis
+			 */
+			void get_rotations_eman(float* az, float* alt, float* phi) const;
+
+			/** Set the rotation of every entry from unit quaternions. Translations are kept,
+			 * scale and mirroring are reset.
+			 */
+			void set_rotations_quaternion(const float* e0, const float* e1, const float* e2, const float* e3);
+
+			/** Get the quaternion of every entry, as get_rotation("quaternion") */
+			void get_rotations_quaternion(float* e0, float* e1, float* e2, float* e3) const;
+
+			/** Invert every entry, as Transform::invert */
+			void invert();
+
+			/** @return a batch holding the inverse of every entry */
+			TransformBatch inverse() const;
+
+			/** Replace every entry M with M*t (eg - applying a symmetry operator)
+			 * @param t the right hand operand
+			 */
+			void right_multiply(const Transform& t);
+
+			/** Replace every entry M with t*M
+			 * @param t the left hand operand
+			 */
+			void left_multiply(const Transform& t);
+
+			/** Entry by entry product, out[i] = a[i]*b[i]. out may be a or b.
+			 * @exception InvalidParameterException if a and b differ in size
+			 */
+			static void multiply(const TransformBatch& a, const TransformBatch& b, TransformBatch& out);
+
+			/** Apply every entry to the same point, o[i] = M[i]*(x,y,z) */
+			void transform(float x, float y, float z, float* ox, float* oy, float* oz) const;
+
+			/** Apply entry i to point i, o[i] = M[i]*(x[i],y[i],z[i]). The outputs may alias the inputs. */
+			void transform(const float* x, const float* y, const float* z, float* ox, float* oy, float* oz) const;
+
+			/** Multiply the same row vector by the 3x3 part of every entry, o[i] = (x,y,z)*M[i].
+			 * For pure rotations this applies the inverse rotation, as operator*(Vec3f,Transform)
+			 */
+			void transpose_transform(float x, float y, float z, float* ox, float* oy, float* oz) const;
+
+		private:
+			size_t n;
+			vector<float> m[12];
+	};
+
 	/** Transform3D
 	 * These are  a collection of transformation tools: rotation, translation,
 	 * and construction of symmetric objects
@@ -40,6 +40,8 @@
 #include <ctf.h>
 #include <emdata.h>
 #include <emobject.h>
+#include <moviealign.h>
+#include <simmx.h>
 #include <xydata.h>
 
 #include "emdata_pickle.h"
@@ -458,6 +460,68 @@ struct EMAN_EMAN2Ctf_Wrapper: EMAN::EMAN2Ctf
     PyObject* py_self;
 };
 
+// The matrices are returned as a list owned by Python
+list EMAN_SimilarityMatrix_compute(EMAN::SimilarityMatrix& self, const std::vector<EMAN::EMData*>& refs, const std::vector<EMAN::EMData*>& ptcls, bool saveali)
+{
+    std::vector<EMAN::EMData*> mx = self.compute(refs, ptcls, saveali);
+    list ret;
+    for (size_t i = 0; i < mx.size(); i++) {
+        ret.append(*mx[i]);
+        delete mx[i];
+    }
+    return ret;
+}
+
+// Results are returned as a list with one list of solutions per volume. The search runs without the GIL.
+list EMAN_RT3DTreeAligner_xform_align_nbest_batch(const EMAN::RT3DTreeAligner& self, const EMAN::RT3DTreePyramid& this_img, const std::vector<EMAN::EMData*>& to_imgs, unsigned int nsoln)
+{
+    std::vector< std::vector<EMAN::Dict> > solns;
+    PyThreadState *state = PyEval_SaveThread();
+    try {
+        solns = self.xform_align_nbest_batch(this_img, to_imgs, nsoln);
+    }
+    catch (...) {
+        PyEval_RestoreThread(state);
+        throw;
+    }
+    PyEval_RestoreThread(state);
+
+    list ret;
+    for (size_t i = 0; i < solns.size(); i++) ret.append(solns[i]);
+    return ret;
+}
+
+// Movie alignment and averaging run on worker threads, without the GIL
+std::vector<float> EMAN_MovieAligner_align(EMAN::MovieAligner& self, const std::vector<EMAN::EMData*>& frames)
+{
+    std::vector<float> traj;
+    PyThreadState *state = PyEval_SaveThread();
+    try {
+        traj = self.align(frames);
+    }
+    catch (...) {
+        PyEval_RestoreThread(state);
+        throw;
+    }
+    PyEval_RestoreThread(state);
+    return traj;
+}
+
+EMAN::EMData* EMAN_MovieAligner_average(const EMAN::MovieAligner& self, const std::vector<EMAN::EMData*>& frames, const std::vector<float>& traj, bool dose_weight)
+{
+    EMAN::EMData *avg = 0;
+    PyThreadState *state = PyEval_SaveThread();
+    try {
+        avg = self.average(frames, traj, dose_weight);
+    }
+    catch (...) {
+        PyEval_RestoreThread(state);
+        throw;
+    }
+    PyEval_RestoreThread(state);
+    return avg;
+}
+
 }// namespace
 
 
@@ -477,6 +541,62 @@ BOOST_PYTHON_MODULE(libpyAligner2)
         .def("get_param_types", pure_virtual(&EMAN::Aligner::get_param_types))
     ;
 
+    class_< EMAN::RT3DTreePyramid, boost::noncopyable >("RT3DTreePyramid",
+    		"The downsampled Fourier-space levels of a volume searched by RT3DTreeAligner. Make one for a\n"
+    		"reference aligned against many volumes and pass it to RT3DTreeAligner.xform_align_nbest_batch.",
+    		init< EMAN::EMData* >(args("image")))
+        .def("get_ny", &EMAN::RT3DTreePyramid::get_ny, "Box size of the original volume")
+        .def("get_nlevels", &EMAN::RT3DTreePyramid::get_nlevels)
+        .def("get_size", &EMAN::RT3DTreePyramid::get_size, args("level"), "Box size of a level")
+    ;
+
+    class_< EMAN::RT3DTreeAligner, bases< EMAN::Aligner >, boost::noncopyable >("RT3DTreeAligner",
+    		"The rotate_translate_3d_tree aligner, with calls taking a prepared RT3DTreePyramid for 'this'.",
+    		init<>())
+        .def("xform_align_nbest", &EMAN::Aligner::xform_align_nbest)
+        .def("xform_align_nbest", (std::vector<EMAN::Dict> (EMAN::RT3DTreeAligner::*)(const EMAN::RT3DTreePyramid&, EMAN::EMData*, const unsigned int) const)&EMAN::RT3DTreeAligner::xform_align_nbest, args("this_img", "to_img", "nsoln"))
+        .def("xform_align_nbest_batch", &EMAN_RT3DTreeAligner_xform_align_nbest_batch, args("this_img", "to_imgs", "nsoln"), "Align each of to_imgs against the pyramid this_img in parallel. Returns a list of solution lists.")
+    ;
+
+    class_< EMAN::SimilarityMatrix, boost::noncopyable >("SimilarityMatrix",
+    		"Native similarity matrix computation for e2simmx.py. Each particle (row) is optionally aligned\n"
+    		"to each reference (column), then compared, with rows distributed over threads.",
+    		init< const std::string&, optional< const EMAN::Dict& > >((arg("cmp_name"), arg("cmp_params"))))
+        .def("set_align", &EMAN::SimilarityMatrix::set_align, (arg("name"), arg("params")=EMAN::Dict(), arg("cmp_name")="dot", arg("cmp_params")=EMAN::Dict()), "Align each reference to the particle before comparison")
+        .def("set_ralign", &EMAN::SimilarityMatrix::set_ralign, (arg("name"), arg("params")=EMAN::Dict(), arg("cmp_name")="dot", arg("cmp_params")=EMAN::Dict()), "Refine the first alignment with a second aligner")
+        .def("set_mask", &EMAN::SimilarityMatrix::set_mask, args("mask"), "Mask applied to the particle and each aligned reference before comparison")
+        .def("set_shrink", &EMAN::SimilarityMatrix::set_shrink, args("shrink"), "Downsample all images by this factor before processing")
+        .def("set_exclude", &EMAN::SimilarityMatrix::set_exclude, args("rows"), "Rows to skip, leaving zeros in the matrix")
+        .def("set_threads", &EMAN::SimilarityMatrix::set_threads, args("n"), "Number of threads, 0 for one per CPU")
+        .def("set_block_size", &EMAN::SimilarityMatrix::set_block_size, args("n"), "Rows computed between writes to the output file")
+        .def("set_verbose", &EMAN::SimilarityMatrix::set_verbose, args("verbose"))
+        .def("compute", &EMAN_SimilarityMatrix_compute, (arg("refs"), arg("ptcls"), arg("saveali")=false), "Compute the matrix for images in memory. Returns [score] or [score,dx,dy,alpha,mirror,scale] images, ncols x nrows.")
+        .def("compute_file", &EMAN::SimilarityMatrix::compute_file, (arg("reffile"), arg("ptclfile"), arg("outfile"), arg("c0")=0, arg("c1")=-1, arg("r0")=0, arg("r1")=-1, arg("saveali")=false),
+        		"Compute the matrix between two image files and write it in e2simmx format, resuming from a checkpoint if one exists")
+        .def("checkpoint_file", &EMAN::SimilarityMatrix::checkpoint_file, args("outfile"), "The checkpoint file compute_file() uses for outfile")
+        .staticmethod("checkpoint_file")
+    ;
+
+    class_< EMAN::MovieAligner, boost::noncopyable >("MovieAligner",
+    		"Whole-frame alignment of direct detector movies. Tile FFTs are computed once per frame and reused\n"
+    		"for all pairwise CCFs, which run in parallel. The pairwise shifts are fit to a trajectory.",
+    		init<>())
+        .def("set_references", &EMAN::MovieAligner::set_references, (arg("dark"), arg("gain")), "Dark and gain references used by correct(). Either may be None.")
+        .def("set_tiles", &EMAN::MovieAligner::set_tiles, (arg("box"), arg("step")), "Tile size and spacing used for alignment, in unshrunk pixels")
+        .def("set_shrink", &EMAN::MovieAligner::set_shrink, args("n"), "Mean-shrink frames by this factor before tiling")
+        .def("set_highpass", &EMAN::MovieAligner::set_highpass, args("pixels"), "Gaussian high-pass radius in Fourier pixels of the shrunk tiles")
+        .def("set_alpha", &EMAN::MovieAligner::set_alpha, args("alpha"), "Ridge penalty on frame-to-frame steps, 0 for none")
+        .def("set_dose", &EMAN::MovieAligner::set_dose, (arg("per_frame"), arg("pre_exposure")=0.0f, arg("voltage")=300.0f), "Exposure per frame and before the first frame (e/A^2), used for dose weighting")
+        .def("set_threads", &EMAN::MovieAligner::set_threads, args("n"), "Number of threads, 0 for one per CPU")
+        .def("set_verbose", &EMAN::MovieAligner::set_verbose, args("verbose"))
+        .def("correct", &EMAN::MovieAligner::correct, args("frames"), "Dark subtract and gain correct frames in place")
+        .def("align", &EMAN_MovieAligner_align, args("frames"), "Align frames. Returns [x0,y0,x1,y1,...], the translation bringing each frame onto frame 0.")
+        .def("get_quality", &EMAN::MovieAligner::get_quality, "Per-frame summed peak strength from the last align()")
+        .def("get_pair_shifts", &EMAN::MovieAligner::get_pair_shifts, "dx,dy,weight for each pair i<j from the last align(); rejected pairs have weight 0")
+        .def("average", &EMAN_MovieAligner_average, (arg("frames"), arg("traj"), arg("dose_weight")=false), return_value_policy< manage_new_object >(),
+        		"Shift frames by traj in Fourier space and average them, optionally dose weighted")
+    ;
+
 #ifdef SPARX_USING_CUDA
     class_< EMAN::CUDA_Aligner, boost::noncopyable>("CUDA_Aligner", init<int>())
     	.def("finish", &EMAN::CUDA_Aligner::finish)
@@ -624,6 +744,8 @@ BOOST_PYTHON_MODULE(libpyAligner2)
         .def("zero", (float (EMAN::EMAN2Ctf::*)(int) const)&EMAN::EMAN2Ctf::zero, (float (EMAN_EMAN2Ctf_Wrapper::*)(int) const)&EMAN_EMAN2Ctf_Wrapper::default_zero)
 		.def("get_phase",(float (EMAN::EMAN2Ctf::*)() const)&EMAN::EMAN2Ctf::get_phase,(float (EMAN::EMAN2Ctf::*)() const)&EMAN_EMAN2Ctf_Wrapper::default_get_phase)
 		.def("set_phase",(void (EMAN::EMAN2Ctf::*)(float) )&EMAN::EMAN2Ctf::set_phase,(void (EMAN::EMAN2Ctf::*)(float) )&EMAN_EMAN2Ctf_Wrapper::default_set_phase)
+		.def("set_image_cache_size", &EMAN::EMAN2Ctf::set_image_cache_size, args("bytes"), "Sets the memory budget for cached 2-D CTF images. 0 disables the cache.")
+		.staticmethod("set_image_cache_size")
     ;
 
 }
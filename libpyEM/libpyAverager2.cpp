@@ -39,6 +39,8 @@
 #include <averager.h>
 #include <emdata.h>
 #include <emobject.h>
+#include <sptavg.h>
+#include <transform.h>
 
 // Using =======================================================================
 using namespace boost::python;
@@ -118,6 +120,24 @@ void averager_add_image_wrapper(EMAN::Averager &ths, EMAN::EMData *img) {
 	ths.add_image(img);
 }
 
+void EMAN_SubtomoAverager_add_images(EMAN::SubtomoAverager& self, const std::vector<EMAN::EMData*>& images, const std::vector<EMAN::Transform>& xforms, const std::vector<float>& weights)
+{
+	GILRelease rel;
+	self.add_images(images, xforms, weights);
+}
+
+void EMAN_SubtomoAverager_add_images_1(EMAN::SubtomoAverager& self, const std::vector<EMAN::EMData*>& images, const std::vector<EMAN::Transform>& xforms)
+{
+	GILRelease rel;
+	self.add_images(images, xforms);
+}
+
+EMAN::EMData* EMAN_SubtomoAverager_finish(EMAN::SubtomoAverager& self, EMAN::EMData* weights)
+{
+	GILRelease rel;
+	return self.finish(weights);
+}
+
 
 }// namespace
 
@@ -146,6 +166,21 @@ BOOST_PYTHON_MODULE(libpyAverager2)
         .staticmethod("get")
     ;
 
+    class_< EMAN::SubtomoAverager, boost::noncopyable >("SubtomoAverager",
+    		"Fourier space subtomogram averaging with missing wedge weighting. Particle FFTs are sampled on the\n"
+    		"rotated grid rather than transformed in real space, and particles are summed in parallel.",
+    		init<>())
+        .def("set_thresh_sigma", &EMAN::SubtomoAverager::set_thresh_sigma, args("thresh_sigma"), "Fourier voxels below this fraction of the mean intensity at their radius are missing, <=0 to disable")
+        .def("set_maxtilt", &EMAN::SubtomoAverager::set_maxtilt, args("maxtilt"), "Maximum tilt in degrees about Y, Fourier voxels outside are missing. >=90 to disable")
+        .def("set_threads", &EMAN::SubtomoAverager::set_threads, args("n"), "Number of threads, 0 for one per CPU")
+        .def("add_image", &EMAN::SubtomoAverager::add_image, (arg("image"), arg("xform"), arg("weight")=1.0f), "Add one particle with its orientation (as used by the xform processor)")
+        .def("add_images", &EMAN_SubtomoAverager_add_images, args("images", "xforms", "weights"), "Add particles (real or their FFTs) with their orientations and weights")
+        .def("add_images", &EMAN_SubtomoAverager_add_images_1, args("images", "xforms"))
+        .def("get_count", &EMAN::SubtomoAverager::get_count, "Number of particles added since the last finish()")
+        .def("finish", &EMAN_SubtomoAverager_finish, (arg("weights")=object()), return_value_policy< manage_new_object >(),
+        		"Return the real space average. If weights is an EMData, it receives the summed weight per Fourier voxel.")
+    ;
+
     def("dump_averagers", &EMAN::dump_averagers);
     def("dump_averagers_list", &EMAN::dump_averagers_list);
 }
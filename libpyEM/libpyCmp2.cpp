@@ -39,6 +39,7 @@
 #include <cmp.h>
 #include <emdata.h>
 #include <emobject.h>
+#include <fsc.h>
 #include <log.h>
 #include <transform.h>
 #include <xydata.h>
@@ -113,6 +114,7 @@ BOOST_PYTHON_MODULE(libpyCmp2)
 
     class_< EMAN::Cmp, boost::noncopyable, EMAN_Cmp_Wrapper >("__Cmp", init<  >())
         .def("cmp", pure_virtual(&EMAN::Cmp::cmp))
+        .def("cmp_batch", &EMAN::Cmp::cmp_batch, args("image", "refs"), "Compare one image against each of a list of references, equivalent to [cmp(image,r) for r in refs]")
         .def("get_name", pure_virtual(&EMAN::Cmp::get_name))
         .def("get_desc", pure_virtual(&EMAN::Cmp::get_desc))
         .def("get_params", &EMAN::Cmp::get_params, &EMAN_Cmp_Wrapper::default_get_params)
@@ -120,6 +122,21 @@ BOOST_PYTHON_MODULE(libpyCmp2)
         .def("get_param_types", pure_virtual(&EMAN::Cmp::get_param_types))
     ;
 
+    class_< EMAN::FourierShellCorrelator, boost::noncopyable >("FourierShellCorrelator",
+    		"Fourier ring/shell correlation with the shell geometry cached per image size.\n"
+    		"Results match EMData.calc_fourier_shell_correlation(). Use FourierShellCorrelator.get(nx,ny,nz)\n"
+    		"rather than constructing one, so the geometry is shared.",
+    		init< int, int, optional< int, float > >())
+        .def("get", (EMAN::FourierShellCorrelator* (*)(int, int, int, float))&EMAN::FourierShellCorrelator::get, (arg("nx"), arg("ny"), arg("nz")=1, arg("width")=1.0f), return_value_policy< reference_existing_object >())
+        .staticmethod("get")
+        .def("calc_fsc", &EMAN::FourierShellCorrelator::calc_fsc, args("image", "with"), "FSC between two images in the EMData.calc_fourier_shell_correlation() format")
+        .def("calc_fsc_batch", &EMAN::FourierShellCorrelator::calc_fsc_batch, args("image", "refs"), "FSC between one image and each of a list of references")
+        .def("frc_cmp", &EMAN::FourierShellCorrelator::frc_cmp, args("image", "with", "params"), "The 'frc' comparator score between two images")
+        .def("frc_cmp_batch", &EMAN::FourierShellCorrelator::frc_cmp_batch, args("image", "refs", "params"), "'frc' comparator scores between one image and each of a list of references")
+        .def("get_nshells", &EMAN::FourierShellCorrelator::get_nshells)
+        .def("get_shell_counts", &EMAN::FourierShellCorrelator::get_shell_counts, return_value_policy< copy_const_reference >())
+    ;
+
     scope* EMAN_Log_scope = new scope(
     class_< EMAN::Log, boost::noncopyable >("Log",
     		"Log defines a way to output logging information.\n"
@@ -86,6 +86,78 @@ using namespace EMAN;
 		Py_END_ALLOW_THREADS
 		return ret;
 	}
+
+	// Reconstructor states are binary, so they cross to Python as bytes rather than str
+	object state_to_python(const string& state) {
+		return object(handle<>(PyBytes_FromStringAndSize(state.data(), state.size())));
+	}
+
+	string state_from_python(const object& obj) {
+		char* buf;
+		Py_ssize_t len;
+		if (PyBytes_AsStringAndSize(obj.ptr(), &buf, &len) < 0) throw_error_already_set();
+		return string(buf, len);
+	}
+
+	object reconstructor_get_state(Reconstructor &self, bool half_weights) {
+		string state;
+		PyThreadState *tstate = PyEval_SaveThread();
+		try {
+			state=self.get_state(half_weights);
+		}
+		catch (...) {
+			PyEval_RestoreThread(tstate);
+			throw;
+		}
+		PyEval_RestoreThread(tstate);
+		return state_to_python(state);
+	}
+
+	object reconstructor_get_state1(Reconstructor &self) {
+		return reconstructor_get_state(self, false);
+	}
+
+	void reconstructor_apply_state(Reconstructor &self, const object& obj, bool add) {
+		string state=state_from_python(obj);
+		PyThreadState *tstate = PyEval_SaveThread();
+		try {
+			if (add) self.merge_state(state);
+			else self.set_state(state);
+		}
+		catch (...) {
+			PyEval_RestoreThread(tstate);
+			throw;
+		}
+		PyEval_RestoreThread(tstate);
+	}
+
+	void reconstructor_set_state(Reconstructor &self, const object& obj) {
+		reconstructor_apply_state(self, obj, false);
+	}
+
+	void reconstructor_merge_state(Reconstructor &self, const object& obj) {
+		reconstructor_apply_state(self, obj, true);
+	}
+
+	object reconstructor_merge_states(const object& seq, bool half_weights) {
+		vector<string> states;
+		for (int i=0; i<len(seq); i++) states.push_back(state_from_python(seq[i]));
+		string merged;
+		PyThreadState *tstate = PyEval_SaveThread();
+		try {
+			merged=Reconstructor::merge_states(states, half_weights);
+		}
+		catch (...) {
+			PyEval_RestoreThread(tstate);
+			throw;
+		}
+		PyEval_RestoreThread(tstate);
+		return state_to_python(merged);
+	}
+
+	object reconstructor_merge_states1(const object& seq) {
+		return reconstructor_merge_states(seq, false);
+	}
 	
 struct EMAN_Reconstructor_Wrapper: EMAN::Reconstructor
 {
@@ -218,6 +290,10 @@ BOOST_PYTHON_MODULE(libpyReconstructor2)
         .def("set_params", &EMAN::Reconstructor::set_params, &EMAN_Reconstructor_Wrapper::default_set_params)
         .def("set_param", &EMAN::Reconstructor::set_param)
 		.def("print_params",  &EMAN::Reconstructor::print_params) // Why is this different to set_params and get_params? Why is the wrapper needed? d.woolford May 2007
+		.def("get_state", &reconstructor_get_state, args("half_weights"), "Returns the accumulated Fourier volume and weights as bytes, storing only non-zero spans. With half_weights the weights are stored as 16 bit floats.")
+		.def("get_state", &reconstructor_get_state1)
+		.def("set_state", &reconstructor_set_state, args("state"), "Replaces the accumulated volume and weights with bytes from get_state or merge_states. The reconstructor must be set up with the same parameters.")
+		.def("merge_state", &reconstructor_merge_state, args("state"), "Adds bytes from get_state or merge_states to the accumulated volume and weights.")
         .def("get_param_types", pure_virtual(&EMAN::Reconstructor::get_param_types))
     ;
 
@@ -227,6 +303,9 @@ BOOST_PYTHON_MODULE(libpyReconstructor2)
         .def("get_list", &EMAN::Factory<EMAN::Reconstructor>::get_list)
         .staticmethod("get_list")
         .staticmethod("get")
+        .def("merge_states", &reconstructor_merge_states, args("states", "half_weights"), "Sums a list of states from get_state into a single state, e.g. at each node of a reduction tree.")
+        .def("merge_states", &reconstructor_merge_states1)
+        .staticmethod("merge_states")
     ;
 
 
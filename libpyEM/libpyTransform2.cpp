@@ -144,6 +144,88 @@ BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(EMAN_Transform_translate_overloads_2_3, t
 BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(EMAN_Transform_translate_newbasis_overloads_2_3, translate_newBasis,3, 4)
 BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(EMAN_Transform_get_rotation_overloads_0_1, get_rotation, 0, 1)
 
+void check_batch_size(const EMAN::TransformBatch& b, size_t n)
+{
+	if (n != b.size()) throw EMAN::InvalidParameterException("The number of values must match the size of the TransformBatch");
+}
+
+tuple EMAN_TransformBatch_get_rotations_eman(const EMAN::TransformBatch& b)
+{
+	size_t n = b.size();
+	std::vector<float> az(n), alt(n), phi(n);
+	if (n) b.get_rotations_eman(&az[0],&alt[0],&phi[0]);
+	return boost::python::make_tuple(az,alt,phi);
+}
+
+void EMAN_TransformBatch_set_rotations_eman(EMAN::TransformBatch& b, const std::vector<float>& az,
+											const std::vector<float>& alt, const std::vector<float>& phi)
+{
+	check_batch_size(b,az.size());
+	check_batch_size(b,alt.size());
+	check_batch_size(b,phi.size());
+	if (b.size()) b.set_rotations_eman(&az[0],&alt[0],&phi[0]);
+}
+
+tuple EMAN_TransformBatch_get_rotations_quaternion(const EMAN::TransformBatch& b)
+{
+	size_t n = b.size();
+	std::vector<float> e0(n), e1(n), e2(n), e3(n);
+	if (n) b.get_rotations_quaternion(&e0[0],&e1[0],&e2[0],&e3[0]);
+	return boost::python::make_tuple(e0,e1,e2,e3);
+}
+
+void EMAN_TransformBatch_set_rotations_quaternion(EMAN::TransformBatch& b, const std::vector<float>& e0,
+		const std::vector<float>& e1, const std::vector<float>& e2, const std::vector<float>& e3)
+{
+	check_batch_size(b,e0.size());
+	check_batch_size(b,e1.size());
+	check_batch_size(b,e2.size());
+	check_batch_size(b,e3.size());
+	if (b.size()) b.set_rotations_quaternion(&e0[0],&e1[0],&e2[0],&e3[0]);
+}
+
+std::vector<EMAN::Vec3f> EMAN_TransformBatch_transform(const EMAN::TransformBatch& b, const EMAN::Vec3f& v)
+{
+	size_t n = b.size();
+	std::vector<float> x(n), y(n), z(n);
+	if (n) b.transform(v[0],v[1],v[2],&x[0],&y[0],&z[0]);
+	std::vector<EMAN::Vec3f> ret(n);
+	for (size_t i = 0; i < n; i++) ret[i] = EMAN::Vec3f(x[i],y[i],z[i]);
+	return ret;
+}
+
+EMAN::TransformBatch EMAN_TransformBatch_multiply(const EMAN::TransformBatch& a, const EMAN::TransformBatch& b)
+{
+	EMAN::TransformBatch ret;
+	EMAN::TransformBatch::multiply(a,b,ret);
+	return ret;
+}
+
+tuple EMAN_OrientationIndex_nearest_angles(const EMAN::OrientationIndex& index, const EMAN::Transform& t, int k)
+{
+	std::vector<int> idx;
+	std::vector<float> ang;
+	index.nearest(t,k,idx,ang);
+	return boost::python::make_tuple(idx,ang);
+}
+
+std::vector<int> EMAN_OrientationIndex_nearest_batch(const EMAN::OrientationIndex& index, const std::vector<EMAN::Transform>& t, int k, int nthreads=0)
+{
+	std::vector<int> ret;
+	PyThreadState *state = PyEval_SaveThread();
+	try {
+		ret = index.nearest_batch(t,k,nthreads);
+	}
+	catch (...) {
+		PyEval_RestoreThread(state);
+		throw;
+	}
+	PyEval_RestoreThread(state);
+	return ret;
+}
+
+BOOST_PYTHON_FUNCTION_OVERLOADS(EMAN_OrientationIndex_nearest_batch_overloads_3_4, EMAN_OrientationIndex_nearest_batch, 3, 4)
+
 }// namespace
 
 
@@ -188,6 +270,10 @@ BOOST_PYTHON_MODULE(libpyTransform2)
 		.def("point_in_which_asym_unit", &EMAN::Symmetry3D::point_in_which_asym_unit, args("v"), "A function that will determine in which asymmetric unit a given vector resides\nThe asymmetric unit 'number' will depend entirely on the order in which different\nsymmetry operations are return by the Symmetry3D::get_sym function\n \nv a Vec3f characterizing a point\n \nreturn the asymmetric unit number the the orientation is in\n")
 		.def("get_touching_au_transforms",&EMAN::Symmetry3D::get_touching_au_transforms, args("inc_mirror"), "Gets a vector of Transform objects that define the set of asymmetric units that touch the default\nasymmetric unit. The 'default asymmetric unit' is defined by the results of Symmetry3d::get_asym_unit_points\nand is sensitive to whether or not you want to include the mirror part of the asymmetric unit.\nThis function is useful when used in conjunction with Symmetry3D::reduce, and particularly when finding\nthe angular deviation of particles through different stages of iterative Single Particle Reconstruction\nThis function could be expanded to work for an asymmetric unit number supplied by the user.\n \ninc_mirror - whether or not to include the mirror portion of the asymmetric unit\n \nreturn a vector of Transform objects that map the default asymmetric unit to the neighboring asymmetric unit\n")
 		.def("get_syms", &EMAN::Symmetry3D::get_syms, "")
+		.def("get_syms_batch", &EMAN::Symmetry3D::get_syms_batch, "All of the symmetry operators as a TransformBatch\n")
+		.def("gen_orientations_batch", &EMAN::Symmetry3D::gen_orientations_batch, args("generatorname", "parms"), "As gen_orientations, but the orientations are returned as a TransformBatch\n \ngeneratorname - the string name of the OrientationGenerator\nparms - the parameters handed to OrientationGenerator::set_params after initial construction\n \nreturn a TransformBatch of orientations\n")
+		.def("reduce_batch", (EMAN::TransformBatch (EMAN::Symmetry3D::*)(const EMAN::TransformBatch&, int) const)&EMAN::Symmetry3D::reduce_batch, args("t3d", "n"), "Reduce every orientation in a TransformBatch, giving the same results as calling reduce on each\n \nt3d - a TransformBatch of orientations\nn - the number of the asymmetric unit to map the orientations into\n \nreturn a TransformBatch of reduced orientations\n")
+		.def("in_which_asym_unit_batch", &EMAN::Symmetry3D::in_which_asym_unit_batch, args("t3d"), "in_which_asym_unit for every orientation in a TransformBatch, with identical results\n \nt3d - a TransformBatch of orientations\n \nreturn a list of asymmetric unit numbers, -1 where none was found\n")
 		.def("get_symmetries", &EMAN::Symmetry3D::get_symmetries, "")
 		.staticmethod("get_symmetries")
 		;
@@ -213,6 +299,18 @@ BOOST_PYTHON_MODULE(libpyTransform2)
 		.staticmethod("get_list")
 		.staticmethod("get")
 		;
+
+	class_< EMAN::OrientationIndex, boost::noncopyable >("OrientationIndex",
+			"Finds the reference orientations nearest to a query orientation, by the angle between their projection\n"
+			"directions. With a symmetry, each reference stands for all of its symmetry related orientations.",
+			init< const std::vector<EMAN::Transform>&, optional< const std::string& > >(args("refs", "sym")))
+		.def("get_nrefs", &EMAN::OrientationIndex::get_nrefs, "The number of references\n")
+		.def("nearest", (std::vector<int> (EMAN::OrientationIndex::*)(const EMAN::Transform&, int) const)&EMAN::OrientationIndex::nearest, args("t", "k"), "Find the nearest references to an orientation\n \nt - the query orientation\nk - the number of references to find\n \nreturn the indices of up to k references, nearest first\n")
+		.def("nearest_angles", &EMAN_OrientationIndex_nearest_angles, args("t", "k"), "As nearest, returning a tuple of the indices and the angles to them in degrees\n")
+		.def("within", &EMAN::OrientationIndex::within, args("t", "maxang"), "Find every reference within maxang degrees of an orientation, nearest first\n")
+		.def("nearest_batch", &EMAN_OrientationIndex_nearest_batch, EMAN_OrientationIndex_nearest_batch_overloads_3_4(args("index", "t", "k", "nthreads"), "nearest for a list of orientations, spread over several threads\n \nt - the query orientations\nk - the number of references to find for each\nnthreads - the number of threads, 0 for the default\n \nreturn k indices per query, query after query. Unused places are -1\n"))
+		.def("angle", &EMAN::OrientationIndex::angle, args("t1", "t2"), "The angle in degrees between the projection directions of two orientations, allowing for the symmetry\n")
+		;
 	typedef void (EMAN::Vec4f::*vec4f_set_value_at_float)(int, const float&);
 	typedef void (EMAN::Vec4f::*vec4f_set_value_float)(const float&, const float&, const float&, const float&);
 	typedef float (EMAN::Vec4f::*vec4f_at_float)(int) const;	
@@ -610,7 +708,7 @@ BOOST_PYTHON_MODULE(libpyTransform2)
 		.def("at", &EMAN::Transform::at, "Get the value stored in the internal transformation matrix at at coordinate (r,c)\n")
 		.def("get_nsym", &EMAN::Transform::get_nsym, args("sym"), "get the number of symmetries associated with the given symmetry name\n")
 		.def("get_sym", &EMAN::Transform::get_sym, args("sym", "n"), "Apply the symmetry deduced from the function arguments to this Transform and\nreturn the result\n")
-		.def("get_sym_proj", &EMAN::Transform::get_sym_proj, args("sym", "s"), "Who knows  Apply the symmetry deduced from the function arguments to this Transform and\nreturn the result\n")
+		.def("get_sym_proj", (std::vector<EMAN::Transform> (EMAN::Transform::*)(const std::string&) const)&EMAN::Transform::get_sym_proj, args("sym", "s"), "Who knows  Apply the symmetry deduced from the function arguments to this Transform and\nreturn the result\n")
 		.def("get_scale", &EMAN::Transform::get_scale, "Get the scale that was applied\n \nreturn the scale factor\n")
 		.def("scale", &EMAN::Transform::scale, args("scale"), "Increment the scale\n \nscale - the amount to scale by\n")
 		.def("to_identity", &EMAN::Transform::to_identity, "Force the internal matrix to become the identity\n")
@@ -635,6 +733,37 @@ BOOST_PYTHON_MODULE(libpyTransform2)
 		.def("__ne__", (bool (EMAN::Transform::*)(const EMAN::Transform&) const)&EMAN::Transform::operator!=)
 	;
 
+	class_< EMAN::TransformBatch >("TransformBatch",
+			"TransformBatch holds many Transforms in structure-of-arrays form, so operations over all of\n"
+			"them (products, inverses, Euler/quaternion conversion, symmetry expansion) run as simple loops.\n"
+			"Entries convert to and from Transform exactly.",
+			init<  >())
+		.def(init< size_t >())
+		.def(init< const EMAN::TransformBatch& >())
+		.def(init< const std::vector<EMAN::Transform>& >())
+		.def("__len__", &EMAN::TransformBatch::size)
+		.def("size", &EMAN::TransformBatch::size, "return the number of entries\n")
+		.def("resize", &EMAN::TransformBatch::resize, args("newsize"), "Change the number of entries, new entries are the identity\n")
+		.def("clear", &EMAN::TransformBatch::clear)
+		.def("append", &EMAN::TransformBatch::push_back, args("t"), "Append a Transform\n")
+		.def("append_eman", &EMAN::TransformBatch::push_back_eman, args("az", "alt", "phi"), "Append a rotation given by EMAN Euler angles (degrees)\n")
+		.def("extend", &EMAN::TransformBatch::append, args("b"), "Append all entries of another TransformBatch\n")
+		.def("get", &EMAN::TransformBatch::get, args("i"), "return entry i as a Transform\n")
+		.def("set", &EMAN::TransformBatch::set, args("i", "t"), "Replace entry i\n")
+		.def("to_list", &EMAN::TransformBatch::to_vector, "return all entries as a list of Transforms\n")
+		.def("get_rotations_eman", &EMAN_TransformBatch_get_rotations_eman, "return a tuple of lists (az,alt,phi), as Transform.get_rotation('eman') on each entry\n")
+		.def("set_rotations_eman", &EMAN_TransformBatch_set_rotations_eman, args("az", "alt", "phi"), "Set the rotation of every entry from lists of EMAN Euler angles. Translations are kept\n")
+		.def("get_rotations_quaternion", &EMAN_TransformBatch_get_rotations_quaternion, "return a tuple of lists (e0,e1,e2,e3), as Transform.get_rotation('quaternion') on each entry\n")
+		.def("set_rotations_quaternion", &EMAN_TransformBatch_set_rotations_quaternion, args("e0", "e1", "e2", "e3"), "Set the rotation of every entry from lists of quaternion components. Translations are kept\n")
+		.def("invert", &EMAN::TransformBatch::invert, "Invert every entry\n")
+		.def("inverse", &EMAN::TransformBatch::inverse, "return a TransformBatch of the inverses\n")
+		.def("right_multiply", &EMAN::TransformBatch::right_multiply, args("t"), "Replace every entry M with M*t\n")
+		.def("left_multiply", &EMAN::TransformBatch::left_multiply, args("t"), "Replace every entry M with t*M\n")
+		.def("multiply", &EMAN_TransformBatch_multiply, args("a", "b"), "return the entry by entry product a[i]*b[i]\n")
+		.staticmethod("multiply")
+		.def("transform", &EMAN_TransformBatch_transform, args("v"), "return a list of M*v for every entry M\n")
+	;
+
 }
 
 
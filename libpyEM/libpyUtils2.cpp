@@ -50,6 +50,10 @@
 #include "ctf.h"
 #include "geometry.h"
 #include "portable_fileio.h"
+#include "parallel.h"
+#include "moviereader.h"
+#include "imagewriter.h"
+#include "headerindex.h"
 
 // Using =======================================================================
 using namespace boost::python;
@@ -259,6 +263,126 @@ BOOST_PYTHON_FUNCTION_OVERLOADS(EMAN_TestUtil_make_image_file2_overloads_2_6, EM
 
 BOOST_PYTHON_FUNCTION_OVERLOADS(EMAN_TestUtil_verify_image_file2_overloads_2_6, EMAN::TestUtil::verify_image_file2, 2, 6)
 
+// ImageWriter calls may block on the writer thread, so they run without the GIL.
+// Python always queues a copy, since the caller's object stays alive in Python.
+void ImageWriter_write(EMAN::ImageWriter &w, EMAN::EMData *image, int img_index=-1)
+{
+	PyThreadState *state = PyEval_SaveThread();
+	try {
+		w.write(image, img_index, true);
+	}
+	catch (...) {
+		PyEval_RestoreThread(state);
+		throw;
+	}
+	PyEval_RestoreThread(state);
+}
+
+BOOST_PYTHON_FUNCTION_OVERLOADS(ImageWriter_write_overloads_2_3, ImageWriter_write, 2, 3)
+
+void ImageWriter_wait(EMAN::ImageWriter &w, bool close)
+{
+	PyThreadState *state = PyEval_SaveThread();
+	try {
+		if (close) w.close();
+		else w.flush();
+	}
+	catch (...) {
+		PyEval_RestoreThread(state);
+		throw;
+	}
+	PyEval_RestoreThread(state);
+}
+
+void ImageWriter_flush(EMAN::ImageWriter &w) { ImageWriter_wait(w, false); }
+
+void ImageWriter_close(EMAN::ImageWriter &w) { ImageWriter_wait(w, true); }
+
+// The column is returned as a read-only array over the mapping, int32 or float32 as stored.
+// The array holds a reference to the HeaderIndex, which owns the mapping.
+object HeaderIndex_get_column(object self, const std::string &key)
+{
+	const EMAN::HeaderIndex &idx = extract<const EMAN::HeaderIndex &>(self);
+	const void *data = idx.get_column_data(key);
+	int type = (idx.get_type(key) == EMAN::HeaderIndex::INDEX_INT ? NPY_INT32 : NPY_FLOAT32);
+	npy_intp dims[1] = { (npy_intp)idx.get_nimg()*idx.get_width(key) };
+
+	PyObject *arr = PyArray_New(&PyArray_Type, 1, dims, type, NULL, const_cast<void *>(data), 0,
+								NPY_ARRAY_C_CONTIGUOUS | NPY_ARRAY_ALIGNED, NULL);
+	if (!arr) throw_error_already_set();
+	Py_INCREF(self.ptr());
+	if (PyArray_SetBaseObject((PyArrayObject *)arr, self.ptr()) < 0) {
+		Py_DECREF(arr);
+		throw_error_already_set();
+	}
+	return object(handle<>(arr));
+}
+
+#if PY_MAJOR_VERSION >= 3
+int
+#else
+void
+#endif
+init_numpy()
+{
+	import_array();
+}
+
+// The batched file queries spend their time on disk, so they also run without the GIL.
+list EMUtil_get_image_types(const std::vector<std::string> &filenames, int nthreads=0)
+{
+	std::vector<EMAN::EMUtil::ImageType> types;
+	PyThreadState *state = PyEval_SaveThread();
+	try {
+		types = EMAN::EMUtil::get_image_types(filenames, nthreads);
+	}
+	catch (...) {
+		PyEval_RestoreThread(state);
+		throw;
+	}
+	PyEval_RestoreThread(state);
+
+	list ret;
+	for (size_t i = 0; i < types.size(); i++) ret.append(types[i]);
+	return ret;
+}
+
+BOOST_PYTHON_FUNCTION_OVERLOADS(EMUtil_get_image_types_overloads_1_2, EMUtil_get_image_types, 1, 2)
+
+std::vector<int> EMUtil_get_image_counts(const std::vector<std::string> &filenames, int nthreads=0)
+{
+	std::vector<int> ret;
+	PyThreadState *state = PyEval_SaveThread();
+	try {
+		ret = EMAN::EMUtil::get_image_counts(filenames, nthreads);
+	}
+	catch (...) {
+		PyEval_RestoreThread(state);
+		throw;
+	}
+	PyEval_RestoreThread(state);
+	return ret;
+}
+
+BOOST_PYTHON_FUNCTION_OVERLOADS(EMUtil_get_image_counts_overloads_1_2, EMUtil_get_image_counts, 1, 2)
+
+std::vector<EMAN::Dict> EMUtil_get_headers(const std::vector<std::string> &filenames, int nthreads=0)
+{
+	std::vector<EMAN::Dict> ret;
+	PyThreadState *state = PyEval_SaveThread();
+	try {
+		ret = EMAN::EMUtil::get_headers(filenames, nthreads);
+	}
+	catch (...) {
+		PyEval_RestoreThread(state);
+		throw;
+	}
+	PyEval_RestoreThread(state);
+	return ret;
+}
+
+BOOST_PYTHON_FUNCTION_OVERLOADS(EMUtil_get_headers_overloads_1_2, EMUtil_get_headers, 1, 2)
+
 }// namespace
 
 /*
@@ -413,6 +537,8 @@ branchfunc, int LIM) {
 // Module ======================================================================
 BOOST_PYTHON_MODULE(libpyUtils2)
 {
+	init_numpy();
+
 	scope* EMAN_Util_scope = new scope(
 		 class_< EMAN::Util>("Util", "Util is a collection of utility functions.", init<  >())
 		.def(init< const EMAN::Util& >())
@@ -1138,6 +1264,9 @@ hyb -- y- mesh spacing above f0\nhya -- y- mesh spacing below f0\n \nInterpolant
         .def("get_image_ext_type", &EMAN::EMUtil::get_image_ext_type, args("file_ext"), "Get an image's format type from its filename extension.\n \nfile_ext - File extension.\n \nreturn image format type.")
         .def("get_image_type", &EMAN::EMUtil::get_image_type, args("filename"), "Get an image's format type by processing the first 1K of the image.\n \nfilename - Image file name.\n \nreturn image format type.")
         .def("get_image_count", &EMAN::EMUtil::get_image_count, args("filename"), "Get the number of images in an image file.\n \nfilename Image file name.\n \nreturn Number of images in the given file.")
+        .def("get_image_types", EMUtil_get_image_types, EMUtil_get_image_types_overloads_1_2(args("filenames", "nthreads"), "Get the format type of many files, examined in parallel. Results are cached by path, size and\nmodification time.\n \nfilenames - Image file names.\nnthreads - Number of threads, 0 for the default.\n \nreturn A list of image format types, IMAGE_UNKNOWN for unreadable files."))
+        .def("get_image_counts", EMUtil_get_image_counts, EMUtil_get_image_counts_overloads_1_2(args("filenames", "nthreads"), "Get the number of images in many files, read in parallel and cached as for get_image_types.\n \nreturn A list of counts, 0 for unreadable files."))
+        .def("get_headers", EMUtil_get_headers, EMUtil_get_headers_overloads_1_2(args("filenames", "nthreads"), "Read the first header of many files, in parallel and cached as for get_image_types.\n \nreturn A list of header dicts, empty for unreadable files."))
         .def("get_imageio", &EMAN::EMUtil::get_imageio, EMAN_EMUtil_get_imageio_overloads_2_3(args("filename", "rw_mode", "image_type"), "Get an ImageIO object. It may be a newly created\nobject. Or an object stored in the cache.\n \nfilename - Image file name.\nrw_mode - ImageIO read/write mode.\nimage_type - Image format type.(default=IMAGE_UNKNOWN)\n \nreturn An ImageIO object.")[ return_internal_reference< 1 >() ])
         .def("get_imagetype_name", &EMAN::EMUtil::get_imagetype_name, args("type"), "Give each image type a meaningful name.\n \ntype - Image format type.\n \nreturn A name for that type.")
         .def("get_datatype_string", &EMAN::EMUtil::get_datatype_string, args("type"), "Give each data type a meaningful name\n \ntype - the EMDataType\n \nreturn a name for that data type")
@@ -1165,6 +1294,9 @@ hyb -- y- mesh spacing above f0\nhya -- y- mesh spacing below f0\n \nInterpolant
         .staticmethod("get_all_attributes")
         .staticmethod("get_imageio")
         .staticmethod("get_image_count")
+        .staticmethod("get_image_types")
+        .staticmethod("get_image_counts")
+        .staticmethod("get_headers")
         .staticmethod("get_imagetype_name")
         .staticmethod("get_image_type")
         .staticmethod("is_same_size")
@@ -1229,6 +1361,55 @@ hyb -- y- mesh spacing above f0\nhya -- y- mesh spacing below f0\n \nInterpolant
 
     delete EMAN_EMUtil_scope;
 
+    class_< EMAN::Parallel, boost::noncopyable >("Parallel", "Thread count used by the multithreaded batch operations in libEM", no_init)
+        .def("get_threads", &EMAN::Parallel::get_threads, "Number of threads batch operations will use. Defaults to the number of online processors.")
+        .def("set_threads", &EMAN::Parallel::set_threads, args("n"), "Set the number of threads for batch operations. 0 restores the default of one per CPU, 1 disables threading.")
+        .staticmethod("get_threads")
+        .staticmethod("set_threads")
+    ;
+
+    class_< EMAN::MovieReader, boost::noncopyable >("MovieReader",
+    		"Frame-by-frame MRC/TIFF movie reader. Dark, gain and defect correction are applied while frames\n"
+    		"are decoded, and the next frame is decoded in the background.", init< const std::string& >(args("filename")))
+        .def("get_nframes", &EMAN::MovieReader::get_nframes)
+        .def("get_xsize", &EMAN::MovieReader::get_xsize)
+        .def("get_ysize", &EMAN::MovieReader::get_ysize)
+        .def("set_references", &EMAN::MovieReader::set_references, args("dark", "gain"), "Dark and gain references, applied as (raw-dark)*gain. Either may be None.")
+        .def("set_defects", &EMAN::MovieReader::set_defects, args("mask"), "Pixels nonzero in mask are replaced by the mean of their good neighbours")
+        .def("set_prefetch", &EMAN::MovieReader::set_prefetch, args("prefetch"), "Decode the next frame in the background after each read")
+        .def("read_frame", &EMAN::MovieReader::read_frame, args("i"), return_value_policy< manage_new_object >(), "Read and correct frame i")
+    ;
+
+    class_< EMAN::ImageWriter, boost::noncopyable >("ImageWriter",
+    		"Writes images to one file on a background thread. write() queues a copy and returns, blocking only\n"
+    		"when max_queue images are waiting. Errors are raised by flush() or close().",
+    		init< const std::string&, optional< EMAN::EMUtil::ImageType, EMAN::EMUtil::EMDataType, int > >(args("filename", "imgtype", "filestoragetype", "max_queue")))
+        .def("write", ImageWriter_write, ImageWriter_write_overloads_2_3(args("self", "image", "img_index"), "Queue a copy of image for writing at img_index, -1 to append"))
+        .def("flush", ImageWriter_flush, "Wait until everything queued has been written")
+        .def("close", ImageWriter_close, "Write everything queued and stop the writer")
+        .def("get_pending", &EMAN::ImageWriter::get_pending, "Number of images queued or being written")
+        .def("get_written", &EMAN::ImageWriter::get_written, "Number of images written so far")
+    ;
+
+    class_< EMAN::HeaderIndex, boost::noncopyable >("HeaderIndex",
+    		"Columnar index of selected header values of an image stack, kept in <filename>.hidx. Columns hold\n"
+    		"one value per image, or the 12 values of a 3x4 matrix for Transforms. Absent values are nan.\n"
+    		"Writes through EMData.write_image and ImageWriter keep a current index current.",
+    		init< const std::string& >(args("filename")))
+        .def("build", &EMAN::HeaderIndex::build, args("filename", "keys"), "Read every header of filename once and index the listed keys. 'ctf.<field>' reaches into the Ctf.")
+        .staticmethod("build")
+        .def("has_current_index", &EMAN::HeaderIndex::has_current_index, args("filename"), "True if filename has an index matching the file as it is now")
+        .staticmethod("has_current_index")
+        .def("index_name", &EMAN::HeaderIndex::index_name, args("filename"))
+        .staticmethod("index_name")
+        .def("is_current", &EMAN::HeaderIndex::is_current, "False if the stack was changed without updating the index")
+        .def("get_nimg", &EMAN::HeaderIndex::get_nimg)
+        .def("get_keys", &EMAN::HeaderIndex::get_keys)
+        .def("get_type", &EMAN::HeaderIndex::get_type, args("key"), "0 for int, 1 for float, 2 for Transform columns, -1 if key is not indexed")
+        .def("get_width", &EMAN::HeaderIndex::get_width, args("key"), "Values per image, 12 for Transforms")
+        .def("get_column", HeaderIndex_get_column, args("self", "key"), "All values of key as a flat read-only numpy array over the index, int32 or float32 as stored")
+    ;
+
     class_< EMAN::ImageSort >("ImageSort", init< const EMAN::ImageSort& >())
         .def(init< int >())
         .def("sort", &EMAN::ImageSort::sort)
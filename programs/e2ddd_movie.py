@@ -116,7 +116,7 @@ def main():
 	parser.add_argument("--optbox", type=int,help="Box size to use during alignment optimization. Default is 512.",default=512, guitype='intbox', row=23, col=0, rowspan=1, colspan=1, mode="align,tomo")
 	parser.add_argument("--optstep", type=int,help="Step size to use during alignment optimization. Default is 400.",default=400,  guitype='intbox', row=23, col=1, rowspan=1, colspan=1, mode="align,tomo")
 	parser.add_argument("--optalpha", type=float,help="Penalization to apply during robust regression. Default is 0.5. If 0.0, unpenalized least squares will be performed (i.e., no trajectory smoothing).",default=0.5, guitype='floatbox', row=23, col=2, rowspan=1, colspan=1, mode="align,tomo")
-	parser.add_argument("--optccf",default="robust",type=str, choices=["robust","centerofmass","ccfmax"],help="Use this approach to determine relative frame translations.\nNote: 'robust' utilizes a bimodal Gaussian to robustly determine CCF peaks between pairs of frames in the presence of a fixed background.", guitype='combobox', row=24, col=0, rowspan=1, colspan=2, mode='align["robust"],tomo["robust"]',choicelist='["robust","centerofmass","ccfmax"]')
+	parser.add_argument("--optccf",default="robust",type=str, choices=["robust","centerofmass","ccfmax","native"],help="Use this approach to determine relative frame translations.\nNote: 'robust' utilizes a bimodal Gaussian to robustly determine CCF peaks between pairs of frames in the presence of a fixed background. 'native' runs the whole alignment in C++ (MovieAligner).", guitype='combobox', row=24, col=0, rowspan=1, colspan=2, mode='align["robust"],tomo["robust"]',choicelist='["robust","centerofmass","ccfmax","native"]')
 
 	parser.add_header(name="orblock5", help='Just a visual separation', title="Optional: ", row=25, col=0, rowspan=2, colspan=3, mode="align,tomo")
 
@@ -500,6 +500,14 @@ def process_movie(options,fsp,dark,gain,first,flast,step,idx):
 		hdr=EMData(fsp,0,True)			# read header
 		nx,ny=hdr["nx"],hdr["ny"]
 
+	# MRC and TIFF movies are decoded natively with dark/gain applied during the conversion to float
+	try:
+		reader=MovieReader(fsp)
+		reader.set_references(dark,gain)
+		reader.set_prefetch(step==1)
+	except:
+		reader=None
+
 	# bgsub and gain correct the stack
 	outim=[]
 	nfs = 0
@@ -509,13 +517,16 @@ def process_movie(options,fsp,dark,gain,first,flast,step,idx):
 			sys.stdout.write(" {}/{}   \r".format(ii-first+1,flast-first+1))
 			sys.stdout.flush()
 
-		if fsp[-4:].lower() in (".mrc") :
-		#if fsp[-4:].lower() in (".mrc") :
-			im=EMData(fsp,0,False,Region(0,0,ii,nx,ny,1))
-		else: im=EMData(fsp,ii)
+		if reader!=None:
+			im=reader.read_frame(ii)
+		else:
+			if fsp[-4:].lower() in (".mrc") :
+			#if fsp[-4:].lower() in (".mrc") :
+				im=EMData(fsp,0,False,Region(0,0,ii,nx,ny,1))
+			else: im=EMData(fsp,ii)
 
-		if dark!=None : im.sub(dark)
-		if gain!=None : im.mult(gain)
+			if dark!=None : im.sub(dark)
+			if gain!=None : im.mult(gain)
 		#im.process_inplace("threshold.clampminmax",{"minval":0,"maxval":im["mean"]+im["sigma"]*3.5,"tozero":1})
 		if options.de64: im.process_inplace( "threshold.clampminmax", { "minval" : im[ 'minimum' ], "maxval" : im[ 'mean' ] + 8.0 * im[ 'sigma' ], "tomean" : True } )
 		#if options.fixbadpixels : im.process_inplace("threshold.outlier.localmean",{"sigma":3.5,"fix_zero":1}) # fixes clear outliers as well as values which were exactly zero
@@ -585,151 +596,164 @@ def process_movie(options,fsp,dark,gain,first,flast,step,idx):
 
 		print("{} frames read ({} x {}). Grouped by {}.".format(nfs_read,nx,ny,options.groupby,n))
 
-		ccfs=queue.Queue(0)
-
-		# prepare image data (outim) by clipping and FFT'ing all tiles (this is threaded as well)
-		immx=[0]*n
-		thds = []
-		for i in range(n):
-			thd = threading.Thread(target=split_fft,args=(options,outim[i],i,options.optbox,options.optstep,ccfs))
-			thds.append(thd)
-		sys.stdout.write("\rPrecompute  /{} FFTs".format(len(thds)))
-		t0=time()
-
-		thrtolaunch=0
-		while thrtolaunch<len(thds) or threading.active_count()>1:
-			if thrtolaunch<len(thds) :
-				while (threading.active_count()==options.threads ) : sleep(.01)
-				#if options.verbose :
-				#	sys.stdout.write("\rPrecompute {}/{} FFTs {}".format(thrtolaunch+1,len(thds),threading.active_count()))
-				#	sys.stdout.flush()
-				thds[thrtolaunch].start()
-				thrtolaunch+=1
-			else: sleep(0.5)
-
-			while not ccfs.empty():
-				i,d=ccfs.get()
-				immx[i]=d
-
-		for th in thds: th.join()
-		print()
-
-		# create threads
-		thds=[]
-		peak_locs=queue.Queue(0)
-		i=-1
-		for ima in range(n-1):
-			for imb in range(ima+1,n):
-				if options.verbose>3: i+=1		# if i>0 then it will write pre-processed CCF images to disk for debugging
-				thds.append(threading.Thread(target=calc_ccf_wrapper,args=(options,(ima,imb),options.optbox,options.optstep,immx[ima],immx[imb],ccfs,peak_locs,i,fsp)))
-
-		print("{:1.1f} s\nCompute {} ccfs".format(time()-t0,len(thds)))
-		t0=time()
-
-		# here we run the threads and save the results, no actual alignment done here
-		csum2={}
-
-		thrtolaunch=0
-		while thrtolaunch<len(thds) or threading.active_count()>1:
-			# If we haven't launched all threads yet, then we wait for an empty slot, and launch another
-			# note that it's ok that we wait here forever, since there can't be new results if an existing
-			# thread hasn't finished.
-			if thrtolaunch<len(thds) :
-				while (threading.active_count()==options.threads ) : sleep(.01)
-				#if options.verbose : print "Starting thread {}/{}".format(thrtolaunch,len(thds))
-				thds[thrtolaunch].start()
-				thrtolaunch+=1
-			else:
-				sleep(0.5)
-
-			while not ccfs.empty():
-				i,d=ccfs.get()
-				csum2[i]=d
-
-			if options.verbose:
-				sys.stdout.write("\r  {}/{} ({})".format(thrtolaunch,len(thds),threading.active_count()))
-				sys.stdout.flush()
-
-		for th in thds: th.join()
-		print()
-
-		avgr=Averagers.get("minmax",{"max":0})
-		avgr.add_image_list(list(csum2.values()))
-		csum=avgr.finish()
-
-		#####
-		# Alignment code
-		#####
-
-		# array of x,y locations of each frame, all relative to the last frame in the series, which will always have 0,0 shift
-		locs=[0]*(n*2) # we store the value for the last frame as well as a conveience
-
-		print("{:1.1f} s\nAlign {} frames".format(time()-t0,n))
-		t0=time()
-
-		peak_locs = {p[0]:p[1] for p in peak_locs.queue}
-
-		if options.debug and options.verbose == 9:
-			print("PEAK LOCATIONS:")
-			for l in list(peak_locs.keys()):
-				print(peak_locs[l])
-
-		# if options.ccweight:
-		# 	# normalize ccpeak values
-		# 	vals = []
-		# 	for ima,(i,j) in enumerate(sorted(peak_locs.keys())):
-		# 		for imb in range(i,j):
-		# 			try:
-		# 				vals.append(peak_locs[(i,j)][-1])
-		# 			except:
-		# 				pass
-		# 	ccmean = np.mean(vals)
-		# 	ccstd = np.std(vals)
-
-		m = n*(n-1)/2
-		bx = np.ones(m)
-		by = np.ones(m)
-		A = np.zeros([m,n]) # coefficient matrix
-		for ima,(i,j) in enumerate(sorted(peak_locs.keys())):
-			for imb in range(i,j):
-				try:
-					bx[ima] = peak_locs[(i,j)][0]
-					by[ima] = peak_locs[(i,j)][1]
-					A[ima,imb] = 1
-					#A[ima,imb] = float(n-np.fabs(i-j))/n
-					#A[ima,imb] = np.exp(1-peak_locs[(i,j)][3])
-					#A[ima,imb] = sqrt(float(n-fabs(i-j))/n)
-				except:
-					pass # CCF peak was not found
-		b = np.c_[bx,by]
-		A = np.asmatrix(A)
-		b = np.asmatrix(b)
-
-		# remove all zero rows from A and corresponding entries in b
-		z = np.argwhere(np.all(A==0,axis=1))
-		A = np.delete(A,z,axis=0)
-		b = np.delete(b,z,axis=0)
-
-		regr = linear_model.Ridge(alpha=options.optalpha,normalize=True,fit_intercept=True)
-		regr.fit(A,b)
-
-		traj = regr.predict(np.tri(n))
-		#shifts = regr.predict(np.eye(n))-options.optbox/2
-
-		traj -= traj[0]
-
-		if options.round == "int": traj = np.round(traj,0)#.astype(np.int8)
-
-		locs = traj.ravel()
-		quals=[0]*n # quality of each frame based on its correlation peak summed over all images
-		cen=options.optbox/2 #csum2[(0,1)]["nx"]/2
-		for i in range(n-1):
-			for j in range(i+1,n):
-				val=csum2[(i,j)].sget_value_at_interp(int(cen+locs[j*2]-locs[i*2]),int(cen+locs[j*2+1]-locs[i*2+1]))*sqrt(float(n-fabs(i-j))/n)
-				quals[i]+=val
-				quals[j]+=val
-
-		print("{:1.1f} s".format(time()-t0,n))
+		if options.optccf == "native":
+			# pairwise CCFs, trajectory fit and quality all computed in C++
+			ma=MovieAligner()
+			ma.set_tiles(options.optbox,options.optstep)
+			ma.set_alpha(options.optalpha)
+			ma.set_threads(options.threads)
+			ma.set_verbose(options.verbose)
+			locs=ma.align(outim)
+			if options.round == "int": locs=[round(l,0) for l in locs]
+			quals=ma.get_quality()
+			traj=np.array(locs).reshape(n,2)
+			t0=time()
+		else:
+			ccfs=queue.Queue(0)
+
+			# prepare image data (outim) by clipping and FFT'ing all tiles (this is threaded as well)
+			immx=[0]*n
+			thds = []
+			for i in range(n):
+				thd = threading.Thread(target=split_fft,args=(options,outim[i],i,options.optbox,options.optstep,ccfs))
+				thds.append(thd)
+			sys.stdout.write("\rPrecompute  /{} FFTs".format(len(thds)))
+			t0=time()
+
+			thrtolaunch=0
+			while thrtolaunch<len(thds) or threading.active_count()>1:
+				if thrtolaunch<len(thds) :
+					while (threading.active_count()==options.threads ) : sleep(.01)
+					#if options.verbose :
+					#	sys.stdout.write("\rPrecompute {}/{} FFTs {}".format(thrtolaunch+1,len(thds),threading.active_count()))
+					#	sys.stdout.flush()
+					thds[thrtolaunch].start()
+					thrtolaunch+=1
+				else: sleep(0.5)
+
+				while not ccfs.empty():
+					i,d=ccfs.get()
+					immx[i]=d
+
+			for th in thds: th.join()
+			print()
+
+			# create threads
+			thds=[]
+			peak_locs=queue.Queue(0)
+			i=-1
+			for ima in range(n-1):
+				for imb in range(ima+1,n):
+					if options.verbose>3: i+=1		# if i>0 then it will write pre-processed CCF images to disk for debugging
+					thds.append(threading.Thread(target=calc_ccf_wrapper,args=(options,(ima,imb),options.optbox,options.optstep,immx[ima],immx[imb],ccfs,peak_locs,i,fsp)))
+
+			print("{:1.1f} s\nCompute {} ccfs".format(time()-t0,len(thds)))
+			t0=time()
+
+			# here we run the threads and save the results, no actual alignment done here
+			csum2={}
+
+			thrtolaunch=0
+			while thrtolaunch<len(thds) or threading.active_count()>1:
+				# If we haven't launched all threads yet, then we wait for an empty slot, and launch another
+				# note that it's ok that we wait here forever, since there can't be new results if an existing
+				# thread hasn't finished.
+				if thrtolaunch<len(thds) :
+					while (threading.active_count()==options.threads ) : sleep(.01)
+					#if options.verbose : print "Starting thread {}/{}".format(thrtolaunch,len(thds))
+					thds[thrtolaunch].start()
+					thrtolaunch+=1
+				else:
+					sleep(0.5)
+
+				while not ccfs.empty():
+					i,d=ccfs.get()
+					csum2[i]=d
+
+				if options.verbose:
+					sys.stdout.write("\r  {}/{} ({})".format(thrtolaunch,len(thds),threading.active_count()))
+					sys.stdout.flush()
+
+			for th in thds: th.join()
+			print()
+
+			avgr=Averagers.get("minmax",{"max":0})
+			avgr.add_image_list(list(csum2.values()))
+			csum=avgr.finish()
+
+			#####
+			# Alignment code
+			#####
+
+			# array of x,y locations of each frame, all relative to the last frame in the series, which will always have 0,0 shift
+			locs=[0]*(n*2) # we store the value for the last frame as well as a conveience
+
+			print("{:1.1f} s\nAlign {} frames".format(time()-t0,n))
+			t0=time()
+
+			peak_locs = {p[0]:p[1] for p in peak_locs.queue}
+
+			if options.debug and options.verbose == 9:
+				print("PEAK LOCATIONS:")
+				for l in list(peak_locs.keys()):
+					print(peak_locs[l])
+
+			# if options.ccweight:
+			# 	# normalize ccpeak values
+			# 	vals = []
+			# 	for ima,(i,j) in enumerate(sorted(peak_locs.keys())):
+			# 		for imb in range(i,j):
+			# 			try:
+			# 				vals.append(peak_locs[(i,j)][-1])
+			# 			except:
+			# 				pass
+			# 	ccmean = np.mean(vals)
+			# 	ccstd = np.std(vals)
+
+			m = n*(n-1)/2
+			bx = np.ones(m)
+			by = np.ones(m)
+			A = np.zeros([m,n]) # coefficient matrix
+			for ima,(i,j) in enumerate(sorted(peak_locs.keys())):
+				for imb in range(i,j):
+					try:
+						bx[ima] = peak_locs[(i,j)][0]
+						by[ima] = peak_locs[(i,j)][1]
+						A[ima,imb] = 1
+						#A[ima,imb] = float(n-np.fabs(i-j))/n
+						#A[ima,imb] = np.exp(1-peak_locs[(i,j)][3])
+						#A[ima,imb] = sqrt(float(n-fabs(i-j))/n)
+					except:
+						pass # CCF peak was not found
+			b = np.c_[bx,by]
+			A = np.asmatrix(A)
+			b = np.asmatrix(b)
+
+			# remove all zero rows from A and corresponding entries in b
+			z = np.argwhere(np.all(A==0,axis=1))
+			A = np.delete(A,z,axis=0)
+			b = np.delete(b,z,axis=0)
+
+			regr = linear_model.Ridge(alpha=options.optalpha,normalize=True,fit_intercept=True)
+			regr.fit(A,b)
+
+			traj = regr.predict(np.tri(n))
+			#shifts = regr.predict(np.eye(n))-options.optbox/2
+
+			traj -= traj[0]
+
+			if options.round == "int": traj = np.round(traj,0)#.astype(np.int8)
+
+			locs = traj.ravel()
+			quals=[0]*n # quality of each frame based on its correlation peak summed over all images
+			cen=options.optbox/2 #csum2[(0,1)]["nx"]/2
+			for i in range(n-1):
+				for j in range(i+1,n):
+					val=csum2[(i,j)].sget_value_at_interp(int(cen+locs[j*2]-locs[i*2]),int(cen+locs[j*2+1]-locs[i*2+1]))*sqrt(float(n-fabs(i-j))/n)
+					quals[i]+=val
+					quals[j]+=val
+
+			print("{:1.1f} s".format(time()-t0,n))
 
 		runtime = time()-start
 		print("Runtime: {:.1f} s".format(runtime))
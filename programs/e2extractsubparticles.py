@@ -144,6 +144,9 @@ will be examined automatically to extract the corresponding particles and projec
 	if options.outermask!=None:
 		outermask=EMData(options.outermask)
 
+	# particles are written on a background thread while the next ones are computed
+	out=ImageWriter(options.output)
+
 	# now we loop over the classes, and subtract away a projection of the reference with the exclusion mask in
 	# each symmetry-related orientation, after careful scaling. Note that we don't have a list of which particle is in each class,
 	# but rather a list of which class each particle is in, so we do this a bit inefficiently for now
@@ -219,10 +222,11 @@ will be examined automatically to extract the corresponding particles and projec
 					ptcl3.translate(-maskctr[k][0]+ptcl3["nx"]/2,-maskctr[k][1]+ptcl3["ny"]/2,0)
 					if options.newbox>3 : 
 						ptcl4=ptcl3.get_clip(Region((ptcl3["nx"]-options.newbox)/2,(ptcl3["ny"]-options.newbox)/2,options.newbox,options.newbox))
-						ptcl4.write_image(options.output,-1)
-					else: ptcl3.write_image(options.output,-1)
+						out.write(ptcl4)
+					else: out.write(ptcl3)
 #					print ptcl.cmp("optsub",projc[0])
 
+	out.close()
 	E2end(logid)
 
 
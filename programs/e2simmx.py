@@ -622,6 +622,7 @@ def main():
 	parser.add_argument("--check","-c",action="store_true",help="Performs a command line argument check only.",default=False)
 	parser.add_argument("--ppid", type=int, help="Set the PID of the parent process, used for cross platform PPID",default=-1)
 	parser.add_argument("--parallel",type=str,help="Parallelism string",default=None)
+	parser.add_argument("--threads", default=4,type=int,help="Number of threads to run in parallel on the local computer when --parallel isn't used")
 
 	(options, args) = parser.parse_args()
 
@@ -657,6 +658,7 @@ def main():
 	if file_exists(options.outfile):
 		if (options.force):
 			remove_file(options.outfile)
+			if os.path.exists(SimilarityMatrix.checkpoint_file(options.outfile)): os.unlink(SimilarityMatrix.checkpoint_file(options.outfile))
 
 	options.align=parsemodopt(options.align)
 	options.aligncmp=parsemodopt(options.aligncmp)
@@ -664,6 +666,7 @@ def main():
 	options.raligncmp=parsemodopt(options.raligncmp)
 	options.cmp=parsemodopt(options.cmp)
 
+	excl=None
 	if options.exclude:
 		try:
 			excl=open(options.exclude,"r").readlines()
@@ -697,6 +700,23 @@ def main():
 		crange=[0,clen]
 		rrange=[0,rlen]
 
+	# The native engine covers everything but the per-column masks, prefiltering and fillzero. It writes rows
+	# as it goes, and resumes from its checkpoint if a previous run with the same range was killed
+	if not (options.colmasks or options.prefilt or options.fillzero):
+		smx=SimilarityMatrix(options.cmp[0],options.cmp[1])
+		if options.align and options.align[0] : smx.set_align(options.align[0],options.align[1],options.aligncmp[0],options.aligncmp[1])
+		if options.ralign and options.ralign[0] : smx.set_ralign(options.ralign[0],options.ralign[1],options.raligncmp[0],options.raligncmp[1])
+		if options.mask!=None : smx.set_mask(EMData(options.mask,0))
+		if options.shrink!=None : smx.set_shrink(options.shrink)
+		if options.exclude and excl : smx.set_exclude(list(excl))
+		smx.set_threads(options.threads)
+		smx.set_verbose(options.verbose)
+		if options.verbose>0: print("Computing Similarities")
+		smx.compute_file(args[0],args[1],args[2],crange[0],crange[1],rrange[0],rrange[1],options.saveali)
+		if options.verbose>0 : print("\nSimilarity computation complete")
+		E2end(E2n)
+		sys.exit(0)
+
 	# initialize output array
 	mxout=[EMData()]
 	mxout[0].set_attr(PROJ_FILE_ATTR,args[0])
@@ -745,7 +765,7 @@ def main():
 	else : mask=EMData(options.mask,0)
 
 	for r in range(*rrange):
-		if options.exclude and r in excl : continue
+		if excl and r in excl : continue
 
 		if options.verbose>0:
 			print("%d/%d\r"%(r,rrange[1]), end=' ')
@@ -830,7 +850,10 @@ def check(options,verbose):
 				error = True
 
 		if  file_exists(options.outfile):
-			if ( not options.force):
+			if os.path.exists(SimilarityMatrix.checkpoint_file(options.outfile)) and not options.force:
+				if verbose>0:
+					print("Resuming the interrupted computation in %s" %options.outfile)
+			elif ( not options.force):
 				if verbose>0:
 					print("Error: File %s exists, will not write over - specify the force option" %options.outfile)
 				error = True
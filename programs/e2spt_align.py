@@ -36,23 +36,8 @@ from builtins import range
 from EMAN2 import *
 import time
 import os
-import threading
-import queue
 from sys import argv,exit
 
-def alifn(jsd,fsp,i,a,options):
-	t=time.time()
-	b=EMData(fsp,i).do_fft()
-	b.process_inplace("xform.phaseorigin.tocorner")
-
-	# we align backwards due to symmetry
-	if options.verbose>2 : print("Aligning: ",fsp,i)
-	c=a.xform_align_nbest("rotate_translate_3d_tree",b,{"verbose":0,"sym":options.sym,"sigmathis":0.1,"sigmato":1.0},1)
-	for cc in c : cc["xform.align3d"]=cc["xform.align3d"].inverse()
-
-	jsd.put((fsp,i,c[0]))
-	if options.verbose>1 : print("{}\t{}\t{}\t{}".format(fsp,i,time.time()-t,c[0]["score"]))
-
 def main():
 	progname = os.path.basename(sys.argv[0])
 	usage = """Usage: e2spt_align.py [options] <subvolume_stack> <reference>
@@ -62,7 +47,7 @@ This program will take an input stack of subtomograms and a reference volume, an
 
 	parser = EMArgumentParser(usage=usage,version=EMANVERSION)
 
-	parser.add_argument("--threads", default=4,type=int,help="Number of alignment threads to run in parallel on a single computer. This is the only parallelism supported by e2spt_align at present.", guitype='intbox', row=24, col=2, rowspan=1, colspan=1, mode="refinement")
+	parser.add_argument("--threads", default=4,type=int,help="Number of particles to align in parallel on a single computer. This is the only parallelism supported by e2spt_align at present.", guitype='intbox', row=24, col=2, rowspan=1, colspan=1, mode="refinement")
 	parser.add_argument("--iter",type=int,help="Iteration number within path. Default = start a new iteration",default=0)
 	parser.add_argument("--goldstandard",type=float,help="If specified, will phase randomize the even and odd references past the specified resolution (in A, not 1/A)",default=0)
 	parser.add_argument("--goldcontinue",action="store_true",help="Will use even/odd refs corresponding to specified reference to continue refining without phase randomizing again",default=False)
@@ -87,7 +72,6 @@ This program will take an input stack of subtomograms and a reference volume, an
 		else: options.iter=max(fls)+1
 
 	reffile=args[1]
-	NTHREADS=max(options.threads+1,2)		# we have one thread just writing results
 
 	logid=E2init(sys.argv, options.ppid)
 
@@ -109,43 +93,36 @@ This program will take an input stack of subtomograms and a reference volume, an
 			ref[0].write_image("{}/align_ref.hdf".format(options.path),0)
 			ref[1].write_image("{}/align_ref.hdf".format(options.path),1)
 
-	ref[0]=ref[0].do_fft()
-	ref[0].process_inplace("xform.phaseorigin.tocorner")
-	ref[1]=ref[1].do_fft()
-	ref[1].process_inplace("xform.phaseorigin.tocorner")
+	Parallel.set_threads(options.threads)
+	ali=RT3DTreeAligner()
+	ali.set_params({"verbose":0,"sym":options.sym,"sigmathis":0.1,"sigmato":1.0})
+
+	# the downsampled reference levels are made once, not once per particle
+	refpyr=[RT3DTreePyramid(r) for r in ref]
 
 	angs=js_open_dict("{}/particle_parms_{:02d}.json".format(options.path,options.iter))
-	jsd=queue.Queue(0)
 
-	n=-1
 	N=EMUtil.get_image_count(args[0])
-	thrds=[threading.Thread(target=alifn,args=(jsd,args[0],i,ref[i%2],options)) for i in range(N)]
-
-	# here we run the threads and save the results, no actual alignment done here
-	print(len(thrds)," threads")
-	thrtolaunch=0
-	while thrtolaunch<len(thrds) or threading.active_count()>1:
-		# If we haven't launched all threads yet, then we wait for an empty slot, and launch another
-		# note that it's ok that we wait here forever, since there can't be new results if an existing
-		# thread hasn't finished.
-		if thrtolaunch<len(thrds) :
-			while (threading.active_count()==NTHREADS ) : time.sleep(.1)
-			if options.verbose : print("Starting thread {}/{}".format(thrtolaunch,len(thrds)))
-			thrds[thrtolaunch].start()
-			thrtolaunch+=1
-		else: time.sleep(1)
-
-		while not jsd.empty():
-			fsp,n,d=jsd.get()
-			angs[(fsp,n)]=d
-			if options.saveali:
-				v=EMData(fsp,n)
-				v.transform(d["xform.align3d"])
-				v.write_image("{}/aliptcls.hdf".format(options.path),n)
-
-
-	for t in thrds:
-		t.join()
+	chunk=max(options.threads*4,8)
+	for i0 in range(0,N,chunk):
+		for eo in (0,1):
+			idx=[i for i in range(i0,min(i0+chunk,N)) if i%2==eo]
+			if len(idx)==0 : continue
+			t=time.time()
+			ptcls=[EMData(args[0],i) for i in idx]
+
+			# we align backwards due to symmetry. Particles are aligned in parallel within the batch
+			if options.verbose>2 : print("Aligning: ",args[0],idx)
+			solns=ali.xform_align_nbest_batch(refpyr[eo],ptcls,1)
+
+			for i,v,c in zip(idx,ptcls,solns):
+				for cc in c : cc["xform.align3d"]=cc["xform.align3d"].inverse()
+				d=c[0]
+				angs[(args[0],i)]=d
+				if options.verbose>1 : print("{}\t{}\t{}\t{}".format(args[0],i,(time.time()-t)/len(idx),d["score"]))
+				if options.saveali:
+					v.transform(d["xform.align3d"])
+					v.write_image("{}/aliptcls.hdf".format(options.path),i)
 
 	E2end(logid)
 
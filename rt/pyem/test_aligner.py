@@ -514,6 +514,96 @@ class TestAligner(unittest.TestCase):
 							#result.set_value_at(x,y,z,intensity)
 				
 	
+	def test_SimilarityMatrix(self):
+		"""test SimilarityMatrix ............................"""
+		from EMAN2_utils import cmponetomany
+		refs = [test_image(0,(32,32)) for i in range(3)]
+		for i,r in enumerate(refs): r.rotate(30.0*i,0,0)
+		ptcls = [refs[i%3].process("xform",{"transform":Transform({"type":"2d","alpha":10.0*i,"tx":1.0})}) for i in range(4)]
+		
+		smx = SimilarityMatrix("dot",{"normalize":1})
+		smx.set_align("rotate_translate_tree",{},"ccc",{})
+		smx.set_threads(2)
+		mx = smx.compute(refs,ptcls,True)
+		self.assertEqual(len(mx),6)
+		self.assertEqual((mx[0]["nx"],mx[0]["ny"]),(3,4))
+		
+		for r,p in enumerate(ptcls):
+			row = cmponetomany([(i.copy(),None) for i in refs],p,("rotate_translate_tree",{}),("ccc",{}),("dot",{"normalize":1}),None)
+			for c in range(3):
+				self.assertAlmostEqual(mx[0][c,r],row[c][0],places=3)
+				self.assertAlmostEqual(mx[3][c,r],row[c][3],places=2)
+		
+		# a run resumed from a checkpoint leaves the completed rows alone
+		for f in ("simmx_test.hdf","simmx_refs.hdf","simmx_ptcls.hdf"): testlib.safe_unlink(f)
+		for i in refs: i.write_image("simmx_refs.hdf",-1)
+		for i in ptcls: i.write_image("simmx_ptcls.hdf",-1)
+		z = EMData(3,4,1)
+		z.to_zero()
+		z.write_image("simmx_test.hdf",0)
+		open(SimilarityMatrix.checkpoint_file("simmx_test.hdf"),"w").write("simmx 0 3 0 4 1 2\n")
+		smx.set_block_size(1)
+		smx.compute_file("simmx_refs.hdf","simmx_ptcls.hdf","simmx_test.hdf")
+		self.assertFalse(os.path.exists(SimilarityMatrix.checkpoint_file("simmx_test.hdf")))
+		out = EMData("simmx_test.hdf",0)
+		for r in range(4):
+			for c in range(3):
+				if r<2 : self.assertEqual(out[c,r],0)
+				else : self.assertAlmostEqual(out[c,r],mx[0][c,r],places=4)
+		for f in ("simmx_test.hdf","simmx_refs.hdf","simmx_ptcls.hdf"): testlib.safe_unlink(f)
+	
+	def test_RT3DTreeAligner_batch(self):
+		"""test RT3DTreeAligner with a prepared pyramid ....."""
+		ref = test_image_3d(0,(24,24,24))
+		ptcls = [ref.process("xform",{"transform":Transform({"type":"eman","az":20.0*i,"alt":15.0,"tx":1.0})}) for i in range(3)]
+		params = {"sym":"c1","sigmathis":0.1,"sigmato":1.0}
+		
+		pyr = RT3DTreePyramid(ref)
+		self.assertEqual(pyr.get_ny(),24)
+		self.assertEqual(pyr.get_size(pyr.get_nlevels()-1),24)
+		
+		ali = RT3DTreeAligner()
+		ali.set_params(params)
+		batch = ali.xform_align_nbest_batch(pyr,ptcls,1)
+		self.assertEqual(len(batch),3)
+		for p,b in zip(ptcls,batch):
+			single = ref.xform_align_nbest("rotate_translate_3d_tree",p,params,1)
+			self.assertAlmostEqual(b[0]["score"],single[0]["score"],places=5)
+			self.assertEqual(b[0]["xform.align3d"].get_matrix(),single[0]["xform.align3d"].get_matrix())
+		
+		self.assertRaises(RuntimeError, RT3DTreePyramid, test_image_3d(0,(24,24,20)))
+	
+	def test_MovieAligner(self):
+		"""test MovieAligner ................................"""
+		base = test_image(0,(256,256))
+		shifts = [(0,0),(1.0,-2.0),(2.0,-4.0),(3.5,-5.0)]
+		frames = []
+		for dx,dy in shifts:
+			f = base.copy()
+			f.translate(dx,dy,0)
+			f.process_inplace("math.addnoise",{"noise":0.2})
+			frames.append(f)
+		
+		ma = MovieAligner()
+		ma.set_tiles(128,64)
+		ma.set_shrink(1)
+		ma.set_alpha(0.0)
+		ma.set_threads(2)
+		traj = ma.align(frames)
+		self.assertEqual(len(traj),8)
+		for i,(dx,dy) in enumerate(shifts):
+			self.assertAlmostEqual(traj[2*i],-dx,delta=0.5)
+			self.assertAlmostEqual(traj[2*i+1],-dy,delta=0.5)
+		self.assertEqual(len(ma.get_pair_shifts()),18)
+		
+		avg = ma.average(frames,traj)
+		self.assertEqual((avg["nx"],avg["ny"]),(256,256))
+		self.assertRaises(RuntimeError, ma.average, frames, traj, True)
+		ma.set_dose(1.5)
+		wavg = ma.average(frames,traj,True)
+		self.assertEqual(wavg["movie_frames"],4)
+
+	
 def test_main():
     p = OptionParser()
     p.add_option('--t', action='store_true', help='test exception', default=False )
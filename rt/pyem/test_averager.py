@@ -80,6 +80,55 @@ class TestAverager(unittest.TestCase):
 		self.assertAlmostEqual(data2[0,0], 10.0, 3)
 		self.assertAlmostEqual(data2[2,2], 2.0, 3)
 
+	def test_SubtomoAverager(self):
+		"""test SubtomoAverager ............................."""
+		ptcls = []
+		for i in range(4):
+			e = test_image_3d(0,(24,24,24))
+			e.process_inplace("math.addnoise",{"noise":0.1,"seed":i+1})
+			ptcls.append(e)
+		ident = [Transform() for p in ptcls]
+
+		# with identity transforms this is mean.tomo
+		avgr = Averagers.get("mean.tomo",{"thresh_sigma":0.5})
+		for p in ptcls: avgr.add_image(p)
+		ref = avgr.finish()
+		sta = SubtomoAverager()
+		sta.add_images(ptcls,ident)
+		self.assertEqual(sta.get_count(),4)
+		avg = sta.finish()
+		self.assertEqual(avg["ptcl_repr"],4)
+		self.assertAlmostEqual((avg-ref)["sigma"],0.0,3)
+
+		# rotating in Fourier space matches the xform processor
+		xf = Transform({"type":"eman","az":90.0,"alt":90.0,"tx":2.0,"ty":-1.0,"tz":1.0})
+		e = test_image_3d(0,(24,24,24))
+		sta.set_thresh_sigma(0)
+		sta.add_image(e,xf)
+		rot = sta.finish()
+		self.assertGreater(-rot.cmp("ccc",e.process("xform",{"transform":xf})),0.99)
+
+		# a missing wedge leaves those voxels out of the weight map, and
+		# the thread count doesn't change the result
+		fts = [p.do_fft() for p in ptcls]
+		xfs = [Transform({"type":"eman","az":30.0*i,"alt":20.0*i}) for i in range(4)]
+		avgs = []
+		for nt in (1,3):
+			sta = SubtomoAverager()
+			sta.set_thresh_sigma(0)
+			sta.set_maxtilt(45.0)
+			sta.set_threads(nt)
+			sta.add_images(fts,xfs,[1.0,0.5,1.0,2.0])
+			w = EMData()
+			avgs.append(sta.finish(w))
+			self.assertEqual((w["nx"],w["ny"],w["nz"]),(13,24,24))
+		self.assertEqual(avgs[0].get_data_as_vector(),avgs[1].get_data_as_vector())
+		self.assertGreater(w["maximum"],0.0)
+		self.assertLessEqual(w["maximum"],4.5001)
+		self.assertEqual(sta.finish(),None)
+
+		self.assertRaises(RuntimeError, sta.add_image, test_image_3d(0,(24,24,20)), Transform())
+
 def test_main():
     p = OptionParser()
     p.add_option('--t', action='store_true', help='test exception', default=False )
@@ -133,6 +133,56 @@ class TestCmp(unittest.TestCase):
         #		    neg_one  = e3.cmp('frc', e3.copy(), {})
 		#		    self.assertAlmostEqual(neg_one,-1, places=6)
         
+    def test_FourierShellCorrelator(self):
+        """test FourierShellCorrelator ......................"""
+        e = EMData()
+        e.set_size(64,64,1)
+        e.process_inplace('testimage.noise.uniform.rand')
+        
+        refs = []
+        for i in range(3):
+            r = EMData()
+            r.set_size(64,64,1)
+            r.process_inplace('testimage.noise.uniform.rand')
+            refs.append(r)
+        
+        fscr = FourierShellCorrelator.get(64,64,1)
+        fsc = e.calc_fourier_shell_correlation(refs[0])
+        fsc2 = fscr.calc_fsc(e, refs[0])
+        self.assertEqual(len(fsc), len(fsc2))
+        for a,b in zip(fsc, fsc2):
+            self.assertAlmostEqual(a, b, places=4)
+        
+        batch = fscr.calc_fsc_batch(e, refs)
+        self.assertEqual(len(batch), 3)
+        for a,b in zip(batch[0], fsc2):
+            self.assertAlmostEqual(a, b, places=5)
+        
+        scores = fscr.frc_cmp_batch(e, refs, {"ampweight":1})
+        for r,score in zip(refs, scores):
+            self.assertAlmostEqual(score, e.cmp('frc', r, {"ampweight":1}), places=5)
+        
+    def test_cmp_batch(self):
+        """test Cmp.cmp_batch ..............................."""
+        e = test_image()
+        refs = []
+        for i in range(5):
+            r = e.copy()
+            r.process_inplace('math.addnoise', {'noise':0.5*(i+1)})
+            refs.append(r)
+        
+        Parallel.set_threads(3)
+        try:
+            for name,params in (('ccc',{}), ('ccc',{'negative':0}), ('sqeuclidean',{}), ('dot',{'normalize':1}),
+                    ('frc',{}), ('phase',{}), ('optsub',{})):
+                c = Cmps.get(name, params)
+                scores = c.cmp_batch(e, refs)
+                self.assertEqual(len(scores), len(refs))
+                for r,score in zip(refs, scores):
+                    self.assertAlmostEqual(score, c.cmp(e, r), places=4)
+        finally:
+            Parallel.set_threads(0)
+        
     def test_PhaseCmp(self):
         """test PhaseCmp ...................................."""
         #THIS TEST WILL BE FIXED SOON BY DAVE
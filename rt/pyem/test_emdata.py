@@ -3396,6 +3396,46 @@ class TestEMData(unittest.TestCase):
         self.assertEqual(q.to_string(), q2.to_string())
         self.assertEqual(q.to_dict(), q2.to_dict())
         testlib.safe_unlink('mydb2')
+
+    def test_eman2ctf_compute_2d_complex(self):
+        """test EMAN2Ctf 2-D CTF synthesis and cache ........"""
+        ctf = EMAN2Ctf()
+        ctf.from_dict({"defocus":2.0, "dfdiff":0.0, "dfang":0.0, "bfactor":100.0, "ampcont":10.0,
+            "voltage":300.0, "cs":2.7, "apix":1.5})
+        img = test_image(size=(64,64))
+        img.do_fft_inplace()
+        ctf.compute_2d_complex(img, Ctf.CtfType.CTF_AMP)
+        curve = ctf.compute_1d(64, 1.0/(1.5*64), Ctf.CtfType.CTF_AMP)
+        for x in range(32):
+            self.assertAlmostEqual(img.get_value_at(2*x,0), curve[x], 4)
+            self.assertEqual(img.get_value_at(2*x+1,0), 0)
+
+        # astigmatic, served from the cache, then recomputed with the cache disabled
+        ctf.dfdiff = 0.5
+        ctf.dfang = 30.0
+        ctf.compute_2d_complex(img, Ctf.CtfType.CTF_INTEN)
+        cached = img.copy()
+        ctf.compute_2d_complex(img, Ctf.CtfType.CTF_INTEN)
+        self.assertEqual(img.get_data_as_vector(), cached.get_data_as_vector())
+
+        # against the exact expression evaluated by the general compute_2d_complex loop
+        lmb = 12.2639 / math.sqrt(300.0e3 + 0.97845 * 300.0 * 300.0)
+        g1 = math.pi / 2.0 * 2.7e7 * lmb ** 3
+        g2 = math.pi * lmb * 1.0e4
+        acac = math.pi / 2.0 - math.asin(0.1)
+        ds = 1.0 / (1.5 * 64)
+        for y in range(-32, 32):
+            for x in range(33):
+                s2 = (x * x + y * y) * ds * ds
+                df = 2.0 + 0.25 * math.cos(2.0 * math.atan2(y, x) - 2.0 * math.pi / 180.0 * 30.0)
+                v = math.cos(-g1 * s2 * s2 + g2 * df * s2 - acac) * math.exp(-100.0 / 4.0 * s2)
+                self.assertAlmostEqual(cached.get_value_at(2 * x, (y + 64) % 64), v * v, 3)
+        EMAN2Ctf.set_image_cache_size(0)
+        try:
+            ctf.compute_2d_complex(img, Ctf.CtfType.CTF_INTEN)
+            self.assertEqual(img.get_data_as_vector(), cached.get_data_as_vector())
+        finally:
+            EMAN2Ctf.set_image_cache_size(64*1024*1024)
         
     def test_transform_pickling(self):
         """test Transform pickle as attribute ..............."""
@@ -35,6 +35,7 @@ from __future__ import print_function
 from builtins import range
 from EMAN2 import *
 import unittest
+import math
 import os
 import sys
 import testlib
@@ -657,6 +658,47 @@ class TestHdfIO(ImageIOTester):
 			self.assertEqual(1, f[i])
 		testlib.safe_unlink(file)
 
+	def test_hdf_stack_layout(self):
+		"""test the single dataset HDF5 stack layout ........"""
+		file = 'stack_layout.hdf'
+		testlib.safe_unlink(file)
+		os.environ["EMAN_HDF_STACK"] = "1"
+		try:
+			for i in range(4):
+				e = EMData(12, 10)
+				e.to_value(float(i))
+				e["class_id"] = i
+				if i == 2:
+					e["xform.projection"] = Transform({"type":"eman","az":10.0,"alt":20.0})
+				e.write_image(file, -1)
+		finally:
+			del os.environ["EMAN_HDF_STACK"]
+
+		# appending keeps the layout without the variable, and images must match in size
+		e = EMData(12, 10)
+		e.to_value(9.0)
+		e.write_image(file, -1)
+		self.assertRaises(RuntimeError, EMData(8, 8).write_image, file, -1)
+
+		self.assertEqual(EMUtil.get_image_count(file), 5)
+		for i in [3, 0, 2]:
+			f = EMData(file, i)
+			self.assertEqual(f["nx"], 12)
+			self.assertEqual(f["class_id"], i)
+			self.assertAlmostEqual(f[5], float(i), 5)
+		self.assertAlmostEqual(EMData(file, 2)["xform.projection"].get_params("eman")["alt"], 20.0, 3)
+		self.assertFalse(EMData(file, 1).has_attr("xform.projection"))
+		self.assertFalse(EMData(file, 4).has_attr("class_id"))
+
+		r = EMData()
+		r.read_image(file, 4, False, Region(-2, 0, 6, 4))
+		self.assertAlmostEqual(r.get_value_at(0, 0), 0.0, 5)
+		self.assertAlmostEqual(r.get_value_at(3, 1), 9.0, 5)
+
+		EMUtil.write_hdf_attribute(file, "class_id", 7, 4)
+		self.assertEqual(EMUtil.read_hdf_attribute(file, "class_id", 4), 7)
+		testlib.safe_unlink(file)
+
 class TestMrcIO(ImageIOTester):
 	"""mrc file IO test"""
 	def test_negative_image_index(self):
@@ -1065,6 +1107,84 @@ class TestImagicIO(ImageIOTester):
 
 #	def 
 
+class TestEERIO(unittest.TestCase):
+	"""test reading synthetic EER event files ..............."""
+	imgfile = 'test_eer_' + str(os.getpid()) + '.eer'
+
+	def encode(self, events, npix):
+		"""7-bit run lengths, each followed by a subpixel code XORed with 0x0A"""
+		out = bytearray()
+		state = [0, 0]
+		def put(v, n):
+			state[0] |= v << state[1]
+			state[1] += n
+			while state[1] >= 8:
+				out.append(state[0] & 255)
+				state[0] >>= 8
+				state[1] -= 8
+		cur = 0
+		for p, code in events:
+			gap = p - cur
+			while gap >= 127:
+				put(127, 7)
+				gap -= 127
+			put(gap, 7)
+			put(code ^ 0x0A, 4)
+			cur = p + 1
+		rem = npix - cur
+		while rem >= 127:
+			put(127, 7)
+			rem -= 127
+		put(rem, 7)
+		if state[1]: out.append(state[0] & 255)
+		return bytes(out)
+
+	def write_eer(self, nx, ny, frames):
+		"""minimal little-endian TIFF, one directory and strip per frame"""
+		import struct
+		out = bytearray(b"II*\x00\x00\x00\x00\x00")
+		strips = []
+		for f in frames:
+			strips.append(len(out))
+			out += f
+		link = 4
+		for i, f in enumerate(frames):
+			if len(out) % 2: out += b"\x00"
+			struct.pack_into("<I", out, link, len(out))
+			tags = [(256, 4, nx), (257, 4, ny), (258, 3, 1), (259, 3, 65001), (262, 3, 1), (273, 4, strips[i]), (277, 3, 1), (278, 4, ny), (279, 4, len(f))]
+			out += struct.pack("<H", len(tags))
+			for tag, typ, val in tags:
+				if typ == 3: out += struct.pack("<HHIHH", tag, typ, 1, val, 0)
+				else: out += struct.pack("<HHII", tag, typ, 1, val)
+			link = len(out)
+			out += struct.pack("<I", 0)
+		open(self.imgfile, "wb").write(out)
+
+	def test_grouping_upsampling(self):
+		"""test EER grouping and super-resolution rendering ."""
+		nx, ny = 40, 30
+		# one electron per frame at (7,5), subpixel (3,1), plus a long run to the end
+		frames = [self.encode([(5 * nx + 7, 3 | 1 << 2)], nx * ny) for i in range(5)]
+		self.write_eer(nx, ny, frames)
+
+		os.environ["EER_GROUPING"] = "2"
+		os.environ["EER_UPSAMPLING"] = "1"
+		self.assertEqual(EMUtil.get_image_count(self.imgfile), 2)
+		e = EMData(self.imgfile, 1)
+		self.assertEqual((e["nx"], e["ny"]), (nx, ny))
+		self.assertEqual(e["EER.frames"], 5)
+		self.assertAlmostEqual(e["mean"] * nx * ny, 2.0, 3)
+		self.assertEqual(e.get_value_at(7, ny - 1 - 5), 2.0)
+
+		os.environ["EER_UPSAMPLING"] = "4"
+		e = EMData(self.imgfile, 0)
+		self.assertEqual(e["nx"], 4 * nx)
+		self.assertEqual(e.get_value_at(4 * 7 + 3, 4 * ny - 1 - (4 * 5 + 1)), 2.0)
+
+		del os.environ["EER_GROUPING"]
+		del os.environ["EER_UPSAMPLING"]
+		testlib.safe_unlink(self.imgfile)
+
 class TestImageIO(unittest.TestCase):
 	"""image data IO test"""
 		
@@ -1387,6 +1507,239 @@ class TestImageIO(unittest.TestCase):
 		
 		os.unlink(file4)
 
+	def test_read_images_block(self):
+		"""test batched read_images and read_images_into ...."""
+		base = "test_read_images_block_" + str(os.getpid())
+		for ext in ["mrcs", "spi", "hed", "hdf"]:
+			stackfile = base + "." + ext
+			n = 7
+			for i in range(n):
+				e = EMData(12, 10)
+				e.process_inplace("testimage.noise.uniform.rand")
+				e.set_value_at(0, 9, float(i))
+				e.write_image(stackfile, i)
+
+			indices = [0, 1, 2, 5, 6, 3]
+			imgs = EMData.read_images(stackfile, indices)
+			self.assertEqual(len(imgs), len(indices))
+			for j, i in enumerate(indices):
+				single = EMData(stackfile, i)
+				self.assertEqual(imgs[j]["source_n"], i)
+				self.assertAlmostEqual(imgs[j].get_value_at(0, 9), float(i), 5)
+				self.assertAlmostEqual(imgs[j].cmp("sqeuclidean", single), 0.0, 5)
+
+			pool = [EMData(12, 10) for i in range(n)]
+			EMData.read_images_into(stackfile, [], pool)
+			for i in range(n):
+				self.assertAlmostEqual(pool[i].get_value_at(0, 9), float(i), 5)
+
+			if ext == "hed":
+				testlib.safe_unlink(base + ".img")
+			os.unlink(stackfile)
+
+	def test_read_binedimage(self):
+		"""test streaming binned read of a volume ..........."""
+		filename = "test_read_binedimage_" + str(os.getpid()) + ".mrc"
+		e = EMData(24, 20, 18)
+		e.process_inplace("testimage.noise.uniform.rand")
+		e.write_image(filename)
+
+		b = EMData()
+		b.read_binedimage(filename, 0, 2)
+		self.assertEqual(b.get_xsize(), 12)
+		self.assertEqual(b.get_zsize(), 9)
+		ref = e.process("math.meanshrink", {"n":2})
+		self.assertAlmostEqual(b.cmp("sqeuclidean", ref), 0.0, 5)
+
+		m = EMData()
+		m.read_binedimage(filename, 0, 3, False, False, "median")
+		self.assertEqual(m.get_ysize(), 6)
+
+		# x*x has a median of (3i+1)^2 over each 3x3x3 block, which the mean
+		# misses by 2/3, and the median ignores the outlier at the origin
+		for z in range(18):
+			for y in range(20):
+				for x in range(24): e.set_value_at(x, y, z, float(x * x))
+		e.set_value_at(0, 0, 0, 1000.0)
+		e.write_image(filename)
+		m = EMData()
+		m.read_binedimage(filename, 0, 3, False, False, "median")
+		for i in range(8):
+			self.assertAlmostEqual(m.get_value_at(i, 0, 0), float((3 * i + 1) ** 2), 3)
+			self.assertAlmostEqual(m.get_value_at(i, 5, 5), float((3 * i + 1) ** 2), 3)
+
+		f = EMData()
+		f.read_binedimage(filename, 0, 2, True, False, "fourier")
+		self.assertEqual(f.get_zsize(), 9)
+		os.unlink(filename)
+
+		# on a smooth image Fourier binning keeps the scale of mean binning
+		g = EMData(24, 20, 18)
+		g.process_inplace("testimage.puregaussian", {"x_sigma":6, "y_sigma":6, "z_sigma":6})
+		g.add(1.0)
+		g.write_image(filename)
+		ref = g.process("math.meanshrink", {"n":2})
+		f = EMData()
+		f.read_binedimage(filename, 0, 2, False, False, "fourier")
+		self.assertAlmostEqual(f["mean"], ref["mean"], 3)
+		self.assertAlmostEqual(f["maximum"] / ref["maximum"], 1.0, 1)
+		os.unlink(filename)
+
+	def test_movie_reader(self):
+		"""test MovieReader with references and defects ....."""
+		filename = "test_movie_reader_" + str(os.getpid()) + ".mrcs"
+		frames = []
+		for i in range(3):
+			e = EMData(32, 24)
+			e.process_inplace("testimage.noise.uniform.rand")
+			e.write_image(filename, i)
+			frames.append(e)
+		dark = EMData(32, 24)
+		dark.to_value(0.25)
+		gain = EMData(32, 24)
+		gain.to_value(2.0)
+		defects = EMData(32, 24)
+		defects.to_zero()
+		defects.set_value_at(5, 6, 1.0)
+
+		mr = MovieReader(filename)
+		self.assertEqual(mr.get_nframes(), 3)
+		mr.set_references(dark, gain)
+		for i in [0, 1, 2, 0]:
+			f = mr.read_frame(i)
+			self.assertAlmostEqual(f.get_value_at(3, 4), (frames[i].get_value_at(3, 4) - 0.25) * 2.0, 5)
+		mr.set_defects(defects)
+		f = mr.read_frame(1)
+		nb = [(frames[1].get_value_at(x, y) - 0.25) * 2.0 for x in (4, 5, 6) for y in (5, 6, 7) if (x, y) != (5, 6)]
+		self.assertAlmostEqual(f.get_value_at(5, 6), sum(nb) / 8.0, 4)
+		os.unlink(filename)
+
+	def test_lst_random_access(self):
+		"""test out of order reads through a LST file ......."""
+		base = "test_lst_random_access_" + str(os.getpid())
+		stackfile = base + ".mrcs"
+		lstfile = base + ".lst"
+		n = 6
+		for i in range(n):
+			e = EMData(16, 12)
+			e.to_value(float(i))
+			e.write_image(stackfile, i)
+
+		order = [4, 1, 5, 0, 3, 2]
+		f = open(lstfile, "w")
+		f.write("#LST\n")
+		for i in order:
+			f.write("%d\t%s\n" % (i, stackfile))
+			f.write("# comment lines are skipped\n")
+		f.close()
+
+		self.assertEqual(EMUtil.get_image_count(lstfile), n)
+		for j in [5, 0, 2, 2, 1, 4, 3]:
+			e = EMData(lstfile, j)
+			self.assertEqual(e.get_attr("source_path"), stackfile)
+			self.assertAlmostEqual(e.get_value_at(3, 5), float(order[j]), 5)
+
+		r = EMData()
+		r.read_image(lstfile, 3, False, Region(2, 3, 8, 6))
+		self.assertEqual(r.get_xsize(), 8)
+		self.assertAlmostEqual(r.get_value_at(1, 1), float(order[3]), 5)
+
+		os.unlink(stackfile)
+		os.unlink(lstfile)
+
+	def test_image_writer(self):
+		"""test asynchronous ImageWriter ...................."""
+		filename = "test_image_writer_" + str(os.getpid()) + ".hdf"
+		w = ImageWriter(filename, EMUtil.ImageType.IMAGE_UNKNOWN, EMUtil.EMDataType.EM_FLOAT, 2)
+		n = 10
+		for i in range(n):
+			e = EMData(16, 12)
+			e.to_value(float(i))
+			w.write(e)
+			e.to_zero()		# the writer holds its own copy
+		w.flush()
+		self.assertEqual(w.get_pending(), 0)
+		w.write(EMData(16, 12), 3)
+		w.close()
+		w.close()
+		self.assertEqual(w.get_written(), n + 1)
+		self.assertEqual(EMUtil.get_image_count(filename), n)
+		for i in [0, 9]:
+			self.assertAlmostEqual(EMData(filename, i).get_value_at(2, 3), float(i), 5)
+		self.assertAlmostEqual(EMData(filename, 3).get_value_at(2, 3), 0.0, 5)
+		self.assertRaises(RuntimeError, w.write, EMData(16, 12))
+		os.unlink(filename)
+
+	def test_batched_file_queries(self):
+		"""test EMUtil batched type/count/header queries ...."""
+		pid = str(os.getpid())
+		files = ["test_batched_" + pid + ".hdf", "test_batched_" + pid + ".mrc", "test_batched_" + pid + ".txt", "test_batched_missing_" + pid + ".mrc"]
+		for i in range(3):
+			e = EMData(8, 6)
+			e["label"] = i
+			e.write_image(files[0], -1)
+		EMData(10, 10).write_image(files[1])
+		f = open(files[2], "w")
+		f.write("not an image\n")
+		f.close()
+
+		types = EMUtil.get_image_types(files)
+		self.assertEqual(types, [EMUtil.ImageType.IMAGE_HDF, EMUtil.ImageType.IMAGE_MRC, EMUtil.ImageType.IMAGE_UNKNOWN, EMUtil.ImageType.IMAGE_UNKNOWN])
+		self.assertEqual(EMUtil.get_image_counts(files, 2), [3, 1, 0, 0])
+		headers = EMUtil.get_headers(files)
+		self.assertEqual(headers[0]["nx"], 8)
+		self.assertEqual(headers[0]["label"], 0)
+		self.assertEqual(headers[1]["nx"], 10)
+		self.assertEqual(len(headers[3]), 0)
+
+		EMData(8, 6).write_image(files[0], -1)
+		self.assertEqual(EMUtil.get_image_counts(files[:1]), [4])
+		for f in files[:3]:
+			os.unlink(f)
+
+	def test_header_index(self):
+		"""test HeaderIndex columnar header sidecar ........."""
+		filename = "test_header_index_" + str(os.getpid()) + ".hdf"
+		for i in range(4):
+			e = EMData(8, 8)
+			e["class_id"] = i % 2
+			if i > 0: e["score"] = 0.5 * i
+			e["xform.projection"] = Transform({"type":"eman", "az":10.0 * i, "tx":float(i)})
+			e.write_image(filename, -1)
+		HeaderIndex.build(filename, ["class_id", "score", "xform.projection"])
+		self.assertTrue(HeaderIndex.has_current_index(filename))
+		idx = HeaderIndex(filename)
+		self.assertEqual(idx.get_nimg(), 4)
+		self.assertEqual(idx.get_type("class_id"), 0)
+		self.assertEqual(idx.get_type("missing"), -1)
+		self.assertEqual(list(idx.get_column("class_id")), [0, 1, 0, 1])
+		self.assertEqual(str(idx.get_column("class_id").dtype), "int32")
+		self.assertEqual(str(idx.get_column("score").dtype), "float32")
+		score = idx.get_column("score")
+		self.assertTrue(math.isnan(score[0]))
+		self.assertAlmostEqual(score[3], 1.5, 5)
+		self.assertEqual(idx.get_width("xform.projection"), 12)
+		self.assertAlmostEqual(idx.get_column("xform.projection")[2*12+3], 2.0, 5)
+
+		e = EMData(8, 8)
+		e["class_id"] = 5
+		e.write_image(filename, -1)
+		self.assertTrue(HeaderIndex.has_current_index(filename))
+		idx = HeaderIndex(filename)
+		self.assertEqual(idx.get_nimg(), 5)
+		self.assertEqual(idx.get_column("class_id")[4], 5)
+
+		# a change within the same second, same size, still makes the index stale
+		st = os.stat(filename)
+		sec = st.st_mtime_ns // 1000000000
+		ns = (st.st_mtime_ns % 1000000000 + 1000) % 1000000000
+		os.utime(filename, ns=(st.st_atime_ns, sec * 1000000000 + ns))
+		if os.stat(filename).st_mtime_ns != st.st_mtime_ns:
+			self.assertFalse(HeaderIndex.has_current_index(filename))
+			self.assertFalse(idx.is_current())
+		os.unlink(filename)
+		os.unlink(HeaderIndex.index_name(filename))
+
 """
 	def  test_spiderio_region(self):
 		file1 = "test_spiderio_region_1.h5"
@@ -1459,6 +1812,9 @@ def test_main():
 	
 	suite14 = unittest.TestLoader().loadTestsFromTestCase(TestDF3IO)	
 	unittest.TextTestRunner(verbosity=2).run(suite14) 
+
+	suite15 = unittest.TestLoader().loadTestsFromTestCase(TestEERIO)
+	unittest.TextTestRunner(verbosity=2).run(suite15)
 	
 if __name__ == '__main__':
 	test_main()
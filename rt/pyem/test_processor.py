@@ -909,6 +909,42 @@ class TestProcessor(unittest.TestCase):
         
         e.process_inplace('math.localmax')
         
+    def test_math_localfsc(self):
+        """test math.localfsc processor ....................."""
+        e = test_image_3d(0,(48,48,48))
+        e["apix_x"] = e["apix_y"] = e["apix_z"] = 2.0
+        o = e.copy()
+        e.process_inplace('math.addnoise', {'noise':0.05, 'seed':1})
+        o.process_inplace('math.addnoise', {'noise':0.05, 'seed':2})
+
+        res = e.process('math.localfsc', {'with':o, 'localsize':16, 'overlap':4})
+        self.assertEqual((res["nx"],res["ny"],res["nz"]), (9,9,9))
+        self.assertAlmostEqual(res["apix_x"], 8.0, 3)
+        self.assertGreaterEqual(res["minimum"], 0.0)
+        self.assertLessEqual(res["maximum"], 0.25+1.0e-5)       # Nyquist
+        self.assertGreater(res["maximum"], 0.0)
+
+        # identical halves correlate to Nyquist wherever there is density
+        same = e.process('math.localfsc', {'with':e, 'localsize':16, 'overlap':4})
+        for v in same.get_data_as_vector():
+            self.assertTrue(v==0 or abs(v-0.25)<1.0e-5)
+
+        # the filtered map doesn't depend on the thread count
+        filts = []
+        try:
+            for nt in (1,3):
+                Parallel.set_threads(nt)
+                f = EMData()
+                r = e.process('math.localfsc', {'with':o, 'localsize':16, 'overlap':4, 'filtered':f})
+                self.assertEqual(r.get_data_as_vector(), res.get_data_as_vector())
+                filts.append(f)
+        finally:
+            Parallel.set_threads(0)
+        self.assertEqual((filts[0]["nx"],filts[0]["ny"],filts[0]["nz"]), (48,48,48))
+        self.assertEqual(filts[0].get_data_as_vector(), filts[1].get_data_as_vector())
+
+        self.assertRaises(RuntimeError, e.process, 'math.localfsc', {'localsize':16})
+
     def test_math_submax(self):
         """test math.submax processor ......................."""
         e = EMData()
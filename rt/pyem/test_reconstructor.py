@@ -118,7 +118,36 @@ class TestReconstructor(unittest.TestCase):
 		result = r.finish(True)
 		
 		testlib.safe_unlink('density.mrc')
-	
+
+	def test_FourierReconstructor_outsize(self):
+		"""test FourierReconstructor fused finish ..........."""
+		n = 32
+		projs = []
+		for i in range(3):
+			e = EMData()
+			e.set_size(n,n,1)
+			e.process_inplace('testimage.noise.uniform.rand')
+			projs.append((e, Transform({'type':'eman', 'alt':1.56+i, 'az':2.56+i, 'phi':3.56+i})))
+
+		for mode,fix in (('gauss_2', ('math.gausskernelfix', {'gauss_width':4.0})), ('gridding_5', ('math.gridkernelfix', {'mode':'gridding_5'}))):
+			params = {'size':(n,n,n), 'mode':mode, 'sym':'c1', 'quiet':True}
+			r = Reconstructors.get('fourier', params)
+			r.setup()
+			for e,t in projs:
+				r.insert_slice(e, t)
+			ref = r.finish(True)
+			ref.process_inplace(fix[0], fix[1])
+			ref.clip_inplace(Region(4,5,6,24,22,20))
+
+			params.update({'outsize':(24,22,20), 'kernelfix':True})
+			r = Reconstructors.get('fourier', params)
+			r.setup()
+			for e,t in projs:
+				r.insert_slice(e, t)
+			fused = r.finish(True)
+			self.assertEqual((fused['nx'],fused['ny'],fused['nz']), (24,22,20))
+			self.assertTrue(numpy.allclose(ref.numpy(), fused.numpy(), rtol=1e-4, atol=1e-6*abs(ref.numpy()).max()))
+
 	def no_test_WienerFourierReconstructor(self):
 		"""test WienerFourierReconstructor .................."""
 		a = 1
@@ -177,6 +206,91 @@ class TestReconstructor(unittest.TestCase):
 		r.insert_slice(e3, Transform({'type':'eman', 'az':0.0, 'alt':0.0, 'phi':0.0}))
 		result = r.finish()
 	
+	def test_nn4Reconstructor_threads(self):
+		"""test nn4 family threaded insertion ..............."""
+		n = 32
+		ctf = EMAN2Ctf()
+		ctf.from_dict({"defocus":2.0, "dfdiff":0.0, "dfang":0.0, "bfactor":100.0, "ampcont":10.0,
+			"voltage":300.0, "cs":2.7, "apix":1.5})
+		projs = []
+		for i in range(4):
+			e = EMData()
+			e.set_size(n,n,1)
+			e.process_inplace('testimage.noise.uniform.rand')
+			e.set_attr('ctf', ctf)
+			e.set_attr('bckgnoise', [1.0]*(2*n))
+			projs.append(e)
+
+		def reconstruct(name, threads):
+			Parallel.set_threads(threads)
+			try:
+				fftvol = EMData()
+				weight = EMData()
+				params = {'size':n, 'npad':2, 'symmetry':'c3', 'fftvol':fftvol, 'weight':weight}
+				if name == 'nn4_rect':
+					params.update({'sizeprojection':n, 'xratio':1.0, 'yratio':1.0, 'zratio':1.0})
+				elif name == 'nn4_ctf':
+					params.update({'snr':1.0, 'sign':1})
+				elif name == 'nn4_ctfw':
+					refvol = EMData(n,1,1)
+					refvol.to_zero()
+					refvol.set_attr('fudge', 1.0)
+					params.update({'snr':1.0, 'sign':1, 'refvol':refvol, 'do_ctf':1})
+				r = Reconstructors.get(name, params)
+				r.setup()
+				for i,e in enumerate(projs):
+					r.insert_slice(e, Transform({'type':'spider', 'phi':37.0*i, 'theta':11.0+23.0*i, 'psi':-13.0*i}))
+				r.finish(True)
+				return fftvol.numpy().copy()
+			finally:
+				Parallel.set_threads(0)
+
+		for name in ('nn4', 'nn4_rect', 'nn4_ctf', 'nn4_ctfw'):
+			serial = reconstruct(name, 1)
+			threaded = reconstruct(name, 4)
+			self.assertTrue(numpy.array_equal(serial, threaded))
+
+	def test_Reconstructor_state(self):
+		"""test merging reconstructor states ................"""
+		n = 32
+		projs = []
+		for i in range(3):
+			e = EMData()
+			e.set_size(n,n,1)
+			e.process_inplace('testimage.noise.uniform.rand')
+			projs.append((e, Transform({'type':'eman', 'alt':1.56+i, 'az':2.56+i, 'phi':3.56+i})))
+		params = {'size':(n,n,n), 'mode':'gauss_2', 'sym':'c1', 'quiet':True}
+
+		r = Reconstructors.get('fourier', params)
+		r.setup()
+		for e,t in projs:
+			r.insert_slice(e, t)
+		whole = r.finish(True)
+
+		states = []
+		for e,t in projs:
+			r = Reconstructors.get('fourier', params)
+			r.setup()
+			r.insert_slice(e, t)
+			states.append(r.get_state())
+		merged = Reconstructors.merge_states([Reconstructors.merge_states(states[:2]), states[2]])
+
+		r = Reconstructors.get('fourier', params)
+		r.setup()
+		r.set_state(merged)
+		self.assertTrue(numpy.array_equal(whole.numpy(), r.finish(True).numpy()))
+
+		r = Reconstructors.get('fourier', params)
+		r.setup()
+		for s in states:
+			r.merge_state(s)
+		self.assertEqual(r.get_state(), merged)
+		self.assertTrue(len(r.get_state(True)) < len(merged))
+
+		other = Reconstructors.get('fourier', {'size':(n,n,n+2), 'mode':'gauss_2', 'sym':'c1', 'quiet':True})
+		other.setup()
+		self.assertRaises(RuntimeError, other.set_state, merged)
+
 	def no_test_ReverseGriddingReconstructor(self):
 		"""test ReverseGriddingReconstructor ................"""
 		e1 = EMData()
@@ -962,6 +962,96 @@ class TestSymmetry(unittest.TestCase):
 				for i in range(1,n):
 					self.assert_reduction_works(i,az,alt,azmax,sym)
 
+	def test_transform_batch(self):
+		"""test TransformBatch .............................."""
+		sym = Symmetries.get("d",{"nsym":3})
+		eulers = sym.gen_orientations("eman",{"delta":5,"inc_mirror":True})
+		batch = TransformBatch(eulers)
+		self.assertEqual(len(batch),len(eulers))
+		self.assertEqual(len(sym.gen_orientations_batch("eman",{"delta":5,"inc_mirror":True})),len(eulers))
+
+		s = sym.get_sym(2)
+		right = TransformBatch(batch)
+		right.right_multiply(s)
+		inv = batch.inverse()
+		az,alt,phi = batch.get_rotations_eman()
+		for i,t in enumerate(eulers):
+			self.assertTrue(right.get(i) == t*s)
+			self.assertTrue(inv.get(i) == t.inverse())
+			rot = t.get_rotation("eman")
+			self.assertAlmostEqual(az[i],rot["az"],3)
+			self.assertAlmostEqual(alt[i],rot["alt"],3)
+			self.assertAlmostEqual(phi[i],rot["phi"],3)
+
+		# reducing in bulk must agree with reducing one at a time
+		symmed = TransformBatch(batch)
+		symmed.right_multiply(sym.get_sym(4))
+		reduced = sym.reduce_batch(symmed,0)
+		for i in range(len(symmed)):
+			self.assertTrue(reduced.get(i) == sym.reduce(symmed.get(i),0))
+		# like get_sym, reduce accepts operator numbers past nsym
+		nsym = sym.get_nsym()
+		wrapped = sym.reduce_batch(symmed,nsym+1)
+		for i in range(len(symmed)):
+			self.assertTrue(wrapped.get(i) == sym.reduce(symmed.get(i),1))
+			self.assertTrue(sym.reduce(symmed.get(i),nsym+1) == sym.reduce(symmed.get(i),1))
+
+		# the bulk asymmetric unit search must agree with the full one
+		for s in [sym,Symmetries.get("icos",{}),Symmetries.get("c",{"nsym":5})]:
+			asym = s.in_which_asym_unit_batch(symmed)
+			self.assertEqual(len(asym),len(symmed))
+			for i in range(len(symmed)):
+				self.assertEqual(asym[i],s.in_which_asym_unit(symmed.get(i)))
+
+		# breaksym expands one asymmetric unit by every symmetry operator
+		full = sym.gen_orientations("eman",{"delta":5,"breaksym_real":True})
+		self.assertEqual(len(full),len(sym.gen_orientations("eman",{"delta":5}))*sym.get_nsym())
+
+	def test_orientation_index(self):
+		"""test OrientationIndex ............................"""
+		sym = Symmetries.get("d",{"nsym":3})
+		refs = sym.gen_orientations("eman",{"delta":5,"inc_mirror":True})
+		index = OrientationIndex(refs,"d3")
+		self.assertEqual(index.get_nrefs(),len(refs))
+		queries = [Transform({"type":"eman","az":az,"alt":alt,"phi":az/2}) for az in range(0,360,37) for alt in range(0,180,23)]
+		for t in queries:
+			angs = sorted([(index.angle(t,r),i) for i,r in enumerate(refs)])
+			near,nearang = index.nearest_angles(t,5)
+			self.assertEqual(len(near),5)
+			for j in range(5):
+				self.assertAlmostEqual(nearang[j],angs[j][0],3)
+				self.assertAlmostEqual(index.angle(t,refs[near[j]]),angs[j][0],3)
+			within = index.within(t,8.0)
+			self.assertEqual(len(within),len([a for a in angs if a[0]<=8.0]))
+		batch = index.nearest_batch(queries,3)
+		for i,t in enumerate(queries):
+			self.assertEqual(batch[3*i:3*i+3],index.nearest(t,3))
+
+	def test_get_sym_proj(self):
+		"""test cached symmetry operators ..................."""
+		t = Transform({"type":"eman","az":23,"alt":41,"phi":-77,"tx":1,"ty":2,"tz":3})
+		for name,sym in [("c5",Symmetries.get("c",{"nsym":5})),("D3",Symmetries.get("d",{"nsym":3})),("oct",Symmetries.get("oct",{}))]:
+			ops = Symmetry3D.get_symmetries(name)
+			self.assertEqual(len(ops),sym.get_nsym())
+			self.assertEqual(Transform.get_nsym(name),sym.get_nsym())
+			for i,op in enumerate(ops):
+				self.assertTrue(op == sym.get_sym(i))
+		for name in ("c5","D3"):
+			ops = Symmetry3D.get_symmetries(name)
+			# repeated calls are served from the cache and compose the same way
+			for j in range(2):
+				proj = t.get_sym_proj(name)
+				for i,op in enumerate(ops):
+					self.assertTrue(proj[i] == t*op)
+		# oct uses the SPARX operators, which are oriented differently from Symmetry3D
+		sparx = {0:[1,0,0,0, 0,1,0,0, 0,0,1,0], 4:[0,0,-1,0, 0,1,0,0, 1,0,0,0], 23:[0,-1,0,0, -1,0,0,0, 0,0,-1,0]}
+		for j in range(2):
+			proj = t.get_sym_proj("oct")
+			self.assertEqual(len(proj),24)
+			for i,m in list(sparx.items()):
+				self.assertTrue(proj[i] == t*Transform([float(x) for x in m]))
+		self.assertEqual(len(Transform().get_sym_proj("icos")),60)
+
 def test_main():
     p = OptionParser()
     p.add_option('--t', action='store_true', help='test exception', default=False )